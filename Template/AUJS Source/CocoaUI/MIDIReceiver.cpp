@@ -1,5 +1,9 @@
 #include "MIDIReceiver.h"
+#include "CAHostTimeBase.h"
+#include "CAAtomic.h"
 #include <cmath>
+#include <cstring>
+#include <algorithm>
 
 // this uses basic coreMIDI stuff to grab all incoming MIDI
 // and send it to the AU.
@@ -19,6 +23,25 @@ namespace
             throw static_cast<OSStatus>(-9);
     }
 
+    // sends each parsed message on to the AU.
+    class AUForwarder : public CAMIDIParser::Handler
+    {
+    public:
+        AUForwarder(MIDIReceiver* receiver) : mReceiver(receiver) {}
+        
+        virtual void MIDIMessage(UInt8 status, UInt8 data1, UInt8 data2, UInt64 timeStamp)
+        {
+            mReceiver->queueMessage(status, data1, data2, timeStamp);
+        }
+        
+        virtual void MIDISysEx(const UInt8* data, UInt32 length, UInt64 timeStamp)
+        {
+            mReceiver->queueSysEx(data, length, timeStamp);
+        }
+    private:
+        MIDIReceiver* mReceiver;
+    };
+
     void ReceiverNotifyProc(const MIDINotification* message, void* refCon)
     {
         MIDIReceiver* that = reinterpret_cast<MIDIReceiver*>(refCon);
@@ -27,7 +50,7 @@ namespace
         {
             case kMIDIMsgObjectAdded:
                 if (addRemove->childType == kMIDIObjectType_Source)
-                    MIDIPortConnectSource(that->getPort(), (MIDIEndpointRef)(addRemove->child), 0);
+                    that->connectSource((MIDIEndpointRef)(addRemove->child));
                 break;
             case kMIDIMsgObjectRemoved:
                 if (addRemove->childType == kMIDIObjectType_Source)
@@ -38,21 +61,32 @@ namespace
     
     void ReceiverReadProc(const MIDIPacketList* pktlist, void* readProcRefCon, void* srcConnRefCon)
     {
-        AudioUnit au = reinterpret_cast<MIDIReceiver*>(readProcRefCon)->getAudioUnit();
+        CAMIDIParser* parser = reinterpret_cast<CAMIDIParser*>(srcConnRefCon);
+        if(not parser)
+            return;
+        
+        AUForwarder forwarder(reinterpret_cast<MIDIReceiver*>(readProcRefCon));
+        const MIDIPacket* packet = pktlist->packet;
         for(UInt32 i = 0; i < pktlist->numPackets; ++i)
         {
-            // skip all packets longer than 3.
-            if(pktlist->packet[i].length <= 3)
-            {
-                Byte data[3] = {0};
-                memcpy(data, pktlist->packet[i].data, std::min(static_cast<UInt16>(3), pktlist->packet[i].length));
-                MusicDeviceMIDIEvent(au, data[0], data[1], data[2], 0);
-            }
+            parser->Parse(packet->data, packet->length, packet->timeStamp, forwarder);
+            packet = MIDIPacketNext(packet);
         }
     }
+    
+    OSStatus ReceiverRenderNotify(void* refCon, AudioUnitRenderActionFlags* ioActionFlags,
+                                  const AudioTimeStamp* inTimeStamp, UInt32 inBusNumber,
+                                  UInt32 inNumberFrames, AudioBufferList* ioData)
+    {
+        if((*ioActionFlags & kAudioUnitRenderAction_PreRender) and inBusNumber == 0)
+            reinterpret_cast<MIDIReceiver*>(refCon)->dispatchQueuedMessages(*inTimeStamp, inNumberFrames);
+        return noErr;
+    }
 };
 
-MIDIReceiver::MIDIReceiver(AudioUnit au) : mAU(au), mClient(0), mPort(0)
+MIDIReceiver::MIDIReceiver(AudioUnit au) : mAU(au), mClient(0), mPort(0),
+                                            mQueueRead(0), mQueueWrite(0), mSysExRead(0), mSysExWrite(0),
+                                            mLastRenderTime(0)
 {
     throwOnErr(MIDIClientCreate(CFSTR("#NAME MIDI Client"), ReceiverNotifyProc, this, &mClient));
     throwIfNull(mClient);
@@ -64,15 +98,132 @@ MIDIReceiver::MIDIReceiver(AudioUnit au) : mAU(au), mClient(0), mPort(0)
     for(ItemCount i = 0; i < MIDIGetNumberOfSources(); ++i)
     {
         MIDIEndpointRef endpoint = MIDIGetSource(i);
-        MIDIPortConnectSource(mPort, endpoint, 0);
+        connectSource(endpoint);
     }
+    
+    throwOnErr(AudioUnitAddRenderNotify(mAU, ReceiverRenderNotify, this));
 };
 
 MIDIReceiver::~MIDIReceiver()
 {
+    AudioUnitRemoveRenderNotify(mAU, ReceiverRenderNotify, this);
+    
     if(mPort)
       MIDIPortDispose(mPort);
     
     if(mClient)
       MIDIClientDispose(mClient);
+    
+    // the port is gone, so no read proc can be using these.
+    for(size_t i = 0; i < mParsers.size(); ++i)
+        delete mParsers[i];
 };
+
+void MIDIReceiver::connectSource(MIDIEndpointRef source)
+{
+    // SysEx as long as the queue can hold, so long dumps get through.
+    CAMIDIParser* parser = new CAMIDIParser(kSysExBufferSize);
+    mParsers.push_back(parser);
+    MIDIPortConnectSource(mPort, source, parser);
+}
+
+void MIDIReceiver::queueMessage(UInt8 status, UInt8 data1, UInt8 data2, MIDITimeStamp time)
+{
+    SInt32 write = mQueueWrite;
+    if(write - mQueueRead >= kQueueSize)
+        return; // the AU isn't rendering; drop it.
+    
+    QueuedMessage& message = mQueue[write & (kQueueSize - 1)];
+    message.time = time ? time : CAHostTimeBase::GetCurrentTime();
+    message.status = status;
+    message.data1 = data1;
+    message.data2 = data2;
+    message.sysExLength = 0;
+    
+    CAMemoryBarrier();
+    mQueueWrite = write + 1;
+}
+
+void MIDIReceiver::queueSysEx(const UInt8* data, UInt32 length, MIDITimeStamp time)
+{
+    SInt32 write = mQueueWrite;
+    if(write - mQueueRead >= kQueueSize or mSysExWrite + length - mSysExRead > kSysExBufferSize)
+        return; // the AU isn't rendering; drop it.
+    
+    UInt32 start = mSysExWrite & (kSysExBufferSize - 1);
+    UInt32 first = std::min<UInt32>(length, kSysExBufferSize - start);
+    memcpy(mSysExBuffer + start, data, first);
+    memcpy(mSysExBuffer, data + first, length - first);
+    
+    QueuedMessage& message = mQueue[write & (kQueueSize - 1)];
+    message.time = time ? time : CAHostTimeBase::GetCurrentTime();
+    message.status = 0xF0;
+    message.sysExStart = mSysExWrite;
+    message.sysExLength = length;
+    mSysExWrite += length;
+    
+    CAMemoryBarrier();
+    mQueueWrite = write + 1;
+}
+
+void MIDIReceiver::dispatchQueuedMessages(const AudioTimeStamp& renderTime, UInt32 frames)
+{
+    MIDITimeStamp now = (renderTime.mFlags & kAudioTimeStampHostTimeValid) ? renderTime.mHostTime : CAHostTimeBase::GetCurrentTime();
+    
+    // this buffer stands in for the time between the last render
+    // and this one.
+    MIDITimeStamp start = (mLastRenderTime and mLastRenderTime < now) ? mLastRenderTime : now;
+    mLastRenderTime = now;
+    
+    CAHostTimeSampleMap map;
+    map.SetSpan(start, now, 0, frames);
+    
+    SInt32 read = mQueueRead;
+    SInt32 write = mQueueWrite;
+    CAMemoryBarrier();
+    
+    UInt32 sysExRead = mSysExRead;
+    UInt32 sysExBytes = 0;
+    for(; read != write; ++read)
+    {
+        const QueuedMessage& message = mQueue[read & (kQueueSize - 1)];
+        
+        // scheduled in the future; wait for a later render.
+        if(message.time >= now)
+            break;
+        
+        if(message.sysExLength)
+        {
+            // over this render's share; it and everything behind it
+            // wait for the next render, keeping their order.
+            if(sysExBytes and sysExBytes + message.sysExLength > kMaxSysExBytesPerRender)
+                break;
+            sysExBytes += message.sysExLength;
+            
+            UInt32 start = message.sysExStart & (kSysExBufferSize - 1);
+            const UInt8* data = mSysExBuffer + start;
+            if(start + message.sysExLength > kSysExBufferSize)
+            {
+                UInt32 first = kSysExBufferSize - start;
+                memcpy(mSysExScratch, mSysExBuffer + start, first);
+                memcpy(mSysExScratch + first, mSysExBuffer, message.sysExLength - first);
+                data = mSysExScratch;
+            }
+            MusicDeviceSysEx(mAU, data, message.sysExLength);
+            sysExRead = message.sysExStart + message.sysExLength;
+            continue;
+        }
+        
+        UInt32 offset = 0;
+        if(message.time > start)
+            offset = static_cast<UInt32>(map.HostTimeToSampleOffset(message.time));
+        if(offset >= frames)
+            offset = frames ? frames - 1 : 0;
+        
+        MusicDeviceMIDIEvent(mAU, message.status, message.data1, message.data2, offset);
+    }
+    
+    CAMemoryBarrier();
+    mSysExRead = sysExRead;
+    mQueueRead = read;
+}
@@ -2,9 +2,18 @@
 #define __#PROJNAME__MIDIReceiver__
 
 #import <CoreMIDI/CoreMIDI.h>
+#include <vector>
+#include "CAMIDIParser.h"
 
 // forwards all CoreMIDI messages to
-// the given audio unit.
+// the given audio unit.  Messages are held until the AU's next
+// render and then sent at the sample offset matching their
+// CoreMIDI timestamp, so timing doesn't jitter with the I/O
+// buffer size.  This adds a constant one-buffer latency.  SysEx
+// shares the queue, so everything reaches the AU in the order it
+// arrived; at most kMaxSysExBytesPerRender bytes of it are sent
+// per render (or one message, if it's bigger), and whatever is
+// behind waits for the next render.
 class MIDIReceiver
 {
 public:
@@ -13,6 +22,23 @@ public:
   
   AudioUnit getAudioUnit() {return mAU;}
   MIDIPortRef getPort() {return mPort;}
+
+  // each connected source gets its own parser, so running status
+  // and SysEx from different sources never get mixed together.
+  void connectSource(MIDIEndpointRef source);
+
+  // MIDI thread: hold a message for the next render.  A time of 0
+  // means now.
+  void queueMessage(UInt8 status, UInt8 data1, UInt8 data2, MIDITimeStamp time);
+
+  // MIDI thread: the same for a whole SysEx message, at most
+  // kSysExBufferSize bytes (the parsers drop longer ones).
+  void queueSysEx(const UInt8* data, UInt32 length, MIDITimeStamp time);
+
+  // render thread, just before the AU renders: sends everything
+  // that arrived since the last render, placing each message in
+  // this buffer in proportion to when it arrived.
+  void dispatchQueuedMessages(const AudioTimeStamp& renderTime, UInt32 frames);
 private:
   // can't copy this.
   MIDIReceiver(const MIDIReceiver& rhs);
@@ -22,6 +48,33 @@ private:
   MIDIClientRef mClient;
   MIDIPortRef mPort;
   
+  // only grows; the read proc may still hold a parser for a source
+  // that was just removed.
+  std::vector<CAMIDIParser*> mParsers;
+  
+  // single reader, single writer.  The counters only increase.
+  // A SysEx message's bytes are in mSysExBuffer, starting at
+  // sysExStart (a byte counter, like mSysExRead).
+  struct QueuedMessage
+  {
+    MIDITimeStamp time;
+    UInt8 status;
+    UInt8 data1;
+    UInt8 data2;
+    UInt32 sysExStart;
+    UInt32 sysExLength; // 0 for everything but SysEx.
+  };
+  enum { kQueueSize = 1024, kSysExBufferSize = 16384, kMaxSysExBytesPerRender = 4096 };
+  QueuedMessage mQueue[kQueueSize];
+  volatile SInt32 mQueueRead;
+  volatile SInt32 mQueueWrite;
+  UInt8 mSysExBuffer[kSysExBufferSize];
+  volatile UInt32 mSysExRead;
+  UInt32 mSysExWrite; // MIDI thread only.
+  
+  // render thread only.
+  MIDITimeStamp mLastRenderTime;
+  UInt8 mSysExScratch[kSysExBufferSize]; // for a message that wraps.
 };
 
 #endif
@@ -7,7 +7,7 @@
 
 #include "iosAUEvents.h"
 #include <vector>
-#include <mach/mach_time.h>
+#include "CAHostTimeBase.h"
 
 using namespace std;
 
@@ -107,10 +107,7 @@ OpaqueAUEventListener::OpaqueAUEventListener(AUEventListenerProc proc,
             mLastNotification(0)
 {
     // we need to convert granularity from seconds to host time ticks.
-    struct mach_timebase_info timeBaseInfo;
-    mach_timebase_info(&timeBaseInfo);
-    Float64 freq = static_cast<Float64>(timeBaseInfo.denom) / static_cast<Float64>(timeBaseInfo.numer);
-    mGranularity = freq * granularity;
+    mGranularity = (granularity > 0) ? CAHostTimeBase::ConvertFromNanos(static_cast<UInt64>(granularity * 1000000000.0)) : 0;
     
     // now, set up the run loop at the interval frequency.
     CFRunLoopTimerContext context = {0, this, 0, 0, 0};
@@ -181,7 +178,7 @@ OpaqueAUEventListener::HandlePendingEvents()
 void
 OpaqueAUEventListener::PushPropToRunLoop(const AudioUnitProperty& prop)
 {
-    UInt64 time = mach_absolute_time();
+    UInt64 time = CAHostTimeBase::GetTheCurrentTime();
     CFRunLoopPerformBlock(mRunLoop, mMode, ^{
         // check to see if this event matches any that we are listening to.
         for(vector<ListeningProp>::iterator i = mListeningProps.begin(); i != mListeningProps.end(); ++i)
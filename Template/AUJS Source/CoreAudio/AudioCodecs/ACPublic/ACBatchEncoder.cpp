@@ -0,0 +1,382 @@
+/*
+	ACBatchEncoder.cpp
+*/
+//=============================================================================
+//	Includes
+//=============================================================================
+
+#include "ACBatchEncoder.h"
+#include "DataSource.h"
+#include "CAHostTimeBase.h"
+#include "CAPThread.h"
+#include <algorithm>
+#include <stdio.h>
+
+//=============================================================================
+//	ACBatchEncoder
+//=============================================================================
+
+ACBatchEncoder::ACBatchEncoder(UInt32 inNumberThreads, UInt32 inQueueDepth)
+:
+	mNumberThreads(std::min(inNumberThreads ? inNumberThreads : CAPThread::GetNumberOfProcessors(), (UInt32)kMaxThreads)),
+	mQueueDepth(std::max(inQueueDepth, (UInt32)1)),
+	mDone(NULL),
+	mDoneRefCon(NULL),
+	mGuard("ACBatchEncoder"),
+	mRunningThreads(0),
+	mQuit(false),
+	mStartNanos(0),
+	mError(noErr)
+{
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+ACBatchEncoder::~ACBatchEncoder()
+{
+	Finish();
+}
+
+OSStatus	ACBatchEncoder::Start(NewCodecProc inNewCodec, void* inNewCodecRefCon, DoneProc inDone, void* inDoneRefCon)
+{
+	if (!inNewCodec) return kAudio_ParamError;
+
+	CAGuard::Locker theLocker(mGuard);
+	if (!mWorkers.empty()) return kAudioCodecStateError;
+
+	mDone = inDone;
+	mDoneRefCon = inDoneRefCon;
+	mQuit = false;
+	mError = noErr;
+	memset(&mStatistics, 0, sizeof(mStatistics));
+
+	//	the threads wait on mGuard until all of them have started
+	for (UInt32 i = 0; i < mNumberThreads; ++i) {
+		ACBaseCodec* theCodec = inNewCodec(inNewCodecRefCon);
+		if (!theCodec) break;
+		Worker* theWorker = new Worker;
+		theWorker->mEncoder = this;
+		theWorker->mCodec = theCodec;
+		theWorker->mIndex = (UInt32)mWorkers.size();
+		CAPThread* theThread = new CAPThread(WorkerEntry, theWorker, CAPThread::kDefaultThreadPriority, false, true, "ACBatchEncoder");
+		try {
+			theThread->Start();
+			mWorkers.push_back(theWorker);
+			++mRunningThreads;
+		} catch (...) {
+			delete theThread;
+			delete theCodec;
+			delete theWorker;
+			break;
+		}
+	}
+	mStatistics.mThreads = mRunningThreads;
+	mStartNanos = CAHostTimeBase::GetCurrentTimeInNanos();
+	return mWorkers.empty() ? kAudioCodecUnspecifiedError : noErr;
+}
+
+OSStatus	ACBatchEncoder::Submit(const Job& inJob)
+{
+	if (!inJob.mInput || !inJob.mOutput) return kAudio_ParamError;
+
+	CAGuard::Locker theLocker(mGuard);
+	for (;;) {
+		if (mWorkers.empty() || mQuit) return kAudioCodecStateError;
+
+		Worker* theShortest = mWorkers[0];
+		for (UInt32 i = 1; i < mWorkers.size(); ++i)
+			if (mWorkers[i]->mQueue.size() < theShortest->mQueue.size()) theShortest = mWorkers[i];
+
+		if (theShortest->mQueue.size() < mQueueDepth) {
+			theShortest->mQueue.push_back(inJob);
+			theLocker.NotifyAll();
+			return noErr;
+		}
+		++mStatistics.mSubmitWaits;
+		theLocker.Wait();
+	}
+}
+
+OSStatus	ACBatchEncoder::Finish()
+{
+	CAGuard::Locker theLocker(mGuard);
+	if (mWorkers.empty()) return noErr;
+
+	//	the threads only stop once every queue is empty
+	mQuit = true;
+	theLocker.NotifyAll();
+	while (mRunningThreads) theLocker.Wait();
+	mStatistics.mWallNanos = CAHostTimeBase::GetCurrentTimeInNanos() - mStartNanos;
+
+	for (UInt32 i = 0; i < mWorkers.size(); ++i) {
+		delete mWorkers[i]->mCodec;
+		delete mWorkers[i];
+	}
+	mWorkers.clear();
+	return mError;
+}
+
+void	ACBatchEncoder::GetStatistics(Statistics& outStatistics)
+{
+	CAGuard::Locker theLocker(mGuard);
+	outStatistics = mStatistics;
+	if (!mWorkers.empty()) outStatistics.mWallNanos = CAHostTimeBase::GetCurrentTimeInNanos() - mStartNanos;
+	Float64 theAvailableNanos = (Float64)outStatistics.mWallNanos * outStatistics.mThreads;
+	outStatistics.mUtilization = theAvailableNanos > 0 ? std::min(outStatistics.mBusyNanos / theAvailableNanos, 1.0) : 0;
+}
+
+void*	ACBatchEncoder::WorkerEntry(void* inWorker)
+{
+	Worker* theWorker = static_cast<Worker*>(inWorker);
+	theWorker->mEncoder->Work(*theWorker);
+	return NULL;
+}
+
+void	ACBatchEncoder::Work(Worker& inWorker)
+{
+	CAAutoFree<Byte> theInput(kReadBytes);
+	CAAutoFree<Byte> theOutput(kWriteBytes);
+	CAAutoFree<AudioStreamPacketDescription> theDescriptions(kWritePackets);
+
+	CAGuard::Locker theLocker(mGuard);
+	for (;;) {
+		Job theJob;
+		if (!TakeJob(inWorker, theJob)) {
+			if (mQuit) break;
+			theLocker.Wait();
+			continue;
+		}
+		theLocker.NotifyAll();		// for Submit, which may be waiting for room
+
+		FileStatistics theStatistics;
+		memset(&theStatistics, 0, sizeof(theStatistics));
+		theStatistics.mThread = inWorker.mIndex;
+		{
+			CAMutex::Unlocker theUnlocker(mGuard);
+			UInt64 theStartNanos = CAHostTimeBase::GetCurrentTimeInNanos();
+			try {
+				theStatistics.mError = EncodeFile(inWorker.mCodec, theJob, theInput, theOutput, theDescriptions, theStatistics);
+			} catch (OSStatus inError) {
+				theStatistics.mError = inError;
+			} catch (...) {
+				theStatistics.mError = kAudioCodecUnspecifiedError;
+			}
+			try {
+				if (inWorker.mCodec->IsInitialized()) inWorker.mCodec->Uninitialize();
+			} catch (...) {
+			}
+			theStatistics.mNanos = CAHostTimeBase::GetCurrentTimeInNanos() - theStartNanos;
+			if (theStatistics.mNanos) theStatistics.mFramesPerSecond = theStatistics.mFrames * 1.0e9 / theStatistics.mNanos;
+			if (mDone) mDone(mDoneRefCon, theJob, theStatistics);
+		}
+
+		if (theStatistics.mError) {
+			++mStatistics.mFilesFailed;
+			if (!mError) mError = theStatistics.mError;
+		} else {
+			++mStatistics.mFilesEncoded;
+		}
+		mStatistics.mFrames += theStatistics.mFrames;
+		mStatistics.mInputBytes += theStatistics.mInputBytes;
+		mStatistics.mOutputBytes += theStatistics.mOutputBytes;
+		mStatistics.mBusyNanos += theStatistics.mNanos;
+	}
+
+	--mRunningThreads;
+	theLocker.NotifyAll();
+}
+
+//	Takes the oldest file in the thread's own queue, or if that's empty, the newest in the longest other queue.
+bool	ACBatchEncoder::TakeJob(Worker& inWorker, Job& outJob)
+{
+	if (!inWorker.mQueue.empty()) {
+		outJob = inWorker.mQueue.front();
+		inWorker.mQueue.pop_front();
+		return true;
+	}
+
+	Worker* theLongest = NULL;
+	for (UInt32 i = 0; i < mWorkers.size(); ++i) {
+		if (mWorkers[i]->mQueue.size() > (theLongest ? theLongest->mQueue.size() : 0)) theLongest = mWorkers[i];
+	}
+	if (!theLongest) return false;
+
+	outJob = theLongest->mQueue.back();
+	theLongest->mQueue.pop_back();
+	++mStatistics.mSteals;
+	return true;
+}
+
+//	Defers a file's size updates while it's written, and brings its size up to date and puts the setting back
+//	however the writing ends, codec exceptions included.
+class DeferredSizeUpdates
+{
+public:
+	DeferredSizeUpdates(AudioFileObject* inFile) : mFile(inFile), mSaved(inFile->DeferSizeUpdates()), mDone(false) { mFile->SetDeferSizeUpdates(1); }
+	~DeferredSizeUpdates() { if (!mDone) Finish(); }
+
+	OSStatus	Finish()
+	{
+		mDone = true;
+		OSStatus theError = mFile->UpdateSizeIfNeeded();
+		mFile->SetDeferSizeUpdates(mSaved);
+		return theError;
+	}
+
+private:
+	AudioFileObject*	mFile;
+	UInt32				mSaved;
+	bool				mDone;
+};
+
+//	Encodes one file with the codec, which it leaves initialized.
+OSStatus	ACBatchEncoder::EncodeFile(	ACBaseCodec*								inCodec,
+										const Job&									inJob,
+										CAAutoFree<Byte>&							ioInput,
+										CAAutoFree<Byte>&							ioOutput,
+										CAAutoFree<AudioStreamPacketDescription>&	ioDescriptions,
+										FileStatistics&								ioStatistics)
+{
+	AudioFileObject* theInputFile = inJob.mInput;
+	AudioFileObject* theOutputFile = inJob.mOutput;
+	const AudioStreamBasicDescription& theInputFormat = theInputFile->GetDataFormat();
+	const AudioStreamBasicDescription& theOutputFormat = theOutputFile->GetDataFormat();
+	const UInt32 theBytesPerFrame = theInputFormat.mBytesPerFrame;
+	if (theInputFormat.mFormatID != kAudioFormatLinearPCM || !theBytesPerFrame || theInputFormat.mBytesPerPacket != theBytesPerFrame)
+		return kAudioFileUnsupportedDataFormatError;
+
+	inCodec->Initialize(&theInputFormat, &theOutputFormat, NULL, 0);
+	UInt32 theCookieSize = inCodec->GetMagicCookieByteSize();
+	if (theCookieSize) {
+		CAAutoFree<Byte> theCookie(theCookieSize);
+		inCodec->GetMagicCookie(theCookie(), theCookieSize);
+		OSStatus theError = theOutputFile->SetMagicCookieData(theCookieSize, theCookie());
+		if (theError) return theError;
+	}
+
+	const bool theOutputIsVBR = theOutputFormat.mBytesPerPacket == 0;
+	UInt32 theMaxPacketBytes = theOutputFormat.mBytesPerPacket;
+	if (theOutputIsVBR) {
+		UInt32 theSize = SizeOf32(theMaxPacketBytes);
+		inCodec->GetProperty(kAudioCodecPropertyMaximumPacketByteSize, theSize, &theMaxPacketBytes);
+	}
+	if (!theMaxPacketBytes || theMaxPacketBytes > kWriteBytes) return kAudioCodecUnsupportedFormatError;
+	const UInt32 theFramesPerPacket = theOutputFormat.mFramesPerPacket;
+	const UInt32 theLeadingFrames = GetLeadingFrames(inCodec);
+
+	//	sequential reads of the input, which the cache reads ahead of; the last page is partly past the audio,
+	//	but that's cheaper than reading the end of the file a frame at a time
+	Cached_DataSource theSource(theInputFile->GetDataSource(), 0, kReadBytes, false, kReadAheadPages + 2);
+	theSource.SetReadAhead(kReadAheadPages);
+	const UInt32 theReadBytes = kReadBytes / theBytesPerFrame * theBytesPerFrame;
+	SInt64 theNextByte = theInputFile->GetDataOffset();
+	SInt64 theEndByte = theNextByte + theInputFile->GetNumPackets() * theBytesPerFrame;
+	SInt64 theSilentBytes = -1;		// how much silence to flush the codec with, once the input has all been read
+
+	DeferredSizeUpdates theSizeUpdates(theOutputFile);
+	const SInt64 theFirstPacket = theOutputFile->GetNumPackets();
+	SInt64 theNextPacket = theFirstPacket;
+
+	OSStatus theError = noErr;
+	UInt32 theInputOffset = 0, theInputBytes = 0, theOutputBytes = 0, theOutputPackets = 0;
+	while (!theError) {
+		UInt32 thePackets = (kWriteBytes - theOutputBytes) / theMaxPacketBytes;
+		if (theOutputIsVBR) thePackets = std::min(thePackets, (UInt32)kWritePackets - theOutputPackets);
+		if (!thePackets) {
+			theError = WritePackets(theOutputFile, theNextPacket, ioOutput(), theOutputBytes, theOutputIsVBR ? ioDescriptions() : NULL, theOutputPackets);
+			continue;
+		}
+
+		UInt32 theBytes = kWriteBytes - theOutputBytes;
+		UInt32 theStatus = inCodec->ProduceOutputPackets(ioOutput() + theOutputBytes, theBytes, thePackets, theOutputIsVBR ? ioDescriptions() + theOutputPackets : NULL);
+		if (theStatus == kAudioCodecProduceOutputPacketFailure) {
+			theError = kAudioCodecUnspecifiedError;
+			break;
+		}
+		if (theOutputIsVBR) {
+			//	the codec's descriptions are relative to where it wrote, and the file wants them relative to the buffer
+			for (UInt32 i = theOutputPackets; i < theOutputPackets + thePackets; ++i)
+				ioDescriptions()[i].mStartOffset += theOutputBytes;
+		}
+		theOutputBytes += theBytes;
+		theOutputPackets += thePackets;
+		ioStatistics.mOutputBytes += theBytes;
+		ioStatistics.mOutputPackets += thePackets;
+
+		if (theStatus == kAudioCodecProduceOutputPacketAtEOF) break;
+		if (theStatus == kAudioCodecProduceOutputPacketSuccessHasMore || (theStatus == kAudioCodecProduceOutputPacketSuccess && thePackets))
+			continue;
+
+		//	the codec wants more input
+		if (theInputOffset == theInputBytes) {
+			theInputOffset = theInputBytes = 0;
+			if (theNextByte < theEndByte) {
+				UInt32 theActualBytes = 0;
+				theError = theSource.ReadBytes(SEEK_SET, theNextByte, (UInt32)std::min((SInt64)theReadBytes, theEndByte - theNextByte), ioInput(), &theActualBytes);
+				if (theError == kAudioFileEndOfFileError) theError = noErr;
+				if (theError) break;
+				theInputBytes = theActualBytes / theBytesPerFrame * theBytesPerFrame;
+				if (!theInputBytes) theEndByte = theNextByte;		// the file is shorter than its header says
+				theNextByte += theInputBytes;
+				ioStatistics.mInputBytes += theInputBytes;
+				ioStatistics.mFrames += theInputBytes / theBytesPerFrame;
+			}
+			if (!theInputBytes) {
+				//	enough silence to finish the packet holding the last of the input, counting the codec's priming
+				if (theSilentBytes < 0) {
+					SInt64 theFrames = theLeadingFrames + ioStatistics.mFrames;
+					SInt64 thePacketFrames = theFramesPerPacket > 1 ? theFramesPerPacket : 1;
+					theSilentBytes = ((thePacketFrames - theFrames % thePacketFrames) % thePacketFrames) * theBytesPerFrame;
+				}
+				if (!theSilentBytes) break;
+				theInputBytes = (UInt32)std::min((SInt64)theReadBytes, theSilentBytes);
+				theSilentBytes -= theInputBytes;
+				memset(ioInput(), 0, theInputBytes);
+			}
+		}
+
+		UInt32 theAppendBytes = theInputBytes - theInputOffset, theAppendFrames = theAppendBytes / theBytesPerFrame;
+		inCodec->AppendInputData(ioInput() + theInputOffset, theAppendBytes, theAppendFrames, NULL);
+		if (!theAppendBytes && !thePackets) theError = kAudioCodecStateError;		// it won't take input or give output
+		theInputOffset += theAppendBytes;
+	}
+
+	if (!theError && theOutputPackets)
+		theError = WritePackets(theOutputFile, theNextPacket, ioOutput(), theOutputBytes, theOutputIsVBR ? ioDescriptions() : NULL, theOutputPackets);
+
+	if (!theError && theFramesPerPacket > 1) {
+		SInt64 theTotalFrames = (theNextPacket - theFirstPacket) * theFramesPerPacket;
+		AudioFilePacketTableInfo theInfo;
+		theInfo.mPrimingFrames = (SInt32)std::min((SInt64)theLeadingFrames, theTotalFrames);
+		theInfo.mNumberValidFrames = std::min((SInt64)ioStatistics.mFrames, theTotalFrames - theInfo.mPrimingFrames);
+		theInfo.mRemainderFrames = (SInt32)(theTotalFrames - theInfo.mPrimingFrames - theInfo.mNumberValidFrames);
+		//	not every file type has somewhere to keep this
+		theOutputFile->SetProperty(kAudioFilePropertyPacketTableInfo, SizeOf32(theInfo), &theInfo);
+	}
+
+	OSStatus theSizeError = theSizeUpdates.Finish();
+	return theError ? theError : theSizeError;
+}
+
+//	Writes the buffered packets and empties the buffer.
+OSStatus	ACBatchEncoder::WritePackets(AudioFileObject* inFile, SInt64& ioNextPacket, const Byte* inData, UInt32& ioNumBytes, const AudioStreamPacketDescription* inDescriptions, UInt32& ioNumPackets)
+{
+	UInt32 thePackets = ioNumPackets;
+	OSStatus theError = inFile->WritePackets(false, ioNumBytes, inDescriptions, ioNextPacket, &thePackets, inData);
+	if (!theError && thePackets != ioNumPackets) theError = kAudioFileUnspecifiedError;
+	ioNextPacket += thePackets;
+	ioNumBytes = 0;
+	ioNumPackets = 0;
+	return theError;
+}
+
+UInt32	ACBatchEncoder::GetLeadingFrames(ACBaseCodec* inCodec)
+{
+	AudioCodecPrimeInfo theInfo = { 0, 0 };
+	UInt32 theSize = SizeOf32(theInfo);
+	try {
+		inCodec->GetProperty(kAudioCodecPropertyPrimeInfo, theSize, &theInfo);
+	} catch (...) {
+		return 0;		// the codec doesn't prime
+	}
+	return theInfo.leadingFrames;
+}
@@ -0,0 +1,140 @@
+/*
+	ACBatchEncoder.h
+
+	Encodes many files at once, for offline jobs (mastering a session's stems, building a library) that would
+	otherwise encode one file after another on one core.
+
+	There is a thread per processor, and each has its own codec, made by the NewCodecProc when the encoder starts,
+	and its own queue of at most inQueueDepth files. Submit puts a file on the shortest queue, and waits when they
+	are all full, so a caller can submit a whole session without the encoder holding it all. A thread whose queue
+	runs dry takes the newest file from the longest other queue, so one long file doesn't hold up the files behind
+	it. Between files a thread uninitializes its codec and initializes it again for the next file's formats.
+
+	The input file has to be linear PCM. It's read through a Cached_DataSource reading ahead of the encoder, in
+	reads of kReadBytes, so the encoder rarely waits for the disk. The encoded packets are collected in memory and
+	written kWriteBytes at a time, bypassing the cache, with the file's size updates deferred to the end of the
+	file. The output file's data format is the one encoded to, and it should be empty; the codec's magic cookie
+	and, for formats with more than one frame per packet, the priming and remainder frames are set on it. At the
+	end of the input, the encoder is given silence until it has output every input frame.
+
+	Nothing else may use a file while it's queued or being encoded.
+*/
+#if !defined(__ACBatchEncoder_h__)
+#define __ACBatchEncoder_h__
+
+//=============================================================================
+//	Includes
+//=============================================================================
+
+#include "ACBaseCodec.h"
+#include "AudioFileObject.h"
+#include "CAGuard.h"
+#include "CAAutoDisposer.h"
+#include <deque>
+#include <vector>
+
+//=============================================================================
+//	ACBatchEncoder
+//=============================================================================
+
+class ACBatchEncoder
+{
+
+public:
+	enum {
+		kDefaultQueueDepth = 4,
+		kMaxThreads = 64,
+		kReadBytes = 64 * 1024,
+		kReadAheadPages = 6,
+		kWriteBytes = 1024 * 1024,
+		kWritePackets = 8192			// when the packets vary in size
+	};
+
+	struct Job {
+		AudioFileObject*	mInput;
+		AudioFileObject*	mOutput;
+		void*				mRefCon;
+	};
+
+	struct FileStatistics {
+		UInt64		mFrames;				// input frames encoded
+		UInt64		mInputBytes;
+		UInt64		mOutputBytes;
+		UInt64		mOutputPackets;
+		UInt64		mNanos;					// from taking the file to writing the last of it
+		Float64		mFramesPerSecond;		// mFrames over mNanos
+		UInt32		mThread;				// which thread encoded it
+		OSStatus	mError;
+	};
+
+	struct Statistics {
+		UInt32		mThreads;
+		UInt32		mFilesEncoded;
+		UInt32		mFilesFailed;
+		UInt64		mFrames;
+		UInt64		mInputBytes;
+		UInt64		mOutputBytes;
+		UInt64		mWallNanos;				// since Start, or from Start to Finish
+		UInt64		mBusyNanos;				// the threads' time encoding, summed
+		Float64		mUtilization;			// mBusyNanos over mThreads times mWallNanos
+		UInt32		mSteals;				// files a thread took from another's queue
+		UInt32		mSubmitWaits;			// times Submit waited for room in a queue
+	};
+
+	// Returns a codec for one thread, not yet initialized; the encoder deletes it in Finish.
+	typedef ACBaseCodec*	(*NewCodecProc)(void* inRefCon);
+
+	// Called when a file is done, successfully or not, from the thread that encoded it. Calls for different
+	// files can overlap.
+	typedef void			(*DoneProc)(void* inRefCon, const Job& inJob, const FileStatistics& inStatistics);
+
+	// inNumberThreads of 0 means one per processor.
+							ACBatchEncoder(UInt32 inNumberThreads = 0, UInt32 inQueueDepth = kDefaultQueueDepth);
+							~ACBatchEncoder();		// finishes
+
+	// Makes the codecs and starts the threads. Fails if no codec can be made or no thread started.
+	OSStatus				Start(NewCodecProc inNewCodec, void* inNewCodecRefCon, DoneProc inDone, void* inDoneRefCon);
+
+	// Queues a file to be encoded, waiting while every queue is full.
+	OSStatus				Submit(const Job& inJob);
+
+	// Waits for every queued file to be done, then stops the threads and deletes the codecs. Returns the error
+	// from the first file that failed, if any did.
+	OSStatus				Finish();
+
+	bool					IsRunning() const { return !mWorkers.empty(); }
+	void					GetStatistics(Statistics& outStatistics);
+
+private:
+							ACBatchEncoder(const ACBatchEncoder&);
+	ACBatchEncoder&			operator=(const ACBatchEncoder&);
+
+	struct Worker {
+		ACBatchEncoder*		mEncoder;
+		ACBaseCodec*		mCodec;
+		UInt32				mIndex;
+		std::deque<Job>		mQueue;
+	};
+
+	static void*			WorkerEntry(void* inWorker);
+	void					Work(Worker& inWorker);
+	bool					TakeJob(Worker& inWorker, Job& outJob);		// expects mGuard to be held
+	OSStatus				EncodeFile(ACBaseCodec* inCodec, const Job& inJob, CAAutoFree<Byte>& ioInput, CAAutoFree<Byte>& ioOutput, CAAutoFree<AudioStreamPacketDescription>& ioDescriptions, FileStatistics& ioStatistics);
+	static OSStatus			WritePackets(AudioFileObject* inFile, SInt64& ioNextPacket, const Byte* inData, UInt32& ioNumBytes, const AudioStreamPacketDescription* inDescriptions, UInt32& ioNumPackets);
+	static UInt32			GetLeadingFrames(ACBaseCodec* inCodec);
+
+	UInt32								mNumberThreads;
+	UInt32								mQueueDepth;
+	DoneProc							mDone;
+	void*								mDoneRefCon;
+
+	CAGuard								mGuard;
+	std::vector<Worker*>				mWorkers;
+	UInt32								mRunningThreads;
+	bool								mQuit;
+	UInt64								mStartNanos;
+	OSStatus							mError;					// the first file's
+	Statistics							mStatistics;
+};
+
+#endif
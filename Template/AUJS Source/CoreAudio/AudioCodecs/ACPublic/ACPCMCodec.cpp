@@ -0,0 +1,169 @@
+/*
+	ACPCMCodec.cpp
+*/
+//=============================================================================
+//	Includes
+//=============================================================================
+
+#include "ACPCMCodec.h"
+#include <algorithm>
+
+//=============================================================================
+//	ACPCMCodec
+//=============================================================================
+
+ACPCMCodec::ACPCMCodec(AudioComponentInstance inInstance, UInt32 inInputBufferByteSize)
+:
+	ACSimpleCodec(inInputBufferByteSize, inInstance),
+	mConverter()
+{
+	//	any sample rate and channel count, in or out
+	AddFormat(32, kAudioFormatFlagsNativeFloatPacked);
+	AddFormat(16, kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked);
+	AddFormat(16, kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked | kAudioFormatFlagIsBigEndian);
+	AddFormat(24, kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked);
+	AddFormat(24, kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked | kAudioFormatFlagIsBigEndian);
+	AddFormat(20, kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsAlignedHigh);
+	AddFormat(20, kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsAlignedHigh | kAudioFormatFlagIsBigEndian);
+}
+
+ACPCMCodec::~ACPCMCodec()
+{
+}
+
+void	ACPCMCodec::AddFormat(UInt32 inBitsPerChannel, UInt32 inFormatFlags)
+{
+	CAStreamBasicDescription theFormat(0, kAudioFormatLinearPCM, 0, 1, 0, 0, inBitsPerChannel, inFormatFlags);
+	AddInputFormat(theFormat);
+	AddOutputFormat(theFormat);
+}
+
+bool	ACPCMCodec::IsSupportedFormat(const AudioStreamBasicDescription& inFormat)
+{
+	//	the ring buffer is one buffer, so the samples have to be interleaved
+	CAStreamBasicDescription theFormat(inFormat);
+	CAPCMConverter::SampleFormat theSample;
+	return theFormat.IsPCM() && theFormat.NumberChannelStreams() == 1 && theFormat.mBytesPerPacket == theFormat.mBytesPerFrame && theSample.Init(theFormat);
+}
+
+void	ACPCMCodec::SetCurrentInputFormat(const AudioStreamBasicDescription& inInputFormat)
+{
+	if(!IsSupportedFormat(inInputFormat)) CODEC_THROW(kAudioCodecUnsupportedFormatError);
+	ACSimpleCodec::SetCurrentInputFormat(inInputFormat);
+}
+
+void	ACPCMCodec::SetCurrentOutputFormat(const AudioStreamBasicDescription& inOutputFormat)
+{
+	if(!IsSupportedFormat(inOutputFormat)) CODEC_THROW(kAudioCodecUnsupportedFormatError);
+	ACSimpleCodec::SetCurrentOutputFormat(inOutputFormat);
+}
+
+void	ACPCMCodec::Initialize(const AudioStreamBasicDescription* inInputFormat, const AudioStreamBasicDescription* inOutputFormat, const void* inMagicCookie, UInt32 inMagicCookieByteSize)
+{
+	if(inInputFormat != NULL) SetCurrentInputFormat(*inInputFormat);
+	if(inOutputFormat != NULL) SetCurrentOutputFormat(*inOutputFormat);
+
+	//	this also checks that the sample rates and channel counts match
+	if(mConverter.Initialize(mInputFormat, mOutputFormat) != noErr) CODEC_THROW(kAudioCodecUnsupportedFormatError);
+
+	ACSimpleCodec::Initialize(inInputFormat, inOutputFormat, inMagicCookie, inMagicCookieByteSize);
+}
+
+UInt32	ACPCMCodec::ProduceOutputPackets(void* outOutputData, UInt32& ioOutputDataByteSize, UInt32& ioNumberPackets, AudioStreamPacketDescription* outPacketDescription)
+{
+	if(!mIsInitialized) CODEC_THROW(kAudioCodecStateError);
+
+	//	a packet is a frame on both sides
+	UInt32 theAvailableFrames = GetUsedInputBufferByteSize() / mInputFormat.mBytesPerFrame;
+	UInt32 theNumberFrames = std::min(ioNumberPackets, ioOutputDataByteSize / mOutputFormat.mBytesPerFrame);
+	UInt32 theAnswer = kAudioCodecProduceOutputPacketSuccess;
+	if(theAvailableFrames < theNumberFrames)
+	{
+		theNumberFrames = theAvailableFrames;
+		theAnswer = kAudioCodecProduceOutputPacketNeedsMoreInputData;
+	}
+	else if(theAvailableFrames > theNumberFrames)
+	{
+		theAnswer = kAudioCodecProduceOutputPacketSuccessHasMore;
+	}
+
+	if(theNumberFrames > 0)
+	{
+		UInt32 theInputByteSize = theNumberFrames * mInputFormat.mBytesPerFrame;
+
+		AudioBufferList theInput;
+		theInput.mNumberBuffers = 1;
+		theInput.mBuffers[0].mNumberChannels = mInputFormat.mChannelsPerFrame;
+		theInput.mBuffers[0].mData = GetBytes(theInputByteSize);
+		theInput.mBuffers[0].mDataByteSize = theInputByteSize;
+
+		AudioBufferList theOutput;
+		theOutput.mNumberBuffers = 1;
+		theOutput.mBuffers[0].mNumberChannels = mOutputFormat.mChannelsPerFrame;
+		theOutput.mBuffers[0].mData = outOutputData;
+		theOutput.mBuffers[0].mDataByteSize = ioOutputDataByteSize;
+
+		if(mConverter.Convert(theInput, theOutput, theNumberFrames) != noErr) CODEC_THROW(kAudioCodecUnspecifiedError);
+		ConsumeInputData(theInputByteSize);
+	}
+
+	ioNumberPackets = theNumberFrames;
+	ioOutputDataByteSize = theNumberFrames * mOutputFormat.mBytesPerFrame;
+	return theAnswer;
+}
+
+void	ACPCMCodec::GetPropertyInfo(AudioCodecPropertyID inPropertyID, UInt32& outPropertyDataSize, Boolean& outWritable)
+{
+	switch(inPropertyID)
+	{
+		case kAudioCodecPropertyPacketFrameSize:
+		case kAudioCodecPropertyMaximumPacketByteSize:
+			outPropertyDataSize = SizeOf32(UInt32);
+			outWritable = false;
+			break;
+		case kACPCMCodecPropertyDither:
+			outPropertyDataSize = SizeOf32(UInt32);
+			outWritable = true;
+			break;
+		default:
+			ACSimpleCodec::GetPropertyInfo(inPropertyID, outPropertyDataSize, outWritable);
+			break;
+	}
+}
+
+void	ACPCMCodec::GetProperty(AudioCodecPropertyID inPropertyID, UInt32& ioPropertyDataSize, void* outPropertyData)
+{
+	switch(inPropertyID)
+	{
+		case kAudioCodecPropertyPacketFrameSize:
+			if(ioPropertyDataSize != SizeOf32(UInt32)) CODEC_THROW(kAudioCodecBadPropertySizeError);
+			*reinterpret_cast<UInt32*>(outPropertyData) = 1;
+			break;
+		case kAudioCodecPropertyMaximumPacketByteSize:
+			if(ioPropertyDataSize != SizeOf32(UInt32)) CODEC_THROW(kAudioCodecBadPropertySizeError);
+			*reinterpret_cast<UInt32*>(outPropertyData) = mOutputFormat.mBytesPerPacket;
+			break;
+		case kACPCMCodecPropertyDither:
+			if(ioPropertyDataSize != SizeOf32(UInt32)) CODEC_THROW(kAudioCodecBadPropertySizeError);
+			*reinterpret_cast<UInt32*>(outPropertyData) = mConverter.GetDither() ? 1 : 0;
+			break;
+		default:
+			ACSimpleCodec::GetProperty(inPropertyID, ioPropertyDataSize, outPropertyData);
+			break;
+	}
+}
+
+void	ACPCMCodec::SetProperty(AudioCodecPropertyID inPropertyID, UInt32 inPropertyDataSize, const void* inPropertyData)
+{
+	switch(inPropertyID)
+	{
+		case kACPCMCodecPropertyDither:
+			//	unlike the other properties, this can change while converting
+			if(inPropertyDataSize != SizeOf32(UInt32)) CODEC_THROW(kAudioCodecBadPropertySizeError);
+			mConverter.SetDither(*reinterpret_cast<const UInt32*>(inPropertyData) != 0);
+			break;
+		default:
+			ACSimpleCodec::SetProperty(inPropertyID, inPropertyDataSize, inPropertyData);
+			break;
+	}
+}
@@ -0,0 +1,68 @@
+/*
+	ACPCMCodec.h
+
+	A codec from linear PCM to linear PCM, for moving audio between Float32 and the packed integer formats it's
+	stored and sent in: 16 bit, 24 bit and 20 bit (at the top of 3 bytes) integers, either byte order. It works
+	in either direction, and between any other pair of formats CAPCMConverter handles, as long as both are one
+	buffer with the same sample rate and channel count. CAPCMConverter does the work, so the packing and byte
+	swapping go through the vector kernels.
+
+	Integer output of 24 bits or fewer can be dithered by setting kACPCMCodecPropertyDither, at any time.
+*/
+#if !defined(__ACPCMCodec_h__)
+#define __ACPCMCodec_h__
+
+//=============================================================================
+//	Includes
+//=============================================================================
+
+#include "ACSimpleCodec.h"
+#include "CAPCMConverter.h"
+
+//=============================================================================
+//	ACPCMCodec
+//=============================================================================
+
+enum
+{
+	// a UInt32; nonzero for triangular dither on integer output of 24 bits or fewer. Off by default.
+	kACPCMCodecPropertyDither = 'dith'
+};
+
+class ACPCMCodec
+:
+	public ACSimpleCodec
+{
+
+//	Construction/Destruction
+public:
+	enum { kDefaultInputBufferByteSize = 64 * 1024 };
+
+						ACPCMCodec(AudioComponentInstance inInstance, UInt32 inInputBufferByteSize = kDefaultInputBufferByteSize);
+	virtual				~ACPCMCodec();
+
+//	Property Management
+public:
+	virtual void		GetPropertyInfo(AudioCodecPropertyID inPropertyID, UInt32& outPropertyDataSize, Boolean& outWritable);
+	virtual void		GetProperty(AudioCodecPropertyID inPropertyID, UInt32& ioPropertyDataSize, void* outPropertyData);
+	virtual void		SetProperty(AudioCodecPropertyID inPropertyID, UInt32 inPropertyDataSize, const void* inPropertyData);
+
+//	Data Handling
+public:
+	virtual void		Initialize(const AudioStreamBasicDescription* inInputFormat, const AudioStreamBasicDescription* inOutputFormat, const void* inMagicCookie, UInt32 inMagicCookieByteSize);
+	virtual UInt32		ProduceOutputPackets(void* outOutputData, UInt32& ioOutputDataByteSize, UInt32& ioNumberPackets, AudioStreamPacketDescription* outPacketDescription);
+
+//	Format Management
+public:
+	virtual void		SetCurrentInputFormat(const AudioStreamBasicDescription& inInputFormat);
+	virtual void		SetCurrentOutputFormat(const AudioStreamBasicDescription& inOutputFormat);
+
+private:
+	static bool			IsSupportedFormat(const AudioStreamBasicDescription& inFormat);
+	void				AddFormat(UInt32 inBitsPerChannel, UInt32 inFormatFlags);
+
+	CAPCMConverter		mConverter;
+
+};
+
+#endif
@@ -0,0 +1,351 @@
+/*
+	ACParallelDecoder.cpp
+*/
+//=============================================================================
+//	Includes
+//=============================================================================
+
+#include "ACParallelDecoder.h"
+#include "CAPThread.h"
+#include <algorithm>
+#include <limits.h>
+
+//=============================================================================
+//	ACParallelDecoder
+//=============================================================================
+
+static const UInt32 kReadPackets = 256;			// per read from the file
+static const UInt32 kOutputFrames = 8192;		// per ProduceOutputPackets
+
+ACParallelDecoder::ACParallelDecoder(UInt32 inNumberThreads, UInt32 inSegmentFrames, UInt32 inPrerollPackets)
+:
+	mNumberThreads(std::min(inNumberThreads ? inNumberThreads : CAPThread::GetNumberOfProcessors(), (UInt32)kMaxThreads)),
+	mSegmentFrames(std::max(inSegmentFrames, (UInt32)1)),
+	mPrerollPackets(inPrerollPackets),
+	mFile(NULL),
+	mOutput(NULL),
+	mOutputRefCon(NULL),
+	mNumberPackets(0),
+	mFramesPerPacket(0),
+	mPacketTable(NULL),
+	mMaxPacketBytes(0),
+	mFirstFrame(0),
+	mEndFrame(0),
+	mNumberSlots(0),
+	mSlotBytes(0),
+	mFileMutex("ACParallelDecoder file"),
+	mGuard("ACParallelDecoder"),
+	mNextSegment(0),
+	mNextOutput(0),
+	mOutputting(false),
+	mRunningThreads(0),
+	mError(noErr)
+{
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+ACParallelDecoder::~ACParallelDecoder()
+{
+}
+
+OSStatus	ACParallelDecoder::Decode(	AudioFileObject*					inFile,
+										const AudioStreamBasicDescription&	inOutputFormat,
+										NewCodecProc						inNewCodec,
+										void*								inNewCodecRefCon,
+										OutputProc							inOutput,
+										void*								inOutputRefCon)
+{
+	if (inOutputFormat.mFormatID != kAudioFormatLinearPCM || inOutputFormat.mBytesPerFrame == 0 || !inNewCodec || !inOutput)
+		return kAudio_ParamError;
+
+	mFile = inFile;
+	mOutputFormat = inOutputFormat;
+	mOutput = inOutput;
+	mOutputRefCon = inOutputRefCon;
+	mNextSegment = 0;
+	mNextOutput = 0;
+	mOutputting = false;
+	mError = noErr;
+	memset(&mStatistics, 0, sizeof(mStatistics));
+
+	OSStatus theError = PlanSegments();
+	if (theError) return theError;
+	if (mSegments.empty()) return noErr;
+
+	//	every thread's codec is set up the same way, here, so a codec that won't initialize fails the whole decode
+	UInt32 theCookieSize = 0;
+	CAAutoFree<Byte> theCookie;
+	if (mFile->GetMagicCookieDataSize(&theCookieSize, NULL) == noErr && theCookieSize) {
+		theCookie.allocBytes(theCookieSize);
+		if (mFile->GetMagicCookieData(&theCookieSize, theCookie()) != noErr) theCookieSize = 0;
+	}
+
+	UInt32 theNumberThreads = std::min(mNumberThreads, (UInt32)mSegments.size());
+	std::vector<Worker> theWorkers;
+	for (UInt32 i = 0; i < theNumberThreads && !theError; ++i) {
+		Worker theWorker = { this, inNewCodec(inNewCodecRefCon) };
+		if (!theWorker.mCodec) {
+			theError = kAudioCodecUnspecifiedError;
+			break;
+		}
+		try {
+			theWorker.mCodec->Initialize(&mFile->GetDataFormat(), &inOutputFormat, theCookieSize ? theCookie() : NULL, theCookieSize);
+		} catch (OSStatus inError) {
+			theError = inError;
+		} catch (...) {
+			theError = kAudioCodecUnspecifiedError;
+		}
+		theWorkers.push_back(theWorker);
+	}
+
+	if (!theError) {
+		mNumberSlots = std::min(2 * theNumberThreads, (UInt32)mSegments.size());
+		mSlots.allocBytes(mNumberSlots * mSlotBytes);
+
+		CAGuard::Locker theLocker(mGuard);
+		for (UInt32 i = 0; i < theWorkers.size(); ++i) {
+			CAPThread* theThread = new CAPThread(WorkerEntry, &theWorkers[i], CAPThread::kDefaultThreadPriority, false, true, "ACParallelDecoder");
+			try {
+				theThread->Start();
+				++mRunningThreads;
+			} catch (...) {
+				delete theThread;
+			}
+		}
+		mStatistics.mThreads = mRunningThreads;
+
+		if (!mRunningThreads) {
+			//	no threads; decode on this one
+			mStatistics.mThreads = 1;
+			++mRunningThreads;
+			CAMutex::Unlocker theUnlocker(mGuard);
+			WorkerEntry(&theWorkers[0]);
+		}
+		while (mRunningThreads) theLocker.Wait();
+		theError = mError;
+	}
+
+	for (UInt32 i = 0; i < theWorkers.size(); ++i)
+		delete theWorkers[i].mCodec;
+	mSlots.free();
+	mSegments.clear();
+	mFile = NULL;
+	return theError;
+}
+
+//	Cuts the file into segments and works out how much of the decoded output to keep.
+OSStatus	ACParallelDecoder::PlanSegments()
+{
+	const AudioStreamBasicDescription& theFormat = mFile->GetDataFormat();
+	mFramesPerPacket = theFormat.mFramesPerPacket;
+	mPacketTable = NULL;
+	SInt64 theTotalFrames;
+	if (mFramesPerPacket) {
+		mNumberPackets = mFile->GetNumPackets();
+		theTotalFrames = mNumberPackets * mFramesPerPacket;
+	} else {
+		OSStatus theError = mFile->ScanForPackets(LLONG_MAX);
+		if (theError && theError != kAudioFileEndOfFileError) return theError;
+		mPacketTable = mFile->GetPacketTable();
+		if (!mPacketTable) return kAudioFileInvalidPacketOffsetError;
+		mNumberPackets = mPacketTable->size();
+		theTotalFrames = mPacketTable->TotalFrames();
+	}
+	mMaxPacketBytes = theFormat.mBytesPerPacket ? theFormat.mBytesPerPacket : mFile->GetPacketSizeUpperBound();
+	if (mNumberPackets && !mMaxPacketBytes) return kAudioFileInvalidFileError;
+
+	mFirstFrame = 0;
+	mEndFrame = theTotalFrames;
+	AudioFilePacketTableInfo theInfo;
+	UInt32 theSize = SizeOf32(theInfo);
+	if (mFile->GetProperty(kAudioFilePropertyPacketTableInfo, &theSize, &theInfo) == noErr && theInfo.mNumberValidFrames > 0) {
+		mFirstFrame = std::min((SInt64)theInfo.mPrimingFrames, theTotalFrames);
+		mEndFrame = std::min(mFirstFrame + theInfo.mNumberValidFrames, theTotalFrames);
+	}
+
+	mSegments.clear();
+	UInt32 theMaxFrames = 0;
+	for (SInt64 thePacket = 0; thePacket < mNumberPackets; ) {
+		Segment theSegment;
+		theSegment.mStartingPacket = thePacket;
+		theSegment.mStartingFrame = FrameForPacket(thePacket);
+
+		//	end on the packet that holds the frame mSegmentFrames on, so segments are never shorter than asked
+		SInt64 theEndFrame = theSegment.mStartingFrame + mSegmentFrames;
+		if (mFramesPerPacket)
+			thePacket = (theEndFrame + mFramesPerPacket - 1) / mFramesPerPacket;
+		else if (theEndFrame < theTotalFrames)
+			thePacket = mPacketTable->PacketForFrame(theEndFrame) + 1;
+		else
+			thePacket = mNumberPackets;
+		thePacket = std::min(std::max(thePacket, theSegment.mStartingPacket + 1), mNumberPackets);
+
+		theSegment.mNumberFrames = (UInt32)(FrameForPacket(thePacket) - theSegment.mStartingFrame);
+		theSegment.mFramesDecoded = 0;
+		theSegment.mDone = false;
+		theMaxFrames = std::max(theMaxFrames, theSegment.mNumberFrames);
+		mSegments.push_back(theSegment);
+	}
+	mSlotBytes = theMaxFrames * mOutputFormat.mBytesPerFrame;
+	mStatistics.mSegments = (UInt32)mSegments.size();
+	return noErr;
+}
+
+SInt64	ACParallelDecoder::FrameForPacket(SInt64 inPacket) const
+{
+	if (mFramesPerPacket) return inPacket * mFramesPerPacket;
+	return inPacket < mNumberPackets ? mPacketTable->FrameForPacket(inPacket) : mPacketTable->TotalFrames();
+}
+
+void*	ACParallelDecoder::WorkerEntry(void* inWorker)
+{
+	Worker* theWorker = static_cast<Worker*>(inWorker);
+	theWorker->mDecoder->Work(theWorker->mCodec);
+	return NULL;
+}
+
+void	ACParallelDecoder::Work(ACCodec* inCodec)
+{
+	CAAutoFree<Byte> theInput(kReadPackets * mMaxPacketBytes);
+	CAAutoFree<AudioStreamPacketDescription> theDescriptions(kReadPackets);
+	CAAutoFree<Byte> theOutput(kOutputFrames * mOutputFormat.mBytesPerFrame);
+
+	CAGuard::Locker theLocker(mGuard);
+	while (!mError && mNextSegment < mSegments.size()) {
+		//	segments are taken in order, so the oldest one not yet output is always being decoded and this can't
+		//	wait forever
+		UInt32 theSegment = mNextSegment++;
+		while (!mError && theSegment >= mNextOutput + mNumberSlots) {
+			++mStatistics.mWindowWaits;
+			theLocker.Wait();
+		}
+		if (mError) break;
+
+		OSStatus theError;
+		UInt64 theDecoded = 0, thePreroll = 0;
+		{
+			CAMutex::Unlocker theUnlocker(mGuard);
+			try {
+				theError = DecodeSegment(inCodec, theSegment, theInput, theDescriptions, theOutput, theDecoded, thePreroll);
+			} catch (OSStatus inError) {
+				theError = inError;
+			} catch (...) {
+				theError = kAudioCodecUnspecifiedError;
+			}
+		}
+		mStatistics.mFramesDecoded += theDecoded;
+		mStatistics.mPrerollFrames += thePreroll;
+		if (theError) {
+			if (!mError) mError = theError;
+			theLocker.NotifyAll();
+			break;
+		}
+		mSegments[theSegment].mDone = true;
+		OutputSegments();
+	}
+
+	--mRunningThreads;
+	theLocker.NotifyAll();
+}
+
+//	Decodes one segment into its slot, starting mPrerollPackets early.
+OSStatus	ACParallelDecoder::DecodeSegment(	ACCodec*									inCodec,
+												UInt32										inSegment,
+												CAAutoFree<Byte>&							ioInput,
+												CAAutoFree<AudioStreamPacketDescription>&	ioDescriptions,
+												CAAutoFree<Byte>&							ioOutput,
+												UInt64&										outFramesDecoded,
+												UInt64&										outPrerollFrames)
+{
+	Segment& theSegment = mSegments[inSegment];
+	const UInt32 theBytesPerFrame = mOutputFormat.mBytesPerFrame;
+	const bool theInputIsVBR = mFile->GetDataFormat().mBytesPerPacket == 0;
+	Byte* theFrames = SegmentFrames(inSegment);
+
+	SInt64 theNextPacket = std::max(theSegment.mStartingPacket - (SInt64)mPrerollPackets, (SInt64)0);
+	SInt64 theEndPacket = inSegment + 1 < mSegments.size() ? mSegments[inSegment + 1].mStartingPacket : mNumberPackets;
+	SInt64 theFramesToSkip = theSegment.mStartingFrame - FrameForPacket(theNextPacket);
+	outPrerollFrames = theFramesToSkip;
+
+	inCodec->Reset();
+
+	UInt32 theInputOffset = 0, theInputBytes = 0, theInputPackets = 0, theInputIndex = 0;
+	UInt32 theFramesWanted = theSegment.mNumberFrames, theFramesDone = 0;
+	while (theFramesDone < theFramesWanted) {
+		UInt32 theNumberFrames = kOutputFrames;
+		UInt32 theNumberBytes = kOutputFrames * theBytesPerFrame;
+		UInt32 theStatus = inCodec->ProduceOutputPackets(ioOutput(), theNumberBytes, theNumberFrames, NULL);
+		if (theStatus == kAudioCodecProduceOutputPacketFailure) return kAudioCodecUnspecifiedError;
+		outFramesDecoded += theNumberFrames;
+
+		//	throw away the preroll, then keep what belongs to this segment
+		const Byte* theSource = ioOutput();
+		UInt32 theSkipped = (UInt32)std::min((SInt64)theNumberFrames, theFramesToSkip);
+		theFramesToSkip -= theSkipped;
+		UInt32 theKept = std::min(theNumberFrames - theSkipped, theFramesWanted - theFramesDone);
+		memcpy(theFrames + theFramesDone * theBytesPerFrame, theSource + theSkipped * theBytesPerFrame, theKept * theBytesPerFrame);
+		theFramesDone += theKept;
+
+		if (theStatus == kAudioCodecProduceOutputPacketAtEOF) break;
+		if (theStatus == kAudioCodecProduceOutputPacketSuccessHasMore || (theStatus == kAudioCodecProduceOutputPacketSuccess && theNumberFrames))
+			continue;
+
+		//	the codec wants more input
+		if (!theInputPackets) {
+			if (theNextPacket >= mNumberPackets) break;		// the codec is holding on to the end of the file
+			//	read up to the end of the segment; past it, a few packets at a time for codecs with latency
+			UInt32 thePackets = (UInt32)std::min(std::max(theEndPacket - theNextPacket, (SInt64)4), std::min((SInt64)kReadPackets, mNumberPackets - theNextPacket));
+			theInputBytes = kReadPackets * mMaxPacketBytes;
+			OSStatus theError;
+			{
+				CAMutex::Locker theFileLocker(mFileMutex);
+				theError = mFile->ReadPacketData(false, &theInputBytes, theInputIsVBR ? ioDescriptions() : NULL, theNextPacket, &thePackets, ioInput());
+			}
+			if (theError && theError != kAudioFileEndOfFileError) return theError;
+			if (!thePackets) break;
+			theNextPacket += thePackets;
+			theInputPackets = thePackets;
+			theInputOffset = 0;
+			theInputIndex = 0;
+		}
+
+		UInt32 theBytes = theInputBytes - theInputOffset, thePackets = theInputPackets;
+		inCodec->AppendInputData(ioInput() + theInputOffset, theBytes, thePackets, theInputIsVBR ? ioDescriptions() + theInputIndex : NULL);
+		if (!thePackets && !theNumberFrames) return kAudioCodecStateError;		// it won't take input or give output
+		theInputOffset += theBytes;
+		theInputPackets -= thePackets;
+		theInputIndex += thePackets;
+		if (theInputIsVBR) {
+			//	the descriptions left are relative to where the data now starts
+			for (UInt32 i = theInputIndex; i < theInputIndex + theInputPackets; ++i)
+				ioDescriptions()[i].mStartOffset -= theBytes;
+		}
+	}
+	theSegment.mFramesDecoded = theFramesDone;
+	return noErr;
+}
+
+//	Hands the decoded segments to the output proc, in order, trimmed to the valid frames. One thread does this at a
+//	time, with mGuard unlocked around the output proc.
+void	ACParallelDecoder::OutputSegments()
+{
+	if (mOutputting) return;
+	mOutputting = true;
+	while (!mError && mNextOutput < mSegments.size() && mSegments[mNextOutput].mDone) {
+		const Segment& theSegment = mSegments[mNextOutput];
+		SInt64 theStart = std::max(theSegment.mStartingFrame, mFirstFrame);
+		SInt64 theEnd = std::min(theSegment.mStartingFrame + theSegment.mFramesDecoded, mEndFrame);
+		if (theStart < theEnd) {
+			const Byte* theData = SegmentFrames(mNextOutput) + (theStart - theSegment.mStartingFrame) * mOutputFormat.mBytesPerFrame;
+			OSStatus theError;
+			{
+				CAMutex::Unlocker theUnlocker(mGuard);
+				theError = mOutput(mOutputRefCon, theStart - mFirstFrame, theData, (UInt32)(theEnd - theStart));
+			}
+			if (theError && !mError) mError = theError;
+		}
+		++mNextOutput;
+		mGuard.NotifyAll();
+	}
+	mOutputting = false;
+}
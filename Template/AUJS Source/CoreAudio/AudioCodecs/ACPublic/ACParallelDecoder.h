@@ -0,0 +1,129 @@
+/*
+	ACParallelDecoder.h
+
+	Decodes a whole AudioFileObject on several threads, for offline jobs (analysis, rendering to a file) that would
+	otherwise wait on one decoder while the other cores idle.
+
+	The file is cut into segments of about inSegmentFrames frames on packet boundaries. Each thread has its own
+	codec and takes the next segment that nobody has started. It resets its codec, primes it by decoding
+	inPrerollPackets packets from before the segment and throwing their output away, and then decodes the segment.
+	Finished segments go to the output proc strictly in order and one at a time, trimmed to the file's priming and
+	remainder frames, so the output proc sees the same frames a single decoder would have produced. The threads
+	stay at most twice their number of segments ahead of the output proc, which bounds the memory used.
+
+	How many packets a codec needs before its output matches a decoder that started at the beginning depends on
+	the codec: none for codecs whose packets decode on their own, one or two for MDCT codecs.
+*/
+#if !defined(__ACParallelDecoder_h__)
+#define __ACParallelDecoder_h__
+
+//=============================================================================
+//	Includes
+//=============================================================================
+
+#include "ACCodec.h"
+#include "AudioFileObject.h"
+#include "CAGuard.h"
+#include "CAAutoDisposer.h"
+#include <vector>
+
+//=============================================================================
+//	ACParallelDecoder
+//=============================================================================
+
+class ACParallelDecoder
+{
+
+public:
+	enum {
+		kDefaultSegmentFrames = 128 * 1024,
+		kDefaultPrerollPackets = 2,
+		kMaxThreads = 64
+	};
+
+	// Returns a codec that will be initialized to decode the file; the decoder deletes it when it's done.
+	typedef ACCodec*	(*NewCodecProc)(void* inRefCon);
+
+	// Called with consecutive runs of the decoded frames, in order and one call at a time, from any of the
+	// decoder's threads. inStartingFrame doesn't count the priming frames. Returning an error stops decoding.
+	typedef OSStatus	(*OutputProc)(void* inRefCon, SInt64 inStartingFrame, const void* inData, UInt32 inNumberFrames);
+
+	struct Statistics {
+		UInt32		mThreads;
+		UInt32		mSegments;
+		UInt64		mFramesDecoded;			// including those thrown away
+		UInt64		mPrerollFrames;			// decoded to prime a codec, then thrown away
+		UInt32		mWindowWaits;			// times a thread waited for the output proc to catch up
+	};
+
+	// inNumberThreads of 0 means one per processor.
+						ACParallelDecoder(UInt32 inNumberThreads = 0, UInt32 inSegmentFrames = kDefaultSegmentFrames, UInt32 inPrerollPackets = kDefaultPrerollPackets);
+						~ACParallelDecoder();
+
+	// Blocks until the whole file has been decoded and output, or something fails. The output format must be
+	// linear PCM. Nothing else may use the file meanwhile.
+	OSStatus			Decode(	AudioFileObject*					inFile,
+								const AudioStreamBasicDescription&	inOutputFormat,
+								NewCodecProc						inNewCodec,
+								void*								inNewCodecRefCon,
+								OutputProc							inOutput,
+								void*								inOutputRefCon);
+
+	void				GetStatistics(Statistics& outStatistics) const { outStatistics = mStatistics; }
+
+private:
+						ACParallelDecoder(const ACParallelDecoder&);
+	ACParallelDecoder&	operator=(const ACParallelDecoder&);
+
+	struct Segment {
+		SInt64			mStartingPacket;
+		SInt64			mStartingFrame;
+		UInt32			mNumberFrames;
+		UInt32			mFramesDecoded;		// may be short at the end of the file
+		bool			mDone;
+	};
+
+	struct Worker {
+		ACParallelDecoder*	mDecoder;
+		ACCodec*			mCodec;
+	};
+
+	OSStatus			PlanSegments();
+	SInt64				FrameForPacket(SInt64 inPacket) const;
+	static void*		WorkerEntry(void* inWorker);
+	void				Work(ACCodec* inCodec);
+	OSStatus			DecodeSegment(ACCodec* inCodec, UInt32 inSegment, CAAutoFree<Byte>& ioInput, CAAutoFree<AudioStreamPacketDescription>& ioDescriptions, CAAutoFree<Byte>& ioOutput, UInt64& outFramesDecoded, UInt64& outPrerollFrames);
+	void				OutputSegments();		// expects mGuard to be held
+	Byte*				SegmentFrames(UInt32 inSegment) { return mSlots() + (inSegment % mNumberSlots) * mSlotBytes; }
+
+	UInt32								mNumberThreads;
+	UInt32								mSegmentFrames;
+	UInt32								mPrerollPackets;
+
+	// for the current Decode
+	AudioFileObject*					mFile;
+	AudioStreamBasicDescription			mOutputFormat;
+	OutputProc							mOutput;
+	void*								mOutputRefCon;
+	SInt64								mNumberPackets;
+	UInt32								mFramesPerPacket;
+	CompressedPacketTable*				mPacketTable;			// when mFramesPerPacket is 0
+	UInt32								mMaxPacketBytes;
+	SInt64								mFirstFrame;			// after the priming frames
+	SInt64								mEndFrame;				// before the remainder frames
+	std::vector<Segment>				mSegments;
+	CAAutoFree<Byte>					mSlots;					// the output of segments decoded but not yet output
+	UInt32								mNumberSlots;
+	UInt32								mSlotBytes;
+
+	CAMutex								mFileMutex;
+	CAGuard								mGuard;
+	UInt32								mNextSegment;			// the next to be decoded
+	UInt32								mNextOutput;			// the next to be output
+	bool								mOutputting;
+	UInt32								mRunningThreads;
+	OSStatus							mError;
+	Statistics							mStatistics;
+};
+
+#endif
@@ -44,6 +44,18 @@
 
 #include "ACSimpleCodec.h"
 #include <string.h>
+#include <algorithm>
+#if ACSimpleCodec_UseMirroredBuffer
+	#include "CAAtomic.h"
+	#include <stdio.h>
+	#include <unistd.h>
+	#if TARGET_OS_MAC
+		#include <mach/mach.h>
+	#else
+		#include <fcntl.h>
+		#include <sys/mman.h>
+	#endif
+#endif
 
 //=============================================================================
 //	ACSimpleCodec
@@ -51,19 +63,84 @@
 
 static const UInt32 kBufferPad = 64; // this is used to prevent end from passing start.
 
+#if ACSimpleCodec_UseMirroredBuffer
+
+//	Maps inByteSize bytes, a multiple of the page size, twice in a row, so that
+//	theBuffer[i] and theBuffer[i + inByteSize] are the same byte. Returns NULL if
+//	the system won't do it.
+static Byte*	AllocateMirroredBuffer(UInt32 inByteSize)
+{
+#if TARGET_OS_MAC
+	vm_address_t theBuffer = 0;
+	if(vm_allocate(mach_task_self(), &theBuffer, 2 * inByteSize, VM_FLAGS_ANYWHERE) != KERN_SUCCESS) return NULL;
+	
+	//	replace the second half with another mapping of the first
+	vm_address_t theMirror = theBuffer + inByteSize;
+	vm_prot_t theCurrentProtection, theMaxProtection;
+	vm_deallocate(mach_task_self(), theMirror, inByteSize);
+	kern_return_t theError = vm_remap(mach_task_self(), &theMirror, inByteSize, 0, 0, mach_task_self(), theBuffer, 0, &theCurrentProtection, &theMaxProtection, VM_INHERIT_DEFAULT);
+	if(theError != KERN_SUCCESS || theMirror != theBuffer + inByteSize)
+	{
+		//	something else took the second half
+		if(theError == KERN_SUCCESS) vm_deallocate(mach_task_self(), theMirror, inByteSize);
+		vm_deallocate(mach_task_self(), theBuffer, inByteSize);
+		return NULL;
+	}
+	return reinterpret_cast<Byte*>(theBuffer);
+#else
+	//	map an unlinked shared memory object into both halves of a reserved range
+	static volatile SInt32 sCounter = 0;
+	char theName[64];
+	snprintf(theName, sizeof(theName), "/ACSimpleCodec.%d.%d", (int)getpid(), (int)CAAtomicIncrement32(&sCounter));
+	int theFile = shm_open(theName, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(theFile < 0) return NULL;
+	shm_unlink(theName);
+	
+	Byte* theBuffer = NULL;
+	if(ftruncate(theFile, inByteSize) == 0)
+	{
+		void* theRange = mmap(NULL, 2 * inByteSize, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+		if(theRange != MAP_FAILED)
+		{
+			theBuffer = static_cast<Byte*>(theRange);
+			if(mmap(theBuffer, inByteSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, theFile, 0) == MAP_FAILED
+			   || mmap(theBuffer + inByteSize, inByteSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, theFile, 0) == MAP_FAILED)
+			{
+				munmap(theBuffer, 2 * inByteSize);
+				theBuffer = NULL;
+			}
+		}
+	}
+	close(theFile);
+	return theBuffer;
+#endif
+}
+
+static void	FreeMirroredBuffer(Byte* inBuffer, UInt32 inByteSize)
+{
+#if TARGET_OS_MAC
+	vm_deallocate(mach_task_self(), reinterpret_cast<vm_address_t>(inBuffer), 2 * inByteSize);
+#else
+	munmap(inBuffer, 2 * inByteSize);
+#endif
+}
+
+#endif
+
 ACSimpleCodec::ACSimpleCodec(UInt32 inInputBufferByteSize, AudioComponentInstance inInstance)
 :
 	ACBaseCodec(inInstance),
 	mInputBuffer(NULL),
 	mInputBufferByteSize(inInputBufferByteSize+kBufferPad),
 	mInputBufferStart(0),
-	mInputBufferEnd(0)
+	mInputBufferEnd(0),
+	mInputBufferIsMirrored(false)
 {
 }
 
 ACSimpleCodec::~ACSimpleCodec()
 {
-	delete[] mInputBuffer;
+	FreeInputBuffer();
 }
 
 void	ACSimpleCodec::Initialize(const AudioStreamBasicDescription* inInputFormat, const AudioStreamBasicDescription* inOutputFormat, const void* inMagicCookie, UInt32 inMagicCookieByteSize)
@@ -83,8 +160,7 @@ void	ACSimpleCodec::Initialize(const AudioStreamBasicDescription* inInputFormat,
 void	ACSimpleCodec::Uninitialize()
 {
 	//	get rid of the buffer
-	delete[] mInputBuffer;
-	mInputBuffer = NULL;
+	FreeInputBuffer();
 	
 	//	reset the ring buffer state
 	mInputBufferStart = 0;
@@ -164,31 +240,13 @@ void	ACSimpleCodec::AppendInputData(const void* inInputData, UInt32& ioInputData
 	}
 	// <<jamesmcc 
 	
-	//	now we have to copy the data taking into account the wrap around and where the start is
-	if(mInputBufferEnd + ioInputDataByteSize < mInputBufferByteSize)
-	{
-		//	no wrap around here
-		memcpy(mInputBuffer + mInputBufferEnd, theInputData, ioInputDataByteSize);
-		
-		//	adjust the end point
-		mInputBufferEnd += ioInputDataByteSize;
-	}
-	else
-	{
-		//	the copy will wrap
-		
-		//	copy the first part
-		UInt32 theBeforeWrapByteSize = mInputBufferByteSize - mInputBufferEnd;
-		memcpy(mInputBuffer + mInputBufferEnd, theInputData, theBeforeWrapByteSize);
-		
-		//	and the rest
-		UInt32 theAfterWrapByteSize = ioInputDataByteSize - theBeforeWrapByteSize;
-		memcpy(mInputBuffer, theInputData + theBeforeWrapByteSize, theAfterWrapByteSize);
-		
-		//	adjust the end point
-		mInputBufferEnd = theAfterWrapByteSize;
-	}
+	//	copy the data in after the end, and move the end, taking into account the wrap around
+	CopyToInputBuffer(mInputBufferEnd, theInputData, ioInputDataByteSize);
+	mInputBufferEnd += ioInputDataByteSize;
+	if(mInputBufferEnd >= mInputBufferByteSize) mInputBufferEnd -= mInputBufferByteSize;
 	
+	//	there are always at least kBufferPad free bytes after the end; keep them zeroed
+	CopyToInputBuffer(mInputBufferEnd, NULL, kBufferPad);
 }
 
 
@@ -215,29 +273,26 @@ void	ACSimpleCodec::ZeroPadInputData(UInt32& ioNumberPackets, const AudioStreamP
 	
 	// <<jamesmcc 
 	
-	//	now we have to copy the data taking into account the wrap around and where the start is
-	if(mInputBufferEnd + minByteSize < mInputBufferByteSize)
+	//	zero the packets and the padding after them, and move the end, taking into account the wrap around
+	CopyToInputBuffer(mInputBufferEnd, NULL, minByteSize + kBufferPad);
+	mInputBufferEnd += minByteSize;
+	if(mInputBufferEnd >= mInputBufferByteSize) mInputBufferEnd -= mInputBufferByteSize;
+}
+
+void	ACSimpleCodec::CopyToInputBuffer(UInt32 inOffset, const Byte* inData, UInt32 inByteSize)
+{
+	//	a mirrored buffer doesn't wrap until twice its size
+	UInt32 theBeforeWrapByteSize = mInputBufferIsMirrored ? inByteSize : std::min(inByteSize, mInputBufferByteSize - inOffset);
+	UInt32 theAfterWrapByteSize = inByteSize - theBeforeWrapByteSize;
+	if(inData)
 	{
-		//	no wrap around here
-		memset(mInputBuffer + mInputBufferEnd, 0, minByteSize);
-		
-		//	adjust the end point
-		mInputBufferEnd += minByteSize;
+		memcpy(mInputBuffer + inOffset, inData, theBeforeWrapByteSize);
+		memcpy(mInputBuffer, inData + theBeforeWrapByteSize, theAfterWrapByteSize);
 	}
 	else
 	{
-		//	the copy will wrap
-		
-		//	copy the first part
-		UInt32 theBeforeWrapByteSize = mInputBufferByteSize - mInputBufferEnd;
-		memset(mInputBuffer + mInputBufferEnd, 0, theBeforeWrapByteSize);
-		
-		//	and the rest
-		UInt32 theAfterWrapByteSize = minByteSize - theBeforeWrapByteSize;
+		memset(mInputBuffer + inOffset, 0, theBeforeWrapByteSize);
 		memset(mInputBuffer, 0, theAfterWrapByteSize);
-		
-		//	adjust the end point
-		mInputBufferEnd = theAfterWrapByteSize;
 	}
 }
 
@@ -245,36 +300,11 @@ void	ACSimpleCodec::ZeroPadInputData(UInt32& ioNumberPackets, const AudioStreamP
 void	ACSimpleCodec::ConsumeInputData(UInt32 inConsumedByteSize)
 {
 	//	this is a convenience routine to make maintaining the ring buffer state easy
-	UInt32 theContiguousRange = GetInputBufferContiguousByteSize();
-	
 	if(inConsumedByteSize > GetUsedInputBufferByteSize()) CODEC_THROW(kAudioCodecUnspecifiedError);
 	
-	if(inConsumedByteSize <= theContiguousRange)
-	{
-		//	the region to consume doesn't wrap
-		
-		//	figure out how much to consume
-		inConsumedByteSize = (theContiguousRange < inConsumedByteSize) ? theContiguousRange : inConsumedByteSize;
-		
-		//	clear the consumed bits
-		memset(mInputBuffer + mInputBufferStart, 0, inConsumedByteSize);
-		
-		//	adjust the start
-		mInputBufferStart += inConsumedByteSize;
-	}
-	else
-	{
-		//	the region to consume will wrap
-		
-		//	clear the bits to the end of the buffer
-		memset(mInputBuffer + mInputBufferStart, 0, theContiguousRange);
-		
-		//	now clear the bits left from the start
-		memset(mInputBuffer, 0, inConsumedByteSize - theContiguousRange);
-		
-		//	adjust the start
-		mInputBufferStart = inConsumedByteSize - theContiguousRange;
-	}
+	//	the consumed bytes are left as they are; only the padding after the end is kept zeroed
+	mInputBufferStart += inConsumedByteSize;
+	if(mInputBufferStart >= mInputBufferByteSize) mInputBufferStart -= mInputBufferByteSize;
 }
 
 
@@ -292,7 +322,8 @@ Byte* ACSimpleCodec::GetBytes(UInt32& ioNumberBytes) const
 		
 	SInt32 leftOver = mInputBufferStart + ioNumberBytes - mInputBufferByteSize;
 	
-	if(leftOver > 0)
+	//	a mirrored buffer already has the beginning after the end
+	if(leftOver > 0 && !mInputBufferIsMirrored)
 	{
 		// need to copy beginning of buffer to the end. 
 		// We cleverly over allocated our buffer space to make this possible.
@@ -305,23 +336,52 @@ Byte* ACSimpleCodec::GetBytes(UInt32& ioNumberBytes) const
 
 void	ACSimpleCodec::ReallocateInputBuffer(UInt32 inInputBufferByteSize)
 {
-	mInputBufferByteSize = inInputBufferByteSize + kBufferPad;
+	//	toss the old buffer, while mInputBufferByteSize still says how big its mirror is
+	FreeInputBuffer();
 	
-	//	toss the old buffer
-	delete[] mInputBuffer;
-	mInputBuffer = NULL;
+	mInputBufferByteSize = inInputBufferByteSize + kBufferPad;
 	
-	//	allocate the new one
-	// allocate extra in order to allow making contiguous data.
-	UInt32 allocSize = 2*inInputBufferByteSize + kBufferPad;
-	mInputBuffer = new Byte[allocSize];
-	memset(mInputBuffer, 0, allocSize);
+#if ACSimpleCodec_UseMirroredBuffer
+	//	the mirror is made of whole pages, so the buffer may grow a little; it comes zeroed
+	UInt32 thePageSize = (UInt32)getpagesize();
+	UInt32 theMirroredByteSize = (mInputBufferByteSize + thePageSize - 1) / thePageSize * thePageSize;
+	mInputBuffer = AllocateMirroredBuffer(theMirroredByteSize);
+	if(mInputBuffer != NULL)
+	{
+		mInputBufferByteSize = theMirroredByteSize;
+		mInputBufferIsMirrored = true;
+	}
+	else
+#endif
+	{
+		//	allocate the new one
+		// allocate extra in order to allow making contiguous data.
+		UInt32 allocSize = 2*inInputBufferByteSize + kBufferPad;
+		mInputBuffer = new Byte[allocSize];
+		memset(mInputBuffer, 0, allocSize);
+	}
 	
 	//	reset the ring buffer state
 	mInputBufferStart = 0;
 	mInputBufferEnd = 0;
 }
 
+void	ACSimpleCodec::FreeInputBuffer()
+{
+#if ACSimpleCodec_UseMirroredBuffer
+	if(mInputBufferIsMirrored)
+	{
+		FreeMirroredBuffer(mInputBuffer, mInputBufferByteSize);
+	}
+	else
+#endif
+	{
+		delete[] mInputBuffer;
+	}
+	mInputBuffer = NULL;
+	mInputBufferIsMirrored = false;
+}
+
 void	ACSimpleCodec::GetPropertyInfo(AudioCodecPropertyID inPropertyID, UInt32& outPropertyDataSize, Boolean& outWritable)
 {
 	switch(inPropertyID)
@@ -47,11 +47,21 @@
 
 #include "ACBaseCodec.h"
 
+//	Where the system allows, the input ring buffer is mapped twice, back to back,
+//	so the used region is always contiguous in memory and nothing ever has to be
+//	split or copied around the wrap. Define this as 0 to always use a plain buffer.
+#if !defined(ACSimpleCodec_UseMirroredBuffer)
+	#define ACSimpleCodec_UseMirroredBuffer	!TARGET_OS_WIN32
+#endif
+
 //=============================================================================
 //	ACSimpleCodec
 //
 //	This extension of ACBaseCodec provides for a simple ring buffer to handle
 //	input data.
+//
+//	Bytes that aren't input data aren't kept zeroed, except for the kBufferPad
+//	bytes after the end of the data, so a codec may read a little past the end.
 //=============================================================================
 
 class ACSimpleCodec
@@ -80,7 +90,7 @@ public:
 protected:
 	void				ConsumeInputData(UInt32 inConsumedByteSize);	
 	Byte*				GetInputBufferStart() const { return mInputBuffer + mInputBufferStart; }
-	UInt32				GetInputBufferContiguousByteSize() const { return (mInputBufferStart <= mInputBufferEnd) ? (mInputBufferEnd - mInputBufferStart) : (mInputBufferByteSize - mInputBufferStart); }
+	UInt32				GetInputBufferContiguousByteSize() const { return (mInputBufferStart <= mInputBufferEnd) ? (mInputBufferEnd - mInputBufferStart) : mInputBufferIsMirrored ? GetUsedInputBufferByteSize() : (mInputBufferByteSize - mInputBufferStart); }
 	virtual void		ReallocateInputBuffer(UInt32 inInputBufferByteSize);
 	
 	// returns a pointer to contiguous bytes. 
@@ -89,10 +99,14 @@ protected:
 	Byte*				GetBytes(UInt32& ioNumberBytes) const;
 
 private:	
+	void				FreeInputBuffer();
+	void				CopyToInputBuffer(UInt32 inOffset, const Byte* inData, UInt32 inByteSize);	// NULL data zeroes
+	
 	Byte*				mInputBuffer;
 	UInt32				mInputBufferByteSize;
 	UInt32				mInputBufferStart;
 	UInt32				mInputBufferEnd;
+	bool				mInputBufferIsMirrored;
 
 };
 
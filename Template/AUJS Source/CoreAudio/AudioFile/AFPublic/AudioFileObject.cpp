@@ -380,7 +380,7 @@ OSStatus AudioFileObject::PacketToFrame(SInt64 inPacket, SInt64& outFirstFrameIn
 		if (inPacket < 0 || inPacket >= packetTableSize)
 			return kAudioFileInvalidPacketOffsetError;
 			
-		outFirstFrameInPacket = (*packetTable)[(size_t)inPacket].mFrameOffset;
+		outFirstFrameInPacket = packetTable->FrameForPacket(inPacket);
 	}
 	else
 	{
@@ -400,18 +400,18 @@ OSStatus AudioFileObject::FrameToPacket(SInt64 inFrame, SInt64& outPacket, UInt3
 			return kAudioFileInvalidPacketOffsetError;
 			
 		// search packet table
-		AudioStreamPacketDescriptionExtended pext;
-		memset(&pext, 0, sizeof(pext));
-		pext.mFrameOffset = inFrame;
-		CompressedPacketTable::iterator iter = std::lower_bound(packetTable->begin(), packetTable->end(), pext);
-		
-		if (iter == packetTable->end())
+		SInt64 totalFrames = packetTable->TotalFrames();
+		if (inFrame < 0 || inFrame > totalFrames)
 			return kAudioFileInvalidPacketOffsetError;
 		
-		if (iter > packetTable->begin()) --iter;
-		
-		outPacket = iter - packetTable->begin();
-		outFrameOffsetInPacket = (UInt32)(inFrame - iter->mFrameOffset);
+		if (inFrame == totalFrames) {
+			// the end of the last packet, like inFrame / mFramesPerPacket would give
+			outPacket = packetTable->size();
+			outFrameOffsetInPacket = 0;
+		} else {
+			outPacket = packetTable->PacketForFrame(inFrame);
+			outFrameOffsetInPacket = (UInt32)(inFrame - packetTable->FrameForPacket(outPacket));
+		}
 	}
 	else
 	{
@@ -459,11 +459,6 @@ OSStatus AudioFileObject::PacketToByte(AudioBytePacketTranslation* abpt)
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-inline bool byte_less_than (const AudioStreamPacketDescriptionExtended& a, const AudioStreamPacketDescriptionExtended& b)
-{
-	return a.mStartOffset < b.mStartOffset;
-}
-
 OSStatus AudioFileObject::ByteToPacket(AudioBytePacketTranslation* abpt)
 {
 	if (mDataFormat.mBytesPerPacket == 0)
@@ -472,12 +467,14 @@ OSStatus AudioFileObject::ByteToPacket(AudioBytePacketTranslation* abpt)
 		if (!packetTable)
 			return kAudioFileInvalidPacketOffsetError;
 			// search packet table
+		SInt64 packet = packetTable->PacketForByte(abpt->mByte);
+		if (packet < 0 && packetTable->size())
+			return kAudioFileInvalidPacketOffsetError;
 		AudioStreamPacketDescriptionExtended pext;
 		memset(&pext, 0, sizeof(pext));
-		pext.mStartOffset = abpt->mByte;
-		CompressedPacketTable::iterator iter = std::lower_bound(packetTable->begin(), packetTable->end(), pext, byte_less_than);
+		if (packet >= 0) pext = (*packetTable)[packet];
 		
-		if (iter == packetTable->end()) {
+		if (packet < 0 || (packet == packetTable->size() - 1 && abpt->mByte >= pext.mStartOffset + pext.mDataByteSize)) {
 			SInt64 numPackets = packetTable->size();
 			if (numPackets < 8) 
 				return 'more' /*kAudioFileStreamError_DataUnavailable*/ ;
@@ -492,9 +489,8 @@ OSStatus AudioFileObject::ByteToPacket(AudioBytePacketTranslation* abpt)
 			abpt->mFlags = kBytePacketTranslationFlag_IsEstimate;
 			
 		} else {
-			if (iter > packetTable->begin()) --iter;
-			abpt->mPacket = iter - packetTable->begin();
-			abpt->mByteOffsetInPacket = (UInt32)(abpt->mByte - iter->mStartOffset);
+			abpt->mPacket = packet;
+			abpt->mByteOffsetInPacket = (UInt32)(abpt->mByte - pext.mStartOffset);
 			abpt->mFlags = 0;
 		}
 	}
@@ -865,18 +861,107 @@ OSStatus AudioFileObject::ReadPacketDataVBR_InTable(
 	}
 	
 	// fill out packet descriptions
-	if (outPacketDescriptions) {						
-		for (UInt32 i = 0; i < *ioNumPackets; i++) {
-			AudioStreamPacketDescription curPacket = (*packetTable)[i + inStartingPacket];
-			outPacketDescriptions[i] = curPacket;				
-			outPacketDescriptions[i].mStartOffset = curPacket.mStartOffset - firstPacketOffset;
-		}
-	}
+	if (outPacketDescriptions)
+		packetTable->GetPacketDescriptions(inStartingPacket, *ioNumPackets, outPacketDescriptions, firstPacketOffset);
 
     return err;
 }
 
 
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+OSStatus AudioFileObject::MapBytes(	SInt64			inStartingByte, 
+									UInt32			*ioNumBytes, 
+									const void		**outBytes)
+{
+	if (ioNumBytes == NULL || outBytes == NULL) return kAudio_ParamError;
+	*outBytes = NULL;
+
+	SInt64 fileOffset = mDataOffset + inStartingByte;
+	bool readingPastEnd = false;
+
+	if (inStartingByte >= GetNumBytes()) {
+		*ioNumBytes = 0;
+		return kAudioFileEndOfFileError;
+	}
+
+	if ((fileOffset + *ioNumBytes) > (GetNumBytes() + mDataOffset)) {
+		*ioNumBytes = (UInt32)(GetNumBytes() + mDataOffset - fileOffset);
+		readingPastEnd = true;
+	}
+
+	OSStatus err = GetDataSource()->MapBytes(SEEK_SET, fileOffset, *ioNumBytes, outBytes, ioNumBytes);
+	if (readingPastEnd && err == noErr)
+		err = kAudioFileEndOfFileError;
+	return err;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+OSStatus AudioFileObject::MapPacketData(	UInt32							*ioNumBytes,
+										AudioStreamPacketDescription	*outPacketDescriptions,
+										SInt64							inStartingPacket, 
+										UInt32  						*ioNumPackets, 
+										const void						**outBytes)
+{
+	if (ioNumPackets == NULL || *ioNumPackets < 1) return kAudio_ParamError;
+	if (ioNumBytes == NULL || *ioNumBytes < 1) return kAudio_ParamError;
+	if (outBytes == NULL) return kAudio_ParamError;
+	*outBytes = NULL;
+
+	if (mDataFormat.mBytesPerPacket) {
+		// CBR
+		UInt32 maxPackets = *ioNumBytes / mDataFormat.mBytesPerPacket;
+		if (*ioNumPackets > maxPackets) *ioNumPackets = maxPackets;
+
+		UInt32 byteCount = *ioNumPackets * mDataFormat.mBytesPerPacket;
+		OSStatus err = MapBytes(inStartingPacket * mDataFormat.mBytesPerPacket, &byteCount, outBytes);
+		if (err == noErr || err == kAudioFileEndOfFileError) {
+			*ioNumPackets = byteCount / mDataFormat.mBytesPerPacket;
+			*ioNumBytes = *ioNumPackets * mDataFormat.mBytesPerPacket;
+		}
+		return err;
+	}
+
+	if (outPacketDescriptions == NULL) return kAudio_ParamError;
+	OSStatus err = ScanForPackets(inStartingPacket+1);
+	if (err && err != kAudioFileEndOfFileError)
+		return err;
+
+	CompressedPacketTable* packetTable = GetPacketTable();
+	if (!packetTable) 
+		return kAudioFileInvalidFileError;
+
+	SInt64 packetTableSize = GetPacketTableSize();
+	if (inStartingPacket >= packetTableSize) {
+		*ioNumBytes = 0;
+		*ioNumPackets = 0;
+		return kAudioFileEndOfFileError;
+	}
+	// past the scanned packets, ReadPacketDataVBR reads first and scans what it read
+	if (inStartingPacket + *ioNumPackets > packetTableSize)
+		return kAudio_UnimplementedError;
+
+	err = HowManyPacketsCanBeReadIntoBuffer(ioNumBytes, inStartingPacket, ioNumPackets);
+	if (err) return err;
+
+	SInt64 firstPacketOffset = (*packetTable)[inStartingPacket].mStartOffset;
+	UInt32 bytesMapped = *ioNumBytes;
+	err = MapBytes(firstPacketOffset, &bytesMapped, outBytes);
+	if (err && err != kAudioFileEndOfFileError)
+		return err;
+	if (bytesMapped != *ioNumBytes) {
+		// the file's shorter than its packet table says
+		*ioNumBytes = 0;
+		*ioNumPackets = 0;
+		*outBytes = NULL;
+		return kAudioFileInvalidFileError;
+	}
+
+	packetTable->GetPacketDescriptions(inStartingPacket, *ioNumPackets, outPacketDescriptions, firstPacketOffset);
+	return err;
+}
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 OSStatus AudioFileObject::WritePackets(	
@@ -929,19 +1014,12 @@ OSStatus AudioFileObject::GetBitRate(			UInt32					*outBitRate)
 		} else {
 			// count frames
 			CompressedPacketTable* packetTable = GetPacketTable();
-			if (packetTable->size() != numPackets) {
+			if (packetTable && packetTable->size() != numPackets) {
 				return kAudioFileInvalidFileError;
 			}
 				
 			if (packetTable) {
-#if !TARGET_OS_WIN32
-				for (ssize_t i = 0; i < numPackets; i++)
-#else
-				for (int i = 0; i < numPackets; i++)
-#endif
-				{
-					numFrames += (*packetTable)[i].mVariableFramesInPacket;
-				}		
+				numFrames = packetTable->TotalFrames();
 			} else {
 				return kAudioFileUnsupportedPropertyError;
 			}
@@ -1730,6 +1808,11 @@ OSStatus AudioFileObject::OpenFile(SInt8 inPermissions, int inFD)
 {
 	OSStatus err = noErr;
 
+#if AudioFileObject_MapReadOnlyFiles
+	if (!(inPermissions & kAudioFileWritePermission))
+		SetDataSource(new MMap_DataSource(inFD, inPermissions, true));
+	else
+#endif
 	SetDataSource(new Cached_DataSource(new UnixFile_DataSource(inFD, inPermissions, true)));
 	
 	mFileD = inFD;
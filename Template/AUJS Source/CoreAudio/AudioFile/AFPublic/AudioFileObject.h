@@ -63,6 +63,13 @@
 #include <io.h>
 #endif
 
+// Set to 1 to read files opened read only through MMap_DataSource rather than a Cached_DataSource
+// over UnixFile_DataSource. Only for files nothing else will truncate while they're open: reading
+// a mapped page past the new end of the file raises SIGBUS rather than returning an error.
+#if !defined(AudioFileObject_MapReadOnlyFiles)
+	#define AudioFileObject_MapReadOnlyFiles	0
+#endif
+
 /*
 	These are structs defined in 10.5. They are included here for compatibility with sources
 */
@@ -306,6 +313,20 @@ public:
                                     UInt32  						*ioNumPackets, 
                                     void							*outBuffer);
 	
+	// Like ReadBytes and ReadPacketData, but point *outBytes into the data source instead of copying, when the 
+	// data source can (see DataSource::MapBytes). The bytes are read only and good until the next read. They 
+	// return kAudio_UnimplementedError when the data source can't map, and MapPacketData does for VBR packets 
+	// that haven't been scanned yet; use ReadBytes or ReadPacketData then.
+	virtual OSStatus MapBytes(		SInt64			inStartingByte, 
+									UInt32			*ioNumBytes, 
+									const void		**outBytes);
+	
+	virtual OSStatus MapPacketData(	UInt32							*ioNumBytes,
+									AudioStreamPacketDescription	*outPacketDescriptions,
+									SInt64							inStartingPacket, 
+									UInt32  						*ioNumPackets, 
+									const void						**outBytes);
+	
 	virtual OSStatus WritePackets(	Boolean								inUseCache,
                                     UInt32								inNumBytes,
                                     const AudioStreamPacketDescription	*inPacketDescriptions,
@@ -523,14 +544,13 @@ public:
     void AppendPacket(const AudioStreamPacketDescription &inPacket) 
 		{
 			CompressedPacketTable* packetTable = GetPacketTable(true);
-			UInt32 numFramesInPacket = mDataFormat.mFramesPerPacket ? mDataFormat.mFramesPerPacket : inPacket.mVariableFramesInPacket;
 			
+			// the table works out mFrameOffset
 			AudioStreamPacketDescriptionExtended pext;
 			memset(&pext, 0, sizeof(pext));
 			pext.mStartOffset = inPacket.mStartOffset;
 			pext.mDataByteSize = inPacket.mDataByteSize;
 			pext.mVariableFramesInPacket = inPacket.mVariableFramesInPacket;
-			pext.mFrameOffset = numFramesInPacket + (packetTable->size() ? packetTable->back().mFrameOffset : 0);
 			
 			packetTable->push_back(pext); 
 			if (inPacket.mDataByteSize > mMaximumPacketSize) 
@@ -0,0 +1,279 @@
+/*
+	AudioFileReadQueue.cpp
+*/
+#include "AudioFileReadQueue.h"
+#include "CAPThread.h"
+#include <algorithm>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+AudioFileReadQueue::AudioFileReadQueue(UInt32 inNumberThreads, UInt32 inMaxReadBytes)
+	: mGuard("AudioFileReadQueue"), mOutstanding(0), mRunningThreads(0), mQuitting(false),
+	  mMaxReadBytes(std::max(inMaxReadBytes, (UInt32)kMaxGapBytes)), mCompletionProc(NULL), mCompletionRefCon(NULL)
+{
+	memset(&mStatistics, 0, sizeof(mStatistics));
+
+	CAGuard::Locker locker(mGuard);
+	inNumberThreads = std::max(inNumberThreads, (UInt32)1);
+	for (UInt32 i = 0; i < inNumberThreads; ++i) {
+		CAPThread* thread = new CAPThread(WorkerEntry, this, CAPThread::kDefaultThreadPriority, false, true, "AudioFileReadQueue");
+		try {
+			thread->Start();
+			++mRunningThreads;
+		} catch (...) {
+			delete thread;
+		}
+	}
+}
+
+AudioFileReadQueue::~AudioFileReadQueue()
+{
+	CAGuard::Locker locker(mGuard);
+	while (mOutstanding) locker.Wait();
+	mQuitting = true;
+	locker.NotifyAll();
+	while (mRunningThreads) locker.Wait();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+void AudioFileReadQueue::Submit(Request* const* inRequests, UInt32 inNumberRequests)
+{
+	CAGuard::Locker locker(mGuard);
+	for (UInt32 i = 0; i < inNumberRequests; ++i) {
+		inRequests[i]->mStatus = noErr;
+		inRequests[i]->mNext = NULL;
+		mPending.push_back(inRequests[i]);
+	}
+	mOutstanding += inNumberRequests;
+	mStatistics.mRequests += inNumberRequests;
+
+	if (!mRunningThreads) {
+		// no threads could be started; read on the caller's thread instead
+		std::vector<Request*> batch;
+		CAAutoFree<UInt8> scratch;
+		while (TakeBatch(batch)) {
+			{
+				CAMutex::Unlocker unlocker(mGuard);
+				ReadBatch(batch, scratch);
+			}
+			mBusyFiles.clear();
+			mOutstanding -= (UInt32)batch.size();
+		}
+	}
+	locker.NotifyAll();
+}
+
+void AudioFileReadQueue::Wait()
+{
+	CAGuard::Locker locker(mGuard);
+	while (mOutstanding) locker.Wait();
+}
+
+void AudioFileReadQueue::GetStatistics(Statistics& outStatistics)
+{
+	CAGuard::Locker locker(mGuard);
+	outStatistics = mStatistics;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+void* AudioFileReadQueue::WorkerEntry(void* inQueue)
+{
+	static_cast<AudioFileReadQueue*>(inQueue)->Worker();
+	return NULL;
+}
+
+void AudioFileReadQueue::Worker()
+{
+	std::vector<Request*> batch;
+	CAAutoFree<UInt8> scratch;
+
+	CAGuard::Locker locker(mGuard);
+	for (;;) {
+		if (TakeBatch(batch)) {
+			AudioFileObject* file = batch[0]->mFile;
+			{
+				CAMutex::Unlocker unlocker(mGuard);
+				ReadBatch(batch, scratch);
+			}
+			mBusyFiles.erase(std::find(mBusyFiles.begin(), mBusyFiles.end(), file));
+			mOutstanding -= (UInt32)batch.size();
+			// wakes Wait, and any worker waiting for this file
+			locker.NotifyAll();
+			continue;
+		}
+		if (mQuitting) break;
+		locker.Wait();
+	}
+
+	--mRunningThreads;
+	locker.NotifyAll();
+}
+
+bool AudioFileReadQueue::TakeBatch(std::vector<Request*>& outBatch)
+{
+	// the oldest request for a file no other worker is reading, and the rest of that file's requests
+	outBatch.clear();
+	std::deque<Request*>::iterator it = mPending.begin();
+	while (it != mPending.end() && std::find(mBusyFiles.begin(), mBusyFiles.end(), (*it)->mFile) != mBusyFiles.end())
+		++it;
+	if (it == mPending.end()) return false;
+
+	// one pass, keeping the order of the requests left behind
+	AudioFileObject* file = (*it)->mFile;
+	std::deque<Request*>::iterator keep = it;
+	for ( ; it != mPending.end(); ++it) {
+		if ((*it)->mFile == file && outBatch.size() < kMaxBatchRequests) outBatch.push_back(*it);
+		else *keep++ = *it;
+	}
+	mPending.erase(keep, mPending.end());
+	mBusyFiles.push_back(file);
+	return true;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+void AudioFileReadQueue::ReadBatch(std::vector<Request*>& ioBatch, CAAutoFree<UInt8>& ioScratch)
+{
+	AudioFileObject* file = ioBatch[0]->mFile;
+	Statistics statistics;
+	memset(&statistics, 0, sizeof(statistics));
+
+	std::vector<Plan> plans;
+	plans.reserve(ioBatch.size());
+	for (size_t i = 0; i < ioBatch.size(); ++i) {
+		Plan plan;
+		if (PlanRequest(ioBatch[i], plan, statistics)) plans.push_back(plan);
+	}
+	std::stable_sort(plans.begin(), plans.end());
+
+	size_t first = 0;
+	while (first < plans.size()) {
+		// take the following requests while they're close enough and the read stays small enough
+		SInt64 start = plans[first].mStartingByte;
+		SInt64 end = start + plans[first].mNumBytes;
+		size_t last = first + 1;
+		while (last < plans.size() && plans[last].mStartingByte <= end + kMaxGapBytes) {
+			SInt64 newEnd = std::max(end, plans[last].mStartingByte + plans[last].mNumBytes);
+			if (newEnd - start > mMaxReadBytes) break;
+			end = newEnd;
+			++last;
+		}
+
+		UInt32 numBytes = (UInt32)(end - start);
+		OSStatus err;
+		if (last == first + 1) {
+			// nothing to merge with, so read straight into the request's buffer
+			err = file->ReadBytes(false, start, &numBytes, plans[first].mRequest->mBuffer);
+			FinishPlan(plans[first], NULL, err && err != kAudioFileEndOfFileError ? 0 : numBytes);
+			if (err && err != kAudioFileEndOfFileError) plans[first].mRequest->mStatus = err;
+		} else {
+			if (!ioScratch()) ioScratch.allocBytes(mMaxReadBytes);
+			err = file->ReadBytes(false, start, &numBytes, ioScratch());
+			for (size_t i = first; i < last; ++i) {
+				UInt32 offset = (UInt32)(plans[i].mStartingByte - start);
+				UInt32 available = (err && err != kAudioFileEndOfFileError) || offset > numBytes ? 0 : numBytes - offset;
+				FinishPlan(plans[i], ioScratch() + offset, available);
+				if (err && err != kAudioFileEndOfFileError) plans[i].mRequest->mStatus = err;
+			}
+		}
+		++statistics.mReads;
+		statistics.mBytesRead += numBytes;
+		first = last;
+	}
+
+	for (size_t i = 0; i < ioBatch.size(); ++i)
+		Complete(ioBatch[i]);
+
+	CAGuard::Locker locker(mGuard);
+	mStatistics.mReads += statistics.mReads;
+	mStatistics.mBytesRead += statistics.mBytesRead;
+	mStatistics.mUnmergedRequests += statistics.mUnmergedRequests;
+}
+
+bool AudioFileReadQueue::PlanRequest(Request* inRequest, Plan& outPlan, Statistics& ioStatistics)
+{
+	AudioFileObject* file = inRequest->mFile;
+	const AudioStreamBasicDescription& format = file->GetDataFormat();
+	outPlan.mRequest = inRequest;
+
+	if (!inRequest->mBuffer || inRequest->mNumPackets < 1 || inRequest->mNumBytes < 1
+			|| (!format.mBytesPerPacket && !inRequest->mPacketDescriptions)) {
+		inRequest->mStatus = kAudio_ParamError;
+		inRequest->mNumPackets = 0;
+		inRequest->mNumBytes = 0;
+		return false;
+	}
+
+	if (format.mBytesPerPacket) {
+		outPlan.mNumPackets = std::min(inRequest->mNumPackets, inRequest->mNumBytes / format.mBytesPerPacket);
+		outPlan.mNumBytes = outPlan.mNumPackets * format.mBytesPerPacket;
+		outPlan.mStartingByte = inRequest->mStartingPacket * format.mBytesPerPacket;
+		if (outPlan.mNumPackets == 0) {
+			inRequest->mNumPackets = 0;
+			inRequest->mNumBytes = 0;
+			return false;
+		}
+		return true;
+	}
+
+	OSStatus err = file->ScanForPackets(inRequest->mStartingPacket + inRequest->mNumPackets);
+	CompressedPacketTable* packetTable = file->GetPacketTable();
+	if ((err && err != kAudioFileEndOfFileError) || !packetTable || inRequest->mStartingPacket < 0
+			|| inRequest->mStartingPacket + inRequest->mNumPackets > packetTable->size()) {
+		// past the packets scanned so far, where ReadPacketDataVBR reads and scans in one go
+		inRequest->mStatus = file->ReadPacketData(false, &inRequest->mNumBytes, inRequest->mPacketDescriptions,
+									inRequest->mStartingPacket, &inRequest->mNumPackets, inRequest->mBuffer);
+		++ioStatistics.mUnmergedRequests;
+		return false;
+	}
+
+	outPlan.mNumBytes = inRequest->mNumBytes;
+	outPlan.mNumPackets = inRequest->mNumPackets;
+	err = file->HowManyPacketsCanBeReadIntoBuffer(&outPlan.mNumBytes, inRequest->mStartingPacket, &outPlan.mNumPackets);
+	if (err) {
+		inRequest->mStatus = err;
+		inRequest->mNumPackets = 0;
+		inRequest->mNumBytes = 0;
+		return false;
+	}
+	outPlan.mStartingByte = packetTable->ByteForPacket(inRequest->mStartingPacket);
+	return true;
+}
+
+void AudioFileReadQueue::FinishPlan(const Plan& inPlan, const UInt8* inBytes, UInt32 inBytesAvailable)
+{
+	// inBytes is NULL when the data was read into the request's buffer
+	Request* request = inPlan.mRequest;
+	UInt32 numBytes = std::min(inBytesAvailable, inPlan.mNumBytes);
+	UInt32 numPackets = inPlan.mNumPackets;
+	const AudioStreamBasicDescription& format = request->mFile->GetDataFormat();
+
+	if (format.mBytesPerPacket) {
+		numPackets = numBytes / format.mBytesPerPacket;
+		numBytes = numPackets * format.mBytesPerPacket;
+	} else {
+		request->mFile->GetPacketTable()->GetPacketDescriptions(request->mStartingPacket, numPackets,
+																request->mPacketDescriptions, inPlan.mStartingByte);
+		if (numBytes < inPlan.mNumBytes) {
+			// only the packets that were read in full
+			UInt32 i = 0;
+			while (i < numPackets && request->mPacketDescriptions[i].mStartOffset + request->mPacketDescriptions[i].mDataByteSize <= numBytes)
+				++i;
+			numPackets = i;
+			numBytes = i ? (UInt32)(request->mPacketDescriptions[i-1].mStartOffset + request->mPacketDescriptions[i-1].mDataByteSize) : 0;
+		}
+	}
+
+	if (inBytes && numBytes) memcpy(request->mBuffer, inBytes, numBytes);
+	request->mNumBytes = numBytes;
+	request->mNumPackets = numPackets;
+	request->mStatus = numBytes < inPlan.mNumBytes ? kAudioFileEndOfFileError : noErr;
+}
+
+void AudioFileReadQueue::Complete(Request* inRequest)
+{
+	if (mCompletionProc) mCompletionProc(inRequest, mCompletionRefCon);
+	else mCompleted.push_atomic(inRequest);
+}
@@ -0,0 +1,110 @@
+/*
+	AudioFileReadQueue.h
+
+	Reads packets from many AudioFileObjects on a small pool of worker threads, so a player streaming lots of files
+	doesn't need a thread per file and doesn't make a system call per packet range.
+
+	Requests have ReadPacketData's semantics. A worker takes every pending request for one file at a time, works
+	out the bytes each one needs, and merges requests whose bytes are adjacent (or less than kMaxGapBytes apart)
+	into reads of up to the queue's maximum read size, which it copies out of. Only one worker reads a given file
+	at a time, and nothing else may use a file while it has requests in the queue. VBR requests that go past the
+	packets the file has scanned are read on their own with ReadPacketData.
+
+	A finished request goes to the completion proc, on the worker's thread, or if there isn't one onto a lock free
+	stack that PopCompleted empties; neither blocks the other workers.
+*/
+#ifndef __AudioFileReadQueue_h__
+#define __AudioFileReadQueue_h__
+
+#include "AudioFileObject.h"
+#include "CAAtomicStack.h"
+#include "CAGuard.h"
+#include <deque>
+
+class AudioFileReadQueue
+{
+public:
+	enum {
+		kMaxGapBytes = 16 * 1024,		// read through gaps up to this size rather than issuing two reads
+		kMaxBatchRequests = 256			// per file, per pass of a worker
+	};
+
+	struct Request {
+		// in
+		AudioFileObject*				mFile;
+		SInt64							mStartingPacket;
+		void*							mBuffer;
+		AudioStreamPacketDescription*	mPacketDescriptions;	// required for VBR files
+		void*							mUserData;
+		// in: what's wanted and the buffer's size; out: what was read
+		UInt32							mNumPackets;
+		UInt32							mNumBytes;
+		// out
+		OSStatus						mStatus;
+
+		Request*&						next() { return mNext; }
+		Request*						mNext;
+	};
+
+	typedef void (*CompletionProc)(Request* inRequest, void* inRefCon);
+
+	struct Statistics {
+		UInt64	mRequests;
+		UInt64	mReads;					// merged reads issued
+		UInt64	mBytesRead;				// including gaps read through
+		UInt64	mUnmergedRequests;		// VBR requests past the scanned packets
+	};
+
+	AudioFileReadQueue(UInt32 inNumberThreads = 2, UInt32 inMaxReadBytes = 1024 * 1024);
+	~AudioFileReadQueue();				// waits for the requests already submitted
+
+	// Set before submitting anything.
+	void			SetCompletionProc(CompletionProc inProc, void* inRefCon) { mCompletionProc = inProc; mCompletionRefCon = inRefCon; }
+
+	// The requests must stay put until they complete.
+	void			Submit(Request* inRequest) { Submit(&inRequest, 1); }
+	void			Submit(Request* const* inRequests, UInt32 inNumberRequests);
+
+	// Requests that have completed since the last call, oldest first, linked through mNext. Lock free.
+	Request*		PopCompleted() { return mCompleted.pop_all_reversed(); }
+
+	// Blocks until every submitted request has completed.
+	void			Wait();
+
+	void			GetStatistics(Statistics& outStatistics);
+
+private:
+	struct Plan {
+		Request*	mRequest;
+		SInt64		mStartingByte;
+		UInt32		mNumBytes;
+		UInt32		mNumPackets;
+		bool operator<(const Plan& other) const { return mStartingByte < other.mStartingByte; }
+	};
+
+	AudioFileReadQueue(const AudioFileReadQueue&);
+	AudioFileReadQueue& operator=(const AudioFileReadQueue&);
+
+	static void*	WorkerEntry(void* inQueue);
+	void			Worker();
+	bool			TakeBatch(std::vector<Request*>& outBatch);		// expects mGuard to be held
+	void			ReadBatch(std::vector<Request*>& ioBatch, CAAutoFree<UInt8>& ioScratch);
+	bool			PlanRequest(Request* inRequest, Plan& outPlan, Statistics& ioStatistics);
+	void			FinishPlan(const Plan& inPlan, const UInt8* inBytes, UInt32 inBytesAvailable);
+	void			Complete(Request* inRequest);
+
+	CAGuard							mGuard;
+	std::deque<Request*>			mPending;
+	std::vector<AudioFileObject*>	mBusyFiles;
+	UInt32							mOutstanding;
+	UInt32							mRunningThreads;
+	bool							mQuitting;
+	UInt32							mMaxReadBytes;
+	Statistics						mStatistics;
+
+	CompletionProc					mCompletionProc;
+	void*							mCompletionRefCon;
+	TAtomicStack<Request>			mCompleted;
+};
+
+#endif // __AudioFileReadQueue_h__
@@ -0,0 +1,231 @@
+/*
+	AudioFileRecorder.cpp
+*/
+#include "AudioFileRecorder.h"
+#include "CABitOperations.h"
+#include "CAHostTimeBase.h"
+#include "CAPThread.h"
+#include <algorithm>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+AudioFileRecorder::AudioFileRecorder(	AudioFileObject*	inFile,
+										UInt32				inRingBytes,
+										UInt32				inChunkBytes,
+										UInt32				inExtentBytes,
+										UInt32				inHeaderIntervalMS)
+	: mFile(inFile), mBytesPerPacket(inFile->GetDataFormat().mBytesPerPacket),
+	  mChunkBytes(NextPowerOfTwo(std::max(inChunkBytes, (UInt32)4096))),
+	  mNextByte(0), mPreallocatedTo(0), mExtentBytes(inExtentBytes),
+	  mHeaderIntervalNanos((UInt64)inHeaderIntervalMS * 1000000ULL), mLastHeaderUpdate(0), mSavedDeferSizeUpdates(1),
+	  mGuard("AudioFileRecorder"), mWriterRunning(false), mQuitting(false)
+{
+	mRingBytes = NextPowerOfTwo(std::max(inRingBytes, 2 * mChunkBytes));
+	mRing.allocBytes(mRingBytes);
+	// touch the ring now rather than page faulting on the render thread
+	memset(mRing(), 0, mRingBytes);
+
+	mWritePosition.StoreRelaxed(0);
+	mReadPosition.StoreRelaxed(0);
+	mMaxRingBytes.StoreRelaxed(0);
+	mPacketsDropped.StoreRelaxed(0);
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+AudioFileRecorder::~AudioFileRecorder()
+{
+	Stop();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+OSStatus AudioFileRecorder::Start()
+{
+	CAGuard::Locker locker(mGuard);
+	if (mWriterRunning) return noErr;
+
+	if (!mFile->CanWrite()) return kAudioFilePermissionsError;
+	mBytesPerPacket = mFile->GetDataFormat().mBytesPerPacket;
+	if (!mBytesPerPacket) return kAudioFileUnsupportedDataFormatError;
+	if (!mFile->IsOptimized()) return kAudioFileNotOptimizedError;
+
+	// start the ring at the same offset within a chunk as the file, so a chunk never wraps around the ring
+	mNextByte = mFile->GetNumPackets() * mBytesPerPacket;
+	UInt32 position = (UInt32)((mFile->GetDataOffset() + mNextByte) & (mChunkBytes - 1));
+	mReadPosition.StoreRelaxed(position);
+	mWritePosition.StoreRelease(position);
+	mMaxRingBytes.StoreRelaxed(0);
+	mPacketsDropped.StoreRelaxed(0);
+	memset(&mStatistics, 0, sizeof(mStatistics));
+
+	mPreallocatedTo = 0;
+	mSavedDeferSizeUpdates = mFile->DeferSizeUpdates();
+	mFile->SetDeferSizeUpdates(1);
+	mLastHeaderUpdate = CAHostTimeBase::GetCurrentTimeInNanos();
+
+	mQuitting = false;
+	CAPThread* thread = new CAPThread(WriterEntry, this, CAPThread::kDefaultThreadPriority, false, true, "AudioFileRecorder");
+	try {
+		thread->Start();
+	} catch (...) {
+		delete thread;
+		mFile->SetDeferSizeUpdates(mSavedDeferSizeUpdates);
+		return kAudioFileUnspecifiedError;
+	}
+	mWriterRunning = true;
+	return noErr;
+}
+
+OSStatus AudioFileRecorder::Stop()
+{
+	CAGuard::Locker locker(mGuard);
+	if (!mWriterRunning) return mStatistics.mError;
+
+	// the writer writes what's left before it goes
+	mQuitting = true;
+	locker.NotifyAll();
+	while (mWriterRunning) locker.Wait();
+
+	OSStatus err = mFile->UpdateSizeIfNeeded();
+	mFile->SetDeferSizeUpdates(mSavedDeferSizeUpdates);
+
+	if (mPreallocatedTo > 0) {
+		// truncating to the current size frees the blocks preallocated past it
+		SInt64 size;
+		if (mFile->GetDataSource()->GetSize(size) == noErr)
+			mFile->GetDataSource()->SetSize(size);
+	}
+
+	mStatistics.mMaxRingBytes = mMaxRingBytes.LoadRelaxed();
+	mStatistics.mPacketsDropped = mPacketsDropped.LoadRelaxed();
+	return mStatistics.mError ? mStatistics.mError : err;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+UInt32 AudioFileRecorder::Push(const void* inPackets, UInt32 inNumPackets)
+{
+	if (!mBytesPerPacket) return 0;
+	UInt32 writePosition = mWritePosition.LoadRelaxed();
+	UInt32 used = writePosition - mReadPosition.LoadAcquire();
+	UInt32 numPackets = std::min(inNumPackets, (mRingBytes - used) / mBytesPerPacket);
+	UInt32 numBytes = numPackets * mBytesPerPacket;
+
+	UInt32 offset = writePosition & (mRingBytes - 1);
+	UInt32 firstPart = std::min(numBytes, mRingBytes - offset);
+	memcpy(mRing() + offset, inPackets, firstPart);
+	memcpy(mRing(), static_cast<const Byte*>(inPackets) + firstPart, numBytes - firstPart);
+	mWritePosition.StoreRelease(writePosition + numBytes);
+
+	if (used + numBytes > mMaxRingBytes.LoadRelaxed())
+		mMaxRingBytes.StoreRelaxed(used + numBytes);
+	if (numPackets < inNumPackets)
+		mPacketsDropped.StoreRelaxed(mPacketsDropped.LoadRelaxed() + inNumPackets - numPackets);
+	return numPackets;
+}
+
+void AudioFileRecorder::GetStatistics(Statistics& outStatistics)
+{
+	CAGuard::Locker locker(mGuard);
+	outStatistics = mStatistics;
+	outStatistics.mMaxRingBytes = mMaxRingBytes.LoadRelaxed();
+	outStatistics.mPacketsDropped = mPacketsDropped.LoadRelaxed();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+void* AudioFileRecorder::WriterEntry(void* inRecorder)
+{
+	static_cast<AudioFileRecorder*>(inRecorder)->Writer();
+	return NULL;
+}
+
+void AudioFileRecorder::Writer()
+{
+	CAGuard::Locker locker(mGuard);
+	while (!mQuitting) {
+		{
+			CAMutex::Unlocker unlocker(mGuard);
+			WriteRing(false);
+		}
+		if (!mQuitting) locker.WaitFor(kWriterIntervalMS * 1000000ULL);
+	}
+	{
+		CAMutex::Unlocker unlocker(mGuard);
+		WriteRing(true);
+	}
+	mWriterRunning = false;
+	locker.NotifyAll();
+}
+
+void AudioFileRecorder::WriteRing(bool inFlush)
+{
+	OSStatus err = noErr;
+	for (;;) {
+		UInt32 readPosition = mReadPosition.LoadRelaxed();
+		UInt32 available = mWritePosition.LoadAcquire() - readPosition;
+		if (mStatistics.mError) {
+			// the file's unusable; keep the ring empty so Push doesn't count everything as dropped
+			mReadPosition.StoreRelease(readPosition + available);
+			return;
+		}
+
+		// up to the next chunk boundary in the file, or, flushing, whatever is left
+		UInt32 numBytes = mChunkBytes - (UInt32)((mFile->GetDataOffset() + mNextByte) & (mChunkBytes - 1));
+		if (available < numBytes) {
+			if (!inFlush || !available) break;
+			numBytes = available;
+		}
+		err = WriteChunk(numBytes);
+		if (err) break;
+	}
+
+	UInt64 now = CAHostTimeBase::GetCurrentTimeInNanos();
+	if (!err && mFile->GetNeedsSizeUpdate() && (inFlush || now - mLastHeaderUpdate >= mHeaderIntervalNanos)) {
+		err = mFile->UpdateSizeIfNeeded();
+		UInt64 nanos = CAHostTimeBase::GetCurrentTimeInNanos() - now;
+		mLastHeaderUpdate = now;
+
+		CAGuard::Locker locker(mGuard);
+		++mStatistics.mHeaderUpdates;
+		mStatistics.mMaxWriteNanos = std::max(mStatistics.mMaxWriteNanos, nanos);
+	}
+
+	if (err) {
+		CAGuard::Locker locker(mGuard);
+		if (!mStatistics.mError) mStatistics.mError = err;
+	}
+}
+
+OSStatus AudioFileRecorder::WriteChunk(UInt32 inNumBytes)
+{
+	SInt64 end = mFile->GetDataOffset() + mNextByte + inNumBytes;
+	bool preallocated = false;
+	if (mPreallocatedTo >= 0 && end > mPreallocatedTo) {
+		// it's only an optimization, so on any error stop trying and let the writes allocate
+		SInt64 target = end + mExtentBytes;
+		if (mFile->GetDataSource()->Preallocate(target) == noErr) {
+			mPreallocatedTo = target;
+			preallocated = true;
+		} else {
+			mPreallocatedTo = -1;
+		}
+	}
+
+	UInt32 readPosition = mReadPosition.LoadRelaxed();
+	UInt32 numBytes = inNumBytes;
+	UInt64 start = CAHostTimeBase::GetCurrentTimeInNanos();
+	OSStatus err = mFile->WriteBytes(false, mNextByte, &numBytes, mRing() + (readPosition & (mRingBytes - 1)));
+	UInt64 nanos = CAHostTimeBase::GetCurrentTimeInNanos() - start;
+	if (!err && numBytes < inNumBytes) err = kAudioFileUnspecifiedError;
+
+	mNextByte += numBytes;
+	mReadPosition.StoreRelease(readPosition + numBytes);
+
+	CAGuard::Locker locker(mGuard);
+	mStatistics.mBytesWritten += numBytes;
+	++mStatistics.mWrites;
+	if (preallocated) ++mStatistics.mPreallocations;
+	mStatistics.mMaxWriteNanos = std::max(mStatistics.mMaxWriteNanos, nanos);
+	return err;
+}
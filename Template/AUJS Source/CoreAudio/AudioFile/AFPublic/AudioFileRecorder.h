@@ -0,0 +1,100 @@
+/*
+	AudioFileRecorder.h
+
+	Appends CBR packets to an AudioFileObject from the render thread without the render thread ever touching the
+	file. Push copies packets into a lock free ring and returns; it never blocks, allocates or makes a system call,
+	and when the ring is full it drops the packets that don't fit and counts them.
+
+	A writer thread wakes every kWriterIntervalMS, and writes what's in the ring in chunks that start and end on
+	multiples of the chunk size in the file, bypassing the cache, so a long recording doesn't push everything else
+	out of memory. Ahead of the writes it preallocates the file's disk space an extent at a time, without changing
+	the file's size, so the file system isn't allocating on every write. The file's size updates are deferred
+	while recording, and the writer patches the header every inHeaderIntervalMS, so a crash loses at most that much
+	of the recording. Stop writes whatever is left, patches the header for good and gives back the unused extent.
+
+	Nothing else may use the file between Start and Stop.
+*/
+#ifndef __AudioFileRecorder_h__
+#define __AudioFileRecorder_h__
+
+#include "AudioFileObject.h"
+#include "CARingBuffer.h"
+#include "CAGuard.h"
+
+class AudioFileRecorder
+{
+public:
+	enum {
+		kDefaultRingBytes = 8 * 1024 * 1024,
+		kDefaultChunkBytes = 256 * 1024,
+		kDefaultExtentBytes = 64 * 1024 * 1024,
+		kDefaultHeaderIntervalMS = 1000,
+		kWriterIntervalMS = 5
+	};
+
+	struct Statistics {
+		UInt64		mBytesWritten;
+		UInt64		mWrites;
+		UInt64		mHeaderUpdates;
+		UInt64		mPreallocations;
+		UInt64		mMaxWriteNanos;			// longest single write, header updates included
+		UInt32		mMaxRingBytes;			// the fullest the ring has been when Push was called
+		UInt32		mPacketsDropped;
+		OSStatus	mError;					// the first error writing, after which the writer stops writing
+	};
+
+	// The ring and chunk sizes are rounded up to powers of 2, and the ring to at least two chunks.
+	AudioFileRecorder(	AudioFileObject*	inFile,
+						UInt32				inRingBytes = kDefaultRingBytes,
+						UInt32				inChunkBytes = kDefaultChunkBytes,
+						UInt32				inExtentBytes = kDefaultExtentBytes,
+						UInt32				inHeaderIntervalMS = kDefaultHeaderIntervalMS);
+	~AudioFileRecorder();					// stops
+
+	// Not real time safe. Recording appends to the packets already in the file.
+	OSStatus		Start();
+	OSStatus		Stop();					// returns mError, if there was one
+	bool			IsRecording() const { return mWriterRunning; }
+
+	// Real time safe; one thread at a time. Packets are in the file's data format. Returns the number of packets
+	// accepted; the rest are dropped.
+	UInt32			Push(const void* inPackets, UInt32 inNumPackets);
+
+	void			GetStatistics(Statistics& outStatistics);
+
+private:
+	AudioFileRecorder(const AudioFileRecorder&);
+	AudioFileRecorder& operator=(const AudioFileRecorder&);
+
+	static void*	WriterEntry(void* inRecorder);
+	void			Writer();
+	void			WriteRing(bool inFlush);
+	OSStatus		WriteChunk(UInt32 inNumBytes);
+
+	AudioFileObject*				mFile;
+	UInt32							mBytesPerPacket;
+
+	// the ring; positions are byte counts that wrap, and mReadPosition is only moved by the writer
+	CAAutoFree<Byte>				mRing;
+	UInt32							mRingBytes;
+	UInt32							mChunkBytes;
+	CARingBufferAtomic<UInt32>		mWritePosition;
+	CARingBufferAtomic<UInt32>		mReadPosition;
+	CARingBufferAtomic<UInt32>		mMaxRingBytes;
+	CARingBufferAtomic<UInt32>		mPacketsDropped;
+
+	// the writer's
+	SInt64							mNextByte;				// in the audio data
+	SInt64							mPreallocatedTo;		// in the file; -1 if the data source can't
+	UInt32							mExtentBytes;
+	UInt64							mHeaderIntervalNanos;
+	UInt64							mLastHeaderUpdate;
+	UInt32							mSavedDeferSizeUpdates;
+
+	CAGuard							mGuard;
+	bool							mWriterRunning;
+	bool							mQuitting;
+	Statistics						mStatistics;
+};
+
+#endif // __AudioFileRecorder_h__
@@ -40,6 +40,7 @@
 */
 #include "CompressedPacketTable.h"
 #include "CAAutoDisposer.h"
+#include <algorithm>
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
@@ -64,7 +65,8 @@ void CompressedPacketTable::push_back(const AudioStreamPacketDescriptionExtended
 	if (packetIndex == 0) {
 		// first packet in a new sequence. create a new PacketBase.
 		PacketBase newBase;
-		newBase.mBaseOffset = 0;
+		newBase.mBaseOffset = inDesc.mStartOffset;
+		newBase.mBaseFrame = mTotalFrames;
 		newBase.mDescs = CA_malloc((kMask+1) * sizeof(AudioStreamPacketDescriptionExtended));
 		newBase.mDescType = kExtendedPacketDescription;
 		mBases.push_back(newBase);
@@ -73,6 +75,8 @@ void CompressedPacketTable::push_back(const AudioStreamPacketDescriptionExtended
 	PacketBase& base = mBases[(size_t)baseIndex];
 	AudioStreamPacketDescriptionExtended* descs = (AudioStreamPacketDescriptionExtended*)base.mDescs;
 	descs[packetIndex] = inDesc;
+	descs[packetIndex].mFrameOffset = mTotalFrames;
+	mTotalFrames += mFramesPerPacket ? mFramesPerPacket : inDesc.mVariableFramesInPacket;
 	
 	if (packetIndex == kMask) {
 		// last packet in a sequence. compress the sequence.
@@ -122,7 +126,7 @@ const AudioStreamPacketDescriptionExtended CompressedPacketTable::operator[](SIn
 	outDesc.mStartOffset = base.mBaseOffset + packetOffset;
 	outDesc.mDataByteSize = packetSize;
 	outDesc.mVariableFramesInPacket = 0;
-	outDesc.mFrameOffset = mFramesPerPacket * inPacketIndex;
+	outDesc.mFrameOffset = base.mBaseFrame + mFramesPerPacket * packetIndex;
 
 	//printf("get %d %10qd   %10qd %2d   %10qd %6d %10qd\n", base.mDescType, inPacketIndex, baseIndex, packetIndex, outDesc.mStartOffset, outDesc.mDataByteSize, outDesc.mFrameOffset);
 	
@@ -131,6 +135,119 @@ const AudioStreamPacketDescriptionExtended CompressedPacketTable::operator[](SIn
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
+SInt64 CompressedPacketTable::PacketForByte(SInt64 inByteOffset) const
+{
+	// the last base starting at or before the offset
+	size_t lo = 0, hi = mBases.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) >> 1;
+		if (mBases[mid].mBaseOffset <= inByteOffset) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == 0) return -1;
+	
+	// then the last packet in it starting at or before the offset; the base's first packet does
+	SInt64 first = (SInt64)(lo - 1) << kShift;
+	SInt64 low = first, high = std::min(first + kMask + 1, (SInt64)mSize) - 1;
+	while (low < high) {
+		SInt64 mid = (low + high + 1) >> 1;
+		if ((*this)[mid].mStartOffset <= inByteOffset) low = mid;
+		else high = mid - 1;
+	}
+	return low;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+SInt64 CompressedPacketTable::PacketForFrame(SInt64 inFrame) const
+{
+	// the bases' first frames are checkpoints of the running total
+	size_t lo = 0, hi = mBases.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) >> 1;
+		if (mBases[mid].mBaseFrame <= inFrame) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == 0) return -1;
+	
+	const PacketBase& base = mBases[lo - 1];
+	SInt64 first = (SInt64)(lo - 1) << kShift;
+	SInt64 last = std::min(first + kMask + 1, (SInt64)mSize) - 1;
+	if (base.mDescType != kExtendedPacketDescription) {
+		// every packet in a compressed base has mFramesPerPacket frames
+		if (!mFramesPerPacket) return last;
+		return std::min(first + (inFrame - base.mBaseFrame) / mFramesPerPacket, last);
+	}
+	
+	AudioStreamPacketDescriptionExtended* descs = (AudioStreamPacketDescriptionExtended*)base.mDescs;
+	UInt32 low = 0, high = (UInt32)(last - first);
+	while (low < high) {
+		UInt32 mid = (low + high + 1) >> 1;
+		if (descs[mid].mFrameOffset <= inFrame) low = mid;
+		else high = mid - 1;
+	}
+	return first + low;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#define DECODE_TYPE(TYPE) \
+		case k##TYPE##ContiguousPacketDescription : { \
+			TYPE##ContiguousPacketDescription* descs = (TYPE##ContiguousPacketDescription*)base.mDescs; \
+			SInt64 packetOffset = packetIndex ? (SInt64)descs[packetIndex-1].mNextOffset : 0; \
+			for (UInt32 i = 0; i < count; ++i) { \
+				SInt64 nextOffset = (SInt64)descs[packetIndex+i].mNextOffset; \
+				outDescs[i].mStartOffset = baseOffset + packetOffset; \
+				outDescs[i].mVariableFramesInPacket = 0; \
+				outDescs[i].mDataByteSize = (UInt32)(nextOffset - packetOffset); \
+				packetOffset = nextOffset; \
+			} \
+		} break; \
+		case k##TYPE##DiscontiguousPacketDescription : { \
+			TYPE##DiscontiguousPacketDescription* descs = (TYPE##DiscontiguousPacketDescription*)base.mDescs; \
+			SInt64 packetOffset = packetIndex ? (SInt64)descs[packetIndex-1].mNextOffset : 0; \
+			for (UInt32 i = 0; i < count; ++i) { \
+				outDescs[i].mStartOffset = baseOffset + packetOffset; \
+				outDescs[i].mVariableFramesInPacket = 0; \
+				outDescs[i].mDataByteSize = descs[packetIndex+i].mDataByteSize; \
+				packetOffset = (SInt64)descs[packetIndex+i].mNextOffset; \
+			} \
+		} break;
+
+UInt32 CompressedPacketTable::GetPacketDescriptions(SInt64 inStartPacket, UInt32 inNumPackets, AudioStreamPacketDescription* outDescs, SInt64 inOrigin) const
+{
+	if (inStartPacket < 0 || inStartPacket >= (SInt64)mSize) return 0;
+	if ((UInt64)inStartPacket + inNumPackets > mSize) inNumPackets = (UInt32)(mSize - inStartPacket);
+	
+	UInt32 numDecoded = 0;
+	while (numDecoded < inNumPackets) {
+		SInt64 packet = inStartPacket + numDecoded;
+		const PacketBase& base = mBases[(size_t)(packet >> kShift)];
+		UInt32 packetIndex = (UInt32)(packet & kMask);
+		UInt32 count = std::min(inNumPackets - numDecoded, kMask + 1 - packetIndex);
+		SInt64 baseOffset = base.mBaseOffset - inOrigin;
+		
+		switch (base.mDescType) 
+		{
+			DECODE_TYPE(Tiny)
+			DECODE_TYPE(Small)
+			DECODE_TYPE(Big)
+			case kExtendedPacketDescription : {
+				AudioStreamPacketDescriptionExtended* descs = (AudioStreamPacketDescriptionExtended*)base.mDescs + packetIndex;
+				for (UInt32 i = 0; i < count; ++i) {
+					outDescs[i] = descs[i];
+					outDescs[i].mStartOffset -= inOrigin;
+				}
+			} break;
+		}
+		outDescs += count;
+		numDecoded += count;
+	}
+	return numDecoded;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
 bool CompressedPacketTable::isContiguous(PacketBase& base)
 {	
 	AudioStreamPacketDescriptionExtended* descs = (AudioStreamPacketDescriptionExtended*)base.mDescs;
@@ -50,7 +50,7 @@
 
 struct  AudioStreamPacketDescriptionExtended : AudioStreamPacketDescription
 {
-    SInt64  mFrameOffset; // this is the sum of the mVariableFramesInPacket up to this point so we can binary search.
+    SInt64  mFrameOffset; // the packet's first frame: the sum of the frames in the packets before it, so we can binary search.
 };
 typedef struct AudioStreamPacketDescriptionExtended AudioStreamPacketDescriptionExtended;
 
@@ -64,26 +64,39 @@ inline bool operator < (const AudioStreamPacketDescriptionExtended& a, const Aud
 class CompressedPacketTable
 {
 public:
-	CompressedPacketTable(UInt32 inFramesPerPacket) : mSize(0), mFramesPerPacket(inFramesPerPacket) {}
+	CompressedPacketTable(UInt32 inFramesPerPacket) : mSize(0), mFramesPerPacket(inFramesPerPacket), mTotalFrames(0) {}
 	~CompressedPacketTable();
 	
 	SInt64 size() const { return mSize; }
+	// inDesc's mFrameOffset is ignored; the table keeps a running total of the frames, mFramesPerPacket per packet 
+	// or mVariableFramesInPacket if that's 0.
 	void push_back(const AudioStreamPacketDescriptionExtended& inDesc);
+	SInt64 TotalFrames() const { return mTotalFrames; }
 	
 	const AudioStreamPacketDescriptionExtended operator[](SInt64 inPacketIndex) const;
 	const AudioStreamPacketDescriptionExtended front() const { return (*this)[0]; }
 	const AudioStreamPacketDescriptionExtended back() const { return (*this)[mSize-1]; }
 	
-	//SInt64 PacketForByte(SInt64 inByteOffset) const;
+	// The last packet that starts at or before inByteOffset, or -1 if there's none. Packets must be in file 
+	// order. Binary searches the bases' offsets, then the packets in one base.
+	SInt64 PacketForByte(SInt64 inByteOffset) const;
 	SInt64 ByteForPacket(SInt64 inPacketIndex) const { return (*this)[inPacketIndex].mStartOffset; }
+	
+	// The same for frames: the last packet whose first frame is at or before inFrame, or -1.
+	SInt64 PacketForFrame(SInt64 inFrame) const;
+	SInt64 FrameForPacket(SInt64 inPacketIndex) const { return (*this)[inPacketIndex].mFrameOffset; }
+	
+	// Decodes up to inNumPackets descriptions starting at inStartPacket, with their start offsets made relative 
+	// to inOrigin, a base at a time. Returns how many it decoded, fewer if the table ends first.
+	UInt32 GetPacketDescriptions(SInt64 inStartPacket, UInt32 inNumPackets, AudioStreamPacketDescription* outDescs, SInt64 inOrigin = 0) const;
 		
 	class iterator {
 		public:
-			typedef std::input_iterator_tag iterator_category;
+			typedef std::random_access_iterator_tag iterator_category;
 			typedef iterator pointer;
 			typedef SInt64 difference_type;
 			typedef AudioStreamPacketDescriptionExtended value_type;
-			typedef value_type& reference;
+			typedef const value_type reference;
 			
 			iterator() : mTable(NULL), mIndex(0) {}
 			iterator(const CompressedPacketTable* table, SInt64 index) : mTable(table), mIndex(index) {}
@@ -93,16 +106,23 @@ public:
 			
 			const AudioStreamPacketDescriptionExtended operator*() const { return (*mTable)[mIndex]; }
 			const AudioStreamPacketDescriptionExtended* const operator->() { mValue = (*mTable)[mIndex]; return &mValue; }
+			const AudioStreamPacketDescriptionExtended operator[](SInt64 index) const { return (*mTable)[mIndex + index]; }
 			iterator& operator++() { ++mIndex; return *this; }
 			iterator& operator--() { --mIndex; return *this; }
+			iterator operator++(int) { iterator old(*this); ++mIndex; return old; }
+			iterator operator--(int) { iterator old(*this); --mIndex; return old; }
+			iterator& operator+=(SInt64 index) { mIndex += index; return *this; }
+			iterator& operator-=(SInt64 index) { mIndex -= index; return *this; }
 			
-			SInt64 operator-(const iterator& that) { return mIndex - that.mIndex; }
-			const iterator operator-(SInt64 index) { return iterator(mTable, mIndex - index); }
-			const iterator operator+(SInt64 index) { return iterator(mTable, mIndex + index); }
-			bool operator==(const iterator& that) { return mIndex == that.mIndex; }
-			bool operator!=(const iterator& that) { return mIndex != that.mIndex; }
-			bool operator>(const iterator& that) { return mIndex > that.mIndex; }
-			bool operator<(const iterator& that) { return mIndex < that.mIndex; }
+			SInt64 operator-(const iterator& that) const { return mIndex - that.mIndex; }
+			const iterator operator-(SInt64 index) const { return iterator(mTable, mIndex - index); }
+			const iterator operator+(SInt64 index) const { return iterator(mTable, mIndex + index); }
+			bool operator==(const iterator& that) const { return mIndex == that.mIndex; }
+			bool operator!=(const iterator& that) const { return mIndex != that.mIndex; }
+			bool operator>(const iterator& that) const { return mIndex > that.mIndex; }
+			bool operator<(const iterator& that) const { return mIndex < that.mIndex; }
+			bool operator>=(const iterator& that) const { return mIndex >= that.mIndex; }
+			bool operator<=(const iterator& that) const { return mIndex <= that.mIndex; }
 		private:
 			const CompressedPacketTable* mTable;
 			SInt64 mIndex;
@@ -149,7 +169,8 @@ private:
 	
 	struct PacketBase
 	{
-		SInt64 mBaseOffset;
+		SInt64 mBaseOffset;		// the first packet's start offset and first frame, so the bases can be binary searched
+		SInt64 mBaseFrame;
 		UInt8 mDescType;
 		void* mDescs;
 	};
@@ -176,5 +197,6 @@ private:
 	std::vector<PacketBase> mBases;
 	UInt64 mSize;
 	UInt32 mFramesPerPacket;
+	SInt64 mTotalFrames;
 };
 
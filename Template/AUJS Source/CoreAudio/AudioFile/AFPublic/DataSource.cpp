@@ -44,9 +44,13 @@
 #else
 	#include <unistd.h>
 	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <errno.h>
 #endif
 #include <sys/stat.h>
+#include <limits.h>
 #include <algorithm>
+#include "CAPThread.h"
 
 #define VERBOSE 0
 
@@ -184,6 +188,29 @@ OSStatus	UnixFile_DataSource::SetSize(SInt64 inSize)
 	return noErr;
 }
 
+OSStatus	UnixFile_DataSource::Preallocate(SInt64 inSize)
+{
+	SInt64 size;
+	OSStatus err = GetSize(size);
+	if (err) return err;
+	if (inSize <= size) return noErr;
+#if TARGET_OS_MAC
+	// contiguous if possible, and past the end of the file so its size doesn't change
+	fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, inSize - size, 0 };
+	if (fcntl(mFileD, F_PREALLOCATE, &store) == -1) {
+		store.fst_flags = F_ALLOCATEALL;
+		if (fcntl(mFileD, F_PREALLOCATE, &store) == -1) return kAudioFilePermissionsError;
+	}
+	return noErr;
+#elif defined(__linux__)
+	if (fallocate(mFileD, FALLOC_FL_KEEP_SIZE, size, inSize - size) == -1) 
+		return errno == EOPNOTSUPP ? (OSStatus)kAudio_UnimplementedError : (OSStatus)kAudioFilePermissionsError;
+	return noErr;
+#else
+	return kAudio_UnimplementedError;
+#endif
+}
+
 
 OSStatus	UnixFile_DataSource::GetPos(SInt64& outPos) const
 {
@@ -321,8 +348,491 @@ OSStatus	UnixFile_DataSource::WriteBytes(UInt16 positionMode,
 
 //////////////////////////////////////////////////////////////////////////////////////////
 
+#if !TARGET_OS_WIN32
+
+MMap_DataSource::MMap_DataSource( int inFD, SInt8 inPermissions, Boolean inCloseOnDelete, UInt32 inWindowSize)
+	: DataSource(inCloseOnDelete), mFileD(inFD), mPermissions(inPermissions), mMap(NULL), mMapOffset(0), mMapSize(0),
+		mWindowSize(0), mAccessPattern(kAccess_Normal), mFilePointer(0)
+{
+	if (inWindowSize) {
+		// whole pages, and at least two so a read that straddles pages still fits
+		UInt32 pageSize = (UInt32)getpagesize();
+		mWindowSize = std::max((inWindowSize + pageSize - 1) & ~(pageSize - 1), 2 * pageSize);
+	}
+}
+
+MMap_DataSource::~MMap_DataSource()
+{
+	Unmap();
+	if (mCloseOnDelete) close(mFileD);
+}
+
+OSStatus	MMap_DataSource::GetSize(SInt64& outSize)
+{
+	outSize = -1; // in case of error
+	struct stat stbuf;
+	if (fstat (mFileD, &stbuf) == -1) return kAudio_FileNotFoundError;
+	outSize = stbuf.st_size;
+	return noErr;
+}
+
+OSStatus	MMap_DataSource::SetSize(SInt64 inSize)
+{
+	// pages past the new end would fault
+	if (mMap && inSize < mMapOffset + mMapSize) Unmap();
+	if (ftruncate (mFileD, inSize) == -1) return kAudioFilePermissionsError;
+	return noErr;
+}
+
+OSStatus	MMap_DataSource::GetPos(SInt64& outPos) const
+{
+	outPos = mFilePointer;
+	return noErr;
+}
+
+SInt64		MMap_DataSource::CurrentOffset (UInt16 positionMode, SInt64 positionOffset)
+{
+	SInt64 size = 0;
+	if ((positionMode & kPositionModeMask) == SEEK_END) {
+		OSStatus result = GetSize (size);
+			if (result) return -1;
+	}
+	return CalcOffset(positionMode, positionOffset, mFilePointer, size);
+}
+
+void	MMap_DataSource::Unmap()
+{
+	if (mMap) {
+		munmap((void*)mMap, (size_t)mMapSize);
+		mMap = NULL;
+		mMapOffset = 0;
+		mMapSize = 0;
+	}
+}
+
+void	MMap_DataSource::Advise()
+{
+	if (!mMap) return;
+	int advice = MADV_NORMAL;
+	if (mAccessPattern == kAccess_Sequential) advice = MADV_SEQUENTIAL;
+	else if (mAccessPattern == kAccess_Random) advice = MADV_RANDOM;
+	madvise((void*)mMap, (size_t)mMapSize, advice);
+}
+
+bool	MMap_DataSource::Map(SInt64 inOffset, UInt32 inByteCount)
+{
+	// the caller has checked that the range is inside the file
+	SInt64 size;
+	if (GetSize(size)) return false;
+	
+	SInt64 start = 0;
+	SInt64 length = size;
+	if (mWindowSize) {
+		start = inOffset & ~(SInt64)(getpagesize() - 1);
+		length = std::min((SInt64)mWindowSize, size - start);
+	}
+	if (length <= 0 || inOffset + inByteCount > start + length) return false;
+	if ((UInt64)length != (size_t)length) return false;	// bigger than the address space
+	
+	Unmap();
+	void* map = mmap(NULL, (size_t)length, PROT_READ, MAP_SHARED, mFileD, (off_t)start);
+	if (map == MAP_FAILED) return false;
+	mMap = (const UInt8*)map;
+	mMapOffset = start;
+	mMapSize = length;
+	Advise();
+#if VERBOSE
+	printf ("MMap_DataSource: mapped %lld bytes at %lld\n", mMapSize, mMapOffset);
+#endif
+	return true;
+}
+
+void	MMap_DataSource::SetAccessPattern(UInt32 inPattern)
+{
+	mAccessPattern = inPattern;
+	Advise();
+}
+
+void	MMap_DataSource::WillNeed(SInt64 inOffset, UInt32 inByteCount)
+{
+	if (!mMap) return;
+	SInt64 start = std::max(inOffset, mMapOffset);
+	SInt64 end = std::min(inOffset + inByteCount, mMapOffset + mMapSize);
+	if (end <= start) return;
+	SInt64 pageStart = (start - mMapOffset) & ~(SInt64)(getpagesize() - 1);
+	madvise((void*)(mMap + pageStart), (size_t)(end - mMapOffset - pageStart), MADV_WILLNEED);
+}
+
+OSStatus	MMap_DataSource::MapBytes(	UInt16 positionMode, 
+								SInt64 positionOffset, 
+								UInt32 requestCount, 
+								const void **outBytes, 
+								UInt32* actualCount)
+{
+	if (actualCount) *actualCount = 0;
+	if (!outBytes || !actualCount) return kAudio_ParamError;
+	*outBytes = NULL;
+
+	SInt64 offset = CurrentOffset (positionMode, positionOffset);
+		if (offset < 0) return kAudioFilePositionError;
+	
+	if (!mMap || offset < mMapOffset || offset + requestCount > mMapOffset + mMapSize) {
+		// only look at the size when the map doesn't cover the read; fstat-ing every read is slow
+		SInt64 size;
+		OSStatus err = GetSize(size);
+		if (err) return err;
+		if (offset >= size) requestCount = 0;
+		else if (offset + requestCount > size) requestCount = (UInt32)(size - offset);
+		if (requestCount == 0) {
+			mFilePointer = offset;
+			return noErr;
+		}
+		// a read that runs to the end of the file may be covered once it's clamped
+		if (!mMap || offset < mMapOffset || offset + requestCount > mMapOffset + mMapSize) {
+			if (!Map(offset, requestCount)) return kAudio_UnimplementedError;
+		}
+	}
+	
+	*outBytes = mMap + (offset - mMapOffset);
+	*actualCount = requestCount;
+	mFilePointer = offset + requestCount;
+	return noErr;
+}
+
+OSStatus	MMap_DataSource::ReadBytes(	UInt16 positionMode, 
+								SInt64 positionOffset, 
+								UInt32 requestCount, 
+								void *buffer, 
+								UInt32* actualCount)
+{
+	if (actualCount) *actualCount = 0;
+	if (!buffer || !actualCount) return kAudio_ParamError;
+	
+	const void* bytes;
+	OSStatus err = MapBytes(positionMode, positionOffset, requestCount, &bytes, actualCount);
+	if (err == noErr) {
+		if (*actualCount) memcpy(buffer, bytes, *actualCount);
+		return noErr;
+	}
+	if (err != kAudio_UnimplementedError) return err;
+	
+	// bigger than a window, or the map failed
+	SInt64 offset = CurrentOffset (positionMode, positionOffset);
+		if (offset < 0) return kAudioFilePositionError;
+	ssize_t numBytes = pread (mFileD, buffer, requestCount, offset);
+	if (numBytes == -1) return kAudioFilePositionError;
+	mFilePointer = offset + numBytes;
+	*actualCount = (UInt32)numBytes;
+	return noErr;
+}
+
+OSStatus	MMap_DataSource::WriteBytes(UInt16 positionMode, 
+								SInt64 positionOffset, 
+								UInt32 requestCount, 
+								const void *buffer, 
+								UInt32* actualCount)
+{
+	if (!buffer) return kAudio_ParamError;
+	if (!CanWrite()) return kAudioFilePermissionsError;
+
+	SInt64 offset = CurrentOffset (positionMode, positionOffset);
+		if (offset < 0) return kAudioFilePositionError;
+
+	ssize_t numBytes = pwrite (mFileD, buffer, requestCount, offset);
+	if (numBytes == -1) return kAudioFilePositionError;
+	mFilePointer = offset + numBytes;
+	
+	*actualCount = (UInt32)numBytes;
+	return noErr;
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////
+
 #define NO_CACHE 0
 
+Cached_DataSource::Cached_DataSource(DataSource* inDataSource, UInt32 inHeaderCacheSize, UInt32 inPageSize, Boolean inOwnDataSource, UInt32 inPageCount)
+	: DataSource(false), 
+	mDataSource(inDataSource), mOwnDataSource(inOwnDataSource), mOffset(0), mHeaderCacheSize(inHeaderCacheSize), 
+	mGuard("Cached_DataSource"), mSourceMutex("Cached_DataSource source"),
+	mPageSize(std::max(inPageSize, (UInt32)512)), mPageCount(std::max(inPageCount, (UInt32)1)), mUseCount(0), 
+	mQueueHead(0), mQueueCount(0), mReadAheadPages(0), mThreadRunning(false), mQuitting(false)
+{
+	for (UInt32 i = 0; i < kMaxStreams; ++i) {
+		mStreams[i].mEnd = -1;
+		mStreams[i].mLastPage = -1;
+		mStreams[i].mReads = 0;
+		mStreams[i].mLastUse = 0;
+	}
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+Cached_DataSource::~Cached_DataSource()
+{
+	{
+		CAGuard::Locker locker(mGuard);
+		mQuitting = true;
+		locker.NotifyAll();
+		while (mThreadRunning) locker.Wait();
+	}
+	if (mOwnDataSource) delete mDataSource;
+}
+
+OSStatus Cached_DataSource::GetSize(SInt64& outSize)
+{
+	CAMutex::Locker locker(mSourceMutex);
+	return mDataSource->GetSize(outSize);
+}
+
+OSStatus Cached_DataSource::GetPos(SInt64& outPos) const
+{
+	// the read ahead thread moves the wrapped source's position around, so it's kept here
+	outPos = mOffset;
+	return noErr;
+}
+
+OSStatus Cached_DataSource::SetSize(SInt64 inSize)
+{
+	OSStatus err;
+	{
+		CAMutex::Locker locker(mSourceMutex);
+		err = mDataSource->SetSize(inSize);
+	}
+	CAGuard::Locker locker(mGuard);
+	InvalidatePages(inSize - inSize % mPageSize, LLONG_MAX);
+	return err;
+}
+
+OSStatus Cached_DataSource::Preallocate(SInt64 inSize)
+{
+	CAMutex::Locker locker(mSourceMutex);
+	return mDataSource->Preallocate(inSize);
+}
+
+void Cached_DataSource::SetReadAhead(UInt32 inPages)
+{
+	CAGuard::Locker locker(mGuard);
+	mReadAheadPages = std::min(inPages, mPageCount > 2 ? mPageCount - 2 : 0);
+	if (!mReadAheadPages) mQueueCount = 0;
+}
+
+void Cached_DataSource::GetStatistics(Statistics& outStatistics)
+{
+	CAGuard::Locker locker(mGuard);
+	outStatistics = mStatistics;
+}
+
+void Cached_DataSource::ResetStatistics()
+{
+	CAGuard::Locker locker(mGuard);
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+void Cached_DataSource::AllocatePages()
+{
+	mPageData.allocBytes((size_t)mPageSize * mPageCount);
+	mPages.alloc(mPageCount, true);
+	for (UInt32 i = 0; i < mPageCount; ++i) {
+		mPages[i].mState = kPage_Empty;
+		mPages[i].mData = mPageData + (size_t)mPageSize * i;
+	}
+}
+
+Cached_DataSource::Page* Cached_DataSource::FindPage(SInt64 inOffset)
+{
+	// a linear search; page counts are small
+	if (!mPages()) return NULL;
+	for (UInt32 i = 0; i < mPageCount; ++i) {
+		Page* page = mPages + i;
+		if (page->mState != kPage_Empty && page->mOffset == inOffset) return page;
+	}
+	return NULL;
+}
+
+Cached_DataSource::Page* Cached_DataSource::ChooseVictim()
+{
+	if (!mPages()) AllocatePages();
+	Page* victim = NULL;
+	for (UInt32 i = 0; i < mPageCount; ++i) {
+		Page* page = mPages + i;
+		if (page->mState == kPage_Empty) return page;
+		if (page->mState == kPage_Valid && (!victim || page->mLastUse < victim->mLastUse)) victim = page;
+	}
+	return victim;
+}
+
+void Cached_DataSource::InvalidatePages(SInt64 inOffset, SInt64 inEnd)
+{
+	if (!mPages()) return;
+	for (UInt32 i = 0; i < mPageCount; ++i) {
+		Page* page = mPages + i;
+		if (page->mState == kPage_Empty || page->mOffset >= inEnd || page->mOffset + mPageSize <= inOffset) continue;
+		if (page->mState == kPage_Loading) page->mStale = true;
+		else page->mState = kPage_Empty;
+	}
+}
+
+OSStatus Cached_DataSource::LoadPage(Page* inPage, SInt64 inOffset, bool inReadAhead)
+{
+	inPage->mOffset = inOffset;
+	inPage->mSize = 0;
+	inPage->mState = kPage_Loading;
+	inPage->mReadAhead = false;
+	inPage->mStale = false;
+	
+	OSStatus err;
+	UInt32 size = 0;
+	{
+		CAMutex::Unlocker unlocker(mGuard);
+		CAMutex::Locker locker(mSourceMutex);
+		err = mDataSource->ReadBytes(SEEK_SET, inOffset, mPageSize, inPage->mData, &size);
+	}
+	if (err == kAudioFileEndOfFileError) err = noErr;
+	
+	if (err || inPage->mStale) {
+		inPage->mState = kPage_Empty;
+	} else {
+		inPage->mState = kPage_Valid;
+		inPage->mSize = size;
+		inPage->mReadAhead = inReadAhead;
+		inPage->mLastUse = ++mUseCount;
+	}
+#if VERBOSE	
+	printf("load page %lld  %lu bytes  err %d  read ahead %d\n", inOffset, size, (int)err, inReadAhead);
+#endif
+	mGuard.NotifyAll();
+	return err;
+}
+
+Cached_DataSource::Page* Cached_DataSource::GetPage(SInt64 inOffset, OSStatus& outErr)
+{
+	outErr = noErr;
+	bool waited = false;
+	for (;;) {
+		Page* page = FindPage(inOffset);
+		if (page && page->mState == kPage_Valid) {
+			++mStatistics.mHits;
+			if (page->mReadAhead) {
+				++mStatistics.mReadAheadHits;
+				page->mReadAhead = false;
+			}
+			page->mLastUse = ++mUseCount;
+			return page;
+		}
+		
+		if (!page) page = ChooseVictim();
+		if (!page || page->mState == kPage_Loading) {
+			// the read ahead thread is reading this page, or every other one
+			if (!waited) ++mStatistics.mReadAheadWaits;
+			waited = true;
+			mGuard.Wait();
+			continue;
+		}
+		
+		++mStatistics.mMisses;
+		outErr = LoadPage(page, inOffset, false);
+		if (outErr) return NULL;
+		if (page->mState == kPage_Valid) {
+			page->mLastUse = ++mUseCount;
+			return page;
+		}
+	}
+}
+
+void Cached_DataSource::QueueReadAhead(SInt64 inOffset)
+{
+	if (FindPage(inOffset) || mQueueCount == kMaxQueuedPages) return;
+	for (UInt32 i = 0; i < mQueueCount; ++i)
+		if (mQueue[(mQueueHead + i) % kMaxQueuedPages] == inOffset) return;
+	mQueue[(mQueueHead + mQueueCount) % kMaxQueuedPages] = inOffset;
+	++mQueueCount;
+}
+
+void Cached_DataSource::NoteRead(SInt64 inOffset, UInt32 inCount)
+{
+	if (!inCount) return;
+	
+	// find the stream this read continues, allowing a gap of less than a page, or replace the oldest one
+	Stream* stream = NULL;
+	Stream* oldest = mStreams;
+	for (UInt32 i = 0; i < kMaxStreams; ++i) {
+		Stream* s = mStreams + i;
+		if (s->mEnd >= 0 && inOffset >= s->mEnd && inOffset - s->mEnd < mPageSize) {
+			stream = s;
+			break;
+		}
+		if (s->mLastUse < oldest->mLastUse) oldest = s;
+	}
+	if (stream) {
+		++stream->mReads;
+	} else {
+		stream = oldest;
+		stream->mReads = 0;
+		stream->mLastPage = -1;
+	}
+	stream->mEnd = inOffset + inCount;
+	stream->mLastUse = ++mUseCount;
+	
+	if (!mReadAheadPages || stream->mReads < kSequentialReads) return;
+	
+	// queue the pages after the stream's current one each time it moves into a new page
+	SInt64 last = stream->mEnd - 1;
+	SInt64 page = last - last % mPageSize;
+	if (page == stream->mLastPage) return;
+	stream->mLastPage = page;
+	
+	for (UInt32 i = 1; i <= mReadAheadPages; ++i)
+		QueueReadAhead(page + (SInt64)i * mPageSize);
+	if (mQueueCount) {
+		if (!mThreadRunning) StartReadAheadThread();
+		mGuard.NotifyAll();
+	}
+}
+
+void Cached_DataSource::StartReadAheadThread()
+{
+	CAPThread* thread = new CAPThread(ReadAheadEntry, this, CAPThread::kDefaultThreadPriority, false, true, "Cached_DataSource read ahead");
+	mThreadRunning = true;
+	try {
+		thread->Start();
+	} catch (...) {
+		delete thread;
+		mThreadRunning = false;
+		mReadAheadPages = 0;
+		mQueueCount = 0;
+	}
+}
+
+void* Cached_DataSource::ReadAheadEntry(void* inCachedDataSource)
+{
+	static_cast<Cached_DataSource*>(inCachedDataSource)->ReadAhead();
+	return NULL;
+}
+
+void Cached_DataSource::ReadAhead()
+{
+	CAGuard::Locker locker(mGuard);
+	for (;;) {
+		while (!mQuitting && !mQueueCount) locker.Wait();
+		if (mQuitting) break;
+		
+		SInt64 offset = mQueue[mQueueHead];
+		mQueueHead = (mQueueHead + 1) % kMaxQueuedPages;
+		--mQueueCount;
+		if (FindPage(offset)) continue;
+		
+		Page* page = ChooseVictim();
+		if (!page) continue;
+		++mStatistics.mReadAheadPages;
+		LoadPage(page, offset, true);
+		// a short page is the end of the file as it was; a reader reads it itself, and again if the file grows
+		if (page->mState == kPage_Valid && page->mSize < mPageSize) page->mState = kPage_Empty;
+	}
+	mThreadRunning = false;
+	locker.NotifyAll();
+}
+
 OSStatus Cached_DataSource::ReadFromHeaderCache(
 					SInt64 offset, 
 					UInt32 requestCount,
@@ -337,6 +847,7 @@ OSStatus Cached_DataSource::ReadFromHeaderCache(
 	printf("read from header %lld %lu   %lld %lu\n", offset, requestCount, 0LL, mHeaderCacheSize);
 #endif
 
+	CAMutex::Locker locker(mSourceMutex);
 	if (!mHeaderCache()) 
 	{
 		mHeaderCache.allocBytes(mHeaderCacheSize, true);
@@ -392,98 +903,60 @@ OSStatus Cached_DataSource::ReadBytes(
 	}
 
 #if NO_CACHE
-	err = mDataSource->ReadBytes(positionMode, positionOffset, requestCount, buffer, &theActualCount);
+	{
+		CAMutex::Locker locker(mSourceMutex);
+		err = mDataSource->ReadBytes(SEEK_SET, offset, requestCount, buffer, &theActualCount);
+	}
 	mOffset = offset + theActualCount;
 #else
 
-	SInt64 cacheEnd = mBodyCacheOffset + mBodyCacheCurSize;
-	if (mBodyCache() && requestCount < mBodyCacheSize && offset >= mBodyCacheOffset && offset < cacheEnd)
+	if (requestCount > mPageSize * std::max(mPageCount / 2, (UInt32)1))
 	{
-		if (offset + requestCount <= cacheEnd) 
-		{
-			// request is entirely within cache
 #if VERBOSE	
-			printf("request is entirely within cache %lld %lu   %lld %lu\n", offset, requestCount, mBodyCacheOffset, mBodyCacheCurSize);
+		printf("large request %lld %lu\n", offset, requestCount);
 #endif
-			memcpy(buffer, mBodyCache + (size_t)(offset - mBodyCacheOffset), requestCount);
-			theActualCount = requestCount;
-		}
-		else
+		// the request is larger than we normally cache, just do a read and don't cache.
 		{
-			// part of request is within cache. copy, read next cache block, copy.
-#if VERBOSE	
-			printf("part of request is within cache %lld %lu   %lld %lu\n", offset, requestCount, mBodyCacheOffset, mBodyCacheCurSize);
-#endif
-			
-			// copy first part.
-			ByteCount firstPart = (ByteCount)(cacheEnd - offset);
-			ByteCount secondPart = requestCount - firstPart;
-#if VERBOSE	
-			printf("memcpy   offset %lld  mBodyCacheOffset %lld  offset - mBodyCacheOffset %lld  firstPart %lu   requestCount %lu\n", 
-						offset, mBodyCacheOffset, offset - mBodyCacheOffset, firstPart, requestCount);
-#endif
-			memcpy(buffer, mBodyCache + (size_t)(offset - mBodyCacheOffset), firstPart);
-			
-			theActualCount = firstPart;
-			
-			// read new block
-			SInt64 nextOffset = mBodyCacheOffset + mBodyCacheCurSize;
-			err = mDataSource->ReadBytes(SEEK_SET, nextOffset, mBodyCacheSize, mBodyCache(), &mBodyCacheCurSize);
-			
-			if (err == kAudioFileEndOfFileError) err = noErr;
-			if (err) goto leave;
-
-			mBodyCacheOffset = nextOffset;
-
-			// copy second part
-			secondPart = std::min(secondPart, (ByteCount)mBodyCacheCurSize);
-			if (secondPart) memcpy((char*)buffer + firstPart, mBodyCache(), secondPart);
-			theActualCount = firstPart + secondPart;
+			CAMutex::Locker locker(mSourceMutex);
+			err = mDataSource->ReadBytes(SEEK_SET, offset, requestCount, buffer, &theActualCount);
 		}
+		CAGuard::Locker locker(mGuard);
+		++mStatistics.mUncachedReads;
+		NoteRead(offset, theActualCount);
 	}
-	else 
+	else
 	{
-		if (requestCount > mBodyCacheSize)
-		{
-#if VERBOSE	
-			printf("large request %lld %lu   %lld %lu\n", offset, requestCount, mBodyCacheOffset, mBodyCacheCurSize);
-#endif
-			// the request is larger than we normally cache, just do a read and don't cache.
-			err = mDataSource->ReadBytes(positionMode, positionOffset, requestCount, buffer, &theActualCount);
-			mOffset = offset + theActualCount;
-		}
-		else
+		CAGuard::Locker locker(mGuard);
+		bool reloaded = false;
+		while (theActualCount < requestCount)
 		{
-			// request is outside cache. read new block.
-#if VERBOSE	
-			printf("request is outside cache %lld %lu   %lld %lu\n", offset, requestCount, mBodyCacheOffset, mBodyCacheCurSize);
-#endif
-			if (!mBodyCache()) 
-			{
-				mBodyCache.allocBytes(mBodyCacheSize, true);
-#if VERBOSE	
-				printf("alloc mBodyCache %08X\n", mBodyCache());
-#endif
+			SInt64 position = offset + theActualCount;
+			Page* page = GetPage(position - position % mPageSize, err);
+			if (!page) break;
+			
+			UInt32 offsetInPage = (UInt32)(position - page->mOffset);
+			if (page->mSize < mPageSize && offsetInPage + (requestCount - theActualCount) > page->mSize && !reloaded) {
+				// a short page was the end of the file when it was read, and someone may have written more since
+				reloaded = true;
+				++mStatistics.mMisses;
+				err = LoadPage(page, page->mOffset, false);
+				if (err) break;
+				continue;
 			}
-			mBodyCacheOffset = offset;
-			err = mDataSource->ReadBytes(SEEK_SET, mBodyCacheOffset, mBodyCacheSize, mBodyCache(), &mBodyCacheCurSize);
-#if VERBOSE	
-			printf("read %08X %d    mBodyCacheOffset %lld   %lu %lu\n", err, err, mBodyCacheOffset, mBodyCacheSize, mBodyCacheCurSize);
-#endif
-			if (err == kAudioFileEndOfFileError) err = noErr;
-			if (err) return err;
-
-			theActualCount = std::min(requestCount, mBodyCacheCurSize);
-			memcpy(buffer, mBodyCache(), theActualCount);
+			if (offsetInPage >= page->mSize) break;		// end of file
+			
+			UInt32 count = std::min(requestCount - theActualCount, page->mSize - offsetInPage);
+			memcpy((char*)buffer + theActualCount, page->mData + offsetInPage, count);
+			theActualCount += count;
+			if (page->mSize < mPageSize) break;
 		}
-		
+		NoteRead(offset, theActualCount);
 	}
-
-leave:
+	mOffset = offset + theActualCount;
 #endif
 	if (actualCount) *actualCount = (UInt32)theActualCount;
 #if VERBOSE	
-	printf("<<read err %d  actualCount %lu\n", err, *actualCount);
+	printf("<<read err %d  actualCount %lu\n", err, theActualCount);
 #endif
 	return err;
 }
@@ -524,20 +997,43 @@ OSStatus Cached_DataSource::WriteBytes(
 	printf("write %lld %lu    %lld %d %lld\n", offset, requestCount, mOffset, positionMode, positionOffset);
 #endif
 
-	SInt64 cacheEnd = mBodyCacheOffset + mBodyCacheCurSize;
-	if (mBodyCache() && offset >= mBodyCacheOffset && offset < cacheEnd)
+	// write first, then update the pages, so a page the read ahead thread is reading is either read after the 
+	// write or marked stale
+	UInt32 theActualCount = 0;
+	{
+		CAMutex::Locker locker(mSourceMutex);
+		err = mDataSource->WriteBytes(SEEK_SET, offset, requestCount, buffer, &theActualCount);
+	}
+	
+	if (theActualCount) 
 	{
-		// body cache write through
-		ByteCount firstPart = std::min((SInt64)requestCount, cacheEnd - offset);
+		CAGuard::Locker locker(mGuard);
+		SInt64 end = offset + theActualCount;
+		for (UInt32 i = 0; mPages() && i < mPageCount; ++i)
+		{
+			// body cache write through
+			Page* page = mPages + i;
+			if (page->mState == kPage_Empty || page->mOffset >= end || page->mOffset + mPageSize <= offset) continue;
+			if (page->mState == kPage_Loading) {
+				page->mStale = true;
+				continue;
+			}
+			
+			UInt32 start = (UInt32)(std::max(offset, page->mOffset) - page->mOffset);
+			UInt32 stop = (UInt32)(std::min(end, page->mOffset + mPageSize) - page->mOffset);
+			if (start > page->mSize) {
+				// would leave a hole in the page
+				page->mState = kPage_Empty;
+				continue;
+			}
 #if VERBOSE	
-		printf("body cache write through %lld %lu  %lld %lu\n", mBodyCacheOffset, mBodyCacheCurSize, offset, firstPart);
+			printf("body cache write through %lld %lu  %lu %lu\n", page->mOffset, page->mSize, start, stop);
 #endif
-		memcpy(mBodyCache + (offset - mBodyCacheOffset), buffer, firstPart);
+			memcpy(page->mData + start, (const char*)buffer + (size_t)(page->mOffset + start - offset), stop - start);
+			page->mSize = std::max(page->mSize, stop);
+		}
 	}
 	
-	UInt32 theActualCount;
-	err = mDataSource->WriteBytes(positionMode, positionOffset, requestCount, buffer, &theActualCount);
-	
 	mOffset = offset + theActualCount;
 	if (actualCount) *actualCount = (UInt32)theActualCount;
 	
@@ -51,6 +51,7 @@
 #include <stdio.h>
 #include <stdexcept>
 #include "CAAutoDisposer.h"
+#include "CAGuard.h"
 
 //////////////////////////////////////////////////////////////////////////////////////////
 
@@ -94,6 +95,21 @@ public:
 								const void *buffer, 
 								UInt32* actualCount)=0;
 	
+	/* Like ReadBytes, but points outBytes at the data instead of copying it, for sources that already have it 
+		in memory. The bytes are read only and stay valid until the next call on the source. Sources that can't 
+		return kAudio_UnimplementedError, and the caller should use ReadBytes instead.
+	*/
+	virtual OSStatus MapBytes(	UInt16 positionMode, 
+								SInt64 positionOffset, 
+								UInt32 requestCount, 
+								const void **outBytes, 
+								UInt32* actualCount) { return kAudio_UnimplementedError; }
+	
+	/* Reserves disk space for the source to grow to inSize bytes, without changing its size, so later writes 
+		up to there don't have to allocate. Sources that can't return kAudio_UnimplementedError.
+	*/
+	virtual OSStatus Preallocate(SInt64 inSize) { return kAudio_UnimplementedError; }
+	
 	virtual void SetCloseOnDelete(Boolean inFlag) { mCloseOnDelete = inFlag; }
 	
 	virtual Boolean CanSeek() const=0;
@@ -175,6 +191,7 @@ public:
 	virtual OSStatus GetPos(SInt64& outPos) const; 
 	
 	virtual OSStatus SetSize(SInt64 inSize);
+	virtual OSStatus Preallocate(SInt64 inSize);
 	
 	virtual OSStatus ReadBytes(	UInt16 positionMode, 
 								SInt64 positionOffset, 
@@ -203,44 +220,132 @@ private:
 
 //////////////////////////////////////////////////////////////////////////////////////////
 
+#if !TARGET_OS_WIN32
+
+/*
+	Reads a file through a read only memory map, so reads are a memcpy out of the page cache with no system 
+	call, and MapBytes hands out pointers into the file with no copy at all. 64 bit processes map the whole 
+	file; 32 bit ones map a window of inWindowSize bytes around each read and slide it as reads move, and reads 
+	bigger than a window go through pread. The map grows when a read goes past its end and the file has grown 
+	since, so a file can be played while it's written; but truncating it under a mapped read raises SIGBUS.
+	Writes go through pwrite; the map is shared, so it sees them.
+*/
+class MMap_DataSource : public DataSource
+{
+	int	  mFileD;
+	SInt8 mPermissions;
+	const UInt8* mMap;
+	SInt64 mMapOffset;			// file offset of mMap[0]
+	SInt64 mMapSize;
+	UInt32 mWindowSize;			// 0 maps the whole file
+	UInt32 mAccessPattern;
+	SInt64 mFilePointer;
+	
+public:
+
+	enum {
+		kAccess_Normal,
+		kAccess_Sequential,		// read ahead aggressively and drop pages behind the reads
+		kAccess_Random			// don't read ahead
+	};
+	
+	enum { kDefaultWindowSize = sizeof(void*) >= 8 ? 0 : 64 * 1024 * 1024 };
+
+	MMap_DataSource( int inFD, SInt8 inPermissions, Boolean inCloseOnDelete, UInt32 inWindowSize = kDefaultWindowSize);
+	virtual ~MMap_DataSource();
+	
+	virtual OSStatus GetSize(SInt64& outSize);
+	virtual OSStatus GetPos(SInt64& outPos) const; 
+	
+	virtual OSStatus SetSize(SInt64 inSize);
+	
+	virtual OSStatus ReadBytes(	UInt16 positionMode, 
+								SInt64 positionOffset, 
+								UInt32 requestCount, 
+								void *buffer, 
+								UInt32* actualCount);
+						
+	virtual OSStatus WriteBytes(UInt16 positionMode, 
+								SInt64 positionOffset, 
+								UInt32 requestCount, 
+								const void *buffer, 
+								UInt32* actualCount);
+	
+	virtual OSStatus MapBytes(	UInt16 positionMode, 
+								SInt64 positionOffset, 
+								UInt32 requestCount, 
+								const void **outBytes, 
+								UInt32* actualCount);
+	
+	virtual Boolean CanSeek() const { return true; }
+	virtual Boolean CanGetSize() const { return true; }
+	virtual Boolean CanSetSize() const { return true; }
+	
+	virtual Boolean CanRead() const { return mPermissions & kAudioFileReadPermission; }
+	virtual Boolean CanWrite() const { return mPermissions & kAudioFileWritePermission; }
+	
+	/* madvise hints; the pattern sticks across remaps. */
+	void SetAccessPattern(UInt32 inPattern);
+	void WillNeed(SInt64 inOffset, UInt32 inByteCount);
+
+private:
+
+	SInt64	CurrentOffset(UInt16 positionMode, SInt64 positionOffset);
+	bool	Map(SInt64 inOffset, UInt32 inByteCount);
+	void	Unmap();
+	void	Advise();
+};
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////
+
 //////////////////////////////////////////////////////////////////////////////////////////
 
 /*
-	A wrapper that caches the wrapped source's header.
+	A wrapper that caches the wrapped source's header, and its body in a block cache: inPageCount pages of
+	inPageSize bytes each, aligned to multiples of the page size and evicted least recently used first, so a
+	reader that moves between a few regions of a file keeps all of them cached. Reads larger than half the cache
+	go straight through. The defaults make a single 32 KB page, the same memory as a plain body window; a reader
+	that streams a file, or moves between several regions of one, passes a larger inPageCount.
+	
+	Reads that carry on where an earlier one ended (up to kMaxStreams interleaved streams of them) count as
+	sequential; once a stream has made kSequentialReads of them, the next SetReadAhead pages after it are read by
+	a background thread, so later reads find them already cached. Reading ahead is off until SetReadAhead is
+	called. The wrapped source is only ever used by one thread at a time.
+	
+	Writes go through to the wrapped source and update any pages they overlap. The short page at the end of the
+	file is read again whenever a read reaches past it, so a file that something else is still writing shows its
+	new data.
 */
 class Cached_DataSource : public DataSource
 {
-	DataSource* mDataSource;
-	CAAutoFree<UInt8> mHeaderCache;
-	UInt32 mHeaderCacheSize;
-	CAAutoFree<UInt8> mBodyCache;
-	UInt32 mBodyCacheSize;
-	UInt32 mBodyCacheCurSize;
-	SInt64 mBodyCacheOffset;
-	SInt64 mOffset;
-	Boolean mOwnDataSource;
-	
 public:
 
-	Cached_DataSource(DataSource* inDataSource, UInt32 inHeaderCacheSize = 4096, UInt32 inBodyCacheSize = 32768, Boolean inOwnDataSource = true)
-					: DataSource(false), 
-					mDataSource(inDataSource), mHeaderCacheSize(inHeaderCacheSize), 
-					mBodyCacheSize(inBodyCacheSize), mBodyCacheCurSize(0), mBodyCacheOffset(-1), 
-					mOffset(0),
-					mOwnDataSource(inOwnDataSource)
-				{
-				}
-				
-	virtual ~Cached_DataSource()
-				{
-					if (mOwnDataSource) delete mDataSource;
-				}
+	enum {
+		kDefaultPageCount = 1,
+		kMaxStreams = 4,
+		kSequentialReads = 2,
+		kMaxQueuedPages = 32
+	};
+	
+	struct Statistics {
+		UInt64	mHits;					// pages found in the cache
+		UInt64	mMisses;				// pages read in by the reading thread
+		UInt64	mReadAheadHits;			// hits on pages the background thread read, counted once per page
+		UInt64	mReadAheadWaits;		// misses that waited for the background thread to finish a page
+		UInt64	mReadAheadPages;		// pages the background thread read
+		UInt64	mUncachedReads;			// reads too large to cache
+	};
 
+	Cached_DataSource(DataSource* inDataSource, UInt32 inHeaderCacheSize = 4096, UInt32 inPageSize = 32768, Boolean inOwnDataSource = true, UInt32 inPageCount = kDefaultPageCount);
+	virtual ~Cached_DataSource();
 	
-	virtual OSStatus GetSize(SInt64& outSize) { return mDataSource->GetSize(outSize); }
-	virtual OSStatus GetPos(SInt64& outPos) const { return mDataSource->GetPos(outPos); } 
+	virtual OSStatus GetSize(SInt64& outSize);
+	virtual OSStatus GetPos(SInt64& outPos) const;
 	
-	virtual OSStatus SetSize(SInt64 inSize) { return mDataSource->SetSize(inSize); }
+	virtual OSStatus SetSize(SInt64 inSize);
+	virtual OSStatus Preallocate(SInt64 inSize);
 	
 	virtual OSStatus ReadBytes(		UInt16 positionMode, 
 									SInt64 positionOffset, 
@@ -265,6 +370,77 @@ public:
 	
 	virtual Boolean CanRead() const { return mDataSource->CanRead(); }
 	virtual Boolean CanWrite() const { return mDataSource->CanWrite(); }
+	
+	/* Number of pages to read ahead of a sequential stream, 0 to turn reading ahead off. It's limited to two 
+		fewer than the page count, so a stream's own page can't be evicted to make room. The thread starts the 
+		first time it's needed.
+	*/
+	void SetReadAhead(UInt32 inPages);
+	UInt32 GetReadAhead() const { return mReadAheadPages; }
+	
+	void GetStatistics(Statistics& outStatistics);
+	void ResetStatistics();
+
+private:
+
+	enum { kPage_Empty, kPage_Loading, kPage_Valid };
+
+	struct Page {
+		SInt64	mOffset;
+		UInt32	mSize;					// less than the page size at the end of the file
+		UInt32	mState;
+		UInt32	mLastUse;
+		bool	mReadAhead;				// read by the background thread and not yet hit
+		bool	mStale;					// written or truncated while loading; discarded when the load finishes
+		UInt8*	mData;
+	};
+	
+	struct Stream {
+		SInt64	mEnd;					// where the stream's last read ended
+		SInt64	mLastPage;
+		UInt32	mReads;
+		UInt32	mLastUse;
+	};
+	
+	Cached_DataSource(const Cached_DataSource&);
+	Cached_DataSource& operator=(const Cached_DataSource&);
+	
+	// all of these expect mGuard to be held
+	void	AllocatePages();
+	Page*	FindPage(SInt64 inOffset);
+	Page*	ChooseVictim();
+	Page*	GetPage(SInt64 inOffset, OSStatus& outErr);
+	OSStatus	LoadPage(Page* inPage, SInt64 inOffset, bool inReadAhead);
+	void	NoteRead(SInt64 inOffset, UInt32 inCount);
+	void	QueueReadAhead(SInt64 inOffset);
+	void	StartReadAheadThread();
+	void	InvalidatePages(SInt64 inOffset, SInt64 inEnd);
+	
+	static void*	ReadAheadEntry(void* inCachedDataSource);
+	void			ReadAhead();
+	
+	DataSource* mDataSource;
+	Boolean mOwnDataSource;
+	SInt64 mOffset;
+	CAAutoFree<UInt8> mHeaderCache;
+	UInt32 mHeaderCacheSize;
+	
+	// the pages, streams, read ahead queue and statistics are guarded by mGuard; the wrapped source by mSourceMutex
+	CAGuard mGuard;
+	CAMutex mSourceMutex;
+	UInt32 mPageSize;
+	UInt32 mPageCount;
+	CAAutoFree<UInt8> mPageData;
+	CAAutoFree<Page> mPages;
+	UInt32 mUseCount;
+	Stream mStreams[kMaxStreams];
+	SInt64 mQueue[kMaxQueuedPages];
+	UInt32 mQueueHead;
+	UInt32 mQueueCount;
+	UInt32 mReadAheadPages;
+	bool mThreadRunning;
+	bool mQuitting;
+	Statistics mStatistics;
 };
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -216,6 +216,7 @@ OSStatus			AUBase::DoInitialize()
 	OSStatus result = noErr;
 	
 	if (!mInitialized) {
+		CAVectorKernels::BindOnce();
 		result = Initialize();
 		if (result == noErr) {
 			mHasBegunInitializing = true;
@@ -60,6 +60,7 @@
 #include "CAMath.h"
 #include "CAThreadSafeList.h"
 #include "CAVectorUnit.h"
+#include "CAVectorKernels.h"
 #if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
 	#include <AudioUnit/AudioUnit.h>
 	#if !CA_BASIC_AU_FEATURES
@@ -580,6 +581,9 @@ public:
 	static bool					HasSSE2() { return sVectorUnitType >= kVecSSE2; }
 	/*! @method HasSSE3 */
 	static bool					HasSSE3() { return sVectorUnitType == kVecSSE3; }
+	/*! @method GetVectorKernels */
+	// the best version of each kernel for this CPU, bound before the first audio unit's Initialize()
+	static const CAVectorKernels &	GetVectorKernels() { return CAVectorKernels::Get(); }
 	
 	/*! @method AudioUnitAPIVersion */
 	UInt8						AudioUnitAPIVersion() const { return mAudioUnitAPIVersion; }
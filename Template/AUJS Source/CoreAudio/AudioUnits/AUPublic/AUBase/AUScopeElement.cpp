@@ -40,6 +40,7 @@
 */
 #include "AUScopeElement.h"
 #include "AUBase.h"
+#include "CADebugPrintf.h"
 
 //_____________________________________________________________________________
 //
@@ -141,7 +142,7 @@ void			AUElement::SetParameter(AudioUnitParameterID paramID, AudioUnitParameterV
 				// but this might cause a regression. So it is better to just fail silently.
 				// COMPONENT_THROW(kAudioUnitErr_InvalidParameter);
 #if DEBUG
-				fprintf(stderr, "WARNING: %s SetParameter for undefined param ID %d while initialized. Ignoring..\n", 
+				DebugPrintfRtn(DebugPrintfFileComma "WARNING: %s SetParameter for undefined param ID %d while initialized. Ignoring..\n", 
 								mAudioUnit->GetLoggingString(), (int)paramID);
 #endif
 			} else {
@@ -184,7 +185,7 @@ void			AUElement::SetScheduledEvent(	AudioUnitParameterID 			paramID,
 				// but this might cause a regression. So it is better to just fail silently.
 				// COMPONENT_THROW(kAudioUnitErr_InvalidParameter);
 #if DEBUG
-				fprintf(stderr, "WARNING: %s SetScheduledEvent for undefined param ID %d while initialized. Ignoring..\n", 
+				DebugPrintfRtn(DebugPrintfFileComma "WARNING: %s SetScheduledEvent for undefined param ID %d while initialized. Ignoring..\n", 
 								mAudioUnit->GetLoggingString(), (int)paramID);
 #endif
 			} else {
@@ -40,6 +40,8 @@
 */
 #include "AUInstrumentBase.h"
 #include "AUMIDIDefs.h"
+#include "AUMPEZoneManager.h"
+#include "CADebugPrintf.h"
 
 #if DEBUG
 	#define DEBUG_PRINT 0
@@ -65,10 +67,11 @@ AUInstrumentBase::AUInstrumentBase(
 	mMaxActiveNotes(0),
 	mNotes(0),
 	mNoteSize(0),
+	mSampleStreamer(0),
 	mInitNumPartEls(numParts)
 {
 #if DEBUG_PRINT
-	printf("new AUInstrumentBase\n");
+	DebugPrintfRtn(DebugPrintfFileComma "new AUInstrumentBase\n");
 #endif
 	mFreeNotes.mState = kNoteState_Free;
 	SetWantsRenderThreadID(true);
@@ -78,8 +81,9 @@ AUInstrumentBase::AUInstrumentBase(
 AUInstrumentBase::~AUInstrumentBase()
 {
 #if DEBUG_PRINT
-	printf("delete AUInstrumentBase\n");
+	DebugPrintfRtn(DebugPrintfFileComma "delete AUInstrumentBase\n");
 #endif
+	delete mSampleStreamer;
 }
 
 AUElement *	AUInstrumentBase::CreateElement(AudioUnitScope inScope, AudioUnitElement element)
@@ -110,7 +114,7 @@ AUScope *	AUInstrumentBase::GetScopeExtended (AudioUnitScope inScope)
 void		AUInstrumentBase::SetNotes(UInt32 inNumNotes, UInt32 inMaxActiveNotes, SynthNote* inNotes, UInt32 inNoteDataSize)
 {
 #if DEBUG_PRINT_NOTE
-	printf("AUInstrumentBase::SetNotes %d %d %p %d\n", inNumNotes, inMaxActiveNotes, inNotes, inNoteDataSize);
+	DebugPrintfRtn(DebugPrintfFileComma "AUInstrumentBase::SetNotes %d %d %p %d\n", inNumNotes, inMaxActiveNotes, inNotes, inNoteDataSize);
 #endif
 	mNumNotes = inNumNotes;
 	mMaxActiveNotes = inMaxActiveNotes;
@@ -146,13 +150,52 @@ void		AUInstrumentBase::AddFreeNote(SynthNote* inNote)
 	}
 #if DEBUG_PRINT_NOTE
 	else {
-			printf("AUInstrumentBase::AddFreeNote: adding fast-released note %p\n", inNote);
+			DebugPrintfRtn(DebugPrintfFileComma "AUInstrumentBase::AddFreeNote: adding fast-released note %p\n", inNote);
 	}
-	printf("AUInstrumentBase::AddFreeNote (%p)  mNumActiveNotes %lu\n", inNote, mNumActiveNotes);
+	DebugPrintfRtn(DebugPrintfFileComma "AUInstrumentBase::AddFreeNote (%p)  mNumActiveNotes %lu\n", inNote, mNumActiveNotes);
 #endif
+	StopStreamingVoice(inNote);
+	StopExpressionVoice(inNote);
 	mFreeNotes.AddNote(inNote);
 }
 
+void		AUInstrumentBase::StartExpressionVoice(SynthNote* inNote, SynthGroupElement* inGroup)
+{
+	AUMPEZoneManager *zones = GetMPEZoneManager();
+	if (zones && inGroup->GroupID() < 16)
+		zones->StartVoice(GetNoteIndex(inNote), (UInt8)inGroup->GroupID());
+}
+
+void		AUInstrumentBase::StopExpressionVoice(SynthNote* inNote)
+{
+	AUMPEZoneManager *zones = GetMPEZoneManager();
+	if (zones)
+		zones->StopVoice(GetNoteIndex(inNote));
+}
+
+void		AUInstrumentBase::MPEAllNotesOff(MusicDeviceGroupID inGroupID)
+{
+	AUMPEZoneManager *zones = GetMPEZoneManager();
+	if (zones && inGroupID < 16)
+		zones->AllNotesOff((UInt8)inGroupID);
+}
+
+Float32		AUInstrumentBase::GetNoteExpression(const SynthNote* inNote, UInt32 inExpression)
+{
+	AUMPEZoneManager *zones = GetMPEZoneManager();
+	UInt32 index = GetNoteIndex(inNote);
+	if (!zones || index >= zones->MaxVoices() || inExpression >= AUMPEZoneManager::kNumberOfExpressions)
+		return 0.f;
+	return zones->Values(inExpression)[index];
+}
+
+void		AUInstrumentBase::EnableSampleStreaming(UInt32 inMaxChannels, UInt32 inRingFrames, UInt32 inChunkFrames)
+{
+	delete mSampleStreamer;
+	mSampleStreamer = 0;
+	mSampleStreamer = new SampleStreamer(mNumNotes, inMaxChannels, inRingFrames, inChunkFrames);
+}
+
 OSStatus			AUInstrumentBase::Initialize()
 {
 /*
@@ -176,6 +219,8 @@ TO DO:
 
 void				AUInstrumentBase::Cleanup()
 {
+	delete mSampleStreamer;
+	mSampleStreamer = 0;
 }
 
 
@@ -183,7 +228,7 @@ OSStatus			AUInstrumentBase::Reset(			AudioUnitScope 					inScope,
 														AudioUnitElement 				inElement)
 {
 #if DEBUG_PRINT
-	printf("AUInstrumentBase::Reset\n");
+	DebugPrintfRtn(DebugPrintfFileComma "AUInstrumentBase::Reset\n");
 #endif
 	if (inScope == kAudioUnitScope_Global)
 	{
@@ -195,10 +240,14 @@ OSStatus			AUInstrumentBase::Reset(			AudioUnitScope 					inScope,
 			if (note->IsSounding()) 
 				note->Kill(0);
 			note->ListRemove();
+			StopStreamingVoice(note);
 			mFreeNotes.AddNote(note);
 		}
 		mNumActiveNotes = 0;
 		mAbsoluteSampleFrame = 0;
+		
+		if (GetMPEZoneManager())
+			GetMPEZoneManager()->Reset();
 
 		// empty lists.
 		UInt32 numGroups = Groups().GetNumberOfElements();
@@ -214,7 +263,7 @@ OSStatus			AUInstrumentBase::Reset(			AudioUnitScope 					inScope,
 void		AUInstrumentBase::PerformEvents(const AudioTimeStamp& inTimeStamp)
 {
 #if DEBUG_PRINT_RENDER
-	printf("AUInstrumentBase::PerformEvents\n");
+	DebugPrintfRtn(DebugPrintfFileComma "AUInstrumentBase::PerformEvents\n");
 #endif
 	SynthEvent *event;
 	SynthGroupElement *group;
@@ -222,7 +271,7 @@ void		AUInstrumentBase::PerformEvents(const AudioTimeStamp& inTimeStamp)
 	while ((event = mEventQueue.ReadItem()) != NULL)
 	{
 #if DEBUG_PRINT_RENDER
-		printf("event %08X %d\n", event, event->GetEventType());
+		DebugPrintfRtn(DebugPrintfFileComma "event %08X %d\n", event, event->GetEventType());
 #endif
 		switch(event->GetEventType())
 		{
@@ -253,10 +302,12 @@ void		AUInstrumentBase::PerformEvents(const AudioTimeStamp& inTimeStamp)
 			case SynthEvent::kEventType_AllNotesOff :
 				group = GetElForGroupID (event->GetGroupID());
 				group->AllNotesOff(event->GetOffsetSampleFrame());
+				MPEAllNotesOff(event->GetGroupID());
 				break;
 			case SynthEvent::kEventType_AllSoundOff :
 				group = GetElForGroupID (event->GetGroupID());
 				group->AllSoundOff(event->GetOffsetSampleFrame());
+				MPEAllNotesOff(event->GetGroupID());
 				break;
 			case SynthEvent::kEventType_ResetAllControllers :
 				group = GetElForGroupID (event->GetGroupID());
@@ -274,6 +325,9 @@ OSStatus			AUInstrumentBase::Render(   AudioUnitRenderActionFlags &	ioActionFlag
 												UInt32							inNumberFrames)
 {
 	PerformEvents(inTimeStamp);
+	
+	if (GetMPEZoneManager())
+		GetMPEZoneManager()->Smooth(inNumberFrames);
 
 	AUScope &outputs = Outputs();
 	UInt32 numOutputs = outputs.GetNumberOfElements();
@@ -326,6 +380,51 @@ bool				AUInstrumentBase::StreamFormatWritable(	AudioUnitScope					scope,
 	return IsInitialized() ? false : true;
 }
 
+OSStatus			AUInstrumentBase::GetPropertyInfo(		AudioUnitPropertyID				inID,
+															AudioUnitScope					inScope,
+															AudioUnitElement				inElement,
+															UInt32 &						outDataSize,
+															Boolean &						outWritable)
+{
+	if (inID == kAudioUnitProperty_SampleStreamerStatistics) {
+		if (inScope != kAudioUnitScope_Global) return kAudioUnitErr_InvalidScope;
+		if (!mSampleStreamer) return kAudioUnitErr_PropertyNotInUse;
+		outDataSize = SampleStreamer::kNumberOfStatistics * sizeof(Float64);
+		outWritable = true;
+		return noErr;
+	}
+	return MusicDeviceBase::GetPropertyInfo(inID, inScope, inElement, outDataSize, outWritable);
+}
+
+OSStatus			AUInstrumentBase::GetProperty(			AudioUnitPropertyID 			inID,
+															AudioUnitScope 					inScope,
+															AudioUnitElement			 	inElement,
+															void *							outData)
+{
+	if (inID == kAudioUnitProperty_SampleStreamerStatistics) {
+		if (inScope != kAudioUnitScope_Global) return kAudioUnitErr_InvalidScope;
+		if (!mSampleStreamer) return kAudioUnitErr_PropertyNotInUse;
+		mSampleStreamer->GetStatistics(static_cast<Float64*>(outData));
+		return noErr;
+	}
+	return MusicDeviceBase::GetProperty(inID, inScope, inElement, outData);
+}
+
+OSStatus			AUInstrumentBase::SetProperty(			AudioUnitPropertyID 			inID,
+															AudioUnitScope 					inScope,
+															AudioUnitElement 				inElement,
+															const void *					inData,
+															UInt32 							inDataSize)
+{
+	if (inID == kAudioUnitProperty_SampleStreamerStatistics) {
+		if (inScope != kAudioUnitScope_Global) return kAudioUnitErr_InvalidScope;
+		if (!mSampleStreamer) return kAudioUnitErr_PropertyNotInUse;
+		mSampleStreamer->ResetStatistics();
+		return noErr;
+	}
+	return MusicDeviceBase::SetProperty(inID, inScope, inElement, inData, inDataSize);
+}
+
 OSStatus			AUInstrumentBase::RealTimeStartNote(	SynthGroupElement 			*inGroup,
 															NoteInstanceID 				inNoteInstanceID, 
 															UInt32 						inOffsetSampleFrame, 
@@ -375,7 +474,7 @@ OSStatus			AUInstrumentBase::RealTimeStopNote(
 												UInt32 						inOffsetSampleFrame)
 {
 #if DEBUG_PRINT
-	printf("AUInstrumentBase::RealTimeStopNote ch %d id %d\n", inGroupID, inNoteInstanceID);
+	DebugPrintfRtn(DebugPrintfFileComma "AUInstrumentBase::RealTimeStopNote ch %d id %d\n", inGroupID, inNoteInstanceID);
 #endif
 	
 	SynthGroupElement *gp = (inGroupID == kMusicNoteEvent_Unused
@@ -383,6 +482,9 @@ OSStatus			AUInstrumentBase::RealTimeStopNote(
 								: GetElForGroupID(inGroupID));
 	if (gp)
 	{
+		SynthNote *note = gp->GetNote(inNoteInstanceID, true);
+		if (note)
+			StopExpressionVoice(note);
 		gp->NoteOff (inNoteInstanceID, inOffsetSampleFrame);
 	}
 	
@@ -392,7 +494,7 @@ OSStatus			AUInstrumentBase::RealTimeStopNote(
 SynthGroupElement *	AUInstrumentBase::GetElForNoteID (NoteInstanceID inNoteID)
 {
 #if DEBUG_PRINT
-	printf("GetElForNoteID id %u\n", inNoteID);
+	DebugPrintfRtn(DebugPrintfFileComma "GetElForNoteID id %u\n", inNoteID);
 #endif
 	AUScope & groups = Groups();
 	unsigned int numEls = groups.GetNumberOfElements();
@@ -421,7 +523,7 @@ OSStatus			AUInstrumentBase::StartNote(	MusicDeviceInstrumentID 	inInstrument,
 		noteID = (UInt32)inParams.mPitch;
 	
 #if DEBUG_PRINT
-	printf("AUInstrumentBase::StartNote ch %u, key %u, offset %u\n", inGroupID, (unsigned) inParams.mPitch, inOffsetSampleFrame);
+	DebugPrintfRtn(DebugPrintfFileComma "AUInstrumentBase::StartNote ch %u, key %u, offset %u\n", inGroupID, (unsigned) inParams.mPitch, inOffsetSampleFrame);
 #endif
 
 	if (InRenderThread ())
@@ -455,7 +557,7 @@ OSStatus			AUInstrumentBase::StopNote( MusicDeviceGroupID 			inGroupID,
 												UInt32 						inOffsetSampleFrame)
 {
 #if DEBUG_PRINT
-	printf("AUInstrumentBase::StopNote ch %u, id %u, offset %u\n", (unsigned)inGroupID, (unsigned)inNoteInstanceID, inOffsetSampleFrame);
+	DebugPrintfRtn(DebugPrintfFileComma "AUInstrumentBase::StopNote ch %u, id %u, offset %u\n", (unsigned)inGroupID, (unsigned)inNoteInstanceID, inOffsetSampleFrame);
 #endif
 	OSStatus err = noErr;
 
@@ -510,10 +612,12 @@ OSStatus	AUInstrumentBase::SendPedalEvent(MusicDeviceGroupID inGroupID, UInt32 i
 			case SynthEvent::kEventType_AllNotesOff :
 				group->AllNotesOff(inOffsetSampleFrame);
 				mNumActiveNotes = CountActiveNotes();
+				MPEAllNotesOff(inGroupID);
 				break;
 			case SynthEvent::kEventType_AllSoundOff :
 				group->AllSoundOff(inOffsetSampleFrame);
 				mNumActiveNotes = CountActiveNotes();
+				MPEAllNotesOff(inGroupID);
 				break;
 			case SynthEvent::kEventType_ResetAllControllers :
 				group->ResetAllControllers(inOffsetSampleFrame);
@@ -538,7 +642,7 @@ OSStatus	AUInstrumentBase::HandleControlChange(	UInt8 	inChannel,
 													UInt32	inStartFrame)
 {
 #if DEBUG_PRINT
-	printf("AUInstrumentBase::HandleControlChange ch %u ctlr: %u val: %u frm: %u\n", inChannel, inController, inValue, inStartFrame);
+	DebugPrintfRtn(DebugPrintfFileComma "AUInstrumentBase::HandleControlChange ch %u ctlr: %u val: %u frm: %u\n", inChannel, inController, inValue, inStartFrame);
 #endif
 	SynthGroupElement *gp = GetElForGroupID(inChannel);
 	if (gp)
@@ -600,7 +704,7 @@ OSStatus	AUInstrumentBase::HandleProgramChange(	UInt8 	inChannel,
 													UInt8 	inValue)
 {
 #if DEBUG_PRINT
-	printf("AUInstrumentBase::HandleProgramChange %u %u\n", inChannel, inValue);
+	DebugPrintfRtn(DebugPrintfFileComma "AUInstrumentBase::HandleProgramChange %u %u\n", inChannel, inValue);
 #endif
 	SynthGroupElement *gp = GetElForGroupID(inChannel);
 	if (gp)
@@ -650,7 +754,7 @@ OSStatus	AUInstrumentBase::HandleAllSoundOff(			UInt8 	inChannel)
 SynthNote*  AUInstrumentBase::GetAFreeNote(UInt32 inFrame)
 {
 #if DEBUG_PRINT_NOTE
-	printf("AUInstrumentBase::GetAFreeNote:  %lu available\n", mFreeNotes.Length());
+	DebugPrintfRtn(DebugPrintfFileComma "AUInstrumentBase::GetAFreeNote:  %lu available\n", mFreeNotes.Length());
 #endif
 	SynthNote *note = mFreeNotes.mHead;
 	if (note)
@@ -659,37 +763,42 @@ SynthNote*  AUInstrumentBase::GetAFreeNote(UInt32 inFrame)
 		return note;
 	}
 	
-	return VoiceStealing(inFrame, true);
+	note = VoiceStealing(inFrame, true);
+	if (note) {
+		StopStreamingVoice(note);
+		StopExpressionVoice(note);
+	}
+	return note;
 }
 
 SynthNote*  AUInstrumentBase::VoiceStealing(UInt32 inFrame, bool inKillIt)
 {
 
 #if DEBUG_PRINT_NOTE
-	printf("AUInstrumentBase::VoiceStealing\n");
+	DebugPrintfRtn(DebugPrintfFileComma "AUInstrumentBase::VoiceStealing\n");
 #endif
 	// free list was empty so we need to kill a note.
 	UInt32 startState = inKillIt ? kNoteState_FastReleased : kNoteState_Released;
 	for (UInt32 i = startState; i <= startState; --i)
 	{
 #if DEBUG_PRINT_NOTE
-		printf(" checking state %d...\n", i);
+		DebugPrintfRtn(DebugPrintfFileComma " checking state %d...\n", i);
 #endif
 		UInt32 numGroups = Groups().GetNumberOfElements();
 		for (UInt32 j = 0; j < numGroups; ++j)
 		{
 			SynthGroupElement *group = (SynthGroupElement*)Groups().GetElement(j);
 #if DEBUG_PRINT_NOTE
-			printf("\tsteal group %d   size %d\n", j, group->mNoteList[i].Length());
+			DebugPrintfRtn(DebugPrintfFileComma "\tsteal group %d   size %d\n", j, group->mNoteList[i].Length());
 #endif
 			if (group->mNoteList[i].NotEmpty()) {
 #if DEBUG_PRINT_NOTE
-				printf("\t-- not empty\n");
+				DebugPrintfRtn(DebugPrintfFileComma "\t-- not empty\n");
 #endif
 				SynthNote *note = group->mNoteList[i].FindMostQuietNote();
 				if (inKillIt) {
 #if DEBUG_PRINT_NOTE
-					printf("\t--=== KILL ===---\n");
+					DebugPrintfRtn(DebugPrintfFileComma "\t--=== KILL ===---\n");
 #endif
 					note->Kill(inFrame);
 					group->mNoteList[i].RemoveNote(note);
@@ -698,7 +807,7 @@ SynthNote*  AUInstrumentBase::VoiceStealing(UInt32 inFrame, bool inKillIt)
 					return note;
 				} else {
 #if DEBUG_PRINT_NOTE
-					printf("\t--=== FAST RELEASE ===---\n");
+					DebugPrintfRtn(DebugPrintfFileComma "\t--=== FAST RELEASE ===---\n");
 #endif
 					group->mNoteList[i].RemoveNote(note);
 					note->FastRelease(inFrame);
@@ -710,7 +819,7 @@ SynthNote*  AUInstrumentBase::VoiceStealing(UInt32 inFrame, bool inKillIt)
 		}
 	}
 #if DEBUG_PRINT_NOTE
-	printf("no notes to steal????\n");
+	DebugPrintfRtn(DebugPrintfFileComma "no notes to steal????\n");
 #endif
 	return NULL; // It should be impossible to get here. It means there were no notes to kill in any state. 
 }
@@ -734,7 +843,7 @@ OSStatus			AUMonotimbralInstrumentBase::RealTimeStartNote(
 															const MusicDeviceNoteParams &inParams)
 {
 #if DEBUG_PRINT_RENDER
-	printf("AUMonotimbralInstrumentBase::RealTimeStartNote %d\n", inNoteInstanceID);
+	DebugPrintfRtn(DebugPrintfFileComma "AUMonotimbralInstrumentBase::RealTimeStartNote %d\n", inNoteInstanceID);
 #endif
 
 	if (NumActiveNotes() + 1 > MaxActiveNotes()) 
@@ -747,6 +856,7 @@ OSStatus			AUMonotimbralInstrumentBase::RealTimeStartNote(
 	SynthPartElement *part = GetPartElement (0);	// Only one part for monotimbral
 	
 	IncNumActiveNotes();
+	StartExpressionVoice(note, inGroup);
 	inGroup->NoteOn(note, part, inNoteInstanceID, inOffsetSampleFrame, inParams);
 	
 	return noErr;
@@ -821,7 +931,7 @@ OSStatus			AUMultitimbralInstrumentBase::SetProperty(  AudioUnitPropertyID 			in
 			break;
 #endif
 		default:
-			result = MusicDeviceBase::SetProperty (inID, inScope, inElement, inData, inDataSize);
+			result = AUInstrumentBase::SetProperty (inID, inScope, inElement, inData, inDataSize);
 	}
 	
 	return result;
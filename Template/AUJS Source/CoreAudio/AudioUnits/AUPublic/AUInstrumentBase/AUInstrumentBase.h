@@ -51,9 +51,16 @@
 #include "SynthEvent.h"
 #include "SynthNote.h"
 #include "SynthElement.h"
+#include "SampleStreamer.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+enum {
+	// Global scope, read only while sample streaming is enabled: SampleStreamer::kNumberOfStatistics Float64s,
+	// in the order of SampleStreamer's statistic enum. Setting it, to anything, resets the statistics.
+	kAudioUnitProperty_SampleStreamerStatistics = 64100
+};
+
 typedef LockFreeFIFOWithFree<SynthEvent> SynthEventQueue;
 
 class AUInstrumentBase : public MusicDeviceBase
@@ -97,6 +104,23 @@ public:
 	virtual bool				StreamFormatWritable(	AudioUnitScope					scope,
 														AudioUnitElement				element);
 
+	virtual OSStatus			GetPropertyInfo(		AudioUnitPropertyID				inID,
+														AudioUnitScope					inScope,
+														AudioUnitElement				inElement,
+														UInt32 &						outDataSize,
+														Boolean &						outWritable);
+
+	virtual OSStatus			GetProperty(			AudioUnitPropertyID 			inID,
+														AudioUnitScope 					inScope,
+														AudioUnitElement			 	inElement,
+														void *							outData);
+
+	virtual OSStatus			SetProperty(			AudioUnitPropertyID 			inID,
+														AudioUnitScope 					inScope,
+														AudioUnitElement 				inElement,
+														const void *					inData,
+														UInt32 							inDataSize);
+
 	virtual OSStatus			Render(					AudioUnitRenderActionFlags &	ioActionFlags,
 														const AudioTimeStamp &			inTimeStamp,
 														UInt32							inNumberFrames);
@@ -157,6 +181,19 @@ public:
 	
 	SynthNote*			GetAFreeNote(UInt32 inFrame);
 	void				AddFreeNote(SynthNote* inNote);
+
+	// NULL unless EnableSampleStreaming was called. Each note has the streaming voice with its index, which a
+	// sampler's note starts in Attack and renders from in Render; the base stops it when the note is freed,
+	// stolen or reset.
+	SampleStreamer*		GetSampleStreamer() { return mSampleStreamer; }
+	UInt32				GetNoteIndex(const SynthNote* inNote) const
+						{
+							return (UInt32)(((const char*)inNote - (const char*)mNotes) / mNoteSize);
+						}
+
+	// A note's smoothed MPE expression (one of AUMPEZoneManager's kExpression_ values), or 0 when MPE isn't
+	// enabled or the note didn't start on a zone's channel. Call EnableMPE with the number of notes.
+	Float32				GetNoteExpression(const SynthNote* inNote, UInt32 inExpression);
 	
 	friend class SynthGroupElement;
 protected:
@@ -167,6 +204,22 @@ protected:
 	// call SetNotes in your Initialize() method to give the base class your note structures and to set the maximum 
 	// number of active notes. inNoteData should be an array of size inMaxActiveNotes.
 	void				SetNotes(UInt32 inNumNotes, UInt32 inMaxActiveNotes, SynthNote* inNotes, UInt32 inNoteSize);
+
+	// call EnableSampleStreaming in your Initialize() method, after SetNotes, to stream samples from disk: it
+	// makes a SampleStreamer with a voice for each note. Cleanup deletes it.
+	void				EnableSampleStreaming(	UInt32 inMaxChannels,
+												UInt32 inRingFrames = SampleStreamer::kDefaultRingFrames,
+												UInt32 inChunkFrames = SampleStreamer::kDefaultChunkFrames);
+	void				StopStreamingVoice(SynthNote* inNote)
+						{
+							if (mSampleStreamer) mSampleStreamer->StopVoice(GetNoteIndex(inNote));
+						}
+	
+	// bind a note to its group's MPE channel when it starts, and unbind it at note off, when it's freed and when
+	// it's stolen. These do nothing unless EnableMPE was called.
+	void				StartExpressionVoice(SynthNote* inNote, SynthGroupElement* inGroup);
+	void				StopExpressionVoice(SynthNote* inNote);
+	void				MPEAllNotesOff(MusicDeviceGroupID inGroupID);
 	
 	void				PerformEvents(   const AudioTimeStamp &			inTimeStamp);
 	OSStatus			SendPedalEvent(MusicDeviceGroupID inGroupID, UInt32 inEventType, UInt32 inOffsetSampleFrame);
@@ -198,6 +251,7 @@ private:
 	SynthNote* mNotes;	
 	SynthNoteList mFreeNotes;
 	UInt32 mNoteSize;
+	SampleStreamer* mSampleStreamer;
 	
 	AUScope			mPartScope;
 	const UInt32	mInitNumPartEls;
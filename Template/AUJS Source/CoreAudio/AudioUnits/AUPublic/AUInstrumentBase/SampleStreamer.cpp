@@ -0,0 +1,402 @@
+/*
+	SampleStreamer.cpp
+
+	See SampleStreamer.h.
+*/
+#include "SampleStreamer.h"
+#include "CAXException.h"
+#include <algorithm>
+#include <stdio.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The prefetch thread wakes at least this often even if no voice was started, so that rings drained by
+// playback are refilled.  Well below the duration of a default ring at any common sample rate.
+static const UInt64 kPrefetchPeriodNanos = 5 * 1000 * 1000;
+
+// the header's frame count, or fewer if the file doesn't hold that many.
+static SInt64	FramesInFile(DataSource *inDataSource, SInt64 inDataOffset, SInt64 inNumberFrames, const CAStreamBasicDescription &inFormat)
+{
+	SInt64 size = 0;
+	if (inFormat.mBytesPerFrame == 0 || !inDataSource->CanGetSize() || inDataSource->GetSize(size))
+		return inNumberFrames;
+	return std::max((SInt64)0, std::min(inNumberFrames, (size - inDataOffset) / inFormat.mBytesPerFrame));
+}
+
+StreamingSample::StreamingSample(	DataSource *						inDataSource,
+									SInt64								inDataOffset,
+									SInt64								inNumberFrames,
+									const CAStreamBasicDescription &	inFormat,
+									UInt32								inHeadFrames)
+	: mDataSource(inDataSource), mDataOffset(inDataOffset),
+	  mNumberFrames(FramesInFile(inDataSource, inDataOffset, inNumberFrames, inFormat)), mFormat(inFormat),
+	  mHeadFrames((UInt32)std::min((SInt64)inHeadFrames, mNumberFrames)), mReadBufferFrames(SampleStreamer::kDefaultChunkFrames)
+{
+	if (!IsSupportedFormat(mFormat))
+		XThrow(kAudioFileUnsupportedDataFormatError, "StreamingSample: format must be interleaved integer or float linear PCM");
+
+	mReadBuffer.alloc(mFormat.FramesToBytes(mReadBufferFrames));
+	mHead.alloc(mHeadFrames * NumberChannels(), true);
+
+	UInt32 framesRead = 0;
+	XThrowIfError(ReadFrames(0, mHeadFrames, mHead, framesRead), "StreamingSample: couldn't read sample head");
+	mHeadFrames = framesRead;
+}
+
+StreamingSample::~StreamingSample()
+{
+	delete mDataSource;
+}
+
+bool	StreamingSample::IsSupportedFormat(const CAStreamBasicDescription &inFormat)
+{
+	if (!inFormat.IsPCM() || !inFormat.IsInterleaved() || inFormat.mFramesPerPacket != 1)
+		return false;
+	UInt32 wordSize = inFormat.SampleWordSize();
+	if (wordSize * inFormat.NumberChannels() != inFormat.mBytesPerFrame)
+		return false;	// padded or non-packed frames
+	if (inFormat.IsFloat())
+		return wordSize == 4 && inFormat.mBitsPerChannel == 32;
+	if (inFormat.IsSignedInteger())
+		return (wordSize == 2 || wordSize == 3 || wordSize == 4) && inFormat.mBitsPerChannel == 8 * wordSize;
+	return false;
+}
+
+OSStatus	StreamingSample::ReadFrames(SInt64 inStartFrame, UInt32 inNumFrames, Float32 *outFrames, UInt32 &outFramesRead)
+{
+	outFramesRead = 0;
+	if (inStartFrame >= mNumberFrames)
+		return noErr;
+	inNumFrames = (UInt32)std::min((SInt64)inNumFrames, mNumberFrames - inStartFrame);
+
+	const UInt32 channels = NumberChannels();
+	while (outFramesRead < inNumFrames) {
+		UInt32 framesThisTime = std::min(inNumFrames - outFramesRead, mReadBufferFrames);
+		UInt32 bytesRead = 0;
+		OSStatus err = mDataSource->ReadBytes(SEEK_SET, mDataOffset + mFormat.mBytesPerFrame * (inStartFrame + outFramesRead),
+											mFormat.FramesToBytes(framesThisTime), mReadBuffer, &bytesRead);
+		UInt32 framesThisRead = bytesRead / mFormat.mBytesPerFrame;
+		ConvertToFloat(mReadBuffer, outFrames + outFramesRead * channels, framesThisRead);
+		outFramesRead += framesThisRead;
+		if (err == kAudioFileEndOfFileError || framesThisRead < framesThisTime) {
+			// the file shrank after the sample was opened.  The render thread relies on the length staying put,
+			// so play silence for the rest.
+			memset(outFrames + outFramesRead * channels, 0, (inNumFrames - outFramesRead) * channels * sizeof(Float32));
+			outFramesRead = inNumFrames;
+			break;
+		}
+		if (err) return err;
+	}
+	return noErr;
+}
+
+void	StreamingSample::ConvertToFloat(const UInt8 *inBytes, Float32 *outFrames, UInt32 inNumFrames) const
+{
+	const UInt32 count = inNumFrames * NumberChannels();
+	const UInt32 wordSize = mFormat.SampleWordSize();
+	const bool bigEndian = (mFormat.mFormatFlags & kAudioFormatFlagIsBigEndian) != 0;
+
+	if (mFormat.IsFloat()) {
+		if (mFormat.IsNativeEndian()) {
+			memcpy(outFrames, inBytes, count * sizeof(Float32));
+			return;
+		}
+		for (UInt32 i = 0; i < count; ++i, inBytes += 4) {
+			UInt32 bits = bigEndian	? ((UInt32)inBytes[0] << 24) | ((UInt32)inBytes[1] << 16) | ((UInt32)inBytes[2] << 8) | inBytes[3]
+									: ((UInt32)inBytes[3] << 24) | ((UInt32)inBytes[2] << 16) | ((UInt32)inBytes[1] << 8) | inBytes[0];
+			memcpy(&outFrames[i], &bits, sizeof(bits));
+		}
+		return;
+	}
+
+	// signed integer: assemble the sample into the top bits of a 32-bit word, then scale.
+	const Float32 scale = 1.0f / 2147483648.0f;
+	for (UInt32 i = 0; i < count; ++i, inBytes += wordSize) {
+		UInt32 word = 0;
+		for (UInt32 b = 0; b < wordSize; ++b) {
+			UInt32 byte = bigEndian ? inBytes[b] : inBytes[wordSize - 1 - b];
+			word |= byte << (24 - 8 * b);
+		}
+		outFrames[i] = (Float32)(SInt32)word * scale;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void	StreamingRingBuffer::Allocate(UInt32 inCapacityFrames, UInt32 inMaxChannels)
+{
+	// round up to a power of two so indices can be masked.
+	UInt32 capacity = 1;
+	while (capacity < inCapacityFrames)
+		capacity <<= 1;
+	mMask = capacity - 1;
+	mFrames.alloc(capacity * inMaxChannels, true);
+	Reset(inMaxChannels);
+}
+
+Float32 *	StreamingRingBuffer::GetWriteRegion(UInt32 &outMaxFrames)
+{
+	UInt32 writeIndex = (UInt32)mWriteCount & mMask;
+	outMaxFrames = std::min(SpaceAvailable(), Capacity() - writeIndex);
+	return mFrames + writeIndex * mChannels;
+}
+
+void	StreamingRingBuffer::CommitWrite(UInt32 inFrames)
+{
+	// the barrier publishes the frames before the new write count.
+	CAAtomicAdd32Barrier((SInt32)inFrames, &mWriteCount);
+}
+
+UInt32	StreamingRingBuffer::Read(Float32 *outFrames, UInt32 inNumFrames)
+{
+	CAMemoryBarrier();
+	UInt32 frames = std::min(inNumFrames, FramesAvailable());
+	UInt32 readIndex = (UInt32)mReadCount & mMask;
+	UInt32 firstPart = std::min(frames, Capacity() - readIndex);
+
+	memcpy(outFrames, mFrames + readIndex * mChannels, firstPart * mChannels * sizeof(Float32));
+	if (frames > firstPart)
+		memcpy(outFrames + firstPart * mChannels, mFrames, (frames - firstPart) * mChannels * sizeof(Float32));
+
+	CAAtomicAdd32Barrier((SInt32)frames, &mReadCount);
+	return frames;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SampleStreamer::SampleStreamer(UInt32 inNumVoices, UInt32 inMaxChannels, UInt32 inRingFrames, UInt32 inChunkFrames)
+	: mNumVoices(inNumVoices), mMaxChannels(inMaxChannels), mChunkFrames(inChunkFrames), mVoices(NULL),
+	  mPrefetchGuard("SampleStreamer prefetch"),
+	  mPrefetchThread(PrefetchEntry, this, CAPThread::kDefaultThreadPriority, false, false, "SampleStreamer prefetch"),
+	  mPrefetchShouldExit(false), mPrefetchRunning(false),
+	  mUnderrunCount(0), mUnderrunFrames(0), mActiveVoices(0), mMinBufferedFrames(0x7FFFFFFF), mBytesRead(0)
+{
+	mVoices = new Voice[mNumVoices];
+	for (UInt32 i = 0; i < mNumVoices; ++i)
+		mVoices[i].mRing.Allocate(inRingFrames, mMaxChannels);
+
+	mPrefetchRunning = true;
+	mPrefetchThread.Start();
+}
+
+SampleStreamer::~SampleStreamer()
+{
+	{
+		CAGuard::Locker locker(mPrefetchGuard);
+		mPrefetchShouldExit = true;
+		locker.NotifyAll();
+		while (mPrefetchRunning)
+			locker.Wait();
+	}
+	delete [] mVoices;
+}
+
+bool	SampleStreamer::StartVoice(UInt32 inVoice, StreamingSample *inSample)
+{
+	Voice &voice = mVoices[inVoice];
+	if (voice.mState == kVoiceState_Playing || inSample->NumberChannels() > mMaxChannels)
+		return false;
+
+	// a releasing voice may still have a read in flight for its old sample, so the ring is left to the prefetch
+	// thread: it sets it up for the new generation before writing to it again.  The head covers the wait.
+	voice.mSample = inSample;
+	voice.mPlayFrame = 0;
+	voice.mLostFrames = 0;
+	CAAtomicIncrement32Barrier(&voice.mGeneration);
+	while (!CAAtomicCompareAndSwap32Barrier(kVoiceState_Free, kVoiceState_Playing, &voice.mState)
+			&& !CAAtomicCompareAndSwap32Barrier(kVoiceState_Releasing, kVoiceState_Playing, &voice.mState))
+		;	// the prefetch thread freed it in between
+	CAAtomicIncrement32Barrier(&mActiveVoices);
+
+	// wake the prefetch thread so the tail starts loading while the head plays.  This only signals the
+	// condition variable; it never waits for the guard.
+	mPrefetchGuard.Notify();
+	return true;
+}
+
+void	SampleStreamer::StopVoice(UInt32 inVoice)
+{
+	Voice &voice = mVoices[inVoice];
+	if (CAAtomicCompareAndSwap32Barrier(kVoiceState_Playing, kVoiceState_Releasing, &voice.mState))
+		CAAtomicDecrement32Barrier(&mActiveVoices);
+}
+
+bool	SampleStreamer::IsVoicePlaying(UInt32 inVoice) const
+{
+	return mVoices[inVoice].mState == kVoiceState_Playing;
+}
+
+UInt32	SampleStreamer::RenderVoice(UInt32 inVoice, Float32 *outFrames, UInt32 inNumFrames)
+{
+	Voice &voice = mVoices[inVoice];
+	if (voice.mState != kVoiceState_Playing)
+		return 0;
+
+	StreamingSample *sample = voice.mSample;
+	const UInt32 channels = sample->NumberChannels();
+	UInt32 framesDone = 0;
+
+	// play from memory while inside the head.
+	if (voice.mPlayFrame < sample->HeadFrames()) {
+		UInt32 headFrames = std::min(inNumFrames, (UInt32)(sample->HeadFrames() - voice.mPlayFrame));
+		memcpy(outFrames, sample->Head() + voice.mPlayFrame * channels, headFrames * channels * sizeof(Float32));
+		voice.mPlayFrame += headFrames;
+		framesDone = headFrames;
+	}
+
+	// the ring holds this start's frames only once the prefetch thread has published where they begin.
+	if (voice.mReadGeneration != voice.mGeneration && voice.mRingGeneration == voice.mGeneration) {
+		CAMemoryBarrier();
+		voice.mRing.SkipTo(voice.mRingStart);
+		voice.mReadGeneration = voice.mGeneration;
+	}
+	const bool ringReady = voice.mReadGeneration == voice.mGeneration;
+
+	// frames that arrive after they were due were already played as silence.
+	if (ringReady && voice.mLostFrames) {
+		UInt32 late = std::min(voice.mLostFrames, voice.mRing.FramesAvailable());
+		voice.mRing.Discard(late);
+		voice.mLostFrames -= late;
+	}
+
+	if (framesDone < inNumFrames) {
+		UInt32 wanted = (UInt32)std::min((SInt64)(inNumFrames - framesDone), sample->NumberFrames() - voice.mPlayFrame);
+		UInt32 buffered = ringReady ? voice.mRing.FramesAvailable() : 0;
+		// near the end of the sample the ring drains by design, so only track the fill while streaming.
+		if (sample->NumberFrames() - voice.mPlayFrame > voice.mRing.Capacity()) {
+			SInt32 minimum;
+			do {
+				minimum = mMinBufferedFrames;
+			} while ((SInt32)buffered < minimum && !CAAtomicCompareAndSwap32Barrier(minimum, (SInt32)buffered, &mMinBufferedFrames));
+		}
+
+		UInt32 got = ringReady ? voice.mRing.Read(outFrames + framesDone * channels, wanted) : 0;
+		voice.mPlayFrame += got;
+		framesDone += got;
+
+		if (got < wanted) {
+			// the disk fell behind: output silence for the missing frames but keep the sample's timeline, so
+			// playback resumes in step once the prefetch thread catches up and the late frames are dropped.
+			UInt32 missing = wanted - got;
+			voice.mLostFrames += missing;
+			memset(outFrames + framesDone * channels, 0, missing * channels * sizeof(Float32));
+			framesDone += missing;
+			CAAtomicIncrement32(&mUnderrunCount);
+			CAAtomicAdd32Barrier((SInt32)missing, &mUnderrunFrames);
+		}
+	}
+
+	if (voice.mPlayFrame >= sample->NumberFrames())
+		StopVoice(inVoice);
+
+	return framesDone;
+}
+
+void	SampleStreamer::GetStatistics(Float64 *outStatistics) const
+{
+	outStatistics[kStatistic_UnderrunCount] = mUnderrunCount;
+	outStatistics[kStatistic_UnderrunFrames] = mUnderrunFrames;
+	outStatistics[kStatistic_ActiveVoices] = mActiveVoices;
+	outStatistics[kStatistic_MinimumBufferedFrames] = mMinBufferedFrames;
+	CAMutex::Locker locker(mPrefetchGuard);
+	outStatistics[kStatistic_BytesRead] = (Float64)mBytesRead;
+}
+
+void	SampleStreamer::ResetStatistics()
+{
+	// take away what was counted so far rather than storing 0, so increments made meanwhile survive.
+	CAAtomicAdd32Barrier(-mUnderrunCount, &mUnderrunCount);
+	CAAtomicAdd32Barrier(-mUnderrunFrames, &mUnderrunFrames);
+	SInt32 minimum;
+	do {
+		minimum = mMinBufferedFrames;
+	} while (!CAAtomicCompareAndSwap32Barrier(minimum, 0x7FFFFFFF, &mMinBufferedFrames));
+
+	CAMutex::Locker locker(mPrefetchGuard);
+	mBytesRead = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void *	SampleStreamer::PrefetchEntry(void *inStreamer)
+{
+	static_cast<SampleStreamer *>(inStreamer)->PrefetchLoop();
+	return NULL;
+}
+
+void	SampleStreamer::PrefetchLoop()
+{
+	for (;;) {
+		// keep reading as long as some ring had room; sleep once every ring is full or idle.
+		bool didWork;
+		do {
+			didWork = false;
+			for (UInt32 i = 0; i < mNumVoices; ++i) {
+				Voice &voice = mVoices[i];
+				if (voice.mState == kVoiceState_Releasing) {
+					CAAtomicCompareAndSwap32Barrier(kVoiceState_Releasing, kVoiceState_Free, &voice.mState);
+				} else if (voice.mState == kVoiceState_Playing) {
+					didWork |= FillVoice(voice);
+				}
+			}
+		} while (didWork && !mPrefetchShouldExit);
+
+		CAGuard::Locker locker(mPrefetchGuard);
+		if (mPrefetchShouldExit)
+			break;
+		locker.WaitFor(kPrefetchPeriodNanos);
+	}
+
+	CAGuard::Locker locker(mPrefetchGuard);
+	mPrefetchRunning = false;
+	locker.NotifyAll();
+}
+
+bool	SampleStreamer::FillVoice(Voice &inVoice)
+{
+	SInt32 generation = inVoice.mGeneration;
+	if (generation != inVoice.mFillGeneration) {
+		// the voice was started again: drop the old sample and tell the render thread where the new one's frames
+		// will begin.  If it's restarted once more meanwhile, the next pass catches that.
+		CAMemoryBarrier();
+		inVoice.mFillSample = inVoice.mSample;
+		inVoice.mDiskFrame = inVoice.mFillSample->HeadFrames();
+		inVoice.mFillGeneration = generation;
+		inVoice.mRingStart = inVoice.mRing.Restart(inVoice.mFillSample->NumberChannels());
+		CAMemoryBarrier();
+		inVoice.mRingGeneration = generation;
+	}
+
+	StreamingSample *sample = inVoice.mFillSample;
+	if (inVoice.mDiskFrame >= sample->NumberFrames())
+		return false;
+
+	// only read whole chunks (or the end of the sample) to keep reads large.
+	UInt32 maxFrames = 0;
+	Float32 *region = inVoice.mRing.GetWriteRegion(maxFrames);
+	UInt32 framesToRead = (UInt32)std::min((SInt64)std::min(maxFrames, mChunkFrames), sample->NumberFrames() - inVoice.mDiskFrame);
+	if (framesToRead < mChunkFrames && inVoice.mDiskFrame + framesToRead < sample->NumberFrames())
+		return false;
+
+	UInt32 framesRead = 0;
+	OSStatus err = sample->ReadFrames(inVoice.mDiskFrame, framesToRead, region, framesRead);
+	if (err) {
+		if (inVoice.mGeneration != generation)
+			return true;
+		DebugMessageN1("SampleStreamer: read failed (%d), stopping voice", (int)err);
+		if (CAAtomicCompareAndSwap32Barrier(kVoiceState_Playing, kVoiceState_Releasing, &inVoice.mState))
+			CAAtomicDecrement32Barrier(&mActiveVoices);
+		return false;
+	}
+
+	if (inVoice.mGeneration != generation)
+		return true;	// restarted during the read; these frames belong to the old sample
+
+	inVoice.mRing.CommitWrite(framesRead);
+	inVoice.mDiskFrame += framesRead;
+	{
+		CAMutex::Locker locker(mPrefetchGuard);
+		mBytesRead += sample->Format().FramesToBytes(framesRead);
+	}
+	return framesRead > 0;
+}
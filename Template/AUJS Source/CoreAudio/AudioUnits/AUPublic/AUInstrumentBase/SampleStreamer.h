@@ -0,0 +1,199 @@
+/*
+	SampleStreamer.h
+
+	Disk streaming support for sample playback instruments.
+
+	A StreamingSample keeps the first few thousand frames ("head") of a PCM sample in memory and
+	leaves the remainder ("tail") on disk behind a DataSource.  A SampleStreamer owns a fixed pool
+	of voices, each with its own single-reader/single-writer ring buffer, and a prefetch thread that
+	keeps those rings topped up from disk.  The render thread never touches the disk: it plays the
+	head straight from memory while the prefetch thread catches up, then plays from the ring.
+*/
+#ifndef __SampleStreamer__
+#define __SampleStreamer__
+
+#include "DataSource.h"
+#include "CAStreamBasicDescription.h"
+#include "CAAutoDisposer.h"
+#include "CAAtomic.h"
+#include "CAGuard.h"
+#include "CAPThread.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A linear PCM sample, decoded to interleaved Float32.  The sample takes ownership of the data source.
+class StreamingSample
+{
+public:
+							StreamingSample(	DataSource *						inDataSource,
+												SInt64								inDataOffset,
+												SInt64								inNumberFrames,
+												const CAStreamBasicDescription &	inFormat,
+												UInt32								inHeadFrames);
+							~StreamingSample();
+
+	const CAStreamBasicDescription &	Format() const { return mFormat; }
+	UInt32					NumberChannels() const { return mFormat.NumberChannels(); }
+	SInt64					NumberFrames() const { return mNumberFrames; }
+	UInt32					HeadFrames() const { return mHeadFrames; }
+	const Float32 *			Head() const { return mHead; }
+
+	// Reads and converts up to inNumFrames frames starting at inStartFrame.  Only the prefetch thread calls this
+	// once the sample is playing, so the data source's file position is never shared.  Frames missing because the
+	// file shrank after the sample was opened read as silence: NumberFrames() never changes.
+	OSStatus				ReadFrames(SInt64 inStartFrame, UInt32 inNumFrames, Float32 *outFrames, UInt32 &outFramesRead);
+
+	static bool				IsSupportedFormat(const CAStreamBasicDescription &inFormat);
+
+private:
+							StreamingSample(const StreamingSample&);
+	StreamingSample&		operator=(const StreamingSample&);
+
+	void					ConvertToFloat(const UInt8 *inBytes, Float32 *outFrames, UInt32 inNumFrames) const;
+
+	DataSource *			mDataSource;
+	SInt64					mDataOffset;
+	const SInt64			mNumberFrames;		// clamped to the file when the sample is opened
+	CAStreamBasicDescription	mFormat;
+	UInt32					mHeadFrames;
+	CAAutoFree<Float32>		mHead;
+	CAAutoFree<UInt8>		mReadBuffer;
+	UInt32					mReadBufferFrames;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Single producer (prefetch thread), single consumer (render thread) ring of interleaved frames.
+// The read and write counters only ever increase; the indices are taken modulo the capacity.
+class StreamingRingBuffer
+{
+public:
+							StreamingRingBuffer() : mMask(0), mChannels(0), mReadCount(0), mWriteCount(0) {}
+
+	void					Allocate(UInt32 inCapacityFrames, UInt32 inMaxChannels);
+	// only while neither side is active.  inChannels must not exceed the allocated maximum.
+	void					Reset(UInt32 inChannels) { mChannels = inChannels; mReadCount = 0; mWriteCount = 0; }
+
+	// producer side: start over with inChannels per frame, while the consumer may still be active.  Returns the
+	// write count the new frames begin at; the consumer must SkipTo it before reading them.
+	SInt32					Restart(UInt32 inChannels) { mChannels = inChannels; return mWriteCount; }
+	// consumer side: drop every frame before inCount, or the next inFrames frames.
+	void					SkipTo(SInt32 inCount) { CAAtomicAdd32Barrier(inCount - mReadCount, &mReadCount); }
+	void					Discard(UInt32 inFrames) { CAAtomicAdd32Barrier((SInt32)inFrames, &mReadCount); }
+
+	UInt32					Capacity() const { return mMask + 1; }
+	UInt32					FramesAvailable() const { return (UInt32)(mWriteCount - mReadCount); }
+	UInt32					SpaceAvailable() const { return Capacity() - FramesAvailable(); }
+
+	// producer side: return the contiguous region at the write position, then commit what was written.
+	Float32 *				GetWriteRegion(UInt32 &outMaxFrames);
+	void					CommitWrite(UInt32 inFrames);
+
+	// consumer side.
+	UInt32					Read(Float32 *outFrames, UInt32 inNumFrames);
+
+private:
+	CAAutoFree<Float32>		mFrames;
+	UInt32					mMask;
+	UInt32					mChannels;
+	volatile SInt32			mReadCount;
+	volatile SInt32			mWriteCount;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class SampleStreamer
+{
+public:
+	enum {
+		kDefaultRingFrames = 16384,
+		kDefaultChunkFrames = 4096
+	};
+
+	// Values reported by GetStatistics(), in this order.  AUInstrumentBase publishes them as
+	// kAudioUnitProperty_SampleStreamerStatistics, which a UI can show as a JSPropDesc::kJSNumberArray.
+	enum {
+		kStatistic_UnderrunCount = 0,		// render cycles in which a voice ran out of streamed data
+		kStatistic_UnderrunFrames,			// total frames replaced by silence
+		kStatistic_ActiveVoices,			// not affected by ResetStatistics()
+		kStatistic_MinimumBufferedFrames,	// lowest ring fill seen by the render thread since the last reset
+		kStatistic_BytesRead,				// file bytes read by the prefetch thread
+		kNumberOfStatistics
+	};
+
+							SampleStreamer(UInt32 inNumVoices, UInt32 inMaxChannels, UInt32 inRingFrames = kDefaultRingFrames, UInt32 inChunkFrames = kDefaultChunkFrames);
+							~SampleStreamer();
+
+	UInt32					NumberVoices() const { return mNumVoices; }
+
+	// render thread.  StartVoice returns false if the voice is still playing; a voice that was stopped can be
+	// started again right away, even while the prefetch thread is still reading for its previous sample.
+	bool					StartVoice(UInt32 inVoice, StreamingSample *inSample);
+	void					StopVoice(UInt32 inVoice);
+	bool					IsVoicePlaying(UInt32 inVoice) const;
+	// Writes up to inNumFrames interleaved frames of the voice's sample.  Frames missing because the disk fell
+	// behind are filled with silence and counted as an underrun.  Returns the number of frames written, which is
+	// less than inNumFrames only when the sample ends.
+	UInt32					RenderVoice(UInt32 inVoice, Float32 *outFrames, UInt32 inNumFrames);
+
+	// any thread.  The render thread's counters are only changed atomically, and the prefetch thread's
+	// under mPrefetchGuard, so a reset never loses or tears a concurrent update.
+	void					GetStatistics(Float64 *outStatistics) const;
+	void					ResetStatistics();
+
+private:
+							SampleStreamer(const SampleStreamer&);
+	SampleStreamer&			operator=(const SampleStreamer&);
+
+	enum {
+		kVoiceState_Free = 0,		// the prefetch thread is done with it
+		kVoiceState_Playing,		// render thread reads, prefetch thread writes
+		kVoiceState_Releasing		// the prefetch thread returns it to free once it is no longer writing
+	};
+
+	// Every StartVoice begins a new generation.  The prefetch thread notices it before it next writes to the
+	// ring, switches to the new sample, and publishes where the new frames begin; the render thread reads
+	// nothing from the ring until it has seen that, so frames still in flight for an older start are skipped.
+	struct Voice
+	{
+		Voice() : mSample(0), mPlayFrame(0), mLostFrames(0), mGeneration(0), mReadGeneration(0), mFillSample(0), mDiskFrame(0),
+				  mFillGeneration(0), mRingStart(0), mRingGeneration(0), mState(kVoiceState_Free) {}
+
+		StreamingSample *		mSample;			// written by the render thread before it bumps mGeneration
+		SInt64					mPlayFrame;			// render thread only
+		UInt32					mLostFrames;		// render thread only: played as silence, still to drop from the ring
+		volatile SInt32			mGeneration;
+		SInt32					mReadGeneration;	// render thread only: the generation it has skipped the ring to
+
+		StreamingSample *		mFillSample;		// prefetch thread only
+		SInt64					mDiskFrame;			// prefetch thread only
+		SInt32					mFillGeneration;	// prefetch thread only
+		volatile SInt32			mRingStart;			// the ring write count where mRingGeneration's frames begin
+		volatile SInt32			mRingGeneration;
+
+		StreamingRingBuffer		mRing;
+		volatile SInt32			mState;
+	};
+
+	static void *			PrefetchEntry(void *inStreamer);
+	void					PrefetchLoop();
+	bool					FillVoice(Voice &inVoice);
+
+	UInt32					mNumVoices;
+	UInt32					mMaxChannels;
+	UInt32					mChunkFrames;
+	Voice *					mVoices;
+
+	mutable CAGuard			mPrefetchGuard;
+	CAPThread				mPrefetchThread;
+	bool					mPrefetchShouldExit;
+	bool					mPrefetchRunning;
+
+	volatile SInt32			mUnderrunCount;
+	volatile SInt32			mUnderrunFrames;
+	volatile SInt32			mActiveVoices;
+	volatile SInt32			mMinBufferedFrames;
+	SInt64					mBytesRead;			// guarded by mPrefetchGuard
+};
+
+#endif
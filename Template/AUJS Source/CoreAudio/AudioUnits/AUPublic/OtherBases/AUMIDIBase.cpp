@@ -39,6 +39,7 @@
 			POSSIBILITY OF SUCH DAMAGE.
 */
 #include "AUMIDIBase.h"
+#include "AUMPEZoneManager.h"
 #include <CoreMIDI/CoreMIDI.h>
 #include "CAXException.h"
 
@@ -59,7 +60,9 @@ enum
 };
 
 AUMIDIBase::AUMIDIBase(AUBase* inBase) 
-	: mAUBaseInstance (*inBase) 
+	: mAUBaseInstance (*inBase),
+	  mMPEZones (NULL),
+	  mMIDIParserHandler (*this)
 {
 #if CA_AUTO_MIDI_MAP
 	mMapManager = new CAAUMIDIMapManager();
@@ -72,6 +75,13 @@ AUMIDIBase::~AUMIDIBase()
 	if (mMapManager) 
 		delete mMapManager;
 #endif
+	delete mMPEZones;
+}
+
+void		AUMIDIBase::EnableMPE(UInt32 inMaxVoices)
+{
+	if (!mMPEZones)
+		mMPEZones = new AUMPEZoneManager(inMaxVoices);
 }
 
 #if TARGET_API_MAC_OSX
@@ -100,6 +110,9 @@ OSStatus			AUMIDIBase::DelegateGetPropertyInfo(AudioUnitPropertyID				inID,
 		ca_require(inScope == kAudioUnitScope_Global, InvalidScope);
 		ca_require(inElement == 0, InvalidElement);
 		outWritable = true;
+			// the host sizes its buffer here before getting the maps, so a hot map learned on the render
+			// thread joins them now rather than between the two calls
+		mMapManager->ApplyPendingHotMap ();
 		outDataSize = sizeof (AUParameterMIDIMapping)*mMapManager->NumMaps();
 		result = noErr;
 		break;
@@ -230,7 +243,7 @@ OSStatus			AUMIDIBase::DelegateSetProperty(	AudioUnitPropertyID 			inID,
 			ca_require(inScope == kAudioUnitScope_Global, InvalidScope);
 			ca_require(inElement == 0, InvalidElement);
 			AUParameterMIDIMapping & map = *((AUParameterMIDIMapping*)inData);
-			mMapManager->SetHotMapping (map);			
+			mMapManager->SetHotMapping (map, mAUBaseInstance);			
 			result = noErr;
 			break;
 		}
@@ -266,46 +279,6 @@ OSStatus			AUMIDIBase::DelegateSetProperty(	AudioUnitPropertyID 			inID,
 #pragma mark ____MidiDispatch
 
 
-inline const Byte *	NextMIDIEvent(const Byte *event, const Byte *end)
-{
-	Byte c = *event;
-	switch (c >> 4) {
-	default:	// data byte -- assume in sysex
-		while ((*++event & 0x80) == 0 && event < end)
-			;
-		break;
-	case 0x8:
-	case 0x9:
-	case 0xA:
-	case 0xB:
-	case 0xE:
-		event += 3;
-		break;
-	case 0xC:
-	case 0xD:
-		event += 2;
-		break;
-	case 0xF:
-		switch (c) {
-		case 0xF0:
-			while ((*++event & 0x80) == 0 && event < end)
-				;
-			break;
-		case 0xF1:
-		case 0xF3:
-			event += 2;
-			break;
-		case 0xF2:
-			event += 3;
-			break;
-		default:
-			++event;
-			break;
-		}
-	}
-	return (event >= end) ? end : event;
-}
-
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 //	AUMIDIBase::HandleMIDIPacketList
 //
@@ -317,18 +290,11 @@ OSStatus			AUMIDIBase::HandleMIDIPacketList(const MIDIPacketList *pktlist)
 	int nPackets = pktlist->numPackets;
 	const MIDIPacket *pkt = pktlist->packet;
 	
+	// the parser keeps its state between packets and packet lists, so running status and
+	// SysEx split across packets both come out whole. The timestamp is the start frame.
 	while (nPackets-- > 0) {
-		const Byte *event = pkt->data, *packetEnd = event + pkt->length;
-		long startFrame = (long)pkt->timeStamp;
-		while (event < packetEnd) {
-			Byte status = event[0];
-			if (status & 0x80) {
-				// really a status byte (not sysex continuation)
-				HandleMidiEvent(status & 0xF0, status & 0x0F, event[1], event[2], startFrame);
-					// note that we're generating a bogus channel number for system messages (0xF0-FF)
-			}
-			event = NextMIDIEvent(event, packetEnd);
-		}
+		const Byte *packetEnd = pkt->data + pkt->length;
+		mMIDIParser.Parse(pkt->data, pkt->length, pkt->timeStamp, mMIDIParserHandler);
 		pkt = reinterpret_cast<const MIDIPacket *>(packetEnd);
 	}
 	return noErr;
@@ -341,7 +307,7 @@ OSStatus			AUMIDIBase::HandleMIDIPacketList(const MIDIPacketList *pktlist)
 OSStatus 	AUMIDIBase::HandleMidiEvent(UInt8 status, UInt8 channel, UInt8 data1, UInt8 data2, UInt32 inStartFrame)
 {
 	if (!mAUBaseInstance.IsInitialized()) return kAudioUnitErr_Uninitialized;
-		
+	
 #if CA_AUTO_MIDI_MAP	
 // you potentially have a choice to make here - if a param mapping matches, do you still want to process the 
 // MIDI event or not. The default behaviour is to continue on with the MIDI event.
@@ -353,6 +319,11 @@ OSStatus 	AUMIDIBase::HandleMidiEvent(UInt8 status, UInt8 channel, UInt8 data1,
 	}	
 #endif	
 	
+		// per-note expression is a table write; skip the generic dispatch entirely. This comes after the
+		// parameter maps so that parameters learned on bend, pressure or CC 74 still follow them.
+	if (mMPEZones && mMPEZones->HandleMIDI(status, channel, data1, data2))
+		return noErr;
+	
 	OSStatus result = noErr;
 	
 	switch(status)
@@ -42,12 +42,14 @@
 #define __AUMIDIBase_h__
 
 #include "AUBase.h"
+#include "CAMIDIParser.h"
 
 #if CA_AUTO_MIDI_MAP
 	#include "CAAUMIDIMapManager.h"
 #endif
 
 struct MIDIPacketList;
+class AUMPEZoneManager;
 
 // ________________________________________________________________________
 //	MusicDeviceBase
@@ -185,6 +187,16 @@ protected:
 	
 #endif
 
+	/*! @method EnableMPE */
+	// Once enabled, MPE per-note expression on member channels goes to the zone manager rather than through
+	// HandlePitchWheel, HandleChannelPressure and HandleControlChange, though parameter MIDI maps still see
+	// it.  AUInstrumentBase binds its notes to it,
+	// smooths it each render and clears it on Reset and all notes off; its notes read their values with
+	// GetNoteExpression.
+	void						EnableMPE(UInt32 inMaxVoices);
+	/*! @method GetMPEZoneManager */
+	AUMPEZoneManager			*GetMPEZoneManager() { return mMPEZones; }
+
 												
 private:
 	/*! @var mAUBaseInstance */
@@ -195,6 +207,30 @@ private:
 	CAAUMIDIMapManager			* mMapManager;
 #endif
 	
+	/*! @var mMPEZones */
+	AUMPEZoneManager			* mMPEZones;
+
+	// HandleMIDIPacketList's parser feeds complete messages back into HandleMidiEvent and SysEx
+	class MIDIParserHandler : public CAMIDIParser::Handler {
+	public:
+						MIDIParserHandler(AUMIDIBase &inOwner) : mOwner(inOwner) {}
+		virtual void	MIDIMessage(UInt8 inStatus, UInt8 inData1, UInt8 inData2, UInt64 inTimeStamp)
+						{
+							mOwner.HandleMidiEvent(inStatus & 0xF0, inStatus & 0x0F, inData1, inData2, (UInt32)inTimeStamp);
+								// note that we're generating a bogus channel number for system messages (0xF0-FF)
+						}
+		virtual void	MIDISysEx(const UInt8 *inData, UInt32 inLength, UInt64 inTimeStamp)
+						{
+							mOwner.SysEx(inData, inLength);
+						}
+	private:
+		AUMIDIBase &	mOwner;
+	};
+	
+	/*! @var mMIDIParser */
+	CAMIDIParser				mMIDIParser;
+	MIDIParserHandler			mMIDIParserHandler;
+	
 public:
 #if !TARGET_OS_IPHONE
 	// component dispatcher
@@ -0,0 +1,335 @@
+/*
+	AUMPEZoneManager.cpp
+*/
+#include "AUMPEZoneManager.h"
+#include <math.h>
+#include <string.h>
+
+enum
+{
+	kMidiMessage_ControlChange 		= 0xB0,
+	kMidiMessage_ChannelPressure 	= 0xD0,
+	kMidiMessage_PitchWheel 		= 0xE0,
+
+	kMidiController_DataEntry		= 6,
+	kMidiController_Timbre			= 74,
+	kMidiController_RPN_LSB			= 100,
+	kMidiController_RPN_MSB			= 101,
+	kMidiController_AllSoundOff		= 120,
+	kMidiController_AllNotesOff		= 123,
+
+	kRPN_PitchBendSensitivity		= 0,
+	kRPN_MPEConfiguration			= 6,
+	kRPN_Null						= 0x3fff
+};
+
+static const Float32 kDefaultTimbre = 64.f / 127.f;
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	AUMPEZoneManager::AUMPEZoneManager
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+AUMPEZoneManager::AUMPEZoneManager(UInt32 inMaxVoices)
+	: mMaxVoices(inMaxVoices),
+	  mStateSequence(0),
+	  mSmoothingCoefficient(1.f)
+{
+	mVoiceChannel.alloc(mMaxVoices);
+	for (UInt32 i = 0; i < kNumberOfExpressions; ++i)
+		mVoiceValues[i].alloc(mMaxVoices, true);
+
+	mState.mLowerMembers = 0;
+	mState.mUpperMembers = 0;
+	for (UInt32 zone = 0; zone < 2; ++zone) {
+		mState.mMemberBendRange[zone] = kDefaultMemberPitchBendRange;
+		mState.mMasterBendRange[zone] = kDefaultMasterPitchBendRange;
+	}
+
+	Reset();
+
+	// until the controller says otherwise, assume the common single-zone layout
+	SetLowerZone(15);
+	mRenderState = mState;
+}
+
+AUMPEZoneManager::~AUMPEZoneManager()
+{
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	AUMPEZoneManager::Reset
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void	AUMPEZoneManager::Reset()
+{
+	BeginStateChange();
+	for (UInt8 ch = 0; ch < 16; ++ch) {
+		ResetChannel(ch);
+		mRPN[ch] = kRPN_Null;
+		mDataEntryMSB[ch] = 0;
+	}
+	EndStateChange();
+	StopAllVoices();
+}
+
+void	AUMPEZoneManager::ResetChannel(UInt8 inChannel)
+{
+	mState.mChannelValues[kExpression_PitchBend][inChannel] = 0.f;
+	mState.mChannelValues[kExpression_Pressure][inChannel] = 0.f;
+	mState.mChannelValues[kExpression_Timbre][inChannel] = kDefaultTimbre;
+}
+
+void	AUMPEZoneManager::UpdateRenderState()
+{
+		// a few tries are plenty, since a change is only a handful of stores; past that the MIDI thread has been
+		// preempted mid change, and the last copy is better than waiting for it
+	for (int tries = 0; tries < 4; ++tries) {
+		SInt32 sequence = mStateSequence;
+		if (sequence & 1)
+			continue;
+		CAMemoryBarrier();
+		ZoneState state;
+		memcpy(&state, &mState, sizeof(state));
+		CAMemoryBarrier();
+		if (mStateSequence == sequence) {
+			mRenderState = state;
+			return;
+		}
+	}
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	Zones
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void	AUMPEZoneManager::SetLowerZone(UInt32 inMemberChannels)
+{
+	BeginStateChange();
+	mState.mLowerMembers = inMemberChannels > 15 ? 15 : inMemberChannels;
+		// the most recently configured zone wins any overlap
+	if (mState.mLowerMembers + mState.mUpperMembers > 14)
+		mState.mUpperMembers = mState.mLowerMembers >= 14 ? 0 : 14 - mState.mLowerMembers;
+	UpdateZones();
+	EndStateChange();
+}
+
+void	AUMPEZoneManager::SetUpperZone(UInt32 inMemberChannels)
+{
+	BeginStateChange();
+	mState.mUpperMembers = inMemberChannels > 15 ? 15 : inMemberChannels;
+	if (mState.mLowerMembers + mState.mUpperMembers > 14)
+		mState.mLowerMembers = mState.mUpperMembers >= 14 ? 0 : 14 - mState.mUpperMembers;
+	UpdateZones();
+	EndStateChange();
+}
+
+void	AUMPEZoneManager::UpdateZones()
+{
+	for (UInt8 ch = 0; ch < 16; ++ch)
+		mState.mZone[ch] = kNoZone;
+
+	if (mState.mLowerMembers > 0)
+		for (UInt32 ch = 0; ch <= mState.mLowerMembers; ++ch)
+			mState.mZone[ch] = kLowerZone;
+
+	if (mState.mUpperMembers > 0)
+		for (SInt32 ch = 15; ch >= 15 - (SInt32)mState.mUpperMembers; --ch)
+			mState.mZone[ch] = kUpperZone;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	AUMPEZoneManager::SetSmoothingTime
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void	AUMPEZoneManager::SetSmoothingTime(Float64 inSampleRate, Float64 inSeconds)
+{
+	if (inSeconds <= 0. || inSampleRate <= 0.)
+		mSmoothingCoefficient = 1.f;
+	else
+		mSmoothingCoefficient = 1.f - expf(-1.f / (Float32)(inSeconds * inSampleRate));
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	AUMPEZoneManager::HandleMIDI
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool	AUMPEZoneManager::HandleMIDI(UInt8 inStatus, UInt8 inChannel, UInt8 inData1, UInt8 inData2)
+{
+	UInt8 ch = inChannel & 0xF;
+
+	switch (inStatus) {
+	case kMidiMessage_PitchWheel:
+		if (mState.mZone[ch] == kNoZone)
+			return false;
+			// master channel bend is stored in the master channel's slot and applies to the whole zone
+		BeginStateChange();
+		mState.mChannelValues[kExpression_PitchBend][ch] = (Float32)((SInt32)((inData2 << 7) | inData1) - 8192) / 8192.f;
+		EndStateChange();
+		return true;
+
+	case kMidiMessage_ChannelPressure:
+		if (!IsMemberChannel(ch))
+			return false;
+		BeginStateChange();
+		mState.mChannelValues[kExpression_Pressure][ch] = inData1 / 127.f;
+		EndStateChange();
+		return true;
+
+	case kMidiMessage_ControlChange:
+		switch (inData1) {
+		case kMidiController_Timbre:
+			if (!IsMemberChannel(ch))
+				return false;
+			BeginStateChange();
+			mState.mChannelValues[kExpression_Timbre][ch] = inData2 / 127.f;
+			EndStateChange();
+			return true;
+
+			// the render thread unbinds the voices when the generic handlers pass these on
+		case kMidiController_AllSoundOff:
+		case kMidiController_AllNotesOff:
+			{
+				UInt8 zone = mState.mZone[ch];
+				bool wholeZone = IsMasterChannel(mState, ch);
+				BeginStateChange();
+				for (UInt8 c = 0; c < 16; ++c)
+					if (c == ch || (wholeZone && mState.mZone[c] == zone))
+						ResetChannel(c);
+				EndStateChange();
+			}
+			return false;
+
+			// RPNs are tracked on every channel, since the configuration message turns zones on, but
+			// they're still passed on so the generic handlers see them too
+		case kMidiController_RPN_MSB:
+			mRPN[ch] = (UInt16)((inData2 << 7) | (mRPN[ch] & 0x7F));
+			return false;
+		case kMidiController_RPN_LSB:
+			mRPN[ch] = (UInt16)((mRPN[ch] & (0x7F << 7)) | inData2);
+			return false;
+		case kMidiController_DataEntry:
+			mDataEntryMSB[ch] = inData2;
+			HandleRPN(ch);
+			return false;
+		}
+		return false;
+	}
+	return false;
+}
+
+void	AUMPEZoneManager::HandleRPN(UInt8 inChannel)
+{
+	UInt8 value = mDataEntryMSB[inChannel];
+
+	switch (mRPN[inChannel]) {
+	case kRPN_MPEConfiguration:
+			// a controller that wants a different member bend range sends it after the configuration message
+		if (inChannel == 0) {
+			SetLowerZone(value);
+			BeginStateChange();
+			mState.mMemberBendRange[kLowerZone] = kDefaultMemberPitchBendRange;
+			EndStateChange();
+		} else if (inChannel == 15) {
+			SetUpperZone(value);
+			BeginStateChange();
+			mState.mMemberBendRange[kUpperZone] = kDefaultMemberPitchBendRange;
+			EndStateChange();
+		}
+		break;
+
+	case kRPN_PitchBendSensitivity:
+		{
+			UInt8 zone = mState.mZone[inChannel];
+			if (zone == kNoZone)
+				break;
+				// sent on any member channel, it applies to all of them
+			BeginStateChange();
+			if (IsMasterChannel(mState, inChannel))
+				mState.mMasterBendRange[zone] = value;
+			else
+				mState.mMemberBendRange[zone] = value;
+			EndStateChange();
+		}
+		break;
+	}
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	Voices
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Float32	AUMPEZoneManager::ChannelTarget(const ZoneState &inState, UInt32 inExpression, UInt8 inChannel)
+{
+	if (inExpression != kExpression_PitchBend)
+		return inState.mChannelValues[inExpression][inChannel];
+
+	UInt8 zone = inState.mZone[inChannel];
+	if (zone == kNoZone)
+		return 0.f;
+
+	UInt8 master = zone == kLowerZone ? 0 : 15;
+	Float32 bend = inState.mChannelValues[kExpression_PitchBend][master] * inState.mMasterBendRange[zone];
+	if (inChannel != master)
+		bend += inState.mChannelValues[kExpression_PitchBend][inChannel] * inState.mMemberBendRange[zone];
+	return bend;
+}
+
+void	AUMPEZoneManager::StartVoice(UInt32 inVoice, UInt8 inChannel)
+{
+	if (inVoice >= mMaxVoices) return;
+
+		// the note's initial expression may have arrived since the last slice
+	UpdateRenderState();
+	mVoiceChannel[inVoice] = inChannel & 0xF;
+	for (UInt32 i = 0; i < kNumberOfExpressions; ++i)
+		mVoiceValues[i][inVoice] = ChannelTarget(mRenderState, i, inChannel & 0xF);
+}
+
+void	AUMPEZoneManager::StopVoice(UInt32 inVoice)
+{
+	if (inVoice >= mMaxVoices) return;
+
+	mVoiceChannel[inVoice] = -1;
+}
+
+void	AUMPEZoneManager::StopAllVoices()
+{
+	for (UInt32 v = 0; v < mMaxVoices; ++v)
+		mVoiceChannel[v] = -1;
+}
+
+void	AUMPEZoneManager::AllNotesOff(UInt8 inChannel)
+{
+	UInt8 ch = inChannel & 0xF;
+	UInt8 zone = mRenderState.mZone[ch];
+	bool wholeZone = IsMasterChannel(mRenderState, ch);
+	
+	for (UInt8 c = 0; c < 16; ++c) {
+		if (c != ch && !(wholeZone && mRenderState.mZone[c] == zone))
+			continue;
+		for (UInt32 v = 0; v < mMaxVoices; ++v)
+			if (mVoiceChannel[v] == (SInt8)c)
+				mVoiceChannel[v] = -1;
+	}
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	AUMPEZoneManager::Smooth
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void	AUMPEZoneManager::Smooth(UInt32 inFrames)
+{
+		// a one pole step per frame, compounded over the slice
+	Float32 coefficient = mSmoothingCoefficient >= 1.f ? 1.f : 1.f - powf(1.f - mSmoothingCoefficient, (Float32)inFrames);
+
+	UpdateRenderState();
+
+	for (UInt32 i = 0; i < kNumberOfExpressions; ++i) {
+		Float32 *values = mVoiceValues[i];
+		for (UInt32 v = 0; v < mMaxVoices; ++v) {
+			SInt8 ch = mVoiceChannel[v];
+			if (ch < 0) continue;
+			values[v] += coefficient * (ChannelTarget(mRenderState, i, (UInt8)ch) - values[v]);
+		}
+	}
+}
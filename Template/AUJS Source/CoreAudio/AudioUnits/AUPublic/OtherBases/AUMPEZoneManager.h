@@ -0,0 +1,137 @@
+/*
+	AUMPEZoneManager.h
+
+	MIDI Polyphonic Expression (MPE) support for AUMIDIBase.
+
+	In MPE a controller gives each sounding note its own member channel, and sends pitch bend, channel pressure
+	and CC 74 on that channel to shape just that note.  The zone manager stores the latest value of each of those
+	per channel, so handling an expression message is a single table write no matter how many voices are playing.
+	Voices are bound to the channel of the note that started them, and once per render slice Smooth() glides
+	each bound voice's values toward its channel's, writing them into per-voice arrays the instrument's render
+	loop can read directly.
+
+	HandleMIDI, the zone setters and Reset belong to the thread that delivers MIDI; StartVoice, StopVoice,
+	AllNotesOff and Smooth to the render thread.  The zones and channel values are published between them with
+	a sequence count, so the render thread never sees a half written layout and the MIDI thread never waits.
+*/
+#ifndef __AUMPEZoneManager_h__
+#define __AUMPEZoneManager_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+#include "CAAutoDisposer.h"
+#include "CAAtomic.h"
+
+// ________________________________________________________________________
+//	AUMPEZoneManager
+//
+class AUMPEZoneManager {
+public:
+	enum {
+		kExpression_PitchBend = 0,		// semitones, member channel bend plus the zone's master channel bend
+		kExpression_Pressure,			// 0 - 1
+		kExpression_Timbre,				// 0 - 1, from CC 74
+		kNumberOfExpressions
+	};
+
+	enum {
+		kDefaultMemberPitchBendRange = 48,		// semitones, as the MPE specification recommends
+		kDefaultMasterPitchBendRange = 2
+	};
+
+								AUMPEZoneManager(UInt32 inMaxVoices);
+								~AUMPEZoneManager();
+
+	// Zones.  The lower zone's master channel is 0 (MIDI channel 1) and its members count up from 1; the upper
+	// zone's master channel is 15 and its members count down from 14.  0 members turns a zone off.  Controllers
+	// normally configure these themselves with the MPE Configuration Message, which HandleMIDI understands; it
+	// also puts the zone's member pitch bend range back to kDefaultMemberPitchBendRange.
+	void						SetLowerZone(UInt32 inMemberChannels);
+	void						SetUpperZone(UInt32 inMemberChannels);
+	bool						IsEnabled() const { return mState.mLowerMembers > 0 || mState.mUpperMembers > 0; }
+	bool						IsMemberChannel(UInt8 inChannel) const { return IsMemberChannel(mState, inChannel & 0xF); }
+
+	// Smoothing time constant for the per-voice values, in seconds.  0 disables smoothing.
+	void						SetSmoothingTime(Float64 inSampleRate, Float64 inSeconds);
+
+	// Handles per-note expression on member channels, zone-wide pitch bend on master channels, and the RPNs
+	// used to configure MPE.  Returns true if the message was consumed and needs no further dispatch.  All notes
+	// off and all sound off return the channel's expression (or the zone's, on a master channel) to rest.
+	bool						HandleMIDI(UInt8 inStatus, UInt8 inChannel, UInt8 inData1, UInt8 inData2);
+
+	// Binding voices.  Call StartVoice when a voice starts a note on an MPE channel; its values snap to the
+	// channel's current expression, since MPE controllers send a note's initial expression before the note on.
+	void						StartVoice(UInt32 inVoice, UInt8 inChannel);
+	void						StopVoice(UInt32 inVoice);
+	void						StopAllVoices();
+
+	// All notes off (or all sound off) on a channel: unbinds the voices on it.  On a master channel, this covers
+	// the whole zone.
+	void						AllNotesOff(UInt8 inChannel);
+
+	// Render thread, once per slice: moves every bound voice's values toward its channel's.
+	void						Smooth(UInt32 inFrames);
+
+	// Per-voice values, one array per expression, indexed by voice.  A stopped voice keeps its last values
+	// through its release, since its channel may already be carrying the next note's expression.
+	const Float32 *				Values(UInt32 inExpression) const { return mVoiceValues[inExpression]; }
+	UInt32						MaxVoices() const { return mMaxVoices; }
+
+	void						Reset();
+
+private:
+								AUMPEZoneManager(const AUMPEZoneManager&);
+	AUMPEZoneManager&			operator=(const AUMPEZoneManager&);
+
+	enum { kNoZone = 0xFF, kLowerZone = 0, kUpperZone = 1 };
+
+	// everything the render thread needs from the MIDI thread
+	struct ZoneState {
+		UInt32					mLowerMembers;
+		UInt32					mUpperMembers;
+		UInt8					mZone[16];				// kLowerZone, kUpperZone or kNoZone for each channel
+
+		Float32					mChannelValues[kNumberOfExpressions][16];	// latest raw values: bend -1 - 1, others 0 - 1
+		Float32					mMemberBendRange[2];	// per zone, semitones
+		Float32					mMasterBendRange[2];
+	};
+
+	static bool					IsMasterChannel(const ZoneState &inState, UInt8 inChannel)
+								{
+									return (inChannel == 0 && inState.mLowerMembers > 0) || (inChannel == 15 && inState.mUpperMembers > 0);
+								}
+	static bool					IsMemberChannel(const ZoneState &inState, UInt8 inChannel)
+								{
+									return inState.mZone[inChannel] != kNoZone && !IsMasterChannel(inState, inChannel);
+								}
+	static Float32				ChannelTarget(const ZoneState &inState, UInt32 inExpression, UInt8 inChannel);
+
+	// MIDI thread: every change to mState is bracketed by these, which make mStateSequence odd while it lasts
+	void						BeginStateChange() { CAAtomicIncrement32Barrier(&mStateSequence); }
+	void						EndStateChange() { CAAtomicIncrement32Barrier(&mStateSequence); }
+	// render thread: copies mState to mRenderState, or keeps the last copy if the MIDI thread is mid change
+	void						UpdateRenderState();
+
+	void						UpdateZones();
+	void						HandleRPN(UInt8 inChannel);
+	void						ResetChannel(UInt8 inChannel);
+
+	UInt32						mMaxVoices;
+
+	ZoneState					mState;					// written by the MIDI thread only
+	volatile SInt32				mStateSequence;
+	ZoneState					mRenderState;			// render thread only
+
+	UInt16						mRPN[16];				// currently selected RPN per channel
+	UInt8						mDataEntryMSB[16];
+
+	Float32						mSmoothingCoefficient;	// per frame, 1 means no smoothing
+	CAAutoFree<SInt8>			mVoiceChannel;			// -1 when unbound
+	CAAutoFree<Float32>			mVoiceValues[kNumberOfExpressions];
+};
+
+#endif // __AUMPEZoneManager_h__
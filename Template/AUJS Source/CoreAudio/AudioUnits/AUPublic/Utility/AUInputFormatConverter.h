@@ -43,12 +43,14 @@
 
 #include "FormatConverterClient.h"
 #include "AUTimestampGenerator.h"
+#include "CAPCMConverter.h"
 
 // ____________________________________________________________________________
 // AUInputFormatConverter
 //
 // Subclass of FormatConverterClient that applies a format conversion
-// to an input of an AudioUnit.
+// to an input of an AudioUnit.  PCM to PCM conversions without sample
+// rate conversion are done by CAPCMConverter instead of the AudioConverter.
 	/*! @class AUInputFormatConverter */
 class AUInputFormatConverter : public FormatConverterClient {
 public:
@@ -56,6 +58,7 @@ public:
 	AUInputFormatConverter(AUBase *hostAU, int inputBus) :
 		mHost(hostAU),
 		mHostBus(inputBus),
+		mUsePCMConverter(false),
 		mPreviousSilentFrames(0x1000)
 	{
 #if DEBUG
@@ -77,6 +80,7 @@ public:
 		if (err) return err;
 		mIsPCMToPCM = (src.mFormatID == kAudioFormatLinearPCM) && (dest.mFormatID == kAudioFormatLinearPCM);
 		mHasSRC = (fnonzero(src.mSampleRate) && fnonzero(dest.mSampleRate) && fnotequal(src.mSampleRate, dest.mSampleRate));
+		mUsePCMConverter = mIsPCMToPCM && !mHasSRC && mPCMConverter.Initialize(src, dest) == noErr;
 		return ca_noErr;
 	}
 
@@ -100,6 +104,8 @@ public:
 									bool&								outSilence)
 	{
 		mTimestampGenerator.AddOutputTime(inTimeStamp, ioOutputDataPacketSize, mOutputFormat.mSampleRate);
+		if (mUsePCMConverter)
+			return ConvertPCM(ioOutputDataPacketSize, outOutputData, outSilence);
 		mSilentOutput = true;
 		OSStatus err = FillComplexBuffer(ioOutputDataPacketSize, outOutputData, outPacketDescription);
 		if (mSilentOutput) {
@@ -133,7 +139,23 @@ public:
 		return err;
 	}
 
+	// the PCM converter, to set dithering and clipping
+	CAPCMConverter &	GetPCMConverter() { return mPCMConverter; }
+
 protected:
+	/*! @method ConvertPCM */
+	OSStatus	ConvertPCM(UInt32 nFrames, AudioBufferList &outOutputData, bool &outSilence)
+	{
+		AudioUnitRenderActionFlags actionFlags = 0;
+		AUInputElement *input = mHost->GetInput(mHostBus);
+		const AudioTimeStamp &inputTime = mTimestampGenerator.GenerateInputTime(nFrames, mInputFormat.mSampleRate);
+		OSStatus err = input->PullInput(actionFlags, inputTime, mHostBus, nFrames);
+		if (!err)
+			err = mPCMConverter.Convert(input->GetBufferList(), outOutputData, nFrames);
+		outSilence = !err && (actionFlags & kAudioUnitRenderAction_OutputIsSilence);
+		return err;
+	}
+
 	/*! @var mHost */
 	AUBase *				mHost;
 	/*! @var mHostBus */
@@ -142,6 +164,8 @@ protected:
 	AUTimestampGenerator	mTimestampGenerator;
 	bool					mIsPCMToPCM;
 	bool					mHasSRC;
+	bool					mUsePCMConverter;
+	CAPCMConverter			mPCMConverter;
 	bool					mSilentOutput;
 	UInt32					mPreviousSilentFrames;
 };
@@ -69,7 +69,7 @@ void	AUTimestampGenerator::AddOutputTime(const AudioTimeStamp &inTimeStamp, Floa
 		mCurrentOutputTime.mFlags |= kAudioTimeStampHostTimeValid;
 #if DEBUG
 		if (mVerbosity > 1)
-			printf("synthesized host time: %.3f (%.3f + %.f smp @ %.f Hz, rs %.3f\n", DebugHostTime(mCurrentOutputTime), DebugHostTime(mLastOutputTime), deltaSamples, outputSampleRate, rateScalar);
+			DebugPrintfRtn(DebugPrintfFileComma "synthesized host time: %.3f (%.3f + %.f smp @ %.f Hz, rs %.3f\n", DebugHostTime(mCurrentOutputTime), DebugHostTime(mLastOutputTime), deltaSamples, outputSampleRate, rateScalar);
 #endif
 	}
 	// copy rate scalar
@@ -97,7 +97,7 @@ void	AUTimestampGenerator::AddOutputTime(const AudioTimeStamp &inTimeStamp, Floa
 #if DEBUG
 		if (mVerbosity > 1)
 			if (mDiscontinuous)
-				printf("%-20.20s: *** DISCONTINUOUS, got "TSGFMT", expected "TSGFMT"\n", mDebugName, (SInt64)mCurrentOutputTime.mSampleTime, (SInt64)mNextOutputSampleTime);
+				DebugPrintfRtn(DebugPrintfFileComma "%-20.20s: *** DISCONTINUOUS, got "TSGFMT", expected "TSGFMT"\n", mDebugName, (SInt64)mCurrentOutputTime.mSampleTime, (SInt64)mNextOutputSampleTime);
 #endif
 	}
 	mNextOutputSampleTime = mCurrentOutputTime.mSampleTime + expectedDeltaFrames;
@@ -134,7 +134,7 @@ const AudioTimeStamp &	AUTimestampGenerator::GenerateInputTime(Float64 framesToA
 			inputSampleTime = lastInputSampleTime + deltaSamples;
 #if DEBUG
 			if (mVerbosity > 1)
-				printf("%-20.20s: adjusted input time: "TSGFMT" -> "TSGFMT" (SR=%.3f, rs=%.3f)\n", mDebugName, (SInt64)lastInputSampleTime, (SInt64)inputSampleTime, inputSampleRate, rateScalar);
+				DebugPrintfRtn(DebugPrintfFileComma "%-20.20s: adjusted input time: "TSGFMT" -> "TSGFMT" (SR=%.3f, rs=%.3f)\n", mDebugName, (SInt64)lastInputSampleTime, (SInt64)inputSampleTime, inputSampleRate, rateScalar);
 #endif
 			mDiscontinuous = false;
 		} else {
@@ -153,7 +153,7 @@ const AudioTimeStamp &	AUTimestampGenerator::GenerateInputTime(Float64 framesToA
 		
 #if DEBUG
 		if (mVerbosity > 1)
-			printf("%-20.20s: adjusted input time: %.0f -> %.0f (SR=%.3f, rs=%.3f, delta=%.0f)\n", mDebugName, mNextInputSampleTime, inputSampleTime, inputSampleRate, mRateScalarAdj, mDiscontinuityDeltaSamples);
+			DebugPrintfRtn(DebugPrintfFileComma "%-20.20s: adjusted input time: %.0f -> %.0f (SR=%.3f, rs=%.3f, delta=%.0f)\n", mDebugName, mNextInputSampleTime, inputSampleTime, inputSampleRate, mRateScalarAdj, mDiscontinuityDeltaSamples);
 #endif
 		
 		mDiscontinuityDeltaSamples = 0.;
@@ -178,7 +178,7 @@ const AudioTimeStamp &	AUTimestampGenerator::GenerateInputTime(Float64 framesToA
 
 #if DEBUG
 	if (mVerbosity > 0) {
-		printf("%-20.20s: out = "TSGFMT" (%10.3fs)  in = "TSGFMT"  (%10.3fs)  delta = "TSGFMT"  advance = "TSGFMT"\n", mDebugName, (SInt64)mCurrentOutputTime.mSampleTime, DebugHostTime(mCurrentOutputTime), (SInt64)inputSampleTime, DebugHostTime(mCurrentInputTime), (SInt64)(mCurrentOutputTime.mSampleTime - inputSampleTime), (SInt64)framesToAdvance);
+		DebugPrintfRtn(DebugPrintfFileComma "%-20.20s: out = "TSGFMT" (%10.3fs)  in = "TSGFMT"  (%10.3fs)  delta = "TSGFMT"  advance = "TSGFMT"\n", mDebugName, (SInt64)mCurrentOutputTime.mSampleTime, DebugHostTime(mCurrentOutputTime), (SInt64)inputSampleTime, DebugHostTime(mCurrentInputTime), (SInt64)(mCurrentOutputTime.mSampleTime - inputSampleTime), (SInt64)framesToAdvance);
 	}
 #endif
 	return mCurrentInputTime;
@@ -43,6 +43,7 @@
 
 #include <math.h>
 #include "CAHostTimeBase.h"
+#include "CADebugPrintf.h"
 #include <stdio.h>
 
 #define TSGFMT "0x%10qx"
@@ -90,7 +91,7 @@ public:
 		mFirstTime = true;
 #if DEBUG
 		if (mVerbosity)
-			printf("%-20.20s: Reset\n", mDebugName);
+			DebugPrintfRtn(DebugPrintfFileComma "%-20.20s: Reset\n", mDebugName);
 #endif
 	}
 	
@@ -111,7 +112,7 @@ public:
 	{
 #if DEBUG
 		if (mVerbosity > 1)
-			printf("%-20.20s:	ADVANCE         in = "TSGFMT"                    advance = "TSGFMT"\n", mDebugName, (SInt64)mCurrentInputTime.mSampleTime, (SInt64)framesToAdvance);
+			DebugPrintfRtn(DebugPrintfFileComma "%-20.20s:	ADVANCE         in = "TSGFMT"                    advance = "TSGFMT"\n", mDebugName, (SInt64)mCurrentInputTime.mSampleTime, (SInt64)framesToAdvance);
 #endif
 		mNextInputSampleTime = mCurrentInputTime.mSampleTime + framesToAdvance;
 	}
@@ -74,7 +74,7 @@ HP_IOThread::HP_IOThread(HP_Device* inDevice)
 :
 	mDevice(inDevice),
 	mIOThread(reinterpret_cast<CAPThread::ThreadRoutine>(ThreadEntry), this, CAPThread::kMaxThreadPriority),
-	mIOGuard("IOGuard"),
+	mIOGuard("IOGuard", true),	//	the IO thread waits on it, so its owner borrows the IO thread's priority
 	mIOCycleUsage(1.0f),
 	mAnchorTime(CAAudioTimeStamp::kZero),
 	mFrameCounter(0),
@@ -39,11 +39,58 @@
 			POSSIBILITY OF SUCH DAMAGE.
 */
 #include "CAAUMIDIMapManager.h"
+#include "CAAtomic.h"
 #include <AudioToolbox/AudioUnitUtilities.h>
+#include <unistd.h>
 
 CAAUMIDIMapManager::CAAUMIDIMapManager()
+	: mMapsMutex("CAAUMIDIMapManager"), hotMapping(kHotMap_Off), mPendingHotMapSerial(0), mDispatchTable(NULL), mDispatchReaders(0)
 {	
-	hotMapping = false;	
+	RebuildDispatchTable();
+}
+
+CAAUMIDIMapManager::~CAAUMIDIMapManager()
+{
+	delete mDispatchTable;
+}
+
+void	CAAUMIDIMapManager::RebuildDispatchTable(SInt32 inHotMapSerial)
+{
+	DispatchTable *table = new DispatchTable;
+	table->mMaps = mParameterMaps;
+	table->mHotMapSerial = inHotMapSerial;
+	
+	for (UInt32 status = 0x80; status <= 0xF0; status += 0x10) {
+		for (UInt8 channel = 0; channel < 16; ++channel) {
+			for (UInt8 data1 = 0; data1 < 128; ++data1) {
+				DispatchTable::Slot &slot = table->mSlots[DispatchTable::SlotIndex(status, channel, data1)];
+				slot.mFirst = (UInt32)table->mMapIndices.size();
+				
+					// the same maps, in the same order, that the sorted search used to visit, minus those
+					// MIDI_Matches would reject on channel alone
+				for (UInt32 i = 0; i < table->mMaps.size(); ++i) {
+					const CAAUMIDIMap &map = table->mMaps[i];
+					if ((map.mStatus & 0xF0) != status)
+						continue;
+					if ((status == 0xB0 || status == 0xC0) && map.mData1 != data1)
+						continue;
+					if (!map.IsAnyChannel() && (map.mStatus & 0xF) != channel)
+						continue;
+					table->mMapIndices.push_back(i);
+				}
+				slot.mCount = (UInt32)table->mMapIndices.size() - slot.mFirst;
+			}
+		}
+	}
+	
+	DispatchTable *oldTable = mDispatchTable;
+	CAAtomicCompareAndSwapPtrBarrier(oldTable, table, (volatile void **)&mDispatchTable);
+	
+		// a render thread may still be walking the old table; it's short, so just wait it out. This is
+		// never the render thread itself, which only records hot maps.
+	while (mDispatchReaders > 0)
+		usleep(100);
+	delete oldTable;
 }
 
 static void FillInMap (CAAUMIDIMap &map, AUBase &That)
@@ -64,6 +111,9 @@ static void FillInMap (CAAUMIDIMap &map, AUBase &That)
 
 OSStatus	CAAUMIDIMapManager::SortedInsertToParamaterMaps	(AUParameterMIDIMapping *maps, UInt32 inNumMaps, AUBase &That)
 {	
+	CAMutex::Locker locker(mMapsMutex);
+	ApplyPendingHotMap ();
+	
 	for (unsigned int i = 0; i < inNumMaps; ++i) 
 	{
 		CAAUMIDIMap map(maps[i]);
@@ -79,20 +129,77 @@ OSStatus	CAAUMIDIMapManager::SortedInsertToParamaterMaps	(AUParameterMIDIMapping
 	}
 	
 	std::sort(mParameterMaps.begin(), mParameterMaps.end(), CompareMIDIMap());	
+	RebuildDispatchTable();
 	
 	return noErr;
 }
 
 void CAAUMIDIMapManager::GetHotParameterMap(AUParameterMIDIMapping &outMap )
 {
+	CAMutex::Locker locker(mMapsMutex);
 	outMap = mHotMap;
+	
+		// learned but not yet applied; the render thread is done with the pending map once the serial is odd
+	if (mPendingHotMapSerial & 1) {
+		CAMemoryBarrier();
+		outMap.mStatus = mPendingHotMap.mStatus;
+		outMap.mData1 = mPendingHotMap.mData1;
+	}
+}
+
+	// expects mMapsMutex to be held. Takes back an armed hot map, or waits out the render thread filling
+	// one in, which is only a couple of stores.
+void CAAUMIDIMapManager::DisarmHotMapping ()
+{
+	while (!CAAtomicCompareAndSwap32Barrier(kHotMap_Armed, kHotMap_Off, &hotMapping)) {
+		if (hotMapping == kHotMap_Off)
+			break;
+		usleep(10);
+	}
+}
+
+void CAAUMIDIMapManager::SetHotMapping (AUParameterMIDIMapping &inMap, AUBase &That)
+{
+	CAMutex::Locker locker(mMapsMutex);
+	DisarmHotMapping ();
+	ApplyPendingHotMap ();
+	
+		// nothing else touches the pending map now: the render thread can't claim it until it's armed, and
+		// ApplyPendingHotMap has waited out any reader that was checking it
+	mHotMap = inMap;
+	mPendingHotMap = CAAUMIDIMap(inMap);
+	FillInMap (mPendingHotMap, That);
+	CAMemoryBarrier();
+	hotMapping = kHotMap_Armed;
+}
+
+void CAAUMIDIMapManager::ApplyPendingHotMap ()
+{
+	CAMutex::Locker locker(mMapsMutex);
+	SInt32 serial = mPendingHotMapSerial;
+	if (!(serial & 1))
+		return;
+	CAMemoryBarrier();
+	
+	mHotMap.mStatus = mPendingHotMap.mStatus;
+	mHotMap.mData1 = mPendingHotMap.mData1;
+	
+	int idx = FindParameterIndex (mHotMap);
+	if (idx > -1)
+		mParameterMaps.erase(mParameterMaps.begin() + idx);
+	mParameterMaps.push_back(mPendingHotMap);
+	std::sort(mParameterMaps.begin(), mParameterMaps.end(), CompareMIDIMap());
+	
+		// publish the table holding the map before FindParameterMapEventMatch stops checking it separately
+	RebuildDispatchTable(serial);
+	CAAtomicIncrement32Barrier(&mPendingHotMapSerial);
 }
 
 void CAAUMIDIMapManager::SortedRemoveFromParameterMaps(AUParameterMIDIMapping *maps, UInt32 inNumMaps, bool &outMapDidChange)
 {	
-	if (hotMapping) {
-		hotMapping = false;
-	}
+	CAMutex::Locker locker(mMapsMutex);
+	DisarmHotMapping ();
+	ApplyPendingHotMap ();
 
 	outMapDidChange = false;
 	for (unsigned int i = 0; i < inNumMaps; ++i) {
@@ -103,10 +210,15 @@ void CAAUMIDIMapManager::SortedRemoveFromParameterMaps(AUParameterMIDIMapping *m
 			outMapDidChange = true;
 		}
 	}
+	
+	if (outMapDidChange)
+		RebuildDispatchTable();
 }
 
 void	CAAUMIDIMapManager::ReplaceAllMaps (AUParameterMIDIMapping* inMappings, UInt32 inNumMaps, AUBase &That)
 {
+	CAMutex::Locker locker(mMapsMutex);
+	ApplyPendingHotMap ();
 	mParameterMaps.clear();
 
 	for (unsigned int i = 0; i < inNumMaps; ++i) {
@@ -117,6 +229,7 @@ void	CAAUMIDIMapManager::ReplaceAllMaps (AUParameterMIDIMapping* inMappings, UIn
 	}
 
 	std::sort(mParameterMaps.begin(),mParameterMaps.end(), CompareMIDIMap());	
+	RebuildDispatchTable();
 }
 
 bool CAAUMIDIMapManager::HandleHotMapping(UInt8 	inStatus,
@@ -127,13 +240,14 @@ bool CAAUMIDIMapManager::HandleHotMapping(UInt8 	inStatus,
 
 	if (inStatus == 0xf0) return false;
 	
-	if (!hotMapping) return false;
-	hotMapping = false;
+		// claiming it keeps SetHotMapping from rewriting the pending map while this fills it in
+	if (hotMapping != kHotMap_Armed || !CAAtomicCompareAndSwap32Barrier(kHotMap_Armed, kHotMap_Learning, &hotMapping))
+		return false;
 
-	mHotMap.mStatus = inStatus | inChannel;  
-	mHotMap.mData1 = inData1; 
-		
-	SortedInsertToParamaterMaps (&mHotMap, 1, That);
+	mPendingHotMap.mStatus = inStatus | inChannel;  
+	mPendingHotMap.mData1 = inData1; 
+	CAAtomicIncrement32Barrier(&mPendingHotMapSerial);
+	CAAtomicCompareAndSwap32Barrier(kHotMap_Learning, kHotMap_Off, &hotMapping);
 	return true;
 }
 
@@ -149,8 +263,15 @@ void CAAUMIDIMapManager::Print()
 
 #endif // DEBUG
 
+UInt32 CAAUMIDIMapManager::NumMaps()
+{
+	CAMutex::Locker locker(mMapsMutex);
+	return mParameterMaps.size();
+}
+
 void CAAUMIDIMapManager::GetMaps(AUParameterMIDIMapping* maps)
 {
+	CAMutex::Locker locker(mMapsMutex);
 	int i = 0;
 	for ( ParameterMaps::iterator iter = mParameterMaps.begin(); iter < mParameterMaps.end(); ++iter, ++i) { 
 		AUParameterMIDIMapping &listmap =  (*iter);	
@@ -162,6 +283,7 @@ int CAAUMIDIMapManager::FindParameterIndex (AUParameterMIDIMapping &inMap)
 { 
 	//used to get back hot mapping and one at a time maps, for ui
 	
+	CAMutex::Locker locker(mMapsMutex);
 	int idx = 0;
 	for ( ParameterMaps::iterator i = mParameterMaps.begin(); i < mParameterMaps.end(); ++i) { 
 		CAAUMIDIMap & listmap =  (*i);
@@ -188,25 +310,19 @@ bool CAAUMIDIMapManager::FindParameterMapEventMatch(	UInt8			inStatus,
 	if (inStatus == 0x90 && !inData2)
 		inStatus = 0x80 | inChannel;
 	
-	//used to test for midi matches once map is made
-	CAAUMIDIMap tempMap;
-	tempMap.mStatus = inStatus | inChannel;
-	tempMap.mData1 = inData1;
-	
-	CompareMIDIMap compareObj;
-
 	AudioUnitEvent event;
 	event.mEventType = kAudioUnitEvent_ParameterValueChange;
 	event.mArgument.mParameter.mAudioUnit = inAUBase.GetComponentInstance();
 	
-	ParameterMaps::iterator lower_iter = 
-	std::lower_bound(mParameterMaps.begin(), mParameterMaps.end(), tempMap, compareObj);
+	CAAtomicIncrement32Barrier(&mDispatchReaders);
+	DispatchTable *table = mDispatchTable;
 	
-	while (lower_iter < mParameterMaps.end()) 
+	const DispatchTable::Slot &slot = table->mSlots[DispatchTable::SlotIndex(inStatus, inChannel, inData1)];
+	const UInt32 *indices = slot.mCount ? &table->mMapIndices[slot.mFirst] : NULL;
+	
+	for (UInt32 i = 0; i < slot.mCount; ++i)
 	{
-		CAAUMIDIMap & map = (*lower_iter);
-		if (compareObj.Finish(map, tempMap)) 
-			break;
+		const CAAUMIDIMap & map = table->mMaps[indices[i]];
 		
 		Float32 value;
 		if (map.MIDI_Matches(inChannel, inData1, inData2, value))
@@ -221,7 +337,33 @@ bool CAAUMIDIMapManager::FindParameterMapEventMatch(	UInt8			inStatus,
 			AUEventListenerNotify(NULL, NULL, &event);
 			ret_value = true;
 		}
-		++lower_iter;
 	}
+	
+		// a hot map learned on this thread works right away, before ApplyPendingHotMap puts it in a table
+	SInt32 serial = mPendingHotMapSerial;
+	if ((serial & 1) && table->mHotMapSerial != serial)
+	{
+		const CAAUMIDIMap & map = mPendingHotMap;
+		UInt8 status = inStatus & 0xF0;
+		
+		Float32 value;
+		if ((map.mStatus & 0xF0) == status
+			&& !((status == 0xB0 || status == 0xC0) && map.mData1 != inData1)
+			&& (map.IsAnyChannel() || (map.mStatus & 0xF) == inChannel)
+			&& map.MIDI_Matches(inChannel, inData1, inData2, value))
+		{
+			inAUBase.SetParameter ( map.mParameterID, map.mScope, map.mElement, 
+									map.ParamValueFromMIDILinear(value), inBufferOffset);
+
+			event.mArgument.mParameter.mParameterID = map.mParameterID;
+			event.mArgument.mParameter.mScope = map.mScope;
+			event.mArgument.mParameter.mElement = map.mElement;
+			
+			AUEventListenerNotify(NULL, NULL, &event);
+			ret_value = true;
+		}
+	}
+	
+	CAAtomicDecrement32Barrier(&mDispatchReaders);
 	return ret_value;
 }
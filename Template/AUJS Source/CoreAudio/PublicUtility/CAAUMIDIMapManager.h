@@ -43,6 +43,7 @@
 
 #include <AUBase.h> 
 #include <CAAUMIDIMap.h>
+#include "CAMutex.h"
 #include <vector>
 #include <AudioToolbox/AudioUnitUtilities.h>
 
@@ -51,16 +52,63 @@ class CAAUMIDIMapManager {
 protected:
 	
 	typedef std::vector<CAAUMIDIMap>	ParameterMaps;
+	
+		// held by every non render thread call; the render thread never takes it
+	CAMutex								mMapsMutex;
 	ParameterMaps						mParameterMaps;
 	
-	bool								hotMapping;
+		// SetHotMapping arms a hot map, and the render thread claims it by moving it from armed to learning,
+		// so only one of them ever writes mPendingHotMap at a time
+	enum { kHotMap_Off, kHotMap_Armed, kHotMap_Learning };
+	volatile SInt32						hotMapping;
 	AUParameterMIDIMapping				mHotMap;
 	
+		// HandleHotMapping runs on the render thread, so it only fills in the status and data byte of
+		// mPendingHotMap (prepared by SetHotMapping) and makes mPendingHotMapSerial odd. ApplyPendingHotMap
+		// adds it to mParameterMaps and rebuilds the table, either when the maps next change or when asked
+		// to; until then FindParameterMapEventMatch checks it after the table, unless the table already
+		// holds it.
+	CAAUMIDIMap							mPendingHotMap;
+	volatile SInt32						mPendingHotMapSerial;
+	
+		// A precomputed copy of mParameterMaps for the render thread. Every (command, channel, data byte)
+		// combination has a slot listing the maps that could match it, so FindParameterMapEventMatch
+		// does a single indexed load instead of searching mParameterMaps. The table is rebuilt by the thread
+		// that changes the maps, never the render thread, and published with a pointer swap.
+	struct DispatchTable {
+		enum { kNumSlots = 8 * 16 * 128 };
+		struct Slot {
+			UInt32						mFirst;
+			UInt32						mCount;
+		};
+		
+		static UInt32					SlotIndex (UInt8 inStatus, UInt8 inChannel, UInt8 inData1)
+										{
+											return ((UInt32)((inStatus >> 4) & 0x7) << 11) | ((UInt32)(inChannel & 0xF) << 7) | (inData1 & 0x7F);
+										}
+		
+		ParameterMaps					mMaps;
+		SInt32							mHotMapSerial;	// of the pending hot map built into the table, or 0
+		std::vector<UInt32>				mMapIndices;	// indices into mMaps, grouped by slot
+		Slot							mSlots[kNumSlots];
+	};
+	
+	DispatchTable * volatile			mDispatchTable;
+	volatile SInt32						mDispatchReaders;
+	
+	void					RebuildDispatchTable(SInt32 inHotMapSerial = 0);
+	void					DisarmHotMapping();
+	
+private:
+							CAAUMIDIMapManager(const CAAUMIDIMapManager&);
+	CAAUMIDIMapManager&		operator=(const CAAUMIDIMapManager&);
+	
 public:
 					
 							CAAUMIDIMapManager();
+							~CAAUMIDIMapManager();
 	
-	UInt32					NumMaps(){return mParameterMaps.size();}
+	UInt32					NumMaps();
 	void					GetMaps(AUParameterMIDIMapping* maps);
 	
 	int						FindParameterIndex(AUParameterMIDIMapping &map);
@@ -72,9 +120,14 @@ public:
 	
 	void					ReplaceAllMaps (AUParameterMIDIMapping* inMappings, UInt32 inNumMaps, AUBase &That);
 	
-	bool					IsHotMapping(){return hotMapping;}
-	void					SetHotMapping (AUParameterMIDIMapping &inMap){hotMapping = true; mHotMap = inMap; }
+	bool					IsHotMapping(){return hotMapping == kHotMap_Armed;}
+	void					SetHotMapping (AUParameterMIDIMapping &inMap, AUBase &That);
+	
+		// not on the render thread: adds a hot map learned since the last call to the maps. The calls
+		// that change the maps make it themselves.
+	void					ApplyPendingHotMap ();
 	
+		// render thread: never allocates or blocks
 	bool					HandleHotMapping(	UInt8 	inStatus,
 												UInt8 	inChannel,
 												UInt8 	inData1,
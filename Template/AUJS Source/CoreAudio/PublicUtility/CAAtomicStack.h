@@ -51,12 +51,37 @@
 	#include <CoreServices/CoreServices.h>
 #endif
 
+// With a double word compare and swap, the head pointer is paired with a tag that changes on every atomic
+// operation, so a compare and swap fails if the head was popped and pushed back in between (the ABA problem).
+// That makes pop_atomic a plain lock free pop that any number of threads may call.  Without one, pop_atomic
+// pops everything and pushes the rest back, which is also ABA safe but briefly shows other threads an empty
+// stack, and pop_atomic_single_reader is only safe with one popping thread.
+// (x86_64 needs cmpxchg16b: -mcx16 with gcc, the default with clang on Mac OS X.)
+#if !defined(CA_ATOMIC_STACK_TAGGED)
+	#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE) \
+		&& ((__LP64__ && defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)) || (!__LP64__ && defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_8)))
+		#define CA_ATOMIC_STACK_TAGGED 1
+	#else
+		#define CA_ATOMIC_STACK_TAGGED 0
+	#endif
+#endif
+
+#if CA_ATOMIC_STACK_TAGGED
+	#include <stdint.h>
+#endif
+
 //  linked list LIFO or FIFO (pop_all_reversed) stack, elements are pushed and popped atomically
 //  class T must implement T *& next().
+//	Popped elements may still have next() read by a thread whose pop is about to fail, so they must not be
+//	freed while other threads may be popping (recycling them, as a free list does, is fine).
 template <class T>
 class TAtomicStack {
 public:
+#if CA_ATOMIC_STACK_TAGGED
+	TAtomicStack() : mHead(NULL), mTag(0) { }
+#else
 	TAtomicStack() : mHead(NULL) { }
+#endif
 	
 	// non-atomic routines, for use when initializing/deinitializing, operate NON-atomically
 	void	push_NA(T *item)
@@ -81,45 +106,52 @@ public:
 	void	push_atomic(T *item)
 	{
 		T *head_;
+		Tag tag;
 		do {
-			head_ = mHead;
+			load_head(head_, tag);
 			item->next() = head_;
-		} while (!compare_and_swap(head_, item, &mHead));
+		} while (!compare_and_swap_head(head_, tag, item));
 	}
 	
 	void	push_multiple_atomic(T *item)
 		// pushes entire linked list headed by item
 	{
 		T *head_, *p = item, *tail;
+		Tag tag;
 		// find the last one -- when done, it will be linked to head
 		do {
 			tail = p;
 			p = p->next();
 		} while (p);
 		do {
-			head_ = mHead;
+			load_head(head_, tag);
 			tail->next() = head_;
-		} while (!compare_and_swap(head_, item, &mHead));
+		} while (!compare_and_swap_head(head_, tag, item));
 	}
 	
 	T *		pop_atomic_single_reader()
-		// this may only be used when only one thread may potentially pop from the stack.
-		// if multiple threads may pop, this suffers from the ABA problem.
+		// without CA_ATOMIC_STACK_TAGGED this may only be used when only one thread may potentially pop
+		// from the stack. if multiple threads may pop, this suffers from the ABA problem.
 		// <rdar://problem/4606346> TAtomicStack suffers from the ABA problem
 	{
 		T *result;
+		Tag tag;
 		do {
-			if ((result = mHead) == NULL)
+			load_head(result, tag);
+			if (result == NULL)
 				break;
-		} while (!compare_and_swap(result, result->next(), &mHead));
+		} while (!compare_and_swap_head(result, tag, result->next()));
 		return result;
 	}
 	
 	T *		pop_atomic()
+	{
+#if CA_ATOMIC_STACK_TAGGED
+		return pop_atomic_single_reader();
+#else
 		// This is inefficient for large linked lists.
 		// prefer pop_all() to a series of calls to pop_atomic.
 		// push_multiple_atomic has to traverse the entire list.
-	{
 		T *result = pop_all();
 		if (result) {
 			T *next = result->next();
@@ -128,15 +160,18 @@ public:
 				push_multiple_atomic(next);
 		}
 		return result;
+#endif
 	}
 	
 	T *		pop_all()
 	{
 		T *result;
+		Tag tag;
 		do {
-			if ((result = mHead) == NULL)
+			load_head(result, tag);
+			if (result == NULL)
 				break;
-		} while (!compare_and_swap(result, NULL, &mHead));
+		} while (!compare_and_swap_head(result, tag, NULL));
 		return result;
 	}
 	
@@ -162,6 +197,8 @@ public:
 	#else
 			return ::CompareAndSwap(UInt32(oldvalue), UInt32(newvalue), (UInt32 *)pvalue);
 	#endif
+#elif defined(__GNUC__)
+			return __sync_bool_compare_and_swap(pvalue, oldvalue, newvalue);
 #else
 			//return ::CompareAndSwap(UInt32(oldvalue), UInt32(newvalue), (UInt32 *)pvalue);
 			return CAAtomicCompareAndSwap32Barrier(SInt32(oldvalue), SInt32(newvalue), (SInt32*)pvalue);
@@ -169,7 +206,48 @@ public:
 	}
 	
 protected:
+#if CA_ATOMIC_STACK_TAGGED
+	typedef uintptr_t			Tag;
+	#if __LP64__
+	typedef unsigned __int128	TaggedHead;
+	#else
+	typedef uint64_t			TaggedHead;
+	#endif
+	union TaggedHeadParts {
+		struct {
+			T *			mHead;
+			Tag			mTag;
+		}				mParts;
+		TaggedHead		mBits;
+	};
+
+	void	load_head(T *&outHead, Tag &outTag)
+	{
+		// the tag first: if the head changes after it's read, so does the tag, and the swap fails
+		outTag = __atomic_load_n(&mTag, __ATOMIC_ACQUIRE);
+		outHead = __atomic_load_n(&mHead, __ATOMIC_ACQUIRE);
+	}
+	
+	bool	compare_and_swap_head(T *oldHead, Tag oldTag, T *newHead)
+	{
+		TaggedHeadParts oldValue, newValue;
+		oldValue.mParts.mHead = oldHead;
+		oldValue.mParts.mTag = oldTag;
+		newValue.mParts.mHead = newHead;
+		newValue.mParts.mTag = oldTag + 1;
+		return __sync_bool_compare_and_swap((TaggedHead *)&mHead, oldValue.mBits, newValue.mBits);
+	}
+
+	T *			mHead __attribute__((aligned(sizeof(TaggedHead))));
+	Tag			mTag;
+#else
+	typedef UInt32	Tag;	// unused
+
+	void	load_head(T *&outHead, Tag &outTag) { outHead = mHead; outTag = 0; }
+	bool	compare_and_swap_head(T *oldHead, Tag, T *newHead) { return compare_and_swap(oldHead, newHead, &mHead); }
+
 	T *		mHead;
+#endif
 };
 
 #if ((MAC_OS_X_VERSION_MAX_ALLOWED >= MAC_OS_X_VERSION_10_5) && !TARGET_OS_WIN32)
@@ -193,7 +271,9 @@ private:
 	OSQueueHead		mHead;
 	size_t			mNextPtrOffset;
 };
+#endif
 
+#if ((MAC_OS_X_VERSION_MAX_ALLOWED >= MAC_OS_X_VERSION_10_5) && !TARGET_OS_WIN32) && !CA_ATOMIC_STACK_TAGGED
 // a more efficient subset of TAtomicStack using OSQueue.
 template <class T>
 class TAtomicStack2 {
@@ -226,8 +306,9 @@ private:
 
 #else
 
+// TAtomicStack is ABA safe either way, and lock free with CA_ATOMIC_STACK_TAGGED
 #define TAtomicStack2 TAtomicStack
 
-#endif // MAC_OS_X_VERSION_MAX_ALLOWED && !TARGET_OS_WIN32
+#endif // MAC_OS_X_VERSION_MAX_ALLOWED && !TARGET_OS_WIN32 && !CA_ATOMIC_STACK_TAGGED
 
 #endif // __CAAtomicStack_h__
@@ -0,0 +1,174 @@
+/*
+	CABroadcastRingBuffer.cpp
+*/
+#include "CABroadcastRingBuffer.h"
+#include "CABitOperations.h"
+#include "CAAutoDisposer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+CABroadcastRingBuffer::CABroadcastRingBuffer() :
+	mBuffers(NULL), mNumberChannels(0), mBytesPerFrame(0), mCapacityFrames(0), mCapacityFramesMask(0)
+{
+	mWriteCount.StoreRelaxed(0);
+	mWriteReserve.StoreRelaxed(0);
+	for (UInt32 i = 0; i < kMaxReaders; ++i) {
+		mReaders[i].mActive.StoreRelaxed(0);
+		mReaders[i].mCursor.StoreRelaxed(0);
+		mReaders[i].mOverruns.StoreRelaxed(0);
+		mReaders[i].mFramesDropped.StoreRelaxed(0);
+	}
+}
+
+CABroadcastRingBuffer::~CABroadcastRingBuffer()
+{
+	Deallocate();
+}
+
+void	CABroadcastRingBuffer::Allocate(UInt32 nChannels, UInt32 bytesPerFrame, UInt32 capacityFrames)
+{
+	Deallocate();
+
+	capacityFrames = NextPowerOfTwo(capacityFrames);
+
+	mNumberChannels = nChannels;
+	mBytesPerFrame = bytesPerFrame;
+	mCapacityFrames = capacityFrames;
+	mCapacityFramesMask = capacityFrames - 1;
+
+	// put everything in one memory allocation, first the pointers, then the deinterleaved channels
+	UInt32 capacityBytes = bytesPerFrame * capacityFrames;
+	UInt32 allocSize = (capacityBytes + sizeof(Byte *)) * nChannels;
+	Byte *p = (Byte *)CA_malloc(allocSize);
+	memset(p, 0, allocSize);
+	mBuffers = (Byte **)p;
+	p += nChannels * sizeof(Byte *);
+	for (UInt32 i = 0; i < nChannels; ++i) {
+		mBuffers[i] = p;
+		p += capacityBytes;
+	}
+
+	mWriteCount.StoreRelaxed(0);
+	mWriteReserve.StoreRelaxed(0);
+	for (UInt32 i = 0; i < kMaxReaders; ++i)
+		mReaders[i].mCursor.StoreRelaxed(0);
+}
+
+void	CABroadcastRingBuffer::Deallocate()
+{
+	if (mBuffers) {
+		free(mBuffers);
+		mBuffers = NULL;
+	}
+	mNumberChannels = 0;
+	mCapacityFrames = 0;
+	mCapacityFramesMask = 0;
+}
+
+void	CABroadcastRingBuffer::Write(const AudioBufferList *abl, UInt32 nFrames)
+{
+	if (mBuffers == NULL || nFrames == 0)
+		return;
+
+	UInt32 srcFrame = 0;
+	if (nFrames > mCapacityFrames) {
+		srcFrame = nFrames - mCapacityFrames;
+		nFrames = mCapacityFrames;
+	}
+
+	// only this thread writes the counters
+	UInt32 start = mWriteCount.LoadRelaxed();
+	mWriteReserve.StoreRelaxed(start + nFrames);
+	CARingBufferAtomic<UInt32>::ReleaseFence();
+
+	UInt32 offset = start & mCapacityFramesMask;
+	UInt32 frames0 = std::min(nFrames, mCapacityFrames - offset);
+	UInt32 nchannels = std::min(mNumberChannels, (UInt32)abl->mNumberBuffers);
+	for (UInt32 ch = 0; ch < nchannels; ++ch) {
+		const Byte *src = (const Byte *)abl->mBuffers[ch].mData + srcFrame * mBytesPerFrame;
+		memcpy(mBuffers[ch] + offset * mBytesPerFrame, src, frames0 * mBytesPerFrame);
+		if (frames0 < nFrames)
+			memcpy(mBuffers[ch], src + frames0 * mBytesPerFrame, (nFrames - frames0) * mBytesPerFrame);
+	}
+
+	mWriteCount.StoreRelease(start + nFrames);
+}
+
+CABroadcastRingBuffer::ReaderID	CABroadcastRingBuffer::AddReader()
+{
+	for (ReaderID i = 0; i < kMaxReaders; ++i) {
+		Reader &reader = mReaders[i];
+		if (reader.mActive.LoadRelaxed())
+			continue;
+		reader.mCursor.StoreRelaxed(mWriteCount.LoadAcquire());
+		reader.mOverruns.StoreRelaxed(0);
+		reader.mFramesDropped.StoreRelaxed(0);
+		reader.mActive.StoreRelease(1);
+		return i;
+	}
+	return kInvalidReader;
+}
+
+void	CABroadcastRingBuffer::RemoveReader(ReaderID reader)
+{
+	if (reader >= 0 && reader < kMaxReaders)
+		mReaders[reader].mActive.StoreRelease(0);
+}
+
+bool	CABroadcastRingBuffer::BeginRead(ReaderID id, UInt32 maxFrames, Span &outSpan)
+{
+	if (mBuffers == NULL)
+		return false;
+
+	Reader &reader = mReaders[id];
+	// the reserve is loaded first, so the count is never more than a buffer behind it
+	UInt32 reserved = mWriteReserve.LoadAcquire();
+	UInt32 written = mWriteCount.LoadAcquire();
+	UInt32 cursor = reader.mCursor.LoadRelaxed();
+
+	// anything older than a buffer behind the frames being written is gone, or about to be
+	if (reserved - cursor > mCapacityFrames) {
+		// skip to halfway back, so a reader that's just a bit slow isn't lapped again straight away
+		UInt32 newCursor = reserved - mCapacityFrames / 2;
+		if ((SInt32)(written - newCursor) < 0)
+			newCursor = written;
+		reader.mOverruns.StoreRelaxed(reader.mOverruns.LoadRelaxed() + 1);
+		reader.mFramesDropped.StoreRelaxed(reader.mFramesDropped.LoadRelaxed() + (newCursor - cursor));
+		cursor = newCursor;
+		reader.mCursor.StoreRelaxed(cursor);
+	}
+
+	UInt32 available = written - cursor;
+	if (available == 0 || maxFrames == 0)
+		return false;
+
+	UInt32 frames = std::min(available, maxFrames);
+	UInt32 offset = cursor & mCapacityFramesMask;
+
+	outSpan.mStartFrame = cursor;
+	outSpan.mRingOffset[0] = offset;
+	outSpan.mFrames[0] = std::min(frames, mCapacityFrames - offset);
+	outSpan.mRingOffset[1] = 0;
+	outSpan.mFrames[1] = frames - outSpan.mFrames[0];
+	return true;
+}
+
+bool	CABroadcastRingBuffer::EndRead(ReaderID id, const Span &span)
+{
+	// the reader's loads of the data come before this check
+	CARingBufferAtomic<UInt32>::AcquireFence();
+	UInt32 reserved = mWriteReserve.LoadRelaxed();
+
+	if (reserved - span.mStartFrame > mCapacityFrames)
+		return false;		// the next BeginRead counts the overrun
+
+	mReaders[id].mCursor.StoreRelaxed(span.mStartFrame + span.TotalFrames());
+	return true;
+}
+
+UInt32	CABroadcastRingBuffer::Lag(ReaderID id) const
+{
+	return mWriteCount.LoadAcquire() - mReaders[id].mCursor.LoadRelaxed();
+}
@@ -0,0 +1,95 @@
+/*
+	CABroadcastRingBuffer.h
+
+	A ring buffer with one writer and several independent readers.
+
+	The writer's cost doesn't depend on the number of readers: it copies each slice in once and never looks at
+	reader state, so a slow reader can't stall it.  A reader that falls more than a buffer behind is lapped; it
+	notices on its next read, counts an overrun, and skips forward.  Readers get spans pointing straight into the
+	ring rather than copies, and confirm after using the data that the writer didn't overwrite it meanwhile.
+
+	Frame positions are 32-bit counters that wrap; only differences between them are meaningful.
+*/
+#ifndef __CABroadcastRingBuffer_h__
+#define __CABroadcastRingBuffer_h__
+
+#include "CARingBuffer.h"
+
+class CABroadcastRingBuffer {
+public:
+	enum { kMaxReaders = 8 };
+
+	typedef SInt32 ReaderID;
+	enum { kInvalidReader = -1 };
+
+	// Up to two contiguous regions of the ring, the second one only non-empty when the span wraps.
+	struct Span {
+		UInt32				mStartFrame;		// stream position of the first frame
+		UInt32				mRingOffset[2];		// frame offset of each region within the ring
+		UInt32				mFrames[2];
+
+		UInt32				TotalFrames() const { return mFrames[0] + mFrames[1]; }
+	};
+
+							CABroadcastRingBuffer();
+							~CABroadcastRingBuffer();
+
+	// Not thread safe.  Existing readers stay registered and restart at the write position.
+	void					Allocate(UInt32 nChannels, UInt32 bytesPerFrame, UInt32 capacityFrames);
+								// capacityFrames will be rounded up to a power of 2
+	void					Deallocate();
+
+	UInt32					NumberChannels() const { return mNumberChannels; }
+	UInt32					BytesPerFrame() const { return mBytesPerFrame; }
+	UInt32					CapacityFrames() const { return mCapacityFrames; }
+
+	// Writer.  Only the last CapacityFrames() of an oversized slice are kept.
+	void					Write(const AudioBufferList *abl, UInt32 nFrames);
+	UInt32					FramesWritten() const { return mWriteCount.LoadAcquire(); }
+
+	// Reader registration.  Call these from one thread, typically the main thread.  A new reader starts at
+	// the current write position.
+	ReaderID				AddReader();
+	void					RemoveReader(ReaderID reader);
+
+	// Reading.  Each reader may be used by one thread at a time.  BeginRead describes up to maxFrames of
+	// unread data, or returns false if there is none.  The data for channel c of region r starts at
+	// SpanData(span, r, c).  EndRead returns false if the writer overwrote any of the span while it was being
+	// used, in which case the data must be discarded; otherwise the reader moves past it.
+	bool					BeginRead(ReaderID reader, UInt32 maxFrames, Span &outSpan);
+	const Byte *			SpanData(const Span &span, UInt32 region, UInt32 channel) const
+								{ return mBuffers[channel] + span.mRingOffset[region] * mBytesPerFrame; }
+	bool					EndRead(ReaderID reader, const Span &span);
+
+	// Per-reader statistics, safe from any thread.
+	UInt32					Lag(ReaderID reader) const;					// frames written but not yet read
+	UInt32					Overruns(ReaderID reader) const { return mReaders[reader].mOverruns.LoadRelaxed(); }
+	UInt32					FramesDropped(ReaderID reader) const { return mReaders[reader].mFramesDropped.LoadRelaxed(); }
+
+private:
+							CABroadcastRingBuffer(const CABroadcastRingBuffer&);
+	CABroadcastRingBuffer&	operator=(const CABroadcastRingBuffer&);
+
+	struct Reader {
+		CARingBufferAtomic<UInt32>	mActive;
+		CARingBufferAtomic<UInt32>	mCursor;			// next frame to read
+		CARingBufferAtomic<UInt32>	mOverruns;
+		CARingBufferAtomic<UInt32>	mFramesDropped;
+	};
+
+	Byte **					mBuffers;				// allocated in one chunk of memory
+	UInt32					mNumberChannels;
+	UInt32					mBytesPerFrame;			// within one deinterleaved channel
+	UInt32					mCapacityFrames;		// per channel, a power of 2
+	UInt32					mCapacityFramesMask;
+
+	// The writer publishes how far it is about to write before touching the ring (mWriteReserve), and how
+	// far it has finished writing afterwards (mWriteCount).  Readers read up to the second and validate
+	// against the first.
+	CARingBufferAtomic<UInt32>	mWriteCount;
+	CARingBufferAtomic<UInt32>	mWriteReserve;
+
+	Reader					mReaders[kMaxReaders];
+};
+
+#endif // __CABroadcastRingBuffer_h__
@@ -99,7 +99,7 @@
 	#else
 		#include "CADebugPrintf.h"
 		
-		#if	(CoreAudio_FlushDebugMessages && !CoreAudio_UseSysLog) || defined(CoreAudio_UseSideFile)
+		#if	(CoreAudio_FlushDebugMessages && !CoreAudio_UseSysLog && !CoreAudio_UseRealTimeLog) || defined(CoreAudio_UseSideFile)
 			#define	FlushRtn	,fflush(DebugPrintfFile)
 		#else
 			#define	FlushRtn
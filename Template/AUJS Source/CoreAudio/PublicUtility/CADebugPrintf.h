@@ -57,6 +57,7 @@
 
 //#define	CoreAudio_UseSysLog		1
 //#define	CoreAudio_UseSideFile	"/CoreAudio-%d.txt"
+//#define	CoreAudio_UseRealTimeLog	1
 
 #if	DEBUG || CoreAudio_Debug
 	
@@ -87,6 +88,12 @@
 			#define	DebugPrintfFile	((sDebugPrintfSideFile != NULL) ? sDebugPrintfSideFile : stderr)
 			#define	DebugPrintfLineEnding	"\n"
 			#define	DebugPrintfFileComma	DebugPrintfFile,
+		#elif CoreAudio_UseRealTimeLog
+			#include "CARealTimeLog.h"
+			#define	DebugPrintfRtn	CARealTimeLogPrintf
+			#define	DebugPrintfFile	stderr
+			#define	DebugPrintfLineEnding	"\n"
+			#define	DebugPrintfFileComma
 		#else
 			#include <stdio.h>
 			#define	DebugPrintfRtn	fprintf
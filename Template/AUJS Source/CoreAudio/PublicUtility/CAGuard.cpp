@@ -71,9 +71,9 @@
 //	CAGuard
 //==================================================================================================
 
-CAGuard::CAGuard(const char* inName)
+CAGuard::CAGuard(const char* inName, bool inPriorityInheritance)
 :
-	CAMutex(inName)
+	CAMutex(inName, inPriorityInheritance)
 #if	Log_Average_Latency
 	,mAverageLatencyAccumulator(0.0),
 	mAverageLatencyCount(0)
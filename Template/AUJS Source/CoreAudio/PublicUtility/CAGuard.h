@@ -69,7 +69,7 @@ class	CAGuard : public CAMutex
 
 //	Construction/Destruction
 public:
-					CAGuard(const char* inName);
+					CAGuard(const char* inName, bool inPriorityInheritance = false);
 	virtual			~CAGuard();
 
 //	Actions
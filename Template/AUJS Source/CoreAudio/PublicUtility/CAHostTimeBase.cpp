@@ -44,6 +44,10 @@
 
 #include "CAHostTimeBase.h"
 
+#if CAHostTimeBase_POSIX && CAHostTimeBase_UseTSC
+	#include <cpuid.h>
+#endif
+
 Float64	CAHostTimeBase::sFrequency = 0;
 Float64	CAHostTimeBase::sInverseFrequency = 0;
 UInt32	CAHostTimeBase::sMinDelta = 0;
@@ -53,6 +57,14 @@ UInt32	CAHostTimeBase::sFromNanosNumerator = 0;
 UInt32	CAHostTimeBase::sFromNanosDenominator = 0;
 bool	CAHostTimeBase::sUseMicroseconds = false;
 bool	CAHostTimeBase::sIsInited = false;
+bool	CAHostTimeBase::sToNanosIsIdentity = false;
+UInt32	CAHostTimeBase::sToNanosWhole = 0;
+UInt64	CAHostTimeBase::sToNanosFraction = 0;
+UInt32	CAHostTimeBase::sFromNanosWhole = 0;
+UInt64	CAHostTimeBase::sFromNanosFraction = 0;
+#if CAHostTimeBase_POSIX
+bool	CAHostTimeBase::sUseTSC = false;
+#endif
 #if Track_Host_TimeBase
 UInt64	CAHostTimeBase::sLastTime = 0;
 #endif
@@ -63,6 +75,82 @@ UInt64	CAHostTimeBase::sLastTime = 0;
 //	This class provides platform independent access to the host's time base.
 //=============================================================================
 
+#if CAHostTimeBase_POSIX
+
+static UInt64	GetMonotonicNanos()
+{
+	struct timespec theValue;
+	clock_gettime(CLOCK_MONOTONIC, &theValue);
+	return static_cast<UInt64>(theValue.tv_sec) * 1000000000ULL + static_cast<UInt64>(theValue.tv_nsec);
+}
+
+#if CAHostTimeBase_UseTSC
+static UInt64	ReadTSC()
+{
+	UInt32 theLow, theHigh;
+	__asm__ __volatile__("rdtsc" : "=a" (theLow), "=d" (theHigh));
+	return (static_cast<UInt64>(theHigh) << 32) | theLow;
+}
+
+//	Only a TSC that runs at a constant rate through frequency changes and sleep
+//	states, and is synchronized across cores, can stand in for the clock.
+static bool		HasInvariantTSC()
+{
+	unsigned int theEAX, theEBX, theECX, theEDX;
+	if(!__get_cpuid(0x80000000, &theEAX, &theEBX, &theECX, &theEDX) || (theEAX < 0x80000007))
+	{
+		return false;
+	}
+	__get_cpuid(0x80000007, &theEAX, &theEBX, &theECX, &theEDX);
+	return (theEDX & (1 << 8)) != 0;
+}
+
+//	Counts TSC ticks across about 20ms of CLOCK_MONOTONIC.
+static Float64	CalibrateTSC()
+{
+	UInt64 theStartNanos = GetMonotonicNanos();
+	UInt64 theStartTicks = ReadTSC();
+	UInt64 theEndNanos;
+	do
+	{
+		struct timespec theNap = { 0, 1000000 };
+		nanosleep(&theNap, NULL);
+		theEndNanos = GetMonotonicNanos();
+	}
+	while((theEndNanos - theStartNanos) < 20000000ULL);
+	UInt64 theEndTicks = ReadTSC();
+	return static_cast<Float64>(theEndTicks - theStartTicks) * 1000000000.0 / static_cast<Float64>(theEndNanos - theStartNanos);
+}
+#endif
+
+//	The clock is chosen, and the TSC calibrated, before anything can read it from a render thread.
+static struct CAHostTimeBaseStartup
+{
+	CAHostTimeBaseStartup() { CAHostTimeBase::GetFrequency(); }
+} sHostTimeBaseStartup;
+
+#endif
+
+void	CAHostTimeBase::RatioToFixed(Float64 inRatio, UInt32& outWhole, UInt64& outFraction)
+{
+	if(!(inRatio > 0))
+	{
+		outWhole = 0;
+		outFraction = 0;
+		return;
+	}
+	Float64 theWhole = (inRatio < 4294967295.0) ? static_cast<Float64>(static_cast<UInt32>(inRatio)) : 4294967295.0;
+	Float64 theFraction = (inRatio - theWhole) * 18446744073709551616.0;
+	if(theFraction >= 18446744073709551616.0)
+	{
+		//	rounded up to the next whole number
+		theWhole += 1.0;
+		theFraction = 0;
+	}
+	outWhole = static_cast<UInt32>(theWhole);
+	outFraction = static_cast<UInt64>(theFraction);
+}
+
 void	CAHostTimeBase::Initialize()
 {
 	//	get the info about Absolute time
@@ -87,9 +175,28 @@ void	CAHostTimeBase::Initialize()
 		sFromNanosNumerator = sToNanosDenominator;
 		sFromNanosDenominator = sToNanosNumerator;
 		sFrequency = static_cast<Float64>(*((UInt64*)&theFrequency));
+	#elif CAHostTimeBase_POSIX
+		sMinDelta = 1;
+		sFrequency = 1000000000.0;
+		#if CAHostTimeBase_UseTSC
+			if(HasInvariantTSC())
+			{
+				sFrequency = CalibrateTSC();
+				sUseTSC = true;
+			}
+		#endif
+		//	kilohertz over a million nanoseconds is close enough for the rational form
+		sToNanosNumerator = 1000000;
+		sToNanosDenominator = static_cast<UInt32>(sFrequency / 1000.0 + 0.5);
+		sFromNanosNumerator = sToNanosDenominator;
+		sFromNanosDenominator = sToNanosNumerator;
 	#endif
 	sInverseFrequency = 1.0 / sFrequency;
 	
+	sToNanosIsIdentity = (sFrequency == 1000000000.0);
+	RatioToFixed(1000000000.0 / sFrequency, sToNanosWhole, sToNanosFraction);
+	RatioToFixed(sFrequency / 1000000000.0, sFromNanosWhole, sFromNanosFraction);
+	
 	#if	Log_Host_Time_Base_Parameters
 		DebugMessage(  "Host Time Base Parameters");
 		DebugMessageN1(" Minimum Delta:          %lu", sMinDelta);
@@ -55,6 +55,13 @@
 	#include <mach/mach_time.h>
 #elif TARGET_OS_WIN32
 	#include <windows.h>
+#elif defined(__unix__)
+	//	CLOCK_MONOTONIC in nanoseconds, or the TSC where it's invariant (see Initialize)
+	#include <time.h>
+	#define	CAHostTimeBase_POSIX	1
+	#if !defined(CAHostTimeBase_UseTSC) && (defined(__i386__) || defined(__x86_64__))
+		#define	CAHostTimeBase_UseTSC	1
+	#endif
 #else
 	#error	Unsupported operating system
 #endif
@@ -65,6 +72,10 @@
 //	CAHostTimeBase
 //
 //	This class provides platform independent access to the host's time base.
+//
+//	Converting to and from nanoseconds multiplies by a 32.64 fixed point ratio
+//	worked out once in Initialize, rather than dividing each time, so it is
+//	cheap enough to call on every render.
 //=============================================================================
 
 #if CoreAudio_Debug
@@ -92,10 +103,22 @@ public:
 	static UInt64	AbsoluteHostDeltaToNanos(UInt64 inStartTime, UInt64 inEndTime);
 	static SInt64	HostDeltaToNanos(UInt64 inStartTime, UInt64 inEndTime);
 
+	//	inValue * (inWhole + inFraction / 2^64), without overflowing before the result does
+	static UInt64	MultiplyFixed(UInt64 inValue, UInt32 inWhole, UInt64 inFraction);
+	static void		RatioToFixed(Float64 inRatio, UInt32& outWhole, UInt64& outFraction);
+
 private:
 	static void		Initialize();
 	
 	static bool		sIsInited;
+	static bool		sToNanosIsIdentity;
+	static UInt32	sToNanosWhole;
+	static UInt64	sToNanosFraction;
+	static UInt32	sFromNanosWhole;
+	static UInt64	sFromNanosFraction;
+#if CAHostTimeBase_POSIX
+	static bool		sUseTSC;
+#endif
 	
 	static Float64	sFrequency;
 	static Float64	sInverseFrequency;
@@ -120,6 +143,26 @@ inline UInt64	CAHostTimeBase::GetTheCurrentTime()
 		LARGE_INTEGER theValue;
 		QueryPerformanceCounter(&theValue);
 		theTime = *((UInt64*)&theValue);
+	#elif CAHostTimeBase_POSIX
+		//	the clock is picked in Initialize, so it has to happen before the first reading
+		if(!sIsInited)
+		{
+			Initialize();
+		}
+		#if CAHostTimeBase_UseTSC
+		if(sUseTSC)
+		{
+			UInt32 theLow, theHigh;
+			__asm__ __volatile__("rdtsc" : "=a" (theLow), "=d" (theHigh));
+			theTime = (static_cast<UInt64>(theHigh) << 32) | theLow;
+		}
+		else
+		#endif
+		{
+			struct timespec theValue;
+			clock_gettime(CLOCK_MONOTONIC, &theValue);
+			theTime = static_cast<UInt64>(theValue.tv_sec) * 1000000000ULL + static_cast<UInt64>(theValue.tv_nsec);
+		}
 	#endif
 	
 	#if	Track_Host_TimeBase
@@ -147,18 +190,11 @@ inline UInt64	CAHostTimeBase::ConvertToNanos(UInt64 inHostTime)
 		Initialize();
 	}
 	
-	Float64 theNumerator = static_cast<Float64>(sToNanosNumerator);
-	Float64 theDenominator = static_cast<Float64>(sToNanosDenominator);
-	Float64 theHostTime = static_cast<Float64>(inHostTime);
-
-	Float64 thePartialAnswer = theHostTime / theDenominator;
-	Float64 theFloatAnswer = thePartialAnswer * theNumerator;
-	UInt64 theAnswer = static_cast<UInt64>(theFloatAnswer);
-
-	//Assert(!((theNumerator > theDenominator) && (theAnswer < inHostTime)), "CAHostTimeBase::ConvertToNanos: The conversion wrapped");
-	//Assert(!((theDenominator > theNumerator) && (theAnswer > inHostTime)), "CAHostTimeBase::ConvertToNanos: The conversion wrapped");
-
-	return theAnswer;
+	if(sToNanosIsIdentity)
+	{
+		return inHostTime;
+	}
+	return MultiplyFixed(inHostTime, sToNanosWhole, sToNanosFraction);
 }
 
 inline UInt64	CAHostTimeBase::ConvertFromNanos(UInt64 inNanos)
@@ -168,18 +204,30 @@ inline UInt64	CAHostTimeBase::ConvertFromNanos(UInt64 inNanos)
 		Initialize();
 	}
 
-	Float64 theNumerator = static_cast<Float64>(sToNanosNumerator);
-	Float64 theDenominator = static_cast<Float64>(sToNanosDenominator);
-	Float64 theNanos = static_cast<Float64>(inNanos);
-
-	Float64 thePartialAnswer = theNanos / theNumerator;
-	Float64 theFloatAnswer = thePartialAnswer * theDenominator;
-	UInt64 theAnswer = static_cast<UInt64>(theFloatAnswer);
-
-	//Assert(!((theDenominator > theNumerator) && (theAnswer < inNanos)), "CAHostTimeBase::ConvertToNanos: The conversion wrapped");
-	//Assert(!((theNumerator > theDenominator) && (theAnswer > inNanos)), "CAHostTimeBase::ConvertToNanos: The conversion wrapped");
+	if(sToNanosIsIdentity)
+	{
+		return inNanos;
+	}
+	return MultiplyFixed(inNanos, sFromNanosWhole, sFromNanosFraction);
+}
 
-	return theAnswer;
+inline UInt64	CAHostTimeBase::MultiplyFixed(UInt64 inValue, UInt32 inWhole, UInt64 inFraction)
+{
+#if defined(__SIZEOF_INT128__)
+	return inValue * inWhole + static_cast<UInt64>((static_cast<unsigned __int128>(inValue) * inFraction) >> 64);
+#else
+	//	the high half of the 128 bit product of the value and the fraction, one 32 x 32 bit product at a time
+	UInt64 theValueHigh = inValue >> 32;
+	UInt64 theValueLow = inValue & 0xFFFFFFFFULL;
+	UInt64 theFractionHigh = inFraction >> 32;
+	UInt64 theFractionLow = inFraction & 0xFFFFFFFFULL;
+	UInt64 theLowLow = theValueLow * theFractionLow;
+	UInt64 theHighLow = theValueHigh * theFractionLow;
+	UInt64 theLowHigh = theValueLow * theFractionHigh;
+	UInt64 theMiddle = (theLowLow >> 32) + (theHighLow & 0xFFFFFFFFULL) + (theLowHigh & 0xFFFFFFFFULL);
+	UInt64 theProductHigh = theValueHigh * theFractionHigh + (theHighLow >> 32) + (theLowHigh >> 32) + (theMiddle >> 32);
+	return inValue * inWhole + theProductHigh;
+#endif
 }
 
 
@@ -222,4 +270,101 @@ inline SInt64	CAHostTimeBase::HostDeltaToNanos(UInt64 inStartTime, UInt64 inEndT
 	return theSign * ConvertToNanos(theAnswer);
 }
 
+//=============================================================================
+//	CAHostTimeSampleMap
+//
+//	Maps host times onto a sample timeline from an anchor: one host time and
+//	the sample time that goes with it, such as a render's AudioTimeStamp.  The
+//	rate is kept as 32.64 fixed point samples per host tick, so mapping a time
+//	to a sample offset is a multiply.  Error grows with distance from the
+//	anchor, so move it every render.
+//=============================================================================
+
+class	CAHostTimeSampleMap
+{
+
+public:
+					CAHostTimeSampleMap() : mAnchorHostTime(0), mAnchorSampleTime(0), mSamplesPerTick(0), mTicksPerSample(0), mSamplesPerTickWhole(0), mSamplesPerTickFraction(0) {}
+
+	//	inRateScalar is AudioTimeStamp's: actual host ticks per sample over the nominal number
+	void			SetAnchor(UInt64 inHostTime, Float64 inSampleTime, Float64 inSampleRate, Float64 inRateScalar = 1.0);
+	void			SetAnchor(const AudioTimeStamp& inTimeStamp, Float64 inSampleRate);
+
+	//	inFrames samples, starting at inStartSampleTime, span inStartHostTime to inEndHostTime
+	void			SetSpan(UInt64 inStartHostTime, UInt64 inEndHostTime, Float64 inStartSampleTime, UInt32 inFrames);
+
+	UInt64			GetAnchorHostTime() const { return mAnchorHostTime; }
+	Float64			GetAnchorSampleTime() const { return mAnchorSampleTime; }
+
+	//	whole samples from the anchor, rounded toward the anchor
+	SInt64			HostTimeToSampleOffset(UInt64 inHostTime) const;
+	Float64			HostTimeToSampleTime(UInt64 inHostTime) const;
+	UInt64			SampleTimeToHostTime(Float64 inSampleTime) const;
+
+private:
+	void			SetRate(Float64 inSamplesPerTick);
+
+	UInt64			mAnchorHostTime;
+	Float64			mAnchorSampleTime;
+	Float64			mSamplesPerTick;
+	Float64			mTicksPerSample;
+	UInt32			mSamplesPerTickWhole;
+	UInt64			mSamplesPerTickFraction;
+};
+
+inline void	CAHostTimeSampleMap::SetRate(Float64 inSamplesPerTick)
+{
+	mSamplesPerTick = inSamplesPerTick;
+	mTicksPerSample = (inSamplesPerTick > 0) ? 1.0 / inSamplesPerTick : 0;
+	CAHostTimeBase::RatioToFixed(inSamplesPerTick, mSamplesPerTickWhole, mSamplesPerTickFraction);
+}
+
+inline void	CAHostTimeSampleMap::SetAnchor(UInt64 inHostTime, Float64 inSampleTime, Float64 inSampleRate, Float64 inRateScalar)
+{
+	mAnchorHostTime = inHostTime;
+	mAnchorSampleTime = inSampleTime;
+	SetRate(inSampleRate * CAHostTimeBase::GetInverseFrequency() / inRateScalar);
+}
+
+inline void	CAHostTimeSampleMap::SetAnchor(const AudioTimeStamp& inTimeStamp, Float64 inSampleRate)
+{
+	UInt64 theHostTime = (inTimeStamp.mFlags & kAudioTimeStampHostTimeValid) ? inTimeStamp.mHostTime : CAHostTimeBase::GetTheCurrentTime();
+	Float64 theSampleTime = (inTimeStamp.mFlags & kAudioTimeStampSampleTimeValid) ? inTimeStamp.mSampleTime : 0;
+	Float64 theRateScalar = ((inTimeStamp.mFlags & kAudioTimeStampRateScalarValid) && (inTimeStamp.mRateScalar > 0)) ? inTimeStamp.mRateScalar : 1.0;
+	SetAnchor(theHostTime, theSampleTime, inSampleRate, theRateScalar);
+}
+
+inline void	CAHostTimeSampleMap::SetSpan(UInt64 inStartHostTime, UInt64 inEndHostTime, Float64 inStartSampleTime, UInt32 inFrames)
+{
+	mAnchorHostTime = inStartHostTime;
+	mAnchorSampleTime = inStartSampleTime;
+	SetRate((inEndHostTime > inStartHostTime) ? static_cast<Float64>(inFrames) / static_cast<Float64>(inEndHostTime - inStartHostTime) : 0);
+}
+
+inline SInt64	CAHostTimeSampleMap::HostTimeToSampleOffset(UInt64 inHostTime) const
+{
+	if(inHostTime >= mAnchorHostTime)
+	{
+		return static_cast<SInt64>(CAHostTimeBase::MultiplyFixed(inHostTime - mAnchorHostTime, mSamplesPerTickWhole, mSamplesPerTickFraction));
+	}
+	return -static_cast<SInt64>(CAHostTimeBase::MultiplyFixed(mAnchorHostTime - inHostTime, mSamplesPerTickWhole, mSamplesPerTickFraction));
+}
+
+inline Float64	CAHostTimeSampleMap::HostTimeToSampleTime(UInt64 inHostTime) const
+{
+	Float64 theDelta = (inHostTime >= mAnchorHostTime) ? static_cast<Float64>(inHostTime - mAnchorHostTime) : -static_cast<Float64>(mAnchorHostTime - inHostTime);
+	return mAnchorSampleTime + theDelta * mSamplesPerTick;
+}
+
+inline UInt64	CAHostTimeSampleMap::SampleTimeToHostTime(Float64 inSampleTime) const
+{
+	Float64 theDelta = (inSampleTime - mAnchorSampleTime) * mTicksPerSample;
+	if(theDelta >= 0)
+	{
+		return mAnchorHostTime + static_cast<UInt64>(theDelta);
+	}
+	UInt64 theEarlier = static_cast<UInt64>(-theDelta);
+	return (theEarlier < mAnchorHostTime) ? mAnchorHostTime - theEarlier : 0;
+}
+
 #endif
@@ -0,0 +1,178 @@
+/*
+	CAMIDIParser.h
+
+	Incremental MIDI 1.0 byte stream parser.
+
+	Bytes can be fed in arbitrarily sized pieces; a message split across calls is completed on a later call.
+	Running status, realtime bytes interleaved anywhere (including in the middle of a message or a SysEx), and
+	SysEx messages spanning many calls are all handled.  SysEx is reassembled into a buffer allocated once by the
+	constructor, so Parse() never allocates and is safe to call on a real-time thread.
+*/
+#ifndef __CAMIDIParser_h__
+#define __CAMIDIParser_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+#include "CAAutoDisposer.h"
+
+class CAMIDIParser
+{
+public:
+	class Handler
+	{
+	public:
+		virtual					~Handler() {}
+
+		// A complete channel or system common message, or a single realtime byte.  Unused data bytes are 0.
+		virtual void			MIDIMessage(UInt8 inStatus, UInt8 inData1, UInt8 inData2, UInt64 inTimeStamp) = 0;
+
+		// A complete system exclusive message, from the F0 through the F7 inclusive.  inData is only valid
+		// for the duration of the call.
+		virtual void			MIDISysEx(const UInt8 *inData, UInt32 inLength, UInt64 inTimeStamp) = 0;
+	};
+
+	enum { kDefaultMaxSysExLength = 4096 };
+
+							CAMIDIParser(UInt32 inMaxSysExLength = kDefaultMaxSysExLength)
+								: mSysEx(inMaxSysExLength), mMaxSysExLength(inMaxSysExLength), mDroppedSysExCount(0)
+							{
+								Reset();
+							}
+
+	// forget any partial message and the running status
+	void					Reset()
+							{
+								mStatus = 0;
+								mDataCount = 0;
+								mDataNeeded = 0;
+								mMessageTimeStamp = 0;
+								mInSysEx = false;
+								mSysExOverflow = false;
+								mSysExLength = 0;
+								mSysExTimeStamp = 0;
+							}
+
+	// SysEx messages longer than the buffer are dropped rather than delivered truncated
+	UInt32					DroppedSysExCount() const { return mDroppedSysExCount; }
+
+	// inTimeStamp is passed through to the handler with every message that starts in this piece of the stream
+	void					Parse(const UInt8 *inData, UInt32 inLength, UInt64 inTimeStamp, Handler &inHandler)
+							{
+								const UInt8 *end = inData + inLength;
+								for (const UInt8 *p = inData; p < end; ++p) {
+									UInt8 byte = *p;
+
+									if (byte >= 0xF8) {
+										// realtime: doesn't disturb anything else in progress
+										inHandler.MIDIMessage(byte, 0, 0, inTimeStamp);
+										continue;
+									}
+
+									if (byte & 0x80) {
+										if (mInSysEx)
+											// any other status byte ends a SysEx, F7 or not
+											EndSysEx(inHandler);
+
+										if (byte == 0xF0) {
+											mStatus = 0;
+											mInSysEx = true;
+											mSysExOverflow = false;
+											mSysExLength = 0;
+											mSysExTimeStamp = inTimeStamp;
+											mSysEx()[mSysExLength++] = byte;
+											continue;
+										}
+
+										mStatus = byte;
+										mDataCount = 0;
+										mDataNeeded = DataLength(byte);
+										mMessageTimeStamp = inTimeStamp;
+										if (mDataNeeded == 0) {
+											if (byte != 0xF7)	// a stray EOX is dropped
+												inHandler.MIDIMessage(byte, 0, 0, inTimeStamp);
+											mStatus = 0;		// system common cancels running status
+										}
+										continue;
+									}
+
+									// data byte
+									if (mInSysEx) {
+										// leave room for the F7
+										if (mSysExLength + 1 < mMaxSysExLength)
+											mSysEx()[mSysExLength++] = byte;
+										else
+											mSysExOverflow = true;
+										continue;
+									}
+
+									if (mStatus == 0)
+										continue;		// no status to attach it to
+
+									if (mDataCount == 0)
+										mMessageTimeStamp = inTimeStamp;
+									mData[mDataCount++] = byte;
+									if (mDataCount == mDataNeeded) {
+										inHandler.MIDIMessage(mStatus, mData[0], mDataNeeded > 1 ? mData[1] : 0, mMessageTimeStamp);
+										mDataCount = 0;
+										if (mStatus >= 0xF0)
+											mStatus = 0;
+									}
+								}
+							}
+
+private:
+							CAMIDIParser(const CAMIDIParser&);
+	CAMIDIParser&			operator=(const CAMIDIParser&);
+
+	static UInt32			DataLength(UInt8 inStatus)
+							{
+								switch (inStatus & 0xF0) {
+								case 0xC0:
+								case 0xD0:
+									return 1;
+								case 0xF0:
+									switch (inStatus) {
+									case 0xF1:	// MTC quarter frame
+									case 0xF3:	// song select
+										return 1;
+									case 0xF2:	// song position
+										return 2;
+									default:
+										return 0;
+									}
+								default:
+									return 2;
+								}
+							}
+
+	void					EndSysEx(Handler &inHandler)
+							{
+								mInSysEx = false;
+								if (mSysExOverflow) {
+									++mDroppedSysExCount;
+									return;
+								}
+								mSysEx()[mSysExLength++] = 0xF7;
+								inHandler.MIDISysEx(mSysEx(), mSysExLength, mSysExTimeStamp);
+							}
+
+	CAAutoFree<UInt8>		mSysEx;
+	UInt32					mMaxSysExLength;
+	UInt32					mSysExLength;
+	UInt64					mSysExTimeStamp;
+	bool					mInSysEx;
+	bool					mSysExOverflow;
+	UInt32					mDroppedSysExCount;
+
+	UInt8					mStatus;			// running status, or 0
+	UInt8					mData[2];
+	UInt32					mDataCount;
+	UInt32					mDataNeeded;
+	UInt64					mMessageTimeStamp;
+};
+
+#endif
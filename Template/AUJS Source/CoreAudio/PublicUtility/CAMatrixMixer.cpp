@@ -0,0 +1,171 @@
+/*
+	CAMatrixMixer.cpp
+*/
+#include "CAMatrixMixer.h"
+#include "CAAtomic.h"
+#include "CAVectorKernels.h"
+#include <math.h>
+#include <string.h>
+
+// once a gain is this close to its target it snaps there, about -100 dB
+static const Float32 kGainSnapThreshold = 1e-5f;
+
+CAMatrixMixer::CAMatrixMixer() :
+	mNumberInputs(0),
+	mNumberOutputs(0),
+	mSampleRate(44100.),
+	mSmoothingTime(0.01),
+	mSmoothingCoefficient(1.f),
+	mGeneration(0),
+	mRowsGeneration(0),
+	mRowsStale(false),
+	mActiveCrosspoints(0)
+{
+}
+
+CAMatrixMixer::~CAMatrixMixer()
+{
+}
+
+void	CAMatrixMixer::Configure(UInt32 nInputs, UInt32 nOutputs, Float64 sampleRate)
+{
+	mNumberInputs = nInputs > kMaxChannels ? kMaxChannels : nInputs;
+	mNumberOutputs = nOutputs > kMaxChannels ? kMaxChannels : nOutputs;
+	mSampleRate = sampleRate;
+
+	UInt32 nCrosspoints = mNumberInputs * mNumberOutputs;
+	mTargets.alloc(nCrosspoints, true);
+	mGains.alloc(nCrosspoints, true);
+	mRowStart.alloc(mNumberOutputs + 1, true);
+	mRowInputs.alloc(nCrosspoints);
+	mActiveCrosspoints = 0;
+
+	SetSmoothingTime(mSmoothingTime);
+	RebuildRows();
+}
+
+void	CAMatrixMixer::SetSmoothingTime(Float64 inSeconds)
+{
+	mSmoothingTime = inSeconds;
+	if (inSeconds <= 0. || mSampleRate <= 0.)
+		mSmoothingCoefficient = 1.f;
+	else
+		mSmoothingCoefficient = 1.f - expf(-1.f / (Float32)(inSeconds * mSampleRate));
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	Gains
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void	CAMatrixMixer::SetGain(UInt32 inInput, UInt32 inOutput, Float32 inGain)
+{
+	if (inInput >= mNumberInputs || inOutput >= mNumberOutputs)
+		return;
+
+	Float32 &target = mTargets[inOutput * mNumberInputs + inInput];
+	bool wasOn = target != 0.f;
+	target = inGain;
+		// only a crosspoint turning on changes which ones the render thread has to visit; it notices one
+		// turning off itself, once the gain has faded out
+	if (!wasOn && inGain != 0.f)
+		CAAtomicIncrement32Barrier(&mGeneration);
+}
+
+void	CAMatrixMixer::SetAllGains(Float32 inGain)
+{
+	UInt32 nCrosspoints = mNumberInputs * mNumberOutputs;
+	for (UInt32 i = 0; i < nCrosspoints; ++i)
+		mTargets[i] = inGain;
+	CAAtomicIncrement32Barrier(&mGeneration);
+}
+
+void	CAMatrixMixer::SetIdentity()
+{
+	for (UInt32 out = 0; out < mNumberOutputs; ++out)
+		for (UInt32 in = 0; in < mNumberInputs; ++in)
+			mTargets[out * mNumberInputs + in] = in == out ? 1.f : 0.f;
+	CAAtomicIncrement32Barrier(&mGeneration);
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	Render
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void	CAMatrixMixer::RebuildRows()
+{
+	UInt32 entry = 0;
+	for (UInt32 out = 0; out < mNumberOutputs; ++out) {
+		mRowStart[out] = entry;
+		const Float32 *targets = mTargets + out * mNumberInputs;
+		const Float32 *gains = mGains + out * mNumberInputs;
+		for (UInt32 in = 0; in < mNumberInputs; ++in)
+			if (targets[in] != 0.f || gains[in] != 0.f)
+				mRowInputs[entry++] = (UInt16)in;
+	}
+	mRowStart[mNumberOutputs] = entry;
+	mRowsStale = false;
+}
+
+void	CAMatrixMixer::Render(const Float32 * const *inInputs, Float32 * const *outOutputs, UInt32 inFrames)
+{
+	if (inFrames == 0)
+		return;
+
+	SInt32 generation = mGeneration;
+	CAMemoryBarrier();		// see the targets that were set before the generation changed
+	if (mRowsStale || generation != mRowsGeneration) {
+		mRowsGeneration = generation;
+		RebuildRows();
+	}
+
+	// the one pole step per frame, compounded over the slice
+	Float32 coefficient = mSmoothingCoefficient >= 1.f ? 1.f : 1.f - powf(1.f - mSmoothingCoefficient, (Float32)inFrames);
+	Float32 rampScale = 1.f / inFrames;
+	const CAVectorKernels &kernels = CAVectorKernels::Get();
+	UInt32 active = 0;
+
+	for (UInt32 out = 0; out < mNumberOutputs; ++out) {
+		Float32 *dest = outOutputs[out];
+		if (dest == NULL) continue;
+		memset(dest, 0, inFrames * sizeof(Float32));
+
+		Float32 *gains = mGains + out * mNumberInputs;
+		const Float32 *targets = mTargets + out * mNumberInputs;
+		for (UInt32 entry = mRowStart[out]; entry < mRowStart[out + 1]; ++entry) {
+			UInt32 in = mRowInputs[entry];
+			Float32 gain = gains[in];
+			Float32 target = targets[in];
+
+			if (gain == target) {
+				if (gain == 0.f) {
+					mRowsStale = true;		// turned off since the rows were built
+					continue;
+				}
+				if (inInputs[in])
+					kernels.mMix(inInputs[in], dest, gain, inFrames);
+			} else {
+				Float32 next = gain + coefficient * (target - gain);
+				if (fabsf(target - next) < kGainSnapThreshold)
+					next = target;
+				if (inInputs[in])
+					kernels.mMixRamp(inInputs[in], dest, gain, (next - gain) * rampScale, inFrames);
+				gains[in] = next;
+			}
+			++active;
+		}
+	}
+	mActiveCrosspoints = active;
+}
+
+void	CAMatrixMixer::Render(const AudioBufferList &inInputs, AudioBufferList &outOutputs, UInt32 inFrames)
+{
+	const Float32 *inputs[kMaxChannels];
+	Float32 *outputs[kMaxChannels];
+
+	for (UInt32 i = 0; i < mNumberInputs; ++i)
+		inputs[i] = i < inInputs.mNumberBuffers ? (const Float32 *)inInputs.mBuffers[i].mData : NULL;
+	for (UInt32 i = 0; i < mNumberOutputs; ++i)
+		outputs[i] = i < outOutputs.mNumberBuffers ? (Float32 *)outOutputs.mBuffers[i].mData : NULL;
+
+	Render(inputs, outputs, inFrames);
+}
@@ -0,0 +1,79 @@
+/*
+	CAMatrixMixer.h
+
+	Mixes N input channels into M output channels through an N x M matrix of gains, like the crosspoints of the
+	matrix mixer AU whose volumes MatrixMixerVolumes prints.
+
+	Only the crosspoints with a non-zero gain cost anything: the render thread keeps, for each output, a compressed
+	list of the inputs that feed it (compressed sparse row layout), and rebuilds those lists only when a crosspoint
+	turns on or off.  Each crosspoint's gain glides toward its target with a one pole smoother, ramped linearly
+	within a slice so changes don't click, and accumulates through CAVectorKernels' mix kernels.
+*/
+#ifndef __CAMatrixMixer_h__
+#define __CAMatrixMixer_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+#include "CAAutoDisposer.h"
+
+class CAMatrixMixer {
+public:
+	enum { kMaxChannels = 128 };
+
+						CAMatrixMixer();
+						~CAMatrixMixer();
+
+	// Allocates for the given numbers of channels (up to kMaxChannels each) and sets every gain to 0.  Not real
+	// time safe, and not to be called while rendering.
+	void				Configure(UInt32 nInputs, UInt32 nOutputs, Float64 sampleRate);
+
+	UInt32				NumberInputs() const { return mNumberInputs; }
+	UInt32				NumberOutputs() const { return mNumberOutputs; }
+
+	// Time constant of the gain smoothing, in seconds.  0 ramps each gain change across a single slice.
+	void				SetSmoothingTime(Float64 inSeconds);
+
+	// Crosspoint gains, linear.  These may be called from any one thread while another renders.
+	void				SetGain(UInt32 inInput, UInt32 inOutput, Float32 inGain);
+	Float32				GetGain(UInt32 inInput, UInt32 inOutput) const { return mTargets[inOutput * mNumberInputs + inInput]; }
+	void				SetAllGains(Float32 inGain);
+	void				SetIdentity();				// input n to output n at unity, everything else off
+
+	// Render thread.  Each output is overwritten with its mix; outputs must not alias inputs.
+	void				Render(const Float32 * const *inInputs, Float32 * const *outOutputs, UInt32 inFrames);
+	void				Render(const AudioBufferList &inInputs, AudioBufferList &outOutputs, UInt32 inFrames);
+								// non-interleaved, one channel per buffer
+
+	// number of crosspoints the last Render mixed, including ones still fading out
+	UInt32				ActiveCrosspoints() const { return mActiveCrosspoints; }
+
+private:
+						CAMatrixMixer(const CAMatrixMixer&);
+	CAMatrixMixer&		operator=(const CAMatrixMixer&);
+
+	void				RebuildRows();
+
+	UInt32				mNumberInputs;
+	UInt32				mNumberOutputs;
+	Float64				mSampleRate;
+	Float64				mSmoothingTime;
+	Float32				mSmoothingCoefficient;		// per frame, 1 means no smoothing
+
+	// written by SetGain, read by Render; indexed output * mNumberInputs + input
+	CAAutoFree<Float32>	mTargets;
+	volatile SInt32		mGeneration;				// bumped when a crosspoint turns on or off
+
+	// owned by the render thread
+	CAAutoFree<Float32>	mGains;						// current, smoothed gains, same indexing as mTargets
+	CAAutoFree<UInt32>	mRowStart;					// mNumberOutputs + 1 offsets into mRowInputs
+	CAAutoFree<UInt16>	mRowInputs;					// the inputs feeding each output
+	SInt32				mRowsGeneration;
+	bool				mRowsStale;
+	UInt32				mActiveCrosspoints;
+};
+
+#endif // __CAMatrixMixer_h__
@@ -47,17 +47,30 @@
 
 #if TARGET_OS_MAC
 	#include <errno.h>
+	#include <unistd.h>
 #endif
 
+//	Standard Library Includes
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
 //	PublicUtility Includes
 #include "CADebugMacros.h"
 #include "CAException.h"
 #include "CAHostTimeBase.h"
+#include "CAAtomic.h"
 
 //==================================================================================================
 //	Logging
 //==================================================================================================
 
+//	Priority inheritance keeps a real time thread from waiting on a lower priority owner, but on
+//	some systems it makes every contended hand off go through the kernel, which costs throughput
+#if !defined(CAMutex_PriorityInheritance)
+	#define	CAMutex_PriorityInheritance	0
+#endif
+
 #if CoreAudio_Debug
 //	#define	Log_Ownership		1
 //	#define	Log_Errors			1
@@ -65,19 +78,81 @@
 //	#define LongLatencyThreshholdNS	1000000ULL	// nanoseconds
 #endif
 
+//==================================================================================================
+//	Spinning
+//==================================================================================================
+
+#if TARGET_OS_MAC
+
+//	the most times a thread checks the mutex before it blocks, about a few microseconds
+static const UInt32	kMaxSpins = 100;
+
+//	spinning only helps when the owner can run at the same time
+static UInt32	sMaxSpins = 0xFFFFFFFF;
+
+static inline void	CAMutexPause()
+{
+	//	the memory clobber makes the spin loop read mOwner again
+	#if defined(__i386__) || defined(__x86_64__)
+		__asm__ __volatile__("pause" ::: "memory");
+	#elif defined(__arm__) || defined(__arm64__) || defined(__aarch64__)
+		__asm__ __volatile__("yield" ::: "memory");
+	#else
+		__asm__ __volatile__("" ::: "memory");
+	#endif
+}
+
+//	every live mutex, for ReportAllStatistics
+static pthread_mutex_t	sRegistryMutex = PTHREAD_MUTEX_INITIALIZER;
+static CAMutex*			sRegistry = NULL;
+
+#endif
+
+bool	CAMutex::sStatisticsEnabled = false;
+
 //==================================================================================================
 //	CAMutex
 //==================================================================================================
 
-CAMutex::CAMutex(const char* inName)
+CAMutex::CAMutex(const char* inName, bool inPriorityInheritance)
 :
 	mName(inName),
-	mOwner(0)
+	mOwner(0),
+	mFailedTries(0)
 {
+	memset(&mStatistics, 0, sizeof(mStatistics));
+
 #if TARGET_OS_MAC
-	OSStatus theError = pthread_mutex_init(&mMutex, NULL);
+	pthread_mutexattr_t theAttributes;
+	pthread_mutexattr_init(&theAttributes);
+	#if defined(PTHREAD_PRIO_INHERIT) || (defined(_POSIX_THREAD_PRIO_INHERIT) && (_POSIX_THREAD_PRIO_INHERIT > 0))
+		if(inPriorityInheritance || CAMutex_PriorityInheritance)
+		{
+			//	a real time thread waiting on the mutex lends its priority to the owner
+			//	this is a hint; the mutex works the same if the system won't do it
+			pthread_mutexattr_setprotocol(&theAttributes, PTHREAD_PRIO_INHERIT);
+		}
+	#endif
+	OSStatus theError = pthread_mutex_init(&mMutex, &theAttributes);
+	pthread_mutexattr_destroy(&theAttributes);
 	ThrowIf(theError != 0, CAException(theError), "CAMutex::CAMutex: Could not init the mutex");
 	
+	if(sMaxSpins == 0xFFFFFFFF)
+	{
+		sMaxSpins = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? kMaxSpins : 0;
+	}
+	mSpinEstimate = 0;
+	
+	pthread_mutex_lock(&sRegistryMutex);
+	mPreviousMutex = NULL;
+	mNextMutex = sRegistry;
+	if(sRegistry != NULL)
+	{
+		sRegistry->mPreviousMutex = this;
+	}
+	sRegistry = this;
+	pthread_mutex_unlock(&sRegistryMutex);
+	
 	#if	Log_Ownership
 		DebugPrintfRtn(DebugPrintfFileComma "%p %.4f: CAMutex::CAMutex: creating %s, owner: %p\n", pthread_self(), ((Float64)(CAHostTimeBase::GetCurrentTimeInNanos()) / 1000000.0), mName, mOwner);
 	#endif
@@ -97,6 +172,21 @@ CAMutex::~CAMutex()
 	#if	Log_Ownership
 		DebugPrintfRtn(DebugPrintfFileComma "%p %.4f: CAMutex::~CAMutex: destroying %s, owner: %p\n", pthread_self(), ((Float64)(CAHostTimeBase::GetCurrentTimeInNanos()) / 1000000.0), mName, mOwner);
 	#endif
+	pthread_mutex_lock(&sRegistryMutex);
+	if(mPreviousMutex != NULL)
+	{
+		mPreviousMutex->mNextMutex = mNextMutex;
+	}
+	else
+	{
+		sRegistry = mNextMutex;
+	}
+	if(mNextMutex != NULL)
+	{
+		mNextMutex->mPreviousMutex = mPreviousMutex;
+	}
+	pthread_mutex_unlock(&sRegistryMutex);
+	
 	pthread_mutex_destroy(&mMutex);
 #elif TARGET_OS_WIN32
 	#if	Log_Ownership
@@ -125,10 +215,33 @@ bool	CAMutex::Lock()
 			UInt64 lockTryTime = CAHostTimeBase::GetCurrentTimeInNanos();
 		#endif
 		
-		OSStatus theError = pthread_mutex_lock(&mMutex);
+		bool theRecordStatistics = sStatisticsEnabled;
+		OSStatus theError = pthread_mutex_trylock(&mMutex);
+		if(theError == EBUSY)
+		{
+			//	another thread has it, so spin for a bit in case it's about to let go, then block
+			pthread_t theContendingOwner = mOwner;
+			UInt64 theWaitStart = theRecordStatistics ? CAHostTimeBase::GetCurrentTimeInNanos() : 0;
+			UInt32 theSpins = 0;
+			bool theSpun = Spin(theSpins);
+			theError = theSpun ? 0 : pthread_mutex_lock(&mMutex);
+			if(theError == 0)
+			{
+				//	now that this thread owns the mutex, it can update the estimate
+				mSpinEstimate += ((SInt32)theSpins - mSpinEstimate) / 8;
+				if(theRecordStatistics)
+				{
+					RecordWait(CAHostTimeBase::GetCurrentTimeInNanos() - theWaitStart, theSpun, theContendingOwner);
+				}
+			}
+		}
 		ThrowIf(theError != 0, CAException(theError), "CAMutex::Lock: Could not lock the mutex");
 		mOwner = theCurrentThread;
 		theAnswer = true;
+		if(theRecordStatistics)
+		{
+			++mStatistics.mAcquisitions;
+		}
 	
 		#if Log_LongLatencies
 			UInt64 lockAcquireTime = CAHostTimeBase::GetCurrentTimeInNanos();
@@ -226,6 +339,10 @@ bool	CAMutex::Try(bool& outWasLocked)
 			mOwner = theCurrentThread;
 			theAnswer = true;
 			outWasLocked = true;
+			if(sStatisticsEnabled)
+			{
+				++mStatistics.mAcquisitions;
+			}
 	
 			#if	Log_Ownership
 				DebugPrintfRtn(DebugPrintfFileComma "%p %.4f: CAMutex::Try: thread %p has locked %s, owner: %p\n", theCurrentThread, ((Float64)(CAHostTimeBase::GetCurrentTimeInNanos()) / 1000000.0), theCurrentThread, mName, mOwner);
@@ -236,6 +353,11 @@ bool	CAMutex::Try(bool& outWasLocked)
 			//	return value of EBUSY means that the lock was already locked by another thread
 			theAnswer = false;
 			outWasLocked = false;
+			if(sStatisticsEnabled)
+			{
+				//	not holding the mutex, so this has to be atomic
+				CAAtomicIncrement32(&mFailedTries);
+			}
 	
 			#if	Log_Ownership
 				DebugPrintfRtn(DebugPrintfFileComma "%p %.4f: CAMutex::Try: thread %p failed to lock %s, owner: %p\n", theCurrentThread, ((Float64)(CAHostTimeBase::GetCurrentTimeInNanos()) / 1000000.0), theCurrentThread, mName, mOwner);
@@ -319,6 +441,136 @@ bool	CAMutex::IsOwnedByCurrentThread() const
 	return theAnswer;
 }
 
+#if TARGET_OS_MAC
+
+bool	CAMutex::Spin(UInt32& outSpins)
+{
+	//	spin up to twice as long as it has taken lately, with some slack so a mutex that stopped
+	//	paying off gets another chance
+	UInt32 theLimit = std::min((UInt32)(2 * mSpinEstimate) + 10, sMaxSpins);
+	for(outSpins = 0; outSpins < theLimit; ++outSpins)
+	{
+		CAMutexPause();
+		if((mOwner == 0) && (pthread_mutex_trylock(&mMutex) == 0))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void	CAMutex::RecordWait(UInt64 inWaitNanos, bool inSpun, pthread_t inContendingOwner)
+{
+	++mStatistics.mContendedAcquisitions;
+	if(inSpun)
+	{
+		++mStatistics.mSpinAcquisitions;
+	}
+	mStatistics.mTotalWaitNanos += inWaitNanos;
+	mStatistics.mMaxWaitNanos = std::max(mStatistics.mMaxWaitNanos, inWaitNanos);
+	if(inContendingOwner != 0)
+	{
+		//	the owner may not have recorded itself yet
+		mStatistics.mLastContendingOwner = (UInt64)(uintptr_t)inContendingOwner;
+	}
+	
+	UInt32 theBucket = 0;
+	for(UInt64 theMicros = inWaitNanos / 1000; (theMicros > 0) && (theBucket < kWaitHistogramBuckets - 1); theMicros >>= 1)
+	{
+		++theBucket;
+	}
+	++mStatistics.mWaitHistogram[theBucket];
+}
+
+#endif
+
+//==================================================================================================
+//	Contention Statistics
+//==================================================================================================
+
+void	CAMutex::SetStatisticsEnabled(bool inEnabled)
+{
+	sStatisticsEnabled = inEnabled;
+}
+
+void	CAMutex::GetStatistics(Statistics& outStatistics) const
+{
+	outStatistics = mStatistics;
+	outStatistics.mFailedTries = (UInt32)mFailedTries;
+}
+
+void	CAMutex::ResetStatistics()
+{
+	//	the owner writes the counters, so hold the mutex to clear them
+	Locker theLocker(*this);
+	memset(&mStatistics, 0, sizeof(mStatistics));
+	CAAtomicAdd32Barrier(-mFailedTries, &mFailedTries);
+}
+
+void	CAMutex::ReportStatistics(FILE* inFile) const
+{
+	Statistics theStatistics;
+	GetStatistics(theStatistics);
+	fprintf(inFile, "%s: %llu acquisitions, %llu contended (%llu while spinning), %llu failed tries, waited %.3f ms, longest %.3f ms, last contended by thread 0x%llx\n",
+			(mName != NULL) ? mName : "(unnamed)",
+			(unsigned long long)theStatistics.mAcquisitions, (unsigned long long)theStatistics.mContendedAcquisitions,
+			(unsigned long long)theStatistics.mSpinAcquisitions, (unsigned long long)theStatistics.mFailedTries,
+			theStatistics.mTotalWaitNanos / 1000000.0, theStatistics.mMaxWaitNanos / 1000000.0,
+			(unsigned long long)theStatistics.mLastContendingOwner);
+	
+	for(UInt32 theBucket = 0; theBucket < kWaitHistogramBuckets; ++theBucket)
+	{
+		if(theStatistics.mWaitHistogram[theBucket] != 0)
+		{
+			if(theBucket < kWaitHistogramBuckets - 1)
+			{
+				fprintf(inFile, "\twaits under %u us: %llu\n", 1U << theBucket, (unsigned long long)theStatistics.mWaitHistogram[theBucket]);
+			}
+			else
+			{
+				fprintf(inFile, "\twaits of %u us or more: %llu\n", 1U << (theBucket - 1), (unsigned long long)theStatistics.mWaitHistogram[theBucket]);
+			}
+		}
+	}
+}
+
+#if TARGET_OS_MAC
+static bool	CAMutex_WaitedLonger(const std::pair<UInt64, const CAMutex*>& inA, const std::pair<UInt64, const CAMutex*>& inB)
+{
+	return inA.first > inB.first;
+}
+#endif
+
+void	CAMutex::ReportAllStatistics(FILE* inFile, UInt32 inMaxMutexes)
+{
+#if TARGET_OS_MAC
+	pthread_mutex_lock(&sRegistryMutex);
+	
+	std::vector<std::pair<UInt64, const CAMutex*> > theMutexes;
+	for(const CAMutex* theMutex = sRegistry; theMutex != NULL; theMutex = theMutex->mNextMutex)
+	{
+		if(theMutex->mStatistics.mContendedAcquisitions != 0)
+		{
+			theMutexes.push_back(std::make_pair(theMutex->mStatistics.mTotalWaitNanos, theMutex));
+		}
+	}
+	std::sort(theMutexes.begin(), theMutexes.end(), CAMutex_WaitedLonger);
+	
+	if(theMutexes.size() > inMaxMutexes)
+	{
+		theMutexes.resize(inMaxMutexes);
+	}
+	for(size_t theIndex = 0; theIndex < theMutexes.size(); ++theIndex)
+	{
+		theMutexes[theIndex].second->ReportStatistics(inFile);
+	}
+	
+	pthread_mutex_unlock(&sRegistryMutex);
+#else
+	(void)inFile;
+	(void)inMaxMutexes;
+#endif
+}
 
 CAMutex::Unlocker::Unlocker(CAMutex& inMutex)
 :	mMutex(inMutex),
@@ -52,6 +52,8 @@
 	#include <CoreAudioTypes.h>
 #endif
 
+#include <stdio.h>
+
 #if TARGET_OS_MAC
 	#include <pthread.h>
 #elif TARGET_OS_WIN32
@@ -62,13 +64,20 @@
 
 //==================================================================================================
 //	A recursive mutex.
+//
+//	On pthreads, a mutex constructed with inPriorityInheritance uses priority inheritance where the
+//	system supports it; that costs contended throughput on some systems, so only mutexes a real time
+//	thread can wait on should ask for it. Building with CAMutex_PriorityInheritance set to 1 turns it
+//	on for every mutex. A thread that finds the mutex held spins briefly, in case the owner is about
+//	to let go, before it blocks.
+//	Each mutex adapts how long it spins to how long spinning has paid off before.
 //==================================================================================================
 
 class	CAMutex
 {
 //	Construction/Destruction
 public:
-					CAMutex(const char* inName);
+					CAMutex(const char* inName, bool inPriorityInheritance = false);
 	virtual			~CAMutex();
 
 //	Actions
@@ -79,6 +88,37 @@ public:
 	
 	virtual bool	IsFree() const;
 	virtual bool	IsOwnedByCurrentThread() const;
+
+//	Contention statistics
+//
+//	These help find the locks that threads fight over. They are off by default. When they are on,
+//	each mutex counts its acquisitions and times the ones that had to wait for another thread.
+//	Only the thread holding the mutex writes the counters, except for mFailedTries, which the
+//	threads that fail count atomically. Readers don't take the mutex, so a report can be slightly
+//	stale; ResetStatistics does. The statistics are only kept on pthreads.
+public:
+	enum { kWaitHistogramBuckets = 16 };
+	struct Statistics
+	{
+		UInt64		mAcquisitions;							//	not counting recursive ones
+		UInt64		mContendedAcquisitions;					//	another thread held the mutex
+		UInt64		mSpinAcquisitions;						//	contended, but taken while spinning
+		UInt64		mFailedTries;							//	Try calls that found the mutex held
+		UInt64		mTotalWaitNanos;
+		UInt64		mMaxWaitNanos;
+		UInt64		mWaitHistogram[kWaitHistogramBuckets];	//	bucket 0: under 1us, bucket n: under 2^n us, last: the rest
+		UInt64		mLastContendingOwner;					//	the thread that held the mutex the last time one waited
+	};
+
+	static void		SetStatisticsEnabled(bool inEnabled);
+	static bool		GetStatisticsEnabled() { return sStatisticsEnabled; }
+	
+	void			GetStatistics(Statistics& outStatistics) const;
+	void			ResetStatistics();
+	void			ReportStatistics(FILE* inFile) const;
+	
+	static void		ReportAllStatistics(FILE* inFile, UInt32 inMaxMutexes = 0xFFFFFFFF);
+						//	the live mutexes that have waited, longest total wait first
 		
 //	Implementation
 protected:
@@ -91,6 +131,19 @@ protected:
 	HANDLE			mMutex;
 #endif
 
+#if TARGET_OS_MAC
+	bool			Spin(UInt32& outSpins);
+	void			RecordWait(UInt64 inWaitNanos, bool inSpun, pthread_t inContendingOwner);
+	
+	SInt32			mSpinEstimate;
+	CAMutex*		mNextMutex;
+	CAMutex*		mPreviousMutex;
+#endif
+	Statistics		mStatistics;
+	volatile SInt32	mFailedTries;		//	copied into Statistics::mFailedTries
+
+	static bool		sStatisticsEnabled;
+
 //	Helper class to manage taking and releasing recursively
 public:
 	class			Locker
@@ -0,0 +1,439 @@
+/*
+	CAPCMConverter.cpp
+*/
+#include "CAPCMConverter.h"
+#include "CAVectorKernels.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+static const bool kNativeIsBigEndian = kAudioFormatFlagsNativeEndian == kAudioFormatFlagIsBigEndian;
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	SampleFormat
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool	CAPCMConverter::SampleFormat::Init(const CAStreamBasicDescription &inDesc)
+{
+	if (!inDesc.IsPCM() || inDesc.mFramesPerPacket != 1 || inDesc.mChannelsPerFrame == 0)
+		return false;
+
+	UInt32 flags = inDesc.mFormatFlags;
+	mBytes = inDesc.SampleWordSize();
+	mBits = inDesc.mBitsPerChannel;
+	mIsFloat = (flags & kAudioFormatFlagIsFloat) != 0;
+	mIsUnsigned = false;
+	mSwapBytes = mBytes > 1 && (flags & kAudioFormatFlagIsBigEndian) != kAudioFormatFlagsNativeEndian;
+	mShift = 0;
+	mScale = 1.f;
+
+	if (mBytes == 0 || mBytes * inDesc.NumberInterleavedChannels() > inDesc.mBytesPerFrame)
+		return false;
+	if (mIsFloat)
+		return (mBytes == 4 || mBytes == 8) && mBits == mBytes * 8;
+
+	if (mBytes > 4 || mBits == 0 || mBits > mBytes * 8)
+		return false;
+	mIsUnsigned = !(flags & kAudioFormatFlagIsSignedInteger);
+	if (mBits < mBytes * 8 && (flags & kAudioFormatFlagIsAlignedHigh))
+		mShift = mBytes * 8 - mBits;
+
+	UInt32 fractionBits = (flags & kLinearPCMFormatFlagsSampleFractionMask) >> kLinearPCMFormatFlagsSampleFractionShift;
+	if (fractionBits >= mBits)
+		return false;
+	mScale = ldexpf(1.f, fractionBits ? fractionBits : mBits - 1);
+	return true;
+}
+
+bool	CAPCMConverter::SampleFormat::SameSamples(const SampleFormat &other) const
+{
+	return mIsFloat == other.mIsFloat && mIsUnsigned == other.mIsUnsigned && mBytes == other.mBytes
+		&& mBits == other.mBits && mShift == other.mShift && mScale == other.mScale;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	Sample loops
+//
+//	Samples are "stride" bytes apart.  When they're contiguous, Int16 and packed 24 bit integers
+//	(up to 24 bits at the top of 3 bytes) of either byte order, native endian Float32 and full width
+//	native 32 bit integers take the fast paths.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+enum EFastPath { kFastPath_None, kFastPath_Float32, kFastPath_Int16, kFastPath_SwappedInt16, kFastPath_Int24, kFastPath_Int32 };
+
+static EFastPath	FastPath(const CAPCMConverter::SampleFormat &f)
+{
+	if (f.mIsUnsigned)
+		return kFastPath_None;
+	if (!f.mIsFloat && f.mBytes == 3 && f.mShift == 24 - f.mBits && f.mScale == ldexpf(1.f, f.mBits - 1))
+		return kFastPath_Int24;
+	if (f.mBits != f.mBytes * 8)
+		return kFastPath_None;
+	if (f.mIsFloat)
+		return (f.mBytes == 4 && !f.mSwapBytes) ? kFastPath_Float32 : kFastPath_None;
+	if (f.mBytes == 2 && f.mScale == 32768.f)
+		return f.mSwapBytes ? kFastPath_SwappedInt16 : kFastPath_Int16;
+	if (f.mBytes == 4 && !f.mSwapBytes)
+		return kFastPath_Int32;
+	return kFastPath_None;
+}
+
+static inline UInt32	ReadContainer(const Byte *p, UInt32 bytes, bool bigEndian)
+{
+	UInt32 v = 0;
+	if (bigEndian)
+		for (UInt32 i = 0; i < bytes; ++i)
+			v = (v << 8) | p[i];
+	else
+		for (UInt32 i = bytes; i-- > 0; )
+			v = (v << 8) | p[i];
+	return v;
+}
+
+static inline void	WriteContainer(Byte *p, UInt32 bytes, bool bigEndian, UInt32 v)
+{
+	if (bigEndian)
+		for (UInt32 i = bytes; i-- > 0; v >>= 8)
+			p[i] = (Byte)v;
+	else
+		for (UInt32 i = 0; i < bytes; ++i, v >>= 8)
+			p[i] = (Byte)v;
+}
+
+static void	DecodeSamples(const CAPCMConverter::SampleFormat &f, const Byte *src, UInt32 stride, Float32 *out, UInt32 n)
+{
+	if (stride == f.mBytes) {
+		switch (FastPath(f)) {
+		case kFastPath_Float32:
+			memcpy(out, src, n * sizeof(Float32));
+			return;
+		case kFastPath_Int16:
+			CAVectorKernels::Get().mInt16ToFloat((const SInt16 *)src, out, n);
+			return;
+		case kFastPath_SwappedInt16:
+			CAVectorKernels::Get().mSwappedInt16ToFloat((const SInt16 *)src, out, n);
+			return;
+		case kFastPath_Int24:
+			CAVectorKernels::Get().mInt24ToFloat(src, out, n, f.mBits, kNativeIsBigEndian != f.mSwapBytes);
+			return;
+		case kFastPath_Int32:
+			{
+				const SInt32 *in = (const SInt32 *)src;
+				Float32 invScale = 1.f / f.mScale;
+				for (UInt32 i = 0; i < n; ++i)
+					out[i] = (Float32)in[i] * invScale;
+			}
+			return;
+		default:
+			break;
+		}
+	}
+
+	bool bigEndian = kNativeIsBigEndian != f.mSwapBytes;
+	if (f.mIsFloat) {
+		for (UInt32 i = 0; i < n; ++i, src += stride) {
+			if (f.mBytes == 4) {
+				UInt32 bits = ReadContainer(src, 4, bigEndian);
+				Float32 x;
+				memcpy(&x, &bits, sizeof(x));
+				out[i] = x;
+			} else {
+				UInt64 hi = ReadContainer(src + (bigEndian ? 0 : 4), 4, bigEndian);
+				UInt64 lo = ReadContainer(src + (bigEndian ? 4 : 0), 4, bigEndian);
+				UInt64 bits = (hi << 32) | lo;
+				Float64 x;
+				memcpy(&x, &bits, sizeof(x));
+				out[i] = (Float32)x;
+			}
+		}
+		return;
+	}
+
+	UInt32 mask = f.mBits < 32 ? (1U << f.mBits) - 1 : 0xFFFFFFFF;
+	UInt32 half = 1U << (f.mBits - 1);
+	UInt32 extend = 32 - f.mBits;
+	Float32 invScale = 1.f / f.mScale;
+	for (UInt32 i = 0; i < n; ++i, src += stride) {
+		UInt32 v = (ReadContainer(src, f.mBytes, bigEndian) >> f.mShift) & mask;
+		SInt32 value = f.mIsUnsigned ? (SInt32)(v - half) : (SInt32)(v << extend) >> extend;
+		out[i] = (Float32)value * invScale;
+	}
+}
+
+static void	EncodeSamples(const CAPCMConverter::SampleFormat &f, const Float32 *in, Byte *dest, UInt32 stride, UInt32 n)
+{
+	if (stride == f.mBytes) {
+		switch (FastPath(f)) {
+		case kFastPath_Float32:
+			memcpy(dest, in, n * sizeof(Float32));
+			return;
+		case kFastPath_Int16:
+			CAVectorKernels::Get().mFloatToInt16(in, (SInt16 *)dest, n);
+			return;
+		case kFastPath_SwappedInt16:
+			CAVectorKernels::Get().mFloatToSwappedInt16(in, (SInt16 *)dest, n);
+			return;
+		case kFastPath_Int24:
+			CAVectorKernels::Get().mFloatToInt24(in, dest, n, f.mBits, kNativeIsBigEndian != f.mSwapBytes);
+			return;
+		case kFastPath_Int32:
+			{
+				// the largest float below 2^31
+				const Float32 kMax = 2147483520.f, kMin = -2147483648.f;
+				SInt32 *out = (SInt32 *)dest;
+				Float32 scale = f.mScale;
+				for (UInt32 i = 0; i < n; ++i) {
+					Float32 x = in[i] * scale;
+					x = x > kMax ? kMax : (x < kMin ? kMin : x);
+					out[i] = (SInt32)lrintf(x);
+				}
+			}
+			return;
+		default:
+			break;
+		}
+	}
+
+	bool bigEndian = kNativeIsBigEndian != f.mSwapBytes;
+	if (f.mIsFloat) {
+		for (UInt32 i = 0; i < n; ++i, dest += stride) {
+			if (f.mBytes == 4) {
+				UInt32 bits;
+				memcpy(&bits, &in[i], sizeof(bits));
+				WriteContainer(dest, 4, bigEndian, bits);
+			} else {
+				Float64 x = in[i];
+				UInt64 bits;
+				memcpy(&bits, &x, sizeof(bits));
+				WriteContainer(dest + (bigEndian ? 0 : 4), 4, bigEndian, (UInt32)(bits >> 32));
+				WriteContainer(dest + (bigEndian ? 4 : 0), 4, bigEndian, (UInt32)bits);
+			}
+		}
+		return;
+	}
+
+	UInt32 mask = f.mBits < 32 ? (1U << f.mBits) - 1 : 0xFFFFFFFF;
+	UInt32 half = 1U << (f.mBits - 1);
+	Float64 maxValue = (Float64)half - 1., minValue = -(Float64)half;
+	Float64 scale = f.mScale;
+	for (UInt32 i = 0; i < n; ++i, dest += stride) {
+		Float64 x = in[i] * scale;
+		x = x > maxValue ? maxValue : (x < minValue ? minValue : x);
+		SInt32 value = (SInt32)lrint(x);
+		UInt32 v = f.mIsUnsigned ? (UInt32)value + half : (UInt32)value;
+		WriteContainer(dest, f.mBytes, bigEndian, (v & mask) << f.mShift);
+	}
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	CAPCMConverter
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+CAPCMConverter::CAPCMConverter() :
+	mNumberChannels(0),
+	mRawCopy(false),
+	mSingleBuffer(false),
+	mDither(false),
+	mApplyDither(false),
+	mClipFloat(false),
+	mDitherSeed(0x5EED)
+{
+}
+
+CAPCMConverter::~CAPCMConverter()
+{
+}
+
+bool	CAPCMConverter::CanConvert(const CAStreamBasicDescription &inSrc, const CAStreamBasicDescription &inDest)
+{
+	SampleFormat srcSample, destSample;
+	if (!srcSample.Init(inSrc) || !destSample.Init(inDest))
+		return false;
+	if (inSrc.mChannelsPerFrame != inDest.mChannelsPerFrame)
+		return false;
+	return inSrc.mSampleRate == 0. || inDest.mSampleRate == 0. || inSrc.mSampleRate == inDest.mSampleRate;
+}
+
+OSStatus	CAPCMConverter::Initialize(const CAStreamBasicDescription &inSrc, const CAStreamBasicDescription &inDest)
+{
+	if (!CanConvert(inSrc, inDest))
+		return kAudio_ParamError;
+
+	mSrcFormat = inSrc;
+	mDestFormat = inDest;
+	mSrcSample.Init(inSrc);
+	mDestSample.Init(inDest);
+	mNumberChannels = inSrc.mChannelsPerFrame;
+	mRawCopy = mSrcSample.SameSamples(mDestSample);
+	mSingleBuffer = inSrc.NumberChannelStreams() == 1 && inDest.NumberChannelStreams() == 1
+		&& inSrc.mBytesPerFrame == mSrcSample.mBytes * mNumberChannels && inDest.mBytesPerFrame == mDestSample.mBytes * mNumberChannels;
+
+	mPlanar.alloc(kChunkFrames * mNumberChannels);
+	mInterleaved.alloc(kChunkFrames * mNumberChannels);
+	SetDither(mDither);
+	return noErr;
+}
+
+void	CAPCMConverter::SetDither(bool inDither)
+{
+	mDither = inDither;
+	// only worth it where a sample loses precision, and below 24 bits, where the noise means anything
+	bool losesPrecision = mSrcSample.mIsFloat || mSrcSample.mScale > mDestSample.mScale;
+	mApplyDither = inDither && !mRawCopy && mNumberChannels > 0 && !mDestSample.mIsFloat
+		&& mDestSample.mBits <= 24 && losesPrecision;
+}
+
+OSStatus	CAPCMConverter::Convert(const AudioBufferList &inData, AudioBufferList &outData, UInt32 inFrames)
+{
+	if (mNumberChannels == 0)
+		return kAudio_ParamError;
+
+	UInt32 nSrcBuffers = mSrcFormat.NumberChannelStreams();
+	UInt32 nDestBuffers = mDestFormat.NumberChannelStreams();
+	if (inData.mNumberBuffers < nSrcBuffers || outData.mNumberBuffers < nDestBuffers)
+		return kAudio_ParamError;
+	for (UInt32 i = 0; i < nSrcBuffers; ++i)
+		if (inData.mBuffers[i].mData == NULL || inData.mBuffers[i].mDataByteSize < inFrames * mSrcFormat.mBytesPerFrame)
+			return kAudio_ParamError;
+	for (UInt32 i = 0; i < nDestBuffers; ++i) {
+		if (outData.mBuffers[i].mData == NULL || outData.mBuffers[i].mDataByteSize < inFrames * mDestFormat.mBytesPerFrame)
+			return kAudio_ParamError;
+		outData.mBuffers[i].mDataByteSize = inFrames * mDestFormat.mBytesPerFrame;
+	}
+
+	if (mRawCopy) {
+		CopyRaw(inData, outData, inFrames);
+		return noErr;
+	}
+
+	for (UInt32 frame = 0; frame < inFrames; frame += kChunkFrames) {
+		UInt32 n = std::min(inFrames - frame, (UInt32)kChunkFrames);
+		if (mSingleBuffer) {
+			ConvertInterleaved(inData, outData, frame, n);
+			continue;
+		}
+		Decode(inData, frame, n);
+		if (mApplyDither)
+			Dither(n);
+		Encode(outData, frame, n);
+	}
+	return noErr;
+}
+
+void	CAPCMConverter::CopyRaw(const AudioBufferList &inData, AudioBufferList &outData, UInt32 inFrames)
+{
+	if (!mSrcSample.mSwapBytes == !mDestSample.mSwapBytes && mSrcFormat.IsInterleaved() == mDestFormat.IsInterleaved()
+	&& mSrcFormat.mBytesPerFrame == mDestFormat.mBytesPerFrame) {
+		for (UInt32 i = 0; i < mSrcFormat.NumberChannelStreams(); ++i)
+			memcpy(outData.mBuffers[i].mData, inData.mBuffers[i].mData, inFrames * mSrcFormat.mBytesPerFrame);
+		return;
+	}
+
+	UInt32 bytes = mSrcSample.mBytes;
+	bool swap = mSrcSample.mSwapBytes != mDestSample.mSwapBytes;
+	UInt32 srcInterleaved = mSrcFormat.NumberInterleavedChannels(), destInterleaved = mDestFormat.NumberInterleavedChannels();
+	UInt32 srcStride = mSrcFormat.mBytesPerFrame, destStride = mDestFormat.mBytesPerFrame;
+	for (UInt32 ch = 0; ch < mNumberChannels; ++ch) {
+		const Byte *src = (const Byte *)inData.mBuffers[ch / srcInterleaved].mData + (ch % srcInterleaved) * bytes;
+		Byte *dest = (Byte *)outData.mBuffers[ch / destInterleaved].mData + (ch % destInterleaved) * bytes;
+		for (UInt32 i = 0; i < inFrames; ++i, src += srcStride, dest += destStride)
+			for (UInt32 b = 0; b < bytes; ++b)
+				dest[b] = src[swap ? bytes - 1 - b : b];
+	}
+}
+
+void	CAPCMConverter::Decode(const AudioBufferList &inData, UInt32 inFrame, UInt32 inFrames)
+{
+	UInt32 nInterleaved = mSrcFormat.NumberInterleavedChannels();
+	UInt32 stride = mSrcFormat.mBytesPerFrame;
+	UInt32 bytes = mSrcSample.mBytes;
+	// interleaved buffers with a fast path convert in one pass and then deinterleave
+	bool wholeFrames = nInterleaved > 1 && stride == bytes * nInterleaved && FastPath(mSrcSample) != kFastPath_None;
+
+	for (UInt32 buf = 0; buf < mSrcFormat.NumberChannelStreams(); ++buf) {
+		const Byte *src = (const Byte *)inData.mBuffers[buf].mData + inFrame * stride;
+		Float32 *planar = mPlanar + buf * nInterleaved * kChunkFrames;
+		if (wholeFrames) {
+			DecodeSamples(mSrcSample, src, bytes, mInterleaved, inFrames * nInterleaved);
+			for (UInt32 ch = 0; ch < nInterleaved; ++ch) {
+				const Float32 *in = mInterleaved + ch;
+				Float32 *out = planar + ch * kChunkFrames;
+				for (UInt32 i = 0; i < inFrames; ++i, in += nInterleaved)
+					out[i] = *in;
+			}
+		} else {
+			for (UInt32 ch = 0; ch < nInterleaved; ++ch)
+				DecodeSamples(mSrcSample, src + ch * bytes, stride, planar + ch * kChunkFrames, inFrames);
+		}
+	}
+}
+
+void	CAPCMConverter::Encode(AudioBufferList &outData, UInt32 inFrame, UInt32 inFrames)
+{
+	if (mClipFloat && mDestSample.mIsFloat)
+		for (UInt32 ch = 0; ch < mNumberChannels; ++ch)
+			ClipSamples(mPlanar + ch * kChunkFrames, inFrames);
+
+	UInt32 nInterleaved = mDestFormat.NumberInterleavedChannels();
+	UInt32 stride = mDestFormat.mBytesPerFrame;
+	UInt32 bytes = mDestSample.mBytes;
+	bool wholeFrames = nInterleaved > 1 && stride == bytes * nInterleaved && FastPath(mDestSample) != kFastPath_None;
+
+	for (UInt32 buf = 0; buf < mDestFormat.NumberChannelStreams(); ++buf) {
+		Byte *dest = (Byte *)outData.mBuffers[buf].mData + inFrame * stride;
+		const Float32 *planar = mPlanar + buf * nInterleaved * kChunkFrames;
+		if (wholeFrames) {
+			for (UInt32 ch = 0; ch < nInterleaved; ++ch) {
+				const Float32 *in = planar + ch * kChunkFrames;
+				Float32 *out = mInterleaved + ch;
+				for (UInt32 i = 0; i < inFrames; ++i, out += nInterleaved)
+					*out = in[i];
+			}
+			EncodeSamples(mDestSample, mInterleaved, dest, bytes, inFrames * nInterleaved);
+		} else {
+			for (UInt32 ch = 0; ch < nInterleaved; ++ch)
+				EncodeSamples(mDestSample, planar + ch * kChunkFrames, dest + ch * bytes, stride, inFrames);
+		}
+	}
+}
+
+void	CAPCMConverter::ConvertInterleaved(const AudioBufferList &inData, AudioBufferList &outData, UInt32 inFrame, UInt32 inFrames)
+{
+	// one buffer of whole frames on both sides, so the samples never need to be deinterleaved
+	UInt32 n = inFrames * mNumberChannels;
+	const Byte *src = (const Byte *)inData.mBuffers[0].mData + inFrame * mSrcFormat.mBytesPerFrame;
+	Byte *dest = (Byte *)outData.mBuffers[0].mData + inFrame * mDestFormat.mBytesPerFrame;
+
+	DecodeSamples(mSrcSample, src, mSrcSample.mBytes, mInterleaved, n);
+	if (mApplyDither)
+		DitherSamples(mInterleaved, n);
+	if (mClipFloat && mDestSample.mIsFloat)
+		ClipSamples(mInterleaved, n);
+	EncodeSamples(mDestSample, mInterleaved, dest, mDestSample.mBytes, n);
+}
+
+void	CAPCMConverter::ClipSamples(Float32 *ioSamples, UInt32 inSamples)
+{
+	for (UInt32 i = 0; i < inSamples; ++i)
+		ioSamples[i] = ioSamples[i] > 1.f ? 1.f : (ioSamples[i] < -1.f ? -1.f : ioSamples[i]);
+}
+
+void	CAPCMConverter::Dither(UInt32 inFrames)
+{
+	for (UInt32 ch = 0; ch < mNumberChannels; ++ch)
+		DitherSamples(mPlanar + ch * kChunkFrames, inFrames);
+}
+
+void	CAPCMConverter::DitherSamples(Float32 *ioSamples, UInt32 inSamples)
+{
+	// triangular noise of +/- 1 LSB: the difference of two uniform values from a linear congruential generator
+	Float32 amplitude = ldexpf(1.f / mDestSample.mScale, -24);
+	UInt32 seed = mDitherSeed;
+	for (UInt32 i = 0; i < inSamples; ++i) {
+		seed = seed * 1664525 + 1013904223;
+		SInt32 r1 = (SInt32)(seed >> 8);
+		seed = seed * 1664525 + 1013904223;
+		SInt32 r2 = (SInt32)(seed >> 8);
+		ioSamples[i] += (Float32)(r1 - r2) * amplitude;
+	}
+	mDitherSeed = seed;
+}
@@ -0,0 +1,90 @@
+/*
+	CAPCMConverter.h
+
+	Converts between linear PCM formats of the same sample rate and channel count without going through
+	AudioConverter: signed or unsigned integers of 1 to 32 bits in 1 to 4 byte containers (packed, aligned high or
+	low, fixed point via the sample fraction bits), Float32 and Float64, either byte order, interleaved or not.
+
+	Samples that only change byte order or layout are moved bit for bit.  Everything else goes through Float32 in
+	chunks of kChunkFrames, so formats with more than 24 bits of precision are rounded to 24 on the way.  Int16 and
+	packed 24 bit integers (20 bits aligned high included) of either byte order, and native endian Float32, use
+	CAVectorKernels; 32 bit integers (8.24 fixed point included) have loops the compiler can vectorize.  Integer output always saturates; float output can optionally be clipped to -1 - 1,
+	and integer output of 24 bits or fewer can optionally get triangular (TPDF) dither when it loses precision.
+*/
+#ifndef __CAPCMConverter_h__
+#define __CAPCMConverter_h__
+
+#include "CAStreamBasicDescription.h"
+#include "CAAutoDisposer.h"
+
+class CAPCMConverter {
+public:
+	enum { kChunkFrames = 256 };
+
+	// how a sample is stored, from the format flags; only used internally and by CanConvert
+	struct SampleFormat {
+		bool		mIsFloat;
+		bool		mIsUnsigned;
+		bool		mSwapBytes;			// not native endian
+		UInt32		mBytes;				// container size
+		UInt32		mBits;				// significant bits
+		UInt32		mShift;				// bits the value sits above the bottom of the container
+		Float32		mScale;				// integer value of 1.0
+
+		bool		Init(const CAStreamBasicDescription &inDesc);
+		bool		SameSamples(const SampleFormat &other) const;	// ignoring byte order
+	};
+
+						CAPCMConverter();
+						~CAPCMConverter();
+
+	static bool			CanConvert(const CAStreamBasicDescription &inSrc, const CAStreamBasicDescription &inDest);
+
+	// Returns kAudio_ParamError if CanConvert would return false.  Allocates; not real time safe.
+	OSStatus			Initialize(const CAStreamBasicDescription &inSrc, const CAStreamBasicDescription &inDest);
+
+	const CAStreamBasicDescription &	GetSourceFormat() const { return mSrcFormat; }
+	const CAStreamBasicDescription &	GetDestinationFormat() const { return mDestFormat; }
+
+	// both off by default
+	void				SetDither(bool inDither);
+	bool				GetDither() const { return mDither; }
+	void				SetClipFloat(bool inClip) { mClipFloat = inClip; }
+	bool				GetClipFloat() const { return mClipFloat; }
+
+	// true if samples are moved without converting them (same samples, different byte order or layout)
+	bool				IsBitExact() const { return mRawCopy; }
+
+	// Converts inFrames frames; real time safe.  The lists need at least NumberChannelStreams() buffers for their
+	// formats, with room for inFrames.  Sets the byte sizes of outData's buffers.
+	OSStatus			Convert(const AudioBufferList &inData, AudioBufferList &outData, UInt32 inFrames);
+
+private:
+						CAPCMConverter(const CAPCMConverter&);
+	CAPCMConverter&		operator=(const CAPCMConverter&);
+
+	void				CopyRaw(const AudioBufferList &inData, AudioBufferList &outData, UInt32 inFrames);
+	void				Decode(const AudioBufferList &inData, UInt32 inFrame, UInt32 inFrames);
+	void				Encode(AudioBufferList &outData, UInt32 inFrame, UInt32 inFrames);
+	void				ConvertInterleaved(const AudioBufferList &inData, AudioBufferList &outData, UInt32 inFrame, UInt32 inFrames);
+	void				Dither(UInt32 inFrames);
+	void				DitherSamples(Float32 *ioSamples, UInt32 inSamples);
+	static void			ClipSamples(Float32 *ioSamples, UInt32 inSamples);
+
+	CAStreamBasicDescription	mSrcFormat;
+	CAStreamBasicDescription	mDestFormat;
+	SampleFormat		mSrcSample;
+	SampleFormat		mDestSample;
+	UInt32				mNumberChannels;
+	bool				mRawCopy;
+	bool				mSingleBuffer;		// one buffer of whole frames on both sides
+	bool				mDither;
+	bool				mApplyDither;
+	bool				mClipFloat;
+	UInt32				mDitherSeed;
+
+	CAAutoFree<Float32>	mPlanar;			// kChunkFrames per channel
+	CAAutoFree<Float32>	mInterleaved;		// kChunkFrames * channels, for the vector paths on interleaved buffers
+};
+
+#endif // __CAPCMConverter_h__
@@ -155,6 +155,18 @@ UInt32	CAPThread::GetScheduledPriority(NativeThread thread)
 #endif
 }
 
+UInt32	CAPThread::GetNumberOfProcessors()
+{
+#if TARGET_OS_WIN32
+	SYSTEM_INFO theInfo;
+	GetSystemInfo(&theInfo);
+	long theAnswer = theInfo.dwNumberOfProcessors;
+#else
+	long theAnswer = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return theAnswer > 0 ? (UInt32)theAnswer : 1;
+}
+
 void	CAPThread::SetPriority(UInt32 inPriority, bool inFixedPriority)
 {
 	mPriority = inPriority;
@@ -133,6 +133,7 @@ public:
 	UInt32					GetPriority() const { return mPriority; }
     UInt32					GetScheduledPriority();
 	static UInt32			GetScheduledPriority(NativeThread thread);
+	static UInt32			GetNumberOfProcessors();	//	online ones, at least 1
     void					SetPriority(UInt32 inPriority, bool inFixedPriority=false);
 
 	void					GetTimeConstraints(UInt32& outPeriod, UInt32& outComputation, UInt32& outConstraint, bool& outIsPreemptible) const { outPeriod = mPeriod; outComputation = mComputation; outConstraint = mConstraint; outIsPreemptible = mIsPreemptible; }
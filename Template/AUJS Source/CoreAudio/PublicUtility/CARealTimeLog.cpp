@@ -0,0 +1,521 @@
+/*
+	CARealTimeLog.cpp
+*/
+#include "CARealTimeLog.h"
+#include "CAAtomic.h"
+#include "CAHostTimeBase.h"
+#include "CARingBuffer.h"		// CARingBufferAtomic
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	Records and rings
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+struct CARealTimeLogRecord {
+	UInt32			mBytes;			// including the header, arguments and strings; a multiple of 8
+	UInt32			mArguments;		// or kPaddingRecord, which means skip to the start of the ring
+	UInt64			mHostTime;
+	const char *	mFormat;
+	// followed by mArguments CARealTimeLogArguments, then the copied strings
+};
+
+union CARealTimeLogArgument {
+	SInt64			mInteger;		// for strings, the copy's offset from the start of the record
+	Float64			mDouble;
+	const void *	mPointer;
+};
+
+enum {
+	kPaddingRecord		= 0xFFFFFFFF,
+	kHeaderBytes		= (sizeof(CARealTimeLogRecord) + 7) & ~7,
+	kMaxRecordBytes		= 1024
+};
+
+enum { kRing_Free = 0, kRing_Claimed, kRing_Released };
+
+struct CARealTimeLogRing {
+	volatile SInt32				mState;
+	CARingBufferAtomic<UInt32>	mWriteIndex;		// bytes, wrapping; written by the logging thread
+	CARingBufferAtomic<UInt32>	mReadIndex;			// written by the drain
+	CARingBufferAtomic<UInt32>	mDropped;			// written by the logging thread
+	UInt32						mDroppedReported;	// drain only
+	Byte *						mData;
+};
+
+static CARealTimeLogRing *	sRings = NULL;
+static pthread_once_t		sSetupOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t		sRingKey;
+static volatile bool		sStarted = false;
+static volatile SInt32		sDroppedWithoutRing = 0;
+
+// the drain thread, the output file and the drop tally belong to whoever holds sDrainMutex
+static pthread_mutex_t		sDrainMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t			sDrainThread;
+static volatile bool		sDrainRunning = false;
+static FILE *				sFile = NULL;
+static bool					sOwnsFile = false;
+static SInt32				sDroppedWithoutRingReported = 0;
+static UInt64				sDroppedMessages = 0;
+
+static void	ReleaseRing(void *inRing)
+{
+	// the thread is exiting; the drain frees the ring once it's empty
+	CARealTimeLogRing *ring = (CARealTimeLogRing *)inRing;
+	CAAtomicCompareAndSwap32Barrier(kRing_Claimed, kRing_Released, &ring->mState);
+}
+
+static void	Setup()
+{
+	sRings = (CARealTimeLogRing *)calloc(CARealTimeLog::kMaxThreads, sizeof(CARealTimeLogRing));
+	Byte *data = (Byte *)calloc(CARealTimeLog::kMaxThreads, CARealTimeLog::kRingBytes);
+	for (UInt32 i = 0; i < CARealTimeLog::kMaxThreads; ++i)
+		sRings[i].mData = data + i * CARealTimeLog::kRingBytes;
+	pthread_key_create(&sRingKey, ReleaseRing);
+}
+
+static CARealTimeLogRing *	ClaimRing()
+{
+	for (UInt32 i = 0; i < CARealTimeLog::kMaxThreads; ++i)
+		if (CAAtomicCompareAndSwap32Barrier(kRing_Free, kRing_Claimed, &sRings[i].mState))
+			return &sRings[i];
+	return NULL;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	Format strings
+//
+//	Both sides walk the format string the same way: the logging thread to know which arguments
+//	to pull off the va_list, the drain to hand each conversion its argument.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+enum EArgumentKind {
+	kArg_Int, kArg_Long, kArg_LongLong, kArg_Double, kArg_LongDouble, kArg_Pointer, kArg_String, kArg_Unsupported
+};
+
+struct CARealTimeLogSpec {
+	const char *	mStart;			// the %
+	UInt32			mLength;
+	UInt32			mStars;			// * widths and precisions, each an int argument before the value
+	EArgumentKind	mKind;
+};
+
+// Finds the next conversion, skipping %%.  Returns false at the end of the string.
+static bool	NextSpec(const char *&ioCursor, CARealTimeLogSpec &outSpec)
+{
+	const char *p = ioCursor;
+	for (;;) {
+		p = strchr(p, '%');
+		if (p == NULL)
+			return false;
+		if (p[1] != '%')
+			break;
+		p += 2;
+	}
+
+	outSpec.mStart = p++;
+	outSpec.mStars = 0;
+	while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+		++p;
+	if (*p == '*') {
+		++outSpec.mStars;
+		++p;
+	} else
+		while (*p >= '0' && *p <= '9') ++p;
+	if (*p == '.') {
+		++p;
+		if (*p == '*') {
+			++outSpec.mStars;
+			++p;
+		} else
+			while (*p >= '0' && *p <= '9') ++p;
+	}
+
+	int longs = 0;
+	bool longDouble = false;
+	for (;; ++p) {
+		if (*p == 'h')
+			continue;
+		else if (*p == 'l')
+			++longs;
+		else if (*p == 'q' || *p == 'j')
+			longs = 2;
+		else if (*p == 'z' || *p == 't')
+			longs = 1;				// size_t and ptrdiff_t are long sized everywhere this builds
+		else if (*p == 'L')
+			longDouble = true;
+		else
+			break;
+	}
+
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+		outSpec.mKind = longs >= 2 ? kArg_LongLong : (longs == 1 ? kArg_Long : kArg_Int);
+		break;
+	case 'c':
+		outSpec.mKind = kArg_Int;	// wint_t for %lc is int sized too
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		outSpec.mKind = longDouble ? kArg_LongDouble : kArg_Double;
+		break;
+	case 'p':
+		outSpec.mKind = kArg_Pointer;
+		break;
+	case 's':
+		outSpec.mKind = longs ? kArg_Unsupported : kArg_String;
+		break;
+	case '\0':
+		return false;				// a stray % at the end
+	default:
+		outSpec.mKind = kArg_Unsupported;
+		break;
+	}
+	++p;
+	outSpec.mLength = (UInt32)(p - outSpec.mStart);
+	ioCursor = p;
+	return true;
+}
+
+static void	AppendLiteral(std::string &ioText, const char *inStart, const char *inEnd)
+{
+	for (const char *p = inStart; p < inEnd; ++p) {
+		ioText += *p;
+		if (p[0] == '%' && p + 1 < inEnd && p[1] == '%')
+			++p;
+	}
+}
+
+template <class T>
+static void	AppendConversion(std::string &ioText, const char *inSpec, UInt32 inStars, const int *inStarValues, T inValue)
+{
+	char piece[512];
+	int n;
+	if (inStars == 0)
+		n = snprintf(piece, sizeof(piece), inSpec, inValue);
+	else if (inStars == 1)
+		n = snprintf(piece, sizeof(piece), inSpec, inStarValues[0], inValue);
+	else
+		n = snprintf(piece, sizeof(piece), inSpec, inStarValues[0], inStarValues[1], inValue);
+	if (n > 0)
+		ioText.append(piece, std::min((size_t)n, sizeof(piece) - 1));
+}
+
+static void	FormatRecord(const CARealTimeLogRecord *inRecord, std::string &outText)
+{
+	const Byte *base = (const Byte *)inRecord;
+	const CARealTimeLogArgument *arguments = (const CARealTimeLogArgument *)(base + kHeaderBytes);
+	UInt32 argument = 0;
+
+	const char *cursor = inRecord->mFormat, *literal = cursor;
+	CARealTimeLogSpec spec;
+	while (NextSpec(cursor, spec)) {
+		// past the arguments the message could log, the rest of the format goes out as it is
+		if (spec.mKind == kArg_Unsupported || argument + spec.mStars + 1 > inRecord->mArguments || spec.mLength >= 32)
+			break;
+		AppendLiteral(outText, literal, spec.mStart);
+		literal = cursor;
+
+		char specText[32];
+		UInt32 length = 0;
+		for (UInt32 i = 0; i < spec.mLength; ++i)
+			if (!(spec.mKind == kArg_LongDouble && spec.mStart[i] == 'L'))		// it was logged as a double
+				specText[length++] = spec.mStart[i];
+		specText[length] = '\0';
+
+		int stars[2];
+		for (UInt32 i = 0; i < spec.mStars; ++i)
+			stars[i] = (int)arguments[argument++].mInteger;
+		const CARealTimeLogArgument &value = arguments[argument++];
+
+		switch (spec.mKind) {
+		case kArg_Int:			AppendConversion(outText, specText, spec.mStars, stars, (int)value.mInteger); break;
+		case kArg_Long:			AppendConversion(outText, specText, spec.mStars, stars, (long)value.mInteger); break;
+		case kArg_LongLong:		AppendConversion(outText, specText, spec.mStars, stars, (long long)value.mInteger); break;
+		case kArg_Double:
+		case kArg_LongDouble:	AppendConversion(outText, specText, spec.mStars, stars, value.mDouble); break;
+		case kArg_Pointer:		AppendConversion(outText, specText, spec.mStars, stars, value.mPointer); break;
+		case kArg_String:		AppendConversion(outText, specText, spec.mStars, stars, (const char *)(base + value.mInteger)); break;
+		default:				break;
+		}
+	}
+	AppendLiteral(outText, literal, literal + strlen(literal));
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	Logging
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void	CARealTimeLog::Printf(const char *inFormat, ...)
+{
+	va_list arguments;
+	va_start(arguments, inFormat);
+	VPrintf(inFormat, arguments);
+	va_end(arguments);
+}
+
+void	CARealTimeLog::VPrintf(const char *inFormat, va_list inArguments)
+{
+	if (!sStarted)
+		Start((FILE *)NULL);
+
+	CARealTimeLogRing *ring = (CARealTimeLogRing *)pthread_getspecific(sRingKey);
+	if (ring == NULL) {
+		ring = ClaimRing();
+		if (ring == NULL) {
+			CAAtomicIncrement32(&sDroppedWithoutRing);
+			return;
+		}
+		pthread_setspecific(sRingKey, ring);
+	}
+
+	// count the arguments first, to know where the strings start
+	UInt32 nArguments = 0;
+	CARealTimeLogSpec spec;
+	const char *cursor = inFormat;
+	while (NextSpec(cursor, spec) && spec.mKind != kArg_Unsupported && nArguments + spec.mStars + 1 <= kMaxArguments)
+		nArguments += spec.mStars + 1;
+
+	UInt64 buffer[kMaxRecordBytes / sizeof(UInt64)];
+	Byte *base = (Byte *)buffer;
+	CARealTimeLogRecord *record = (CARealTimeLogRecord *)base;
+	CARealTimeLogArgument *arguments = (CARealTimeLogArgument *)(base + kHeaderBytes);
+	UInt32 stringOffset = kHeaderBytes + nArguments * sizeof(CARealTimeLogArgument);
+
+	UInt32 argument = 0;
+	cursor = inFormat;
+	while (argument < nArguments && NextSpec(cursor, spec)) {
+		for (UInt32 i = 0; i < spec.mStars; ++i)
+			arguments[argument++].mInteger = va_arg(inArguments, int);
+
+		CARealTimeLogArgument &value = arguments[argument++];
+		switch (spec.mKind) {
+		case kArg_Int:			value.mInteger = va_arg(inArguments, int); break;
+		case kArg_Long:			value.mInteger = va_arg(inArguments, long); break;
+		case kArg_LongLong:		value.mInteger = va_arg(inArguments, long long); break;
+		case kArg_Double:		value.mDouble = va_arg(inArguments, double); break;
+		case kArg_LongDouble:	value.mDouble = (Float64)va_arg(inArguments, long double); break;
+		case kArg_Pointer:		value.mPointer = va_arg(inArguments, void *); break;
+		case kArg_String:
+			{
+				const char *string = va_arg(inArguments, const char *);
+				if (string == NULL)
+					string = "(null)";
+				if (stringOffset >= kMaxRecordBytes) {
+					// the record is full; the last string's terminator serves as an empty string
+					value.mInteger = kMaxRecordBytes - 1;
+					break;
+				}
+				UInt32 room = std::min((UInt32)kMaxStringLength, (UInt32)kMaxRecordBytes - 1 - stringOffset);
+				UInt32 length = 0;
+				while (length < room && string[length] != '\0')
+					++length;
+				memcpy(base + stringOffset, string, length);
+				base[stringOffset + length] = '\0';
+				value.mInteger = stringOffset;
+				stringOffset += length + 1;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	UInt32 bytes = (stringOffset + 7) & ~7;
+	record->mBytes = bytes;
+	record->mArguments = nArguments;
+	record->mHostTime = CAHostTimeBase::GetTheCurrentTime();
+	record->mFormat = inFormat;
+
+	// a record doesn't wrap around the end of the ring; a padding record fills the space it skips
+	UInt32 write = ring->mWriteIndex.LoadRelaxed();
+	UInt32 read = ring->mReadIndex.LoadAcquire();
+	UInt32 offset = write & (kRingBytes - 1);
+	UInt32 tail = kRingBytes - offset;
+	UInt32 needed = bytes + (tail < bytes ? tail : 0);
+	if (kRingBytes - (write - read) < needed) {
+		ring->mDropped.StoreRelaxed(ring->mDropped.LoadRelaxed() + 1);
+		return;
+	}
+	if (tail < bytes) {
+		CARealTimeLogRecord *padding = (CARealTimeLogRecord *)(ring->mData + offset);
+		padding->mBytes = tail;
+		padding->mArguments = kPaddingRecord;
+		write += tail;
+		offset = 0;
+	}
+	memcpy(ring->mData + offset, base, bytes);
+	ring->mWriteIndex.StoreRelease(write + bytes);
+}
+
+UInt64	CARealTimeLog::DroppedMessages()
+{
+	pthread_mutex_lock(&sDrainMutex);
+	UInt64 dropped = sDroppedMessages;
+	pthread_mutex_unlock(&sDrainMutex);
+	return dropped;
+}
+
+int		CARealTimeLogPrintf(const char *inFormat, ...)
+{
+	va_list arguments;
+	va_start(arguments, inFormat);
+	CARealTimeLog::VPrintf(inFormat, arguments);
+	va_end(arguments);
+	return 0;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	Draining
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+struct CARealTimeLogLine {
+	UInt64		mHostTime;
+	std::string	mText;
+
+	bool operator < (const CARealTimeLogLine &other) const { return mHostTime < other.mHostTime; }
+};
+
+static void	DrainLocked()
+{
+	if (sRings == NULL)
+		return;
+
+	std::vector<CARealTimeLogLine> lines;
+	UInt64 now = CAHostTimeBase::GetTheCurrentTime();
+
+	for (UInt32 i = 0; i < CARealTimeLog::kMaxThreads; ++i) {
+		CARealTimeLogRing &ring = sRings[i];
+		SInt32 state = ring.mState;
+		if (state == kRing_Free)
+			continue;
+		CAMemoryBarrier();
+
+		UInt32 write = ring.mWriteIndex.LoadAcquire();
+		UInt32 read = ring.mReadIndex.LoadRelaxed();
+		while (read != write) {
+			const CARealTimeLogRecord *record = (const CARealTimeLogRecord *)(ring.mData + (read & (CARealTimeLog::kRingBytes - 1)));
+			if (record->mArguments != kPaddingRecord) {
+				lines.push_back(CARealTimeLogLine());
+				lines.back().mHostTime = record->mHostTime;
+				FormatRecord(record, lines.back().mText);
+			}
+			read += record->mBytes;
+		}
+		ring.mReadIndex.StoreRelease(read);
+
+		UInt32 dropped = ring.mDropped.LoadRelaxed();
+		if (dropped != ring.mDroppedReported) {
+			char text[128];
+			snprintf(text, sizeof(text), "CARealTimeLog: dropped %u messages, ring full\n", (unsigned)(dropped - ring.mDroppedReported));
+			lines.push_back(CARealTimeLogLine());
+			lines.back().mHostTime = now;
+			lines.back().mText = text;
+			sDroppedMessages += dropped - ring.mDroppedReported;
+			ring.mDroppedReported = dropped;
+		}
+
+		if (state == kRing_Released) {
+			// its thread is gone, so nothing else touches it until it's claimed again
+			ring.mWriteIndex.StoreRelaxed(0);
+			ring.mReadIndex.StoreRelaxed(0);
+			ring.mDropped.StoreRelaxed(0);
+			ring.mDroppedReported = 0;
+			CAAtomicCompareAndSwap32Barrier(kRing_Released, kRing_Free, &ring.mState);
+		}
+	}
+
+	SInt32 droppedWithoutRing = sDroppedWithoutRing;
+	if (droppedWithoutRing != sDroppedWithoutRingReported) {
+		char text[128];
+		snprintf(text, sizeof(text), "CARealTimeLog: dropped %d messages, more than %d threads logging\n",
+					(int)(droppedWithoutRing - sDroppedWithoutRingReported), (int)CARealTimeLog::kMaxThreads);
+		lines.push_back(CARealTimeLogLine());
+		lines.back().mHostTime = now;
+		lines.back().mText = text;
+		sDroppedMessages += droppedWithoutRing - sDroppedWithoutRingReported;
+		sDroppedWithoutRingReported = droppedWithoutRing;
+	}
+
+	if (lines.empty())
+		return;
+	std::stable_sort(lines.begin(), lines.end());
+	FILE *file = sFile != NULL ? sFile : stderr;
+	for (size_t i = 0; i < lines.size(); ++i)
+		fputs(lines[i].mText.c_str(), file);
+	fflush(file);
+}
+
+static void *	DrainThread(void *)
+{
+	for (;;) {
+		pthread_mutex_lock(&sDrainMutex);
+		bool running = sDrainRunning;
+		if (running)
+			DrainLocked();
+		pthread_mutex_unlock(&sDrainMutex);
+		if (!running)
+			break;
+		usleep(CARealTimeLog::kDrainIntervalMS * 1000);
+	}
+	return NULL;
+}
+
+void	CARealTimeLog::Drain()
+{
+	pthread_mutex_lock(&sDrainMutex);
+	DrainLocked();
+	pthread_mutex_unlock(&sDrainMutex);
+}
+
+void	CARealTimeLog::Start(FILE *inFile)
+{
+	pthread_once(&sSetupOnce, Setup);
+
+	pthread_mutex_lock(&sDrainMutex);
+	DrainLocked();		// what's already logged goes to the old file
+	if (sOwnsFile && sFile != inFile)
+		fclose(sFile);
+	sFile = inFile;
+	sOwnsFile = false;
+	if (!sDrainRunning) {
+		sDrainRunning = true;
+		pthread_create(&sDrainThread, NULL, DrainThread, NULL);
+	}
+	sStarted = true;
+	pthread_mutex_unlock(&sDrainMutex);
+}
+
+bool	CARealTimeLog::Start(const char *inPath)
+{
+	FILE *file = fopen(inPath, "a");
+	if (file == NULL)
+		return false;
+	Start(file);
+	pthread_mutex_lock(&sDrainMutex);
+	sOwnsFile = true;
+	pthread_mutex_unlock(&sDrainMutex);
+	return true;
+}
+
+void	CARealTimeLog::Stop()
+{
+	pthread_mutex_lock(&sDrainMutex);
+	bool wasRunning = sDrainRunning;
+	sDrainRunning = false;
+	pthread_mutex_unlock(&sDrainMutex);
+	if (wasRunning)
+		pthread_join(sDrainThread, NULL);
+
+	pthread_mutex_lock(&sDrainMutex);
+	DrainLocked();
+	if (sOwnsFile)
+		fclose(sFile);
+	sFile = NULL;
+	sOwnsFile = false;
+	pthread_mutex_unlock(&sDrainMutex);
+}
@@ -0,0 +1,67 @@
+/*
+	CARealTimeLog.h
+
+	printf style logging that is safe to call from the render thread. Each thread that logs gets its own lock free
+	ring of binary records. A record holds a time stamp, the format string's address, the arguments and copies of
+	any strings (truncated to kMaxStringLength characters). A background thread drains the rings every few
+	milliseconds, formats the records in time order and writes them to a file. Logging never blocks, allocates or
+	touches stdio. When a ring is full the record is dropped and counted, and the count goes out with the next drain.
+
+	Only the format string's address is logged, so it must outlive the drain: a string literal, in practice. %n is
+	not supported, and long doubles are logged as doubles.  Past kMaxArguments, or at a conversion it can't log,
+	the rest of the format string is written as it is.
+
+	Start allocates the rings and starts the drain thread. If nothing calls Start, the first message does, so call
+	it before rendering. A thread claims a ring the first time it logs and gives it back when it exits. Once all
+	kMaxThreads rings are claimed, messages from further threads are dropped.
+
+	Defining CoreAudio_UseRealTimeLog routes DebugPrintfRtn, and so the DebugMessage macros, through here.
+*/
+#ifndef __CARealTimeLog_h__
+#define __CARealTimeLog_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#if defined(__cplusplus)
+class CARealTimeLog {
+public:
+	enum {
+		kMaxThreads			= 32,
+		kRingBytes			= 64 * 1024,	// per thread
+		kMaxArguments		= 16,			// per message, counting * widths and precisions
+		kMaxStringLength	= 63,
+		kDrainIntervalMS	= 10
+	};
+
+	// Not real time safe.  A NULL file means stderr.  Start again to change files.
+	static void		Start(FILE *inFile);
+	static bool		Start(const char *inPath);				// appends; false if the file won't open
+	static void		Stop();									// writes what's left and stops the drain thread
+	static void		Drain();								// writes what's been logged so far, now
+
+	// Real time safe.
+	static void		Printf(const char *inFormat, ...)
+#if defined(__GNUC__)
+						__attribute__((format(printf, 1, 2)))
+#endif
+						;
+	static void		VPrintf(const char *inFormat, va_list inArguments);
+
+	// messages dropped, as of the last drain, because a ring was full or no ring was free
+	static UInt64	DroppedMessages();
+};
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+#endif
+int		CARealTimeLogPrintf(const char *inFormat, ...);			// for CADebugPrintf; returns 0
+
+#endif // __CARealTimeLog_h__
@@ -41,12 +41,10 @@
 #include "CARingBuffer.h"
 #include "CABitOperations.h"
 #include "CAAutoDisposer.h"
-#include "CAAtomic.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <algorithm>
-#include <libkern/OSAtomic.h>
 
 CARingBuffer::CARingBuffer() :
 	mBuffers(NULL), mNumberChannels(0), mCapacityFrames(0), mCapacityBytes(0)
@@ -85,11 +83,11 @@ void	CARingBuffer::Allocate(int nChannels, UInt32 bytesPerFrame, UInt32 capacity
 	
 	for (UInt32 i = 0; i<kGeneralRingTimeBoundsQueueSize; ++i)
 	{
-		mTimeBoundsQueue[i].mStartTime = 0;
-		mTimeBoundsQueue[i].mEndTime = 0;
-		mTimeBoundsQueue[i].mUpdateCounter = 0;
+		mTimeBoundsQueue[i].mStartTime.StoreRelaxed(0);
+		mTimeBoundsQueue[i].mEndTime.StoreRelaxed(0);
+		mTimeBoundsQueue[i].mUpdateCounter.StoreRelaxed(0);
 	}
-	mTimeBoundsQueuePtr = 0;
+	mTimeBoundsQueuePtr.StoreRelease(0);
 }
 
 void	CARingBuffer::Deallocate()
@@ -133,6 +131,49 @@ inline void FetchABL(AudioBufferList *abl, int destOffset, Byte **buffers, int s
 	}
 }
 
+inline void FetchConvertedABL(AudioBufferList *abl, int destFrame, Byte **buffers, int srcFrame, int nFrames, CARingBufferFormat format, Float32 gain)
+{
+	int nchannels = abl->mNumberBuffers;
+	AudioBuffer *dest = abl->mBuffers;
+	while (--nchannels >= 0) {
+		Float32 *out = (Float32 *)dest->mData + destFrame;
+		switch (format) {
+		case kCARingBufferFormat_Float32:
+			{
+				const Float32 *in = (const Float32 *)*buffers + srcFrame;
+				for (int i = 0; i < nFrames; ++i)
+					out[i] = in[i] * gain;
+			}
+			break;
+		case kCARingBufferFormat_SInt16:
+			{
+				const SInt16 *in = (const SInt16 *)*buffers + srcFrame;
+				const Float32 scale = gain / 32768.f;
+				for (int i = 0; i < nFrames; ++i)
+					out[i] = in[i] * scale;
+			}
+			break;
+		case kCARingBufferFormat_SInt24:
+			{
+				const Byte *in = *buffers + srcFrame * 3;
+				const Float32 scale = gain / 2147483648.f;
+				for (int i = 0; i < nFrames; ++i, in += 3) {
+						// build the sample in the top 24 bits of an SInt32 so the sign comes for free
+#if TARGET_RT_BIG_ENDIAN
+					SInt32 sample = (SInt32)(((UInt32)in[0] << 24) | ((UInt32)in[1] << 16) | ((UInt32)in[2] << 8));
+#else
+					SInt32 sample = (SInt32)(((UInt32)in[2] << 24) | ((UInt32)in[1] << 16) | ((UInt32)in[0] << 8));
+#endif
+					out[i] = sample * scale;
+				}
+			}
+			break;
+		}
+		++buffers;
+		++dest;
+	}
+}
+
 inline void ZeroABL(AudioBufferList *abl, int destOffset, int nbytes)
 {
 	int nBuffers = abl->mNumberBuffers;
@@ -201,28 +242,36 @@ CARingBufferError	CARingBuffer::Store(const AudioBufferList *abl, UInt32 framesT
 
 void	CARingBuffer::SetTimeBounds(SampleTime startTime, SampleTime endTime)
 {
-	UInt32 nextPtr = mTimeBoundsQueuePtr + 1;
-	UInt32 index = nextPtr & kGeneralRingTimeBoundsQueueMask;
+	// only Store calls this, so only one thread ever writes the queue
+	UInt32 nextPtr = mTimeBoundsQueuePtr.LoadRelaxed() + 1;
+	TimeBounds &bounds = mTimeBoundsQueue[nextPtr & kGeneralRingTimeBoundsQueueMask];
+	
+	// a reader that laps the writer sees the invalidated counter and retries
+	bounds.mUpdateCounter.StoreRelaxed(nextPtr - 1);
+	CARingBufferAtomic<UInt32>::ReleaseFence();
+	bounds.mStartTime.StoreRelaxed(startTime);
+	bounds.mEndTime.StoreRelaxed(endTime);
+	bounds.mUpdateCounter.StoreRelease(nextPtr);
 	
-	mTimeBoundsQueue[index].mStartTime = startTime;
-	mTimeBoundsQueue[index].mEndTime = endTime;
-	mTimeBoundsQueue[index].mUpdateCounter = nextPtr;
-	CAAtomicCompareAndSwap32Barrier(mTimeBoundsQueuePtr, mTimeBoundsQueuePtr + 1, (SInt32*)&mTimeBoundsQueuePtr);
+	mTimeBoundsQueuePtr.StoreRelease(nextPtr);
 }
 
 CARingBufferError	CARingBuffer::GetTimeBounds(SampleTime &startTime, SampleTime &endTime)
 {
 	for (int i=0; i<8; ++i) // fail after a few tries.
 	{
-		UInt32 curPtr = mTimeBoundsQueuePtr;
+		UInt32 curPtr = mTimeBoundsQueuePtr.LoadAcquire();
 		UInt32 index = curPtr & kGeneralRingTimeBoundsQueueMask;
 		CARingBuffer::TimeBounds* bounds = mTimeBoundsQueue + index;
 		
-		startTime = bounds->mStartTime;
-		endTime = bounds->mEndTime;
-		UInt32 newPtr = bounds->mUpdateCounter;
+		if (bounds->mUpdateCounter.LoadAcquire() != curPtr)
+			continue;
+		startTime = bounds->mStartTime.LoadRelaxed();
+		endTime = bounds->mEndTime.LoadRelaxed();
+		CARingBufferAtomic<UInt32>::AcquireFence();
 		
-		if (newPtr == curPtr) 
+		// still the same entry, so the times weren't torn by a writer reusing it
+		if (bounds->mUpdateCounter.LoadRelaxed() == curPtr)
 			return kCARingBufferError_OK;
 	}
 	return kCARingBufferError_CPUOverload;
@@ -243,6 +292,20 @@ CARingBufferError	CARingBuffer::ClipTimeBounds(SampleTime& startRead, SampleTime
 }
 
 CARingBufferError	CARingBuffer::Fetch(AudioBufferList *abl, UInt32 nFrames, SampleTime startRead)
+{
+	return FetchFrames(abl, nFrames, startRead, false, 0, 1.f);
+}
+
+CARingBufferError	CARingBuffer::Fetch(AudioBufferList *abl, UInt32 nFrames, SampleTime startRead, CARingBufferFormat storedFormat, Float32 gain)
+{
+	static const UInt32 kFormatBytes[] = { sizeof(Float32), sizeof(SInt16), 3 };
+	if (storedFormat > kCARingBufferFormat_SInt24 || kFormatBytes[storedFormat] != mBytesPerFrame)
+		return kCARingBufferError_InvalidFormat;
+	
+	return FetchFrames(abl, nFrames, startRead, true, storedFormat, gain);
+}
+
+CARingBufferError	CARingBuffer::FetchFrames(AudioBufferList *abl, UInt32 nFrames, SampleTime startRead, bool convert, CARingBufferFormat storedFormat, Float32 gain)
 {
 	SampleTime endRead = startRead + nFrames;
 
@@ -254,17 +317,19 @@ CARingBufferError	CARingBuffer::Fetch(AudioBufferList *abl, UInt32 nFrames, Samp
 	if (err) return err;
 	size = endRead - startRead;
 	
-	SInt32 destStartOffset = startRead - startRead0;
-    if(destStartOffset > nFrames)
-        return kCARingBufferError_CPUOverload;
-        
+	SInt64 destStartOffset = startRead - startRead0;
+	if (destStartOffset > (SInt64)nFrames)
+		return kCARingBufferError_CPUOverload;
+	
+	UInt32 destBytesPerFrame = convert ? sizeof(Float32) : mBytesPerFrame;
+	
 	if (destStartOffset > 0) {
-		ZeroABL(abl, 0, destStartOffset * mBytesPerFrame);
+		ZeroABL(abl, 0, destStartOffset * destBytesPerFrame);
 	}
 
-	SInt32 destEndSize = endRead0 - endRead; 
+	SInt64 destEndSize = endRead0 - endRead; 
 	if (destEndSize > 0) {
-		ZeroABL(abl, destStartOffset + size, destEndSize * mBytesPerFrame);
+		ZeroABL(abl, (destStartOffset + size) * destBytesPerFrame, destEndSize * destBytesPerFrame);
 	}
 	
 	Byte **buffers = mBuffers;
@@ -272,12 +337,27 @@ CARingBufferError	CARingBuffer::Fetch(AudioBufferList *abl, UInt32 nFrames, Samp
 	int offset1 = FrameOffset(endRead);
 	int nbytes;
 	
-	if (offset0 < offset1) {
-		FetchABL(abl, destStartOffset, buffers, offset0, nbytes = offset1 - offset0);
+	if (size == 0) {
+		nbytes = 0;
+	} else if (convert) {
+		int frame0 = offset0 / mBytesPerFrame;
+		int frame1 = offset1 / mBytesPerFrame;
+		int nframes;
+		if (offset0 < offset1) {
+			FetchConvertedABL(abl, destStartOffset, buffers, frame0, nframes = frame1 - frame0, storedFormat, gain);
+		} else {
+			nframes = mCapacityFrames - frame0;
+			FetchConvertedABL(abl, destStartOffset, buffers, frame0, nframes, storedFormat, gain);
+			FetchConvertedABL(abl, destStartOffset + nframes, buffers, 0, frame1, storedFormat, gain);
+			nframes += frame1;
+		}
+		nbytes = nframes * sizeof(Float32);
+	} else if (offset0 < offset1) {
+		FetchABL(abl, destStartOffset * mBytesPerFrame, buffers, offset0, nbytes = offset1 - offset0);
 	} else {
 		nbytes = mCapacityBytes - offset0;
-		FetchABL(abl, destStartOffset, buffers, offset0, nbytes);
-		FetchABL(abl, destStartOffset + nbytes, buffers, 0, offset1);
+		FetchABL(abl, destStartOffset * mBytesPerFrame, buffers, offset0, nbytes);
+		FetchABL(abl, destStartOffset * mBytesPerFrame + nbytes, buffers, 0, offset1);
 		nbytes += offset1;
 	}
 
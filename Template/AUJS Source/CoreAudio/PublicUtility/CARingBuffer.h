@@ -48,17 +48,71 @@
 #ifndef CARingBuffer_Header
 #define CARingBuffer_Header
 
+// The time bounds queue uses C++11 atomics when the standard library has them, and falls back on CAAtomic's
+// barriers with older libraries (libstdc++ 4.2 has no <atomic>).
+#if !defined(CA_RINGBUFFER_USE_STD_ATOMIC)
+	#if __cplusplus >= 201103L && defined(__has_include)
+		#if __has_include(<atomic>)
+			#define CA_RINGBUFFER_USE_STD_ATOMIC 1
+		#endif
+	#endif
+#endif
+
+#if CA_RINGBUFFER_USE_STD_ATOMIC
+	#include <atomic>
+#else
+	#include "CAAtomic.h"
+#endif
+
 enum {
 	kCARingBufferError_OK = 0,
 	kCARingBufferError_TooMuch = 3, // fetch start time is earlier than buffer start time and fetch end time is later than buffer end time
-	kCARingBufferError_CPUOverload = 4 // the reader is unable to get enough CPU cycles to capture a consistent snapshot of the time bounds
+	kCARingBufferError_CPUOverload = 4, // the reader is unable to get enough CPU cycles to capture a consistent snapshot of the time bounds
+	kCARingBufferError_InvalidFormat = 5 // the stored sample format doesn't match the buffer's bytes per frame
 };
 
 typedef SInt32 CARingBufferError;
 
+// Sample formats Fetch can convert to Float32 on the way out. The buffer must have been allocated with
+// the matching bytes per frame.
+enum {
+	kCARingBufferFormat_Float32 = 0,	// 4 bytes, native endian
+	kCARingBufferFormat_SInt16,			// 2 bytes, native endian
+	kCARingBufferFormat_SInt24			// 3 bytes packed, native endian
+};
+
+typedef UInt32 CARingBufferFormat;
+
 const UInt32 kGeneralRingTimeBoundsQueueSize = 32;
 const UInt32 kGeneralRingTimeBoundsQueueMask = kGeneralRingTimeBoundsQueueSize - 1;
 
+// An atomic variable with just the orderings the time bounds queue needs.
+template <typename T>
+class CARingBufferAtomic {
+public:
+#if CA_RINGBUFFER_USE_STD_ATOMIC
+	T		LoadRelaxed() const { return mValue.load(std::memory_order_relaxed); }
+	T		LoadAcquire() const { return mValue.load(std::memory_order_acquire); }
+	void	StoreRelaxed(T inValue) { mValue.store(inValue, std::memory_order_relaxed); }
+	void	StoreRelease(T inValue) { mValue.store(inValue, std::memory_order_release); }
+
+	static void	AcquireFence() { std::atomic_thread_fence(std::memory_order_acquire); }
+	static void	ReleaseFence() { std::atomic_thread_fence(std::memory_order_release); }
+private:
+	std::atomic<T>	mValue;
+#else
+	T		LoadRelaxed() const { return mValue; }
+	T		LoadAcquire() const { T value = mValue; CAMemoryBarrier(); return value; }
+	void	StoreRelaxed(T inValue) { mValue = inValue; }
+	void	StoreRelease(T inValue) { CAMemoryBarrier(); mValue = inValue; }
+
+	static void	AcquireFence() { CAMemoryBarrier(); }
+	static void	ReleaseFence() { CAMemoryBarrier(); }
+private:
+	volatile T		mValue;
+#endif
+};
+
 class CARingBuffer {
 public:
 	typedef SInt64 SampleTime;
@@ -82,6 +136,10 @@ public:
 				
 	CARingBufferError	Fetch(AudioBufferList *abl, UInt32 nFrames, SampleTime frameNumber);
 								// will alter mNumDataBytes of the buffers
+
+	CARingBufferError	Fetch(AudioBufferList *abl, UInt32 nFrames, SampleTime frameNumber, CARingBufferFormat storedFormat, Float32 gain);
+								// Like Fetch, but converts the stored samples to Float32 and scales them by
+								// gain in the same pass, so abl's buffers must hold nFrames Float32s each.
 	
 	CARingBufferError	GetTimeBounds(SampleTime &startTime, SampleTime &endTime);
 	
@@ -90,10 +148,11 @@ protected:
 	int						FrameOffset(SampleTime frameNumber) { return (frameNumber & mCapacityFramesMask) * mBytesPerFrame; }
 
 	CARingBufferError		ClipTimeBounds(SampleTime& startRead, SampleTime& endRead);
+	CARingBufferError		FetchFrames(AudioBufferList *abl, UInt32 nFrames, SampleTime startRead, bool convert, CARingBufferFormat storedFormat, Float32 gain);
 	
 	// these should only be called from Store.
-	SampleTime				StartTime() const { return mTimeBoundsQueue[mTimeBoundsQueuePtr & kGeneralRingTimeBoundsQueueMask].mStartTime; }
-	SampleTime				EndTime()   const { return mTimeBoundsQueue[mTimeBoundsQueuePtr & kGeneralRingTimeBoundsQueueMask].mEndTime; }
+	SampleTime				StartTime() const { return mTimeBoundsQueue[mTimeBoundsQueuePtr.LoadRelaxed() & kGeneralRingTimeBoundsQueueMask].mStartTime.LoadRelaxed(); }
+	SampleTime				EndTime()   const { return mTimeBoundsQueue[mTimeBoundsQueuePtr.LoadRelaxed() & kGeneralRingTimeBoundsQueueMask].mEndTime.LoadRelaxed(); }
 	void					SetTimeBounds(SampleTime startTime, SampleTime endTime);
 	
 protected:
@@ -104,15 +163,16 @@ protected:
 	UInt32					mCapacityFramesMask;
 	UInt32					mCapacityBytes;			// per channel
 	
-	// range of valid sample time in the buffer
+	// range of valid sample time in the buffer. Each entry is written like a seqlock: mUpdateCounter
+	// is invalidated, the times are written, then mUpdateCounter is set to the entry's queue position.
 	typedef struct {
-		volatile SampleTime		mStartTime;
-		volatile SampleTime		mEndTime;
-		volatile UInt32			mUpdateCounter;
+		CARingBufferAtomic<SampleTime>	mStartTime;
+		CARingBufferAtomic<SampleTime>	mEndTime;
+		CARingBufferAtomic<UInt32>		mUpdateCounter;
 	} TimeBounds;
 	
 	CARingBuffer::TimeBounds mTimeBoundsQueue[kGeneralRingTimeBoundsQueueSize];
-	UInt32 mTimeBoundsQueuePtr;
+	CARingBufferAtomic<UInt32> mTimeBoundsQueuePtr;
 };
 
 
@@ -0,0 +1,880 @@
+/*
+	CAVectorKernels.cpp
+*/
+#include "CAVectorKernels.h"
+#include "CAAtomic.h"
+#include <math.h>
+
+// SSE2 is the baseline on every Intel Mac, so it needs no special compiler flags.  Later extensions are compiled
+// into individual functions with the target attribute, when the compiler supports it, and only called if
+// CAVectorUnit finds them.
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+	#define CA_VECTOR_SSE2 1
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+	#if defined(__has_attribute)
+		#if __has_attribute(target)
+			#include <immintrin.h>
+			#define CA_VECTOR_X86_TARGETS 1
+			#define CA_VECTOR_TARGET(x) __attribute__((target(x)))
+		#endif
+	#endif
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+	#include <arm_neon.h>
+	#define CA_VECTOR_NEON 1
+#endif
+
+static const Float32 kInt16Scale = 32768.f;
+static const Float32 kInt16Max = 32767.f;
+static const Float32 kInt16Min = -32768.f;
+
+// 24 bit samples are read into the top of an int32, where they convert to float exactly
+static const Float32 kInt32Scale = 2147483648.f;
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	Scalar
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static void	Gain_Scalar(const Float32 *in, Float32 *out, Float32 gain, UInt32 nFrames)
+{
+	for (UInt32 i = 0; i < nFrames; ++i)
+		out[i] = in[i] * gain;
+}
+
+static void	Mix_Scalar(const Float32 *in, Float32 *io, Float32 gain, UInt32 nFrames)
+{
+	for (UInt32 i = 0; i < nFrames; ++i)
+		io[i] += in[i] * gain;
+}
+
+static void	MixRamp_Scalar(const Float32 *in, Float32 *io, Float32 gain, Float32 gainStep, UInt32 nFrames)
+{
+	for (UInt32 i = 0; i < nFrames; ++i)
+		io[i] += in[i] * (gain + i * gainStep);
+}
+
+static void	BiquadCascade_Scalar(const Float32 *in, Float32 *out, UInt32 nFrames,
+								const Float32 *coeffs, Float32 *state, UInt32 nSections)
+{
+	const Float32 *src = in;
+	for (UInt32 s = 0; s < nSections; ++s) {
+		const Float32 b0 = coeffs[0], b1 = coeffs[1], b2 = coeffs[2], a1 = coeffs[3], a2 = coeffs[4];
+		Float32 z1 = state[0], z2 = state[1];
+		for (UInt32 i = 0; i < nFrames; ++i) {
+			Float32 x = src[i];
+			Float32 y = b0 * x + z1;
+			z1 = b1 * x - a1 * y + z2;
+			z2 = b2 * x - a2 * y;
+			out[i] = y;
+		}
+		state[0] = z1;
+		state[1] = z2;
+		coeffs += 5;
+		state += 2;
+		src = out;		// later sections run in place
+	}
+	if (nSections == 0 && in != out)
+		for (UInt32 i = 0; i < nFrames; ++i)
+			out[i] = in[i];
+}
+
+static void	Int16ToFloat_Scalar(const SInt16 *in, Float32 *out, UInt32 nFrames)
+{
+	for (UInt32 i = 0; i < nFrames; ++i)
+		out[i] = in[i] * (1.f / kInt16Scale);
+}
+
+static inline SInt16	FloatToInt16(Float32 x)
+{
+	x *= kInt16Scale;
+	if (x > kInt16Max) x = kInt16Max;
+	else if (x < kInt16Min) x = kInt16Min;
+	return (SInt16)lrintf(x);
+}
+
+static void	FloatToInt16_Scalar(const Float32 *in, SInt16 *out, UInt32 nFrames)
+{
+	for (UInt32 i = 0; i < nFrames; ++i)
+		out[i] = FloatToInt16(in[i]);
+}
+
+static inline SInt16	SwapInt16(SInt16 x)
+{
+	return (SInt16)(((UInt16)x << 8) | ((UInt16)x >> 8));
+}
+
+static void	SwappedInt16ToFloat_Scalar(const SInt16 *in, Float32 *out, UInt32 nFrames)
+{
+	for (UInt32 i = 0; i < nFrames; ++i)
+		out[i] = SwapInt16(in[i]) * (1.f / kInt16Scale);
+}
+
+static void	FloatToSwappedInt16_Scalar(const Float32 *in, SInt16 *out, UInt32 nFrames)
+{
+	for (UInt32 i = 0; i < nFrames; ++i)
+		out[i] = SwapInt16(FloatToInt16(in[i]));
+}
+
+// the mask that keeps a bits wide sample at the top of an int32
+static inline UInt32	Int24Mask(UInt32 bits)
+{
+	return 0xFFFFFFFF << (32 - bits);
+}
+
+static void	Int24ToFloat_Scalar(const Byte *in, Float32 *out, UInt32 nFrames, UInt32 bits, bool bigEndian)
+{
+	UInt32 mask = Int24Mask(bits);
+	for (UInt32 i = 0; i < nFrames; ++i, in += 3) {
+		UInt32 x = bigEndian ? ((UInt32)in[0] << 24) | ((UInt32)in[1] << 16) | ((UInt32)in[2] << 8)
+							 : ((UInt32)in[2] << 24) | ((UInt32)in[1] << 16) | ((UInt32)in[0] << 8);
+		out[i] = (Float32)(SInt32)(x & mask) * (1.f / kInt32Scale);
+	}
+}
+
+static void	FloatToInt24_Scalar(const Float32 *in, Byte *out, UInt32 nFrames, UInt32 bits, bool bigEndian)
+{
+	Float32 scale = (Float32)(1 << (bits - 1));
+	Float32 maxValue = scale - 1.f, minValue = -scale;
+	UInt32 shift = 24 - bits;
+	for (UInt32 i = 0; i < nFrames; ++i, out += 3) {
+		Float32 x = in[i] * scale;
+		if (x > maxValue) x = maxValue;
+		else if (x < minValue) x = minValue;
+		UInt32 v = (UInt32)lrintf(x) << shift;
+		out[bigEndian ? 2 : 0] = (Byte)v;
+		out[1] = (Byte)(v >> 8);
+		out[bigEndian ? 0 : 2] = (Byte)(v >> 16);
+	}
+}
+
+static inline void	Butterflies_Scalar(Float32 *re, Float32 *im, UInt32 start, UInt32 end, UInt32 halfSize,
+								const Float32 *twRe, const Float32 *twIm)
+{
+	for (UInt32 k = start; k < end; ++k) {
+		Float32 *ar = re + k, *ai = im + k, *br = ar + halfSize, *bi = ai + halfSize;
+		Float32 tr = *br * twRe[k] - *bi * twIm[k];
+		Float32 ti = *br * twIm[k] + *bi * twRe[k];
+		*br = *ar - tr;
+		*bi = *ai - ti;
+		*ar += tr;
+		*ai += ti;
+	}
+}
+
+static void	FFTButterfly_Scalar(Float32 *re, Float32 *im, UInt32 n, UInt32 halfSize,
+								const Float32 *twRe, const Float32 *twIm)
+{
+	for (UInt32 j = 0; j < n; j += 2 * halfSize)
+		Butterflies_Scalar(re + j, im + j, 0, halfSize, halfSize, twRe, twIm);
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	SSE2
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#if CA_VECTOR_SSE2
+static void	Gain_SSE2(const Float32 *in, Float32 *out, Float32 gain, UInt32 nFrames)
+{
+	__m128 g = _mm_set1_ps(gain);
+	UInt32 i = 0;
+	for (; i + 4 <= nFrames; i += 4)
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), g));
+	Gain_Scalar(in + i, out + i, gain, nFrames - i);
+}
+
+static void	Mix_SSE2(const Float32 *in, Float32 *io, Float32 gain, UInt32 nFrames)
+{
+	__m128 g = _mm_set1_ps(gain);
+	UInt32 i = 0;
+	for (; i + 4 <= nFrames; i += 4)
+		_mm_storeu_ps(io + i, _mm_add_ps(_mm_loadu_ps(io + i), _mm_mul_ps(_mm_loadu_ps(in + i), g)));
+	Mix_Scalar(in + i, io + i, gain, nFrames - i);
+}
+
+static void	MixRamp_SSE2(const Float32 *in, Float32 *io, Float32 gain, Float32 gainStep, UInt32 nFrames)
+{
+	__m128 g = _mm_add_ps(_mm_set1_ps(gain), _mm_mul_ps(_mm_set_ps(3.f, 2.f, 1.f, 0.f), _mm_set1_ps(gainStep)));
+	__m128 step = _mm_set1_ps(4.f * gainStep);
+	UInt32 i = 0;
+	for (; i + 4 <= nFrames; i += 4) {
+		_mm_storeu_ps(io + i, _mm_add_ps(_mm_loadu_ps(io + i), _mm_mul_ps(_mm_loadu_ps(in + i), g)));
+		g = _mm_add_ps(g, step);
+	}
+	MixRamp_Scalar(in + i, io + i, gain + i * gainStep, gainStep, nFrames - i);
+}
+
+static void	Int16ToFloat_SSE2(const SInt16 *in, Float32 *out, UInt32 nFrames)
+{
+	__m128 scale = _mm_set1_ps(1.f / kInt16Scale);
+	UInt32 i = 0;
+	for (; i + 8 <= nFrames; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		// sign extend by putting each sample in the top half of a 32 bit lane and shifting down
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	Int16ToFloat_Scalar(in + i, out + i, nFrames - i);
+}
+
+static void	FloatToInt16_SSE2(const Float32 *in, SInt16 *out, UInt32 nFrames)
+{
+	__m128 scale = _mm_set1_ps(kInt16Scale);
+	__m128 maxValue = _mm_set1_ps(kInt16Max);
+	__m128 minValue = _mm_set1_ps(kInt16Min);
+	UInt32 i = 0;
+	for (; i + 8 <= nFrames; i += 8) {
+		// clip before converting; out of range conversions don't saturate
+		__m128 a = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), maxValue), minValue);
+		__m128 b = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), maxValue), minValue);
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+	}
+	FloatToInt16_Scalar(in + i, out + i, nFrames - i);
+}
+
+static inline __m128i	SwapInt16_SSE2(__m128i x)
+{
+	return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+static void	SwappedInt16ToFloat_SSE2(const SInt16 *in, Float32 *out, UInt32 nFrames)
+{
+	__m128 scale = _mm_set1_ps(1.f / kInt16Scale);
+	UInt32 i = 0;
+	for (; i + 8 <= nFrames; i += 8) {
+		__m128i x = SwapInt16_SSE2(_mm_loadu_si128((const __m128i *)(in + i)));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	SwappedInt16ToFloat_Scalar(in + i, out + i, nFrames - i);
+}
+
+static void	FloatToSwappedInt16_SSE2(const Float32 *in, SInt16 *out, UInt32 nFrames)
+{
+	__m128 scale = _mm_set1_ps(kInt16Scale);
+	__m128 maxValue = _mm_set1_ps(kInt16Max);
+	__m128 minValue = _mm_set1_ps(kInt16Min);
+	UInt32 i = 0;
+	for (; i + 8 <= nFrames; i += 8) {
+		__m128 a = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), maxValue), minValue);
+		__m128 b = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), maxValue), minValue);
+		_mm_storeu_si128((__m128i *)(out + i), SwapInt16_SSE2(_mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b))));
+	}
+	FloatToSwappedInt16_Scalar(in + i, out + i, nFrames - i);
+}
+
+static void	FFTButterfly_SSE2(Float32 *re, Float32 *im, UInt32 n, UInt32 halfSize,
+								const Float32 *twRe, const Float32 *twIm)
+{
+	if (halfSize < 4) {
+		FFTButterfly_Scalar(re, im, n, halfSize, twRe, twIm);
+		return;
+	}
+	for (UInt32 j = 0; j < n; j += 2 * halfSize) {
+		Float32 *ar = re + j, *ai = im + j, *br = ar + halfSize, *bi = ai + halfSize;
+		for (UInt32 k = 0; k < halfSize; k += 4) {
+			__m128 wr = _mm_loadu_ps(twRe + k), wi = _mm_loadu_ps(twIm + k);
+			__m128 xr = _mm_loadu_ps(br + k), xi = _mm_loadu_ps(bi + k);
+			__m128 tr = _mm_sub_ps(_mm_mul_ps(xr, wr), _mm_mul_ps(xi, wi));
+			__m128 ti = _mm_add_ps(_mm_mul_ps(xr, wi), _mm_mul_ps(xi, wr));
+			__m128 yr = _mm_loadu_ps(ar + k), yi = _mm_loadu_ps(ai + k);
+			_mm_storeu_ps(br + k, _mm_sub_ps(yr, tr));
+			_mm_storeu_ps(bi + k, _mm_sub_ps(yi, ti));
+			_mm_storeu_ps(ar + k, _mm_add_ps(yr, tr));
+			_mm_storeu_ps(ai + k, _mm_add_ps(yi, ti));
+		}
+	}
+}
+#endif
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	SSSE3, AVX, AVX2 + FMA, AVX-512
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#if CA_VECTOR_X86_TARGETS
+// Packed 24 bit samples are moved between 3 byte slots and the top of 32 bit lanes with byte shuffles.  Reads
+// load 16 bytes for every 12 they use and writes store 16 bytes for every 12, the extra 4 being overwritten by
+// the next store, so the loops stop a few samples short of the end and leave those to the scalar version.
+CA_VECTOR_TARGET("ssse3")
+static inline __m128i	Int24Expander_SSSE3(bool bigEndian)
+{
+	return bigEndian ? _mm_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9)
+					 : _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+}
+
+CA_VECTOR_TARGET("ssse3")
+static inline __m128i	Int24Packer_SSSE3(bool bigEndian)
+{
+	return bigEndian ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+					 : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+}
+
+CA_VECTOR_TARGET("ssse3")
+static void	Int24ToFloat_SSSE3(const Byte *in, Float32 *out, UInt32 nFrames, UInt32 bits, bool bigEndian)
+{
+	__m128i expander = Int24Expander_SSSE3(bigEndian);
+	__m128i mask = _mm_set1_epi32((int)Int24Mask(bits));
+	__m128 scale = _mm_set1_ps(1.f / kInt32Scale);
+	UInt32 i = 0;
+	for (; i + 10 <= nFrames; i += 8) {
+		__m128i a = _mm_and_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 3 * i)), expander), mask);
+		__m128i b = _mm_and_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 3 * i + 12)), expander), mask);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(a), scale));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), scale));
+	}
+	Int24ToFloat_Scalar(in + 3 * i, out + i, nFrames - i, bits, bigEndian);
+}
+
+CA_VECTOR_TARGET("ssse3")
+static void	FloatToInt24_SSSE3(const Float32 *in, Byte *out, UInt32 nFrames, UInt32 bits, bool bigEndian)
+{
+	__m128i packer = Int24Packer_SSSE3(bigEndian);
+	__m128i shift = _mm_cvtsi32_si128(24 - bits);
+	Float32 fullScale = (Float32)(1 << (bits - 1));
+	__m128 scale = _mm_set1_ps(fullScale);
+	__m128 maxValue = _mm_set1_ps(fullScale - 1.f);
+	__m128 minValue = _mm_set1_ps(-fullScale);
+	UInt32 i = 0;
+	for (; i + 10 <= nFrames; i += 8) {
+		__m128 a = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), maxValue), minValue);
+		__m128 b = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), maxValue), minValue);
+		_mm_storeu_si128((__m128i *)(out + 3 * i), _mm_shuffle_epi8(_mm_sll_epi32(_mm_cvtps_epi32(a), shift), packer));
+		_mm_storeu_si128((__m128i *)(out + 3 * i + 12), _mm_shuffle_epi8(_mm_sll_epi32(_mm_cvtps_epi32(b), shift), packer));
+	}
+	FloatToInt24_Scalar(in + i, out + 3 * i, nFrames - i, bits, bigEndian);
+}
+
+CA_VECTOR_TARGET("avx")
+static void	Gain_AVX(const Float32 *in, Float32 *out, Float32 gain, UInt32 nFrames)
+{
+	__m256 g = _mm256_set1_ps(gain);
+	UInt32 i = 0;
+	for (; i + 8 <= nFrames; i += 8)
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), g));
+	Gain_Scalar(in + i, out + i, gain, nFrames - i);
+}
+
+CA_VECTOR_TARGET("avx")
+static void	Mix_AVX(const Float32 *in, Float32 *io, Float32 gain, UInt32 nFrames)
+{
+	__m256 g = _mm256_set1_ps(gain);
+	UInt32 i = 0;
+	for (; i + 8 <= nFrames; i += 8)
+		_mm256_storeu_ps(io + i, _mm256_add_ps(_mm256_loadu_ps(io + i), _mm256_mul_ps(_mm256_loadu_ps(in + i), g)));
+	Mix_Scalar(in + i, io + i, gain, nFrames - i);
+}
+
+CA_VECTOR_TARGET("avx")
+static void	MixRamp_AVX(const Float32 *in, Float32 *io, Float32 gain, Float32 gainStep, UInt32 nFrames)
+{
+	__m256 g = _mm256_add_ps(_mm256_set1_ps(gain),
+				_mm256_mul_ps(_mm256_set_ps(7.f, 6.f, 5.f, 4.f, 3.f, 2.f, 1.f, 0.f), _mm256_set1_ps(gainStep)));
+	__m256 step = _mm256_set1_ps(8.f * gainStep);
+	UInt32 i = 0;
+	for (; i + 8 <= nFrames; i += 8) {
+		_mm256_storeu_ps(io + i, _mm256_add_ps(_mm256_loadu_ps(io + i), _mm256_mul_ps(_mm256_loadu_ps(in + i), g)));
+		g = _mm256_add_ps(g, step);
+	}
+	MixRamp_Scalar(in + i, io + i, gain + i * gainStep, gainStep, nFrames - i);
+}
+
+// the AVX2 byte shuffle works within each 16 byte half, so each half gets 12 bytes of samples of its own
+CA_VECTOR_TARGET("avx2")
+static void	Int24ToFloat_AVX2(const Byte *in, Float32 *out, UInt32 nFrames, UInt32 bits, bool bigEndian)
+{
+	__m256i expander = _mm256_broadcastsi128_si256(Int24Expander_SSSE3(bigEndian));
+	__m256i mask = _mm256_set1_epi32((int)Int24Mask(bits));
+	__m256 scale = _mm256_set1_ps(1.f / kInt32Scale);
+	UInt32 i = 0;
+	for (; i + 18 <= nFrames; i += 16) {
+		const Byte *p = in + 3 * i;
+		__m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+											_mm_loadu_si128((const __m128i *)(p + 12)), 1);
+		__m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(p + 24))),
+											_mm_loadu_si128((const __m128i *)(p + 36)), 1);
+		a = _mm256_and_si256(_mm256_shuffle_epi8(a, expander), mask);
+		b = _mm256_and_si256(_mm256_shuffle_epi8(b, expander), mask);
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(a), scale));
+		_mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(b), scale));
+	}
+	Int24ToFloat_Scalar(in + 3 * i, out + i, nFrames - i, bits, bigEndian);
+}
+
+CA_VECTOR_TARGET("avx2")
+static void	FloatToInt24_AVX2(const Float32 *in, Byte *out, UInt32 nFrames, UInt32 bits, bool bigEndian)
+{
+	__m256i packer = _mm256_broadcastsi128_si256(Int24Packer_SSSE3(bigEndian));
+	__m128i shift = _mm_cvtsi32_si128(24 - bits);
+	Float32 fullScale = (Float32)(1 << (bits - 1));
+	__m256 scale = _mm256_set1_ps(fullScale);
+	__m256 maxValue = _mm256_set1_ps(fullScale - 1.f);
+	__m256 minValue = _mm256_set1_ps(-fullScale);
+	UInt32 i = 0;
+	for (; i + 18 <= nFrames; i += 16) {
+		__m256 a = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), maxValue), minValue);
+		__m256 b = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale), maxValue), minValue);
+		__m256i x = _mm256_shuffle_epi8(_mm256_sll_epi32(_mm256_cvtps_epi32(a), shift), packer);
+		__m256i y = _mm256_shuffle_epi8(_mm256_sll_epi32(_mm256_cvtps_epi32(b), shift), packer);
+		Byte *p = out + 3 * i;
+		_mm_storeu_si128((__m128i *)p, _mm256_castsi256_si128(x));
+		_mm_storeu_si128((__m128i *)(p + 12), _mm256_extracti128_si256(x, 1));
+		_mm_storeu_si128((__m128i *)(p + 24), _mm256_castsi256_si128(y));
+		_mm_storeu_si128((__m128i *)(p + 36), _mm256_extracti128_si256(y, 1));
+	}
+	FloatToInt24_Scalar(in + i, out + 3 * i, nFrames - i, bits, bigEndian);
+}
+
+CA_VECTOR_TARGET("avx2,fma")
+static void	Mix_AVX2(const Float32 *in, Float32 *io, Float32 gain, UInt32 nFrames)
+{
+	__m256 g = _mm256_set1_ps(gain);
+	UInt32 i = 0;
+	for (; i + 8 <= nFrames; i += 8)
+		_mm256_storeu_ps(io + i, _mm256_fmadd_ps(_mm256_loadu_ps(in + i), g, _mm256_loadu_ps(io + i)));
+	Mix_Scalar(in + i, io + i, gain, nFrames - i);
+}
+
+CA_VECTOR_TARGET("avx")
+static void	FFTButterfly_AVX(Float32 *re, Float32 *im, UInt32 n, UInt32 halfSize,
+								const Float32 *twRe, const Float32 *twIm)
+{
+	if (halfSize < 8) {
+		FFTButterfly_Scalar(re, im, n, halfSize, twRe, twIm);
+		return;
+	}
+	for (UInt32 j = 0; j < n; j += 2 * halfSize) {
+		Float32 *ar = re + j, *ai = im + j, *br = ar + halfSize, *bi = ai + halfSize;
+		for (UInt32 k = 0; k < halfSize; k += 8) {
+			__m256 wr = _mm256_loadu_ps(twRe + k), wi = _mm256_loadu_ps(twIm + k);
+			__m256 xr = _mm256_loadu_ps(br + k), xi = _mm256_loadu_ps(bi + k);
+			__m256 tr = _mm256_sub_ps(_mm256_mul_ps(xr, wr), _mm256_mul_ps(xi, wi));
+			__m256 ti = _mm256_add_ps(_mm256_mul_ps(xr, wi), _mm256_mul_ps(xi, wr));
+			__m256 yr = _mm256_loadu_ps(ar + k), yi = _mm256_loadu_ps(ai + k);
+			_mm256_storeu_ps(br + k, _mm256_sub_ps(yr, tr));
+			_mm256_storeu_ps(bi + k, _mm256_sub_ps(yi, ti));
+			_mm256_storeu_ps(ar + k, _mm256_add_ps(yr, tr));
+			_mm256_storeu_ps(ai + k, _mm256_add_ps(yi, ti));
+		}
+	}
+}
+
+CA_VECTOR_TARGET("avx2,fma")
+static void	FFTButterfly_AVX2(Float32 *re, Float32 *im, UInt32 n, UInt32 halfSize,
+								const Float32 *twRe, const Float32 *twIm)
+{
+	if (halfSize < 8) {
+		FFTButterfly_Scalar(re, im, n, halfSize, twRe, twIm);
+		return;
+	}
+	for (UInt32 j = 0; j < n; j += 2 * halfSize) {
+		Float32 *ar = re + j, *ai = im + j, *br = ar + halfSize, *bi = ai + halfSize;
+		for (UInt32 k = 0; k < halfSize; k += 8) {
+			__m256 wr = _mm256_loadu_ps(twRe + k), wi = _mm256_loadu_ps(twIm + k);
+			__m256 xr = _mm256_loadu_ps(br + k), xi = _mm256_loadu_ps(bi + k);
+			__m256 tr = _mm256_fmsub_ps(xr, wr, _mm256_mul_ps(xi, wi));
+			__m256 ti = _mm256_fmadd_ps(xr, wi, _mm256_mul_ps(xi, wr));
+			__m256 yr = _mm256_loadu_ps(ar + k), yi = _mm256_loadu_ps(ai + k);
+			_mm256_storeu_ps(br + k, _mm256_sub_ps(yr, tr));
+			_mm256_storeu_ps(bi + k, _mm256_sub_ps(yi, ti));
+			_mm256_storeu_ps(ar + k, _mm256_add_ps(yr, tr));
+			_mm256_storeu_ps(ai + k, _mm256_add_ps(yi, ti));
+		}
+	}
+}
+
+CA_VECTOR_TARGET("avx512f")
+static void	Gain_AVX512(const Float32 *in, Float32 *out, Float32 gain, UInt32 nFrames)
+{
+	__m512 g = _mm512_set1_ps(gain);
+	UInt32 i = 0;
+	for (; i + 16 <= nFrames; i += 16)
+		_mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(in + i), g));
+	Gain_Scalar(in + i, out + i, gain, nFrames - i);
+}
+
+CA_VECTOR_TARGET("avx512f")
+static void	Mix_AVX512(const Float32 *in, Float32 *io, Float32 gain, UInt32 nFrames)
+{
+	__m512 g = _mm512_set1_ps(gain);
+	UInt32 i = 0;
+	for (; i + 16 <= nFrames; i += 16)
+		_mm512_storeu_ps(io + i, _mm512_fmadd_ps(_mm512_loadu_ps(in + i), g, _mm512_loadu_ps(io + i)));
+	Mix_Scalar(in + i, io + i, gain, nFrames - i);
+}
+#endif
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	NEON
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#if CA_VECTOR_NEON
+static void	Gain_Neon(const Float32 *in, Float32 *out, Float32 gain, UInt32 nFrames)
+{
+	UInt32 i = 0;
+	for (; i + 4 <= nFrames; i += 4)
+		vst1q_f32(out + i, vmulq_n_f32(vld1q_f32(in + i), gain));
+	Gain_Scalar(in + i, out + i, gain, nFrames - i);
+}
+
+static void	Mix_Neon(const Float32 *in, Float32 *io, Float32 gain, UInt32 nFrames)
+{
+	UInt32 i = 0;
+	for (; i + 4 <= nFrames; i += 4)
+		vst1q_f32(io + i, vmlaq_n_f32(vld1q_f32(io + i), vld1q_f32(in + i), gain));
+	Mix_Scalar(in + i, io + i, gain, nFrames - i);
+}
+
+static void	MixRamp_Neon(const Float32 *in, Float32 *io, Float32 gain, Float32 gainStep, UInt32 nFrames)
+{
+	static const Float32 kOffsets[4] = { 0.f, 1.f, 2.f, 3.f };
+	float32x4_t g = vmlaq_n_f32(vdupq_n_f32(gain), vld1q_f32(kOffsets), gainStep);
+	float32x4_t step = vdupq_n_f32(4.f * gainStep);
+	UInt32 i = 0;
+	for (; i + 4 <= nFrames; i += 4) {
+		vst1q_f32(io + i, vmlaq_f32(vld1q_f32(io + i), vld1q_f32(in + i), g));
+		g = vaddq_f32(g, step);
+	}
+	MixRamp_Scalar(in + i, io + i, gain + i * gainStep, gainStep, nFrames - i);
+}
+
+static void	Int16ToFloat_Neon(const SInt16 *in, Float32 *out, UInt32 nFrames)
+{
+	UInt32 i = 0;
+	for (; i + 8 <= nFrames; i += 8) {
+		int16x8_t x = vld1q_s16(in + i);
+		vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), 1.f / kInt16Scale));
+		vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), 1.f / kInt16Scale));
+	}
+	Int16ToFloat_Scalar(in + i, out + i, nFrames - i);
+}
+
+static void	FloatToInt16_Neon(const Float32 *in, SInt16 *out, UInt32 nFrames)
+{
+	// vcvtq truncates, so round by adding a half away from zero first; the conversion and the narrowing
+	// both saturate
+	float32x4_t half = vdupq_n_f32(0.5f);
+	uint32x4_t signBit = vdupq_n_u32(0x80000000);
+	UInt32 i = 0;
+	for (; i + 8 <= nFrames; i += 8) {
+		float32x4_t a = vmulq_n_f32(vld1q_f32(in + i), kInt16Scale);
+		float32x4_t b = vmulq_n_f32(vld1q_f32(in + i + 4), kInt16Scale);
+		a = vaddq_f32(a, vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(a), signBit), vreinterpretq_u32_f32(half))));
+		b = vaddq_f32(b, vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(b), signBit), vreinterpretq_u32_f32(half))));
+		vst1q_s16(out + i, vcombine_s16(vqmovn_s32(vcvtq_s32_f32(a)), vqmovn_s32(vcvtq_s32_f32(b))));
+	}
+	FloatToInt16_Scalar(in + i, out + i, nFrames - i);
+}
+
+static void	SwappedInt16ToFloat_Neon(const SInt16 *in, Float32 *out, UInt32 nFrames)
+{
+	UInt32 i = 0;
+	for (; i + 8 <= nFrames; i += 8) {
+		int16x8_t x = vreinterpretq_s16_u8(vrev16q_u8(vld1q_u8((const uint8_t *)(in + i))));
+		vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), 1.f / kInt16Scale));
+		vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), 1.f / kInt16Scale));
+	}
+	SwappedInt16ToFloat_Scalar(in + i, out + i, nFrames - i);
+}
+
+// rounds to nearest even, like lrintf
+static inline int32x4_t	RoundToInt32_Neon(float32x4_t x)
+{
+#if defined(__aarch64__) || defined(__arm64__)
+	return vcvtnq_s32_f32(x);
+#else
+	// 32 bit NEON only converts toward zero, but its arithmetic always rounds to nearest even: adding and
+	// subtracting 2^23 rounds magnitudes below 2^23 to integers, and larger ones already are
+	float32x4_t magic = vdupq_n_f32(8388608.f);
+	float32x4_t ax = vabsq_f32(x);
+	float32x4_t rounded = vbslq_f32(vcltq_f32(ax, magic), vsubq_f32(vaddq_f32(ax, magic), magic), ax);
+	uint32x4_t signBit = vandq_u32(vreinterpretq_u32_f32(x), vdupq_n_u32(0x80000000));
+	return vcvtq_s32_f32(vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(rounded), signBit)));
+#endif
+}
+
+static void	FloatToSwappedInt16_Neon(const Float32 *in, SInt16 *out, UInt32 nFrames)
+{
+	UInt32 i = 0;
+	for (; i + 8 <= nFrames; i += 8) {
+		int32x4_t a = RoundToInt32_Neon(vmulq_n_f32(vld1q_f32(in + i), kInt16Scale));
+		int32x4_t b = RoundToInt32_Neon(vmulq_n_f32(vld1q_f32(in + i + 4), kInt16Scale));
+		int16x8_t x = vcombine_s16(vqmovn_s32(a), vqmovn_s32(b));
+		vst1q_u8((uint8_t *)(out + i), vrev16q_u8(vreinterpretq_u8_s16(x)));
+	}
+	FloatToSwappedInt16_Scalar(in + i, out + i, nFrames - i);
+}
+
+// vld3 and vst3 split 16 samples into their first, second and third bytes; the 32 bit lanes are put together
+// with zips, little endian
+static void	Int24ToFloat_Neon(const Byte *in, Float32 *out, UInt32 nFrames, UInt32 bits, bool bigEndian)
+{
+	int32x4_t mask = vdupq_n_s32((int32_t)Int24Mask(bits));
+	UInt32 i = 0;
+	for (; i + 16 <= nFrames; i += 16) {
+		uint8x16x3_t b = vld3q_u8(in + 3 * i);
+		uint8x16_t lo = bigEndian ? b.val[2] : b.val[0], hi = bigEndian ? b.val[0] : b.val[2];
+		uint8x16x2_t lowHalves = vzipq_u8(vdupq_n_u8(0), lo);
+		uint8x16x2_t highHalves = vzipq_u8(b.val[1], hi);
+		uint16x8x2_t first = vzipq_u16(vreinterpretq_u16_u8(lowHalves.val[0]), vreinterpretq_u16_u8(highHalves.val[0]));
+		uint16x8x2_t second = vzipq_u16(vreinterpretq_u16_u8(lowHalves.val[1]), vreinterpretq_u16_u8(highHalves.val[1]));
+		vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vandq_s32(vreinterpretq_s32_u16(first.val[0]), mask)), 1.f / kInt32Scale));
+		vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vandq_s32(vreinterpretq_s32_u16(first.val[1]), mask)), 1.f / kInt32Scale));
+		vst1q_f32(out + i + 8, vmulq_n_f32(vcvtq_f32_s32(vandq_s32(vreinterpretq_s32_u16(second.val[0]), mask)), 1.f / kInt32Scale));
+		vst1q_f32(out + i + 12, vmulq_n_f32(vcvtq_f32_s32(vandq_s32(vreinterpretq_s32_u16(second.val[1]), mask)), 1.f / kInt32Scale));
+	}
+	Int24ToFloat_Scalar(in + 3 * i, out + i, nFrames - i, bits, bigEndian);
+}
+
+static void	FloatToInt24_Neon(const Float32 *in, Byte *out, UInt32 nFrames, UInt32 bits, bool bigEndian)
+{
+	Float32 fullScale = (Float32)(1 << (bits - 1));
+	float32x4_t maxValue = vdupq_n_f32(fullScale - 1.f), minValue = vdupq_n_f32(-fullScale);
+	int32x4_t shift = vdupq_n_s32(24 - bits);
+	UInt32 i = 0;
+	for (; i + 16 <= nFrames; i += 16) {
+		uint32x4_t v[4];
+		for (UInt32 j = 0; j < 4; ++j) {
+			float32x4_t x = vmaxq_f32(vminq_f32(vmulq_n_f32(vld1q_f32(in + i + 4 * j), fullScale), maxValue), minValue);
+			v[j] = vreinterpretq_u32_s32(vshlq_s32(RoundToInt32_Neon(x), shift));
+		}
+		uint16x8_t low16a = vcombine_u16(vmovn_u32(v[0]), vmovn_u32(v[1]));
+		uint16x8_t low16b = vcombine_u16(vmovn_u32(v[2]), vmovn_u32(v[3]));
+		uint16x8_t high16a = vcombine_u16(vshrn_n_u32(v[0], 16), vshrn_n_u32(v[1], 16));
+		uint16x8_t high16b = vcombine_u16(vshrn_n_u32(v[2], 16), vshrn_n_u32(v[3], 16));
+		uint8x16x3_t b;
+		b.val[bigEndian ? 2 : 0] = vcombine_u8(vmovn_u16(low16a), vmovn_u16(low16b));
+		b.val[1] = vcombine_u8(vshrn_n_u16(low16a, 8), vshrn_n_u16(low16b, 8));
+		b.val[bigEndian ? 0 : 2] = vcombine_u8(vmovn_u16(high16a), vmovn_u16(high16b));
+		vst3q_u8(out + 3 * i, b);
+	}
+	FloatToInt24_Scalar(in + i, out + 3 * i, nFrames - i, bits, bigEndian);
+}
+
+static void	FFTButterfly_Neon(Float32 *re, Float32 *im, UInt32 n, UInt32 halfSize,
+								const Float32 *twRe, const Float32 *twIm)
+{
+	if (halfSize < 4) {
+		FFTButterfly_Scalar(re, im, n, halfSize, twRe, twIm);
+		return;
+	}
+	for (UInt32 j = 0; j < n; j += 2 * halfSize) {
+		Float32 *ar = re + j, *ai = im + j, *br = ar + halfSize, *bi = ai + halfSize;
+		for (UInt32 k = 0; k < halfSize; k += 4) {
+			float32x4_t wr = vld1q_f32(twRe + k), wi = vld1q_f32(twIm + k);
+			float32x4_t xr = vld1q_f32(br + k), xi = vld1q_f32(bi + k);
+			float32x4_t tr = vmlsq_f32(vmulq_f32(xr, wr), xi, wi);
+			float32x4_t ti = vmlaq_f32(vmulq_f32(xr, wi), xi, wr);
+			float32x4_t yr = vld1q_f32(ar + k), yi = vld1q_f32(ai + k);
+			vst1q_f32(br + k, vsubq_f32(yr, tr));
+			vst1q_f32(bi + k, vsubq_f32(yi, ti));
+			vst1q_f32(ar + k, vaddq_f32(yr, tr));
+			vst1q_f32(ai + k, vaddq_f32(yi, ti));
+		}
+	}
+}
+#endif
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	Registry
+//
+//	Each kernel's versions, best first.  The scalar version is always last and needs nothing.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+template <typename Proc>
+struct CAVectorKernelVariant {
+	UInt32			mFeatures;		// all of these are required
+	const char *	mName;
+	Proc			mProc;
+};
+
+static const CAVectorKernelVariant<CAVectorKernels::GainProc> sGainVariants[] = {
+#if CA_VECTOR_X86_TARGETS
+	{ kVecFeature_AVX512F, "AVX-512", Gain_AVX512 },
+	{ kVecFeature_AVX, "AVX", Gain_AVX },
+#endif
+#if CA_VECTOR_SSE2
+	{ kVecFeature_SSE2, "SSE2", Gain_SSE2 },
+#endif
+#if CA_VECTOR_NEON
+	{ kVecFeature_Neon, "NEON", Gain_Neon },
+#endif
+	{ 0, "Scalar", Gain_Scalar }
+};
+
+static const CAVectorKernelVariant<CAVectorKernels::MixProc> sMixVariants[] = {
+#if CA_VECTOR_X86_TARGETS
+	{ kVecFeature_AVX512F, "AVX-512", Mix_AVX512 },
+	{ kVecFeature_AVX2 | kVecFeature_FMA, "AVX2+FMA", Mix_AVX2 },
+	{ kVecFeature_AVX, "AVX", Mix_AVX },
+#endif
+#if CA_VECTOR_SSE2
+	{ kVecFeature_SSE2, "SSE2", Mix_SSE2 },
+#endif
+#if CA_VECTOR_NEON
+	{ kVecFeature_Neon, "NEON", Mix_Neon },
+#endif
+	{ 0, "Scalar", Mix_Scalar }
+};
+
+static const CAVectorKernelVariant<CAVectorKernels::MixRampProc> sMixRampVariants[] = {
+#if CA_VECTOR_X86_TARGETS
+	{ kVecFeature_AVX, "AVX", MixRamp_AVX },
+#endif
+#if CA_VECTOR_SSE2
+	{ kVecFeature_SSE2, "SSE2", MixRamp_SSE2 },
+#endif
+#if CA_VECTOR_NEON
+	{ kVecFeature_Neon, "NEON", MixRamp_Neon },
+#endif
+	{ 0, "Scalar", MixRamp_Scalar }
+};
+
+// Each biquad's output feeds its own next sample, so there's nothing across time to vectorize; the scalar
+// version is the only one.
+static const CAVectorKernelVariant<CAVectorKernels::BiquadCascadeProc> sBiquadCascadeVariants[] = {
+	{ 0, "Scalar", BiquadCascade_Scalar }
+};
+
+static const CAVectorKernelVariant<CAVectorKernels::Int16ToFloatProc> sInt16ToFloatVariants[] = {
+#if CA_VECTOR_SSE2
+	{ kVecFeature_SSE2, "SSE2", Int16ToFloat_SSE2 },
+#endif
+#if CA_VECTOR_NEON
+	{ kVecFeature_Neon, "NEON", Int16ToFloat_Neon },
+#endif
+	{ 0, "Scalar", Int16ToFloat_Scalar }
+};
+
+static const CAVectorKernelVariant<CAVectorKernels::FloatToInt16Proc> sFloatToInt16Variants[] = {
+#if CA_VECTOR_SSE2
+	{ kVecFeature_SSE2, "SSE2", FloatToInt16_SSE2 },
+#endif
+#if CA_VECTOR_NEON
+	{ kVecFeature_Neon, "NEON", FloatToInt16_Neon },
+#endif
+	{ 0, "Scalar", FloatToInt16_Scalar }
+};
+
+static const CAVectorKernelVariant<CAVectorKernels::SwappedInt16ToFloatProc> sSwappedInt16ToFloatVariants[] = {
+#if CA_VECTOR_SSE2
+	{ kVecFeature_SSE2, "SSE2", SwappedInt16ToFloat_SSE2 },
+#endif
+#if CA_VECTOR_NEON
+	{ kVecFeature_Neon, "NEON", SwappedInt16ToFloat_Neon },
+#endif
+	{ 0, "Scalar", SwappedInt16ToFloat_Scalar }
+};
+
+static const CAVectorKernelVariant<CAVectorKernels::FloatToSwappedInt16Proc> sFloatToSwappedInt16Variants[] = {
+#if CA_VECTOR_SSE2
+	{ kVecFeature_SSE2, "SSE2", FloatToSwappedInt16_SSE2 },
+#endif
+#if CA_VECTOR_NEON
+	{ kVecFeature_Neon, "NEON", FloatToSwappedInt16_Neon },
+#endif
+	{ 0, "Scalar", FloatToSwappedInt16_Scalar }
+};
+
+static const CAVectorKernelVariant<CAVectorKernels::Int24ToFloatProc> sInt24ToFloatVariants[] = {
+#if CA_VECTOR_X86_TARGETS
+	{ kVecFeature_AVX2, "AVX2", Int24ToFloat_AVX2 },
+	{ kVecFeature_SSSE3, "SSSE3", Int24ToFloat_SSSE3 },
+#endif
+#if CA_VECTOR_NEON
+	{ kVecFeature_Neon, "NEON", Int24ToFloat_Neon },
+#endif
+	{ 0, "Scalar", Int24ToFloat_Scalar }
+};
+
+static const CAVectorKernelVariant<CAVectorKernels::FloatToInt24Proc> sFloatToInt24Variants[] = {
+#if CA_VECTOR_X86_TARGETS
+	{ kVecFeature_AVX2, "AVX2", FloatToInt24_AVX2 },
+	{ kVecFeature_SSSE3, "SSSE3", FloatToInt24_SSSE3 },
+#endif
+#if CA_VECTOR_NEON
+	{ kVecFeature_Neon, "NEON", FloatToInt24_Neon },
+#endif
+	{ 0, "Scalar", FloatToInt24_Scalar }
+};
+
+static const CAVectorKernelVariant<CAVectorKernels::FFTButterflyProc> sFFTButterflyVariants[] = {
+#if CA_VECTOR_X86_TARGETS
+	{ kVecFeature_AVX2 | kVecFeature_FMA, "AVX2+FMA", FFTButterfly_AVX2 },
+	{ kVecFeature_AVX, "AVX", FFTButterfly_AVX },
+#endif
+#if CA_VECTOR_SSE2
+	{ kVecFeature_SSE2, "SSE2", FFTButterfly_SSE2 },
+#endif
+#if CA_VECTOR_NEON
+	{ kVecFeature_Neon, "NEON", FFTButterfly_Neon },
+#endif
+	{ 0, "Scalar", FFTButterfly_Scalar }
+};
+
+template <typename Proc, size_t N>
+static const CAVectorKernelVariant<Proc> &	SelectVariant(const CAVectorKernelVariant<Proc> (&variants)[N], UInt32 features)
+{
+	for (size_t i = 0; i < N - 1; ++i)
+		if ((variants[i].mFeatures & features) == variants[i].mFeatures)
+			return variants[i];
+	return variants[N - 1];
+}
+
+CAVectorKernels CAVectorKernels::sKernels = {
+	Gain_Scalar, Mix_Scalar, MixRamp_Scalar, BiquadCascade_Scalar, Int16ToFloat_Scalar, FloatToInt16_Scalar,
+	SwappedInt16ToFloat_Scalar, FloatToSwappedInt16_Scalar, Int24ToFloat_Scalar, FloatToInt24_Scalar,
+	FFTButterfly_Scalar,
+	{ "Scalar", "Scalar", "Scalar", "Scalar", "Scalar", "Scalar", "Scalar", "Scalar", "Scalar", "Scalar", "Scalar" }
+};
+volatile SInt32 CAVectorKernels::sBindState = CAVectorKernels::kUnbound;
+
+void	CAVectorKernels::Bind(UInt32 featureMask)
+{
+	UInt32 features = CAVectorUnit::GetFeatures() & featureMask;
+
+	CAVectorKernels kernels;
+#define CA_BIND_KERNEL(kernel, member, variants) \
+	{ \
+		const CAVectorKernelVariant<kernel##Proc> &variant = SelectVariant(variants, features); \
+		kernels.member = variant.mProc; \
+		kernels.mVariantNames[kKernel_##kernel] = variant.mName; \
+	}
+	CA_BIND_KERNEL(Gain, mGain, sGainVariants)
+	CA_BIND_KERNEL(Mix, mMix, sMixVariants)
+	CA_BIND_KERNEL(MixRamp, mMixRamp, sMixRampVariants)
+	CA_BIND_KERNEL(BiquadCascade, mBiquadCascade, sBiquadCascadeVariants)
+	CA_BIND_KERNEL(Int16ToFloat, mInt16ToFloat, sInt16ToFloatVariants)
+	CA_BIND_KERNEL(FloatToInt16, mFloatToInt16, sFloatToInt16Variants)
+	CA_BIND_KERNEL(SwappedInt16ToFloat, mSwappedInt16ToFloat, sSwappedInt16ToFloatVariants)
+	CA_BIND_KERNEL(FloatToSwappedInt16, mFloatToSwappedInt16, sFloatToSwappedInt16Variants)
+	CA_BIND_KERNEL(Int24ToFloat, mInt24ToFloat, sInt24ToFloatVariants)
+	CA_BIND_KERNEL(FloatToInt24, mFloatToInt24, sFloatToInt24Variants)
+	CA_BIND_KERNEL(FFTButterfly, mFFTButterfly, sFFTButterflyVariants)
+#undef CA_BIND_KERNEL
+
+	sKernels = kernels;
+	CAMemoryBarrier();
+	sBindState = kBound;
+}
+
+void	CAVectorKernels::BindOnce()
+{
+	if (sBindState == kBound) {
+		CAMemoryBarrier();
+		return;
+	}
+	if (CAAtomicCompareAndSwap32Barrier(kUnbound, kBinding, &sBindState)) {
+		Bind();
+		return;
+	}
+		// another thread is binding; it only takes as long as examining the CPU
+	while (sBindState != kBound)
+		CAMemoryBarrier();
+	CAMemoryBarrier();
+}
@@ -0,0 +1,99 @@
+/*
+	CAVectorKernels.h
+
+	Common DSP inner loops, each with a scalar version and vector versions for the instruction sets that help.
+	Bind() picks the best version of each kernel the CPU supports, using CAVectorUnit's feature detection, and
+	Get() returns the bound table.  Until Bind() is called the table holds the scalar versions, so it's always
+	safe to call through.  AUBase binds the table when the first audio unit initializes.
+
+	All buffers may be unaligned.  Vector versions may round differently than the scalar ones in the last bit
+	(fused multiply-add, for instance), so don't compare their output for exact equality.
+*/
+#ifndef __CAVectorKernels_h__
+#define __CAVectorKernels_h__
+
+#include "CAVectorUnit.h"
+
+struct CAVectorKernels {
+	// out[i] = in[i] * gain.  in and out may be the same buffer.
+	typedef void	(*GainProc)(const Float32 *in, Float32 *out, Float32 gain, UInt32 nFrames);
+
+	// io[i] += in[i] * gain
+	typedef void	(*MixProc)(const Float32 *in, Float32 *io, Float32 gain, UInt32 nFrames);
+
+	// io[i] += in[i] * (gain + i * gainStep), for gain changes smoothed across a slice
+	typedef void	(*MixRampProc)(const Float32 *in, Float32 *io, Float32 gain, Float32 gainStep, UInt32 nFrames);
+
+	// Cascade of transposed direct form II biquads.  coeffs holds b0 b1 b2 a1 a2 for each section (a0 normalized
+	// to 1), state holds 2 values per section and carries over between calls.  in and out may be the same buffer.
+	typedef void	(*BiquadCascadeProc)(const Float32 *in, Float32 *out, UInt32 nFrames,
+								const Float32 *coeffs, Float32 *state, UInt32 nSections);
+
+	// Conversion between 16 bit integer samples and floats in -1 - 1.  Floats out of range are clipped.
+	typedef void	(*Int16ToFloatProc)(const SInt16 *in, Float32 *out, UInt32 nFrames);
+	typedef void	(*FloatToInt16Proc)(const Float32 *in, SInt16 *out, UInt32 nFrames);
+
+	// The same for 16 bit integer samples in the other byte order.
+	typedef void	(*SwappedInt16ToFloatProc)(const SInt16 *in, Float32 *out, UInt32 nFrames);
+	typedef void	(*FloatToSwappedInt16Proc)(const Float32 *in, SInt16 *out, UInt32 nFrames);
+
+	// Conversion between packed 24 bit integer samples (3 bytes each, either byte order) and floats in -1 - 1.
+	// Samples of fewer bits (20, say) sit at the top of the 3 bytes: reading ignores the bits below them, and
+	// writing rounds to them and clears the rest.  Floats out of range are clipped.  Every version gives the same
+	// results as the scalar one.
+	typedef void	(*Int24ToFloatProc)(const Byte *in, Float32 *out, UInt32 nFrames, UInt32 bits, bool bigEndian);
+	typedef void	(*FloatToInt24Proc)(const Float32 *in, Byte *out, UInt32 nFrames, UInt32 bits, bool bigEndian);
+
+	// One in-place radix 2 decimation in time pass of a complex FFT of n points (split real and imaginary arrays).
+	// Butterflies are halfSize apart; twiddle k for this pass is (twRe[k], twIm[k]), 0 <= k < halfSize.
+	typedef void	(*FFTButterflyProc)(Float32 *re, Float32 *im, UInt32 n, UInt32 halfSize,
+								const Float32 *twRe, const Float32 *twIm);
+
+	enum {
+		kKernel_Gain = 0,
+		kKernel_Mix,
+		kKernel_MixRamp,
+		kKernel_BiquadCascade,
+		kKernel_Int16ToFloat,
+		kKernel_FloatToInt16,
+		kKernel_SwappedInt16ToFloat,
+		kKernel_FloatToSwappedInt16,
+		kKernel_Int24ToFloat,
+		kKernel_FloatToInt24,
+		kKernel_FFTButterfly,
+		kNumberOfKernels
+	};
+
+	GainProc				mGain;
+	MixProc					mMix;
+	MixRampProc				mMixRamp;
+	BiquadCascadeProc		mBiquadCascade;
+	Int16ToFloatProc		mInt16ToFloat;
+	FloatToInt16Proc		mFloatToInt16;
+	SwappedInt16ToFloatProc	mSwappedInt16ToFloat;
+	FloatToSwappedInt16Proc	mFloatToSwappedInt16;
+	Int24ToFloatProc		mInt24ToFloat;
+	FloatToInt24Proc		mFloatToInt24;
+	FFTButterflyProc		mFFTButterfly;
+
+	// which version of each kernel is bound ("Scalar", "SSE2", "AVX2+FMA", ...), for logging and benchmarks
+	const char *			mVariantNames[kNumberOfKernels];
+
+	// Binds the best version of each kernel using only the features in featureMask (kVecFeature_ bits) that the
+	// CPU also has.  Passing a restricted mask is useful for comparing versions.  Don't call this while anything
+	// might be calling through the table.
+	static void				Bind(UInt32 featureMask = 0xFFFFFFFF);
+
+	// Binds with every feature the CPU has, unless the table was already bound.  Safe to call from several
+	// threads at once; callers that lose the race wait for the winner's table.
+	static void				BindOnce();
+
+	static const CAVectorKernels &	Get() { return sKernels; }
+
+private:
+	static CAVectorKernels	sKernels;
+	enum { kUnbound, kBinding, kBound };
+	static volatile SInt32	sBindState;
+};
+
+#endif // __CAVectorKernels_h__
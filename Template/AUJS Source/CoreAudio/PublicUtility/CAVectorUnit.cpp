@@ -40,59 +40,103 @@
 */
 #include "CAVectorUnit.h"
 
-#if !TARGET_OS_WIN32
+#if TARGET_OS_MAC
 	#include <sys/sysctl.h>
-#elif HAS_IPP
+#elif TARGET_OS_WIN32 && HAS_IPP
 	#include "ippdefs.h"
 	#include "ippcore.h"
 #endif
 
+// Everywhere but the Mac, x86 extensions are found with cpuid.
+#if !TARGET_OS_MAC && (defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64))
+	#define CA_VECTOR_UNIT_CPUID 1
+	#if TARGET_OS_WIN32
+		#include <intrin.h>
+		#include <immintrin.h>
+	#else
+		#include <cpuid.h>
+	#endif
+#endif
+
 int gCAVectorUnitType = kVecUninitialized;
+UInt32 gCAVectorUnitFeatures = 0;
 
-#if TARGET_OS_WIN32
-// Use cpuid to check if SSE2 is available.
-// Before calling this function make sure cpuid is available
-static SInt32 IsSSE2Available()
+#if TARGET_OS_MAC && (TARGET_CPU_X86 || TARGET_CPU_X86_64)
+// The hw.optional keys only report an extension if the OS also saves its registers.
+static UInt32 SysctlFeature(const char *name, UInt32 feature)
 {
-	int return_value;
+	int answer = 0;
+	size_t length = sizeof(answer);
+	int error = sysctlbyname(name, &answer, &length, NULL, 0);
+	return (!error && answer) ? feature : 0;
+}
+#endif
 
-	{
-		int r_edx;
-		_asm
-		{
-			mov eax, 0x01
-			cpuid
-			mov r_edx, edx
-		}
-		return_value = (r_edx >> 26) & 0x1;
-	}
-	return return_value;
+#if CA_VECTOR_UNIT_CPUID
+static void Cpuid(UInt32 leaf, UInt32 subleaf, UInt32 outRegisters[4])
+{
+#if TARGET_OS_WIN32
+	__cpuidex((int *)outRegisters, (int)leaf, (int)subleaf);
+#else
+	__cpuid_count(leaf, subleaf, outRegisters[0], outRegisters[1], outRegisters[2], outRegisters[3]);
+#endif
 }
 
-// Use cpuid to check if SSE3 is available.
-// Before calling this function make sure cpuid is available
-static SInt32 IsSSE3Available()
+// The register state the OS saves on a context switch (XCR0).  Only valid if cpuid reports OSXSAVE.
+static UInt64 XGetBV()
 {
-	SInt32 return_value;
+#if TARGET_OS_WIN32
+	return _xgetbv(0);
+#else
+	UInt32 eax, edx;
+	__asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0" : "=a" (eax), "=d" (edx) : "c" (0));	// xgetbv
+	return ((UInt64)edx << 32) | eax;
+#endif
+}
 
-	{
-		SInt32 r_ecx;
-		_asm
-		{
-			mov eax, 0x01
-			cpuid
-			mov r_ecx, ecx
-		}
-		return_value = r_ecx & 0x1;
+// Like the hw.optional keys on the Mac, the AVX family is only reported if the OS also saves its registers.
+// Before calling this function make sure cpuid is available
+static UInt32 CpuidFeatures()
+{
+	UInt32 regs[4];
+	Cpuid(0, 0, regs);
+	UInt32 maxLeaf = regs[0];
+	if (maxLeaf < 1)
+		return 0;
+	
+	UInt32 features = 0;
+	Cpuid(1, 0, regs);
+	UInt32 ecx = regs[2], edx = regs[3];
+	if (edx & (1 << 26)) features |= kVecFeature_SSE2;
+	if (ecx & (1 << 0)) features |= kVecFeature_SSE3;
+	if (ecx & (1 << 9)) features |= kVecFeature_SSSE3;
+	if (ecx & (1 << 19)) features |= kVecFeature_SSE41;
+	
+	UInt64 xcr0 = (ecx & (1 << 27)) ? XGetBV() : 0;
+	bool ymmSaved = (xcr0 & 0x6) == 0x6;		// SSE and AVX state
+	bool zmmSaved = (xcr0 & 0xE6) == 0xE6;		// and the AVX-512 opmask and upper registers
+	if (ymmSaved && (ecx & (1 << 28))) features |= kVecFeature_AVX;
+	if (ymmSaved && (ecx & (1 << 12))) features |= kVecFeature_FMA;
+	
+	if (maxLeaf >= 7) {
+		Cpuid(7, 0, regs);
+		UInt32 ebx = regs[1];
+		if (ymmSaved && (ebx & (1 << 5))) features |= kVecFeature_AVX2;
+		if (zmmSaved && (ebx & (1 << 16))) features |= kVecFeature_AVX512F;
 	}
-	return return_value;
+	return features;
 }
+#endif
 
+#if TARGET_OS_WIN32
 // Return true if the cpuid instruction is available.
 // The cpuid instruction is available if bit 21 in the EFLAGS register can be changed
 // This function may not work on Intel CPUs prior to Pentium (didn't test)
 static bool IsCpuidAvailable()
 {
+#if defined(_M_X64)
+	return true;	// every x64 processor has it, and there's no inline assembler
+#else
 	SInt32 return_value = 0x0;
 	_asm{
 		pushfd    ;			//push original EFLAGS 
@@ -110,6 +154,7 @@ end_cpuid_identify:
 		nop;
 		}
 		return return_value;
+#endif
 }
 
 #endif
@@ -117,6 +162,7 @@ end_cpuid_identify:
 SInt32	CAVectorUnit_Examine()
 {
 	int result = kVecNone;
+	UInt32 features = 0;
 	
 #if TARGET_OS_WIN32
 #if HAS_IPP	
@@ -135,14 +181,11 @@ SInt32	CAVectorUnit_Examine()
 		// The IPP library does not detect SSE on AMD processors.
 		if (IsCpuidAvailable())
 		{
-			if(IsSSE3Available())
-			{
+			features = CpuidFeatures();
+			if (features & kVecFeature_SSE3)
 				result = kVecSSE3;
-			}
-			else if(IsSSE2Available())
-			{
+			else if (features & kVecFeature_SSE2)
 				result = kVecSSE2;
-			}
 		}
 	}
 #elif TARGET_OS_MAC
@@ -159,26 +202,39 @@ SInt32	CAVectorUnit_Examine()
 		int vType = 0; //0 == scalar only
 		size_t length = sizeof(vType);
 		int error = sysctl(sels, 2, &vType, &length, NULL, 0);
-		if (!error && vType > 0)
+		if (!error && vType > 0) {
 			result = kVecAltivec;
+			features |= kVecFeature_Altivec;
+		}
 	#elif (TARGET_CPU_X86 || TARGET_CPU_X86_64)
-		int answer = 0;
-		size_t length = sizeof(answer);
-		int error = sysctlbyname("hw.optional.sse3", &answer, &length, NULL, 0);
-		if (!error && answer)
+		features |= SysctlFeature("hw.optional.sse2", kVecFeature_SSE2);
+		features |= SysctlFeature("hw.optional.sse3", kVecFeature_SSE3);
+		features |= SysctlFeature("hw.optional.supplementalsse3", kVecFeature_SSSE3);
+		features |= SysctlFeature("hw.optional.sse4_1", kVecFeature_SSE41);
+		features |= SysctlFeature("hw.optional.avx1_0", kVecFeature_AVX);
+		features |= SysctlFeature("hw.optional.avx2_0", kVecFeature_AVX2);
+		features |= SysctlFeature("hw.optional.fma", kVecFeature_FMA);
+		features |= SysctlFeature("hw.optional.avx512f", kVecFeature_AVX512F);
+		if (features & kVecFeature_SSE3)
 			result = kVecSSE3;
-		else {
-			answer = 0;
-			length = sizeof(answer);
-			error = sysctlbyname("hw.optional.sse2", &answer, &length, NULL, 0);
-			if (!error && answer)
-				result = kVecSSE2;
-		}
-	#elif (TARGET_CPU_ARM) && defined(_ARM_ARCH_7)
+		else if (features & kVecFeature_SSE2)
+			result = kVecSSE2;
+	#elif ((TARGET_CPU_ARM) && defined(_ARM_ARCH_7)) || defined(__arm64__) || defined(__aarch64__)
 		result = kVecNeon;
+		features |= kVecFeature_Neon;
 	#endif
 	}
+#elif CA_VECTOR_UNIT_CPUID
+	features = CpuidFeatures();
+	if (features & kVecFeature_SSE3)
+		result = kVecSSE3;
+	else if (features & kVecFeature_SSE2)
+		result = kVecSSE2;
+#elif defined(__aarch64__) || defined(__ARM_NEON__) || defined(__ARM_NEON)
+	result = kVecNeon;
+	features |= kVecFeature_Neon;
 #endif
+	gCAVectorUnitFeatures = features;
 	gCAVectorUnitType = result;
 	return result;
 }
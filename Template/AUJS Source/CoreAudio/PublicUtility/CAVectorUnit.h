@@ -56,6 +56,7 @@
 // Allow setting an environment variable "CA_NoVector" to turn off vectorized code at runtime (very useful for performance testing).
 
 extern int gCAVectorUnitType;
+extern UInt32 gCAVectorUnitFeatures;
 
 #ifdef __cplusplus
 extern "C" {
@@ -69,6 +70,13 @@ static inline SInt32 CAVectorUnit_GetType()
 	return (x != kVecUninitialized) ? x : CAVectorUnit_Examine();
 }
 
+// a mask of kVecFeature_ bits
+static inline UInt32 CAVectorUnit_GetFeatures()
+{
+	CAVectorUnit_GetType();
+	return gCAVectorUnitFeatures;
+}
+
 static inline Boolean CAVectorUnit_HasVectorUnit()
 {
 	return CAVectorUnit_GetType() > kVecNone;
@@ -88,6 +96,15 @@ public:
 	static bool			HasSSE2() { return GetVectorUnitType() >= kVecSSE2; }
 	static bool			HasSSE3() { return GetVectorUnitType() == kVecSSE3; }
 	static bool			HasNeon() { return GetVectorUnitType() == kVecNeon; }
+
+	static UInt32		GetFeatures() { return CAVectorUnit_GetFeatures(); }
+	static bool			HasFeatures(UInt32 mask) { return (GetFeatures() & mask) == mask; }
+	static bool			HasSSSE3() { return HasFeatures(kVecFeature_SSSE3); }
+	static bool			HasSSE41() { return HasFeatures(kVecFeature_SSE41); }
+	static bool			HasAVX() { return HasFeatures(kVecFeature_AVX); }
+	static bool			HasAVX2() { return HasFeatures(kVecFeature_AVX2); }
+	static bool			HasFMA() { return HasFeatures(kVecFeature_FMA); }
+	static bool			HasAVX512F() { return HasFeatures(kVecFeature_AVX512F); }
 };
 #endif
 
@@ -50,4 +50,19 @@ enum {
 	kVecNeon = 200
 };
 
+// Individual instruction set extensions, as a bit mask.  A CPU's type above is its best baseline; these say
+// which of the later extensions it also has.
+enum {
+	kVecFeature_SSE2		= 1 << 0,
+	kVecFeature_SSE3		= 1 << 1,
+	kVecFeature_SSE41		= 1 << 2,
+	kVecFeature_AVX			= 1 << 3,
+	kVecFeature_AVX2		= 1 << 4,
+	kVecFeature_FMA			= 1 << 5,
+	kVecFeature_AVX512F		= 1 << 6,
+	kVecFeature_SSSE3		= 1 << 7,
+	kVecFeature_Altivec		= 1 << 16,
+	kVecFeature_Neon		= 1 << 24
+};
+
 #endif
@@ -46,6 +46,135 @@
 #include "CADebugMacros.h"
 #include <math.h>
 
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+	#include <arm_neon.h>
+#endif
+
+//=============================================================================
+//	Lookup Table Helpers
+//=============================================================================
+
+//	The scalar tables are spaced evenly in a root of the scalar rather than the scalar itself.  The transfer
+//	functions are powers of the scalar, which change fastest near 0; taking inRoots square roots, enough to at
+//	least undo the curve's exponent, spreads the entries out so that region isn't squeezed into the first
+//	segment.  For the default kPow2Over1Curve one root makes the table exactly piecewise linear in raw steps.
+static inline Float32	ScalarToTablePosition(Float32 inScalar, UInt32 inRoots)
+{
+	Float32 thePosition = std::min(1.0f, std::max(0.0f, inScalar));
+	for(UInt32 theRoot = 0; theRoot < inRoots; ++theRoot)
+	{
+		thePosition = sqrtf(thePosition);
+	}
+	return thePosition;
+}
+
+static inline Float32	TablePositionToScalar(Float32 inPosition, UInt32 inRoots)
+{
+	for(UInt32 theRoot = 0; theRoot < inRoots; ++theRoot)
+	{
+		inPosition *= inPosition;
+	}
+	return inPosition;
+}
+
+static inline Float32	InterpolateTable(const Float32* inTable, UInt32 inNumberSegments, Float32 inPosition)
+{
+	//	inPosition is 0 to 1 across the table
+	Float32 thePosition = std::min(1.0f, std::max(0.0f, inPosition)) * static_cast<Float32>(inNumberSegments);
+	UInt32 theIndex = static_cast<UInt32>(thePosition);
+	if(theIndex >= inNumberSegments) theIndex = inNumberSegments - 1;
+	Float32 theFraction = thePosition - static_cast<Float32>(theIndex);
+	return inTable[theIndex] + theFraction * (inTable[theIndex + 1] - inTable[theIndex]);
+}
+
+//	looks up each scalar in the table and either stores the result or, if inAudio isn't NULL, multiplies inAudio by it
+static void	ApplyTable(const Float32* inTable, UInt32 inNumberSegments, UInt32 inRoots, const Float32* inScalars, const Float32* inAudio, Float32* outData, UInt32 inNumberFrames)
+{
+	UInt32 theFrame = 0;
+	
+#if defined(__SSE2__)
+	const __m128 theZero = _mm_setzero_ps();
+	const __m128 theOne = _mm_set1_ps(1.0f);
+	const __m128 theSegments = _mm_set1_ps(static_cast<Float32>(inNumberSegments));
+	const __m128 theLastSegment = _mm_set1_ps(static_cast<Float32>(inNumberSegments - 1));
+	for(; theFrame + 4 <= inNumberFrames; theFrame += 4)
+	{
+		//	max before min, so NaN becomes 0
+		__m128 thePosition = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(inScalars + theFrame), theZero), theOne);
+		for(UInt32 theRoot = 0; theRoot < inRoots; ++theRoot)
+		{
+			thePosition = _mm_sqrt_ps(thePosition);
+		}
+		thePosition = _mm_mul_ps(thePosition, theSegments);
+		__m128i theIndex = _mm_cvttps_epi32(_mm_min_ps(thePosition, theLastSegment));
+		__m128 theFraction = _mm_sub_ps(thePosition, _mm_cvtepi32_ps(theIndex));
+		
+		//	there's no gather in SSE2, so the table reads are scalar
+		SInt32 theIndices[4];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(theIndices), theIndex);
+		__m128 theLow = _mm_setr_ps(inTable[theIndices[0]], inTable[theIndices[1]], inTable[theIndices[2]], inTable[theIndices[3]]);
+		__m128 theHigh = _mm_setr_ps(inTable[theIndices[0] + 1], inTable[theIndices[1] + 1], inTable[theIndices[2] + 1], inTable[theIndices[3] + 1]);
+		__m128 theValue = _mm_add_ps(theLow, _mm_mul_ps(theFraction, _mm_sub_ps(theHigh, theLow)));
+		
+		if(inAudio != NULL)
+		{
+			theValue = _mm_mul_ps(theValue, _mm_loadu_ps(inAudio + theFrame));
+		}
+		_mm_storeu_ps(outData + theFrame, theValue);
+	}
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+	const float32x4_t theZero = vdupq_n_f32(0.0f);
+	const float32x4_t theOne = vdupq_n_f32(1.0f);
+	const float32x4_t theLastSegment = vdupq_n_f32(static_cast<Float32>(inNumberSegments - 1));
+	for(; theFrame + 4 <= inNumberFrames; theFrame += 4)
+	{
+		float32x4_t theScalar = vminq_f32(vmaxq_f32(vld1q_f32(inScalars + theFrame), theZero), theOne);
+	#if defined(__aarch64__)
+		for(UInt32 theRoot = 0; theRoot < inRoots; ++theRoot)
+		{
+			theScalar = vsqrtq_f32(theScalar);
+		}
+	#else
+		Float32 theRoots[4];
+		vst1q_f32(theRoots, theScalar);
+		for(UInt32 theLane = 0; theLane < 4; ++theLane)
+		{
+			theRoots[theLane] = ScalarToTablePosition(theRoots[theLane], inRoots);
+		}
+		theScalar = vld1q_f32(theRoots);
+	#endif
+		float32x4_t thePosition = vmulq_n_f32(theScalar, static_cast<Float32>(inNumberSegments));
+		uint32x4_t theIndex = vcvtq_u32_f32(vminq_f32(thePosition, theLastSegment));
+		float32x4_t theFraction = vsubq_f32(thePosition, vcvtq_f32_u32(theIndex));
+		
+		UInt32 theIndices[4];
+		vst1q_u32(theIndices, theIndex);
+		Float32 theLows[4], theHighs[4];
+		for(UInt32 theLane = 0; theLane < 4; ++theLane)
+		{
+			theLows[theLane] = inTable[theIndices[theLane]];
+			theHighs[theLane] = inTable[theIndices[theLane] + 1];
+		}
+		float32x4_t theLow = vld1q_f32(theLows);
+		float32x4_t theValue = vmlaq_f32(theLow, theFraction, vsubq_f32(vld1q_f32(theHighs), theLow));
+		
+		if(inAudio != NULL)
+		{
+			theValue = vmulq_f32(theValue, vld1q_f32(inAudio + theFrame));
+		}
+		vst1q_f32(outData + theFrame, theValue);
+	}
+#endif
+	
+	for(; theFrame < inNumberFrames; ++theFrame)
+	{
+		Float32 theValue = InterpolateTable(inTable, inNumberSegments, ScalarToTablePosition(inScalars[theFrame], inRoots));
+		outData[theFrame] = (inAudio != NULL) ? theValue * inAudio[theFrame] : theValue;
+	}
+}
+
 //=============================================================================
 //	CAVolumeCurve
 //=============================================================================
@@ -57,7 +186,12 @@ CAVolumeCurve::CAVolumeCurve()
 	mIsApplyingTransferFunction(true),
 	mTransferFunction(kPow2Over1Curve),
 	mRawToScalarExponentNumerator(2.0f),
-	mRawToScalarExponentDenominator(1.0f)
+	mRawToScalarExponentDenominator(1.0f),
+	mScalarToDBTable(),
+	mScalarToAmplitudeTable(),
+	mDBToScalarTable(),
+	mLookupTableRoots(1),
+	mLookupTableErrorDB(0)
 {
 }
 
@@ -122,6 +256,7 @@ Float32	CAVolumeCurve::GetMaximumDB() const
 void	CAVolumeCurve::SetTransferFunction(int inTransferFunction)
 {
 	mTransferFunction = inTransferFunction;
+	DiscardLookupTables();
 	
 	//	figure out the co-efficients
 	switch(inTransferFunction)
@@ -252,6 +387,7 @@ void	CAVolumeCurve::AddRange(SInt32 inMinRaw, SInt32 inMaxRaw, Float32 inMinDB,
 	if(!isOverlapped)
 	{
 		mCurveMap.insert(CurveMap::value_type(theRaw, theDB));
+		DiscardLookupTables();
 	}
 	else
 	{
@@ -262,6 +398,7 @@ void	CAVolumeCurve::AddRange(SInt32 inMinRaw, SInt32 inMaxRaw, Float32 inMinDB,
 void	CAVolumeCurve::ResetRange()
 {
 	mCurveMap.clear();
+	DiscardLookupTables();
 }
 
 bool	CAVolumeCurve::CheckForContinuity() const
@@ -474,3 +611,195 @@ Float32	CAVolumeCurve::ConvertScalarToDB(Float32 inScalar) const
 	Float32 theAnswer = ConvertRawToDB(theRawValue);
 	return theAnswer;
 }
+
+Float32	CAVolumeCurve::ConvertScalarToDBContinuous(Float32 inScalar) const
+{
+	//	this is ConvertScalarToDB without rounding to whole raw steps
+	inScalar = std::min(1.0f, std::max(0.0f, inScalar));
+	
+	Float32	theDBRange = GetMaximumDB() - GetMinimumDB();
+	if(mIsApplyingTransferFunction && (theDBRange > 30.0f))
+	{
+		inScalar = powf(inScalar, mRawToScalarExponentDenominator / mRawToScalarExponentNumerator);
+	}
+	
+	Float32 theNumberRawSteps = inScalar * static_cast<Float32>(GetMaximumRaw() - GetMinimumRaw());
+	
+	CurveMap::const_iterator theIterator = mCurveMap.begin();
+	Float32 theAnswer = theIterator->second.mMinimum;
+	while((theNumberRawSteps > 0) && (theIterator != mCurveMap.end()))
+	{
+		Float32 theRawRange = static_cast<Float32>(theIterator->first.mMaximum - theIterator->first.mMinimum);
+		Float32 theDBRange = theIterator->second.mMaximum - theIterator->second.mMinimum;
+		
+		Float32 theRawStepsToAdd = std::min(theRawRange, theNumberRawSteps);
+		if(theRawRange > 0)
+		{
+			theAnswer += theRawStepsToAdd * theDBRange / theRawRange;
+		}
+		theNumberRawSteps -= theRawStepsToAdd;
+		
+		std::advance(theIterator, 1);
+	}
+	
+	return theAnswer;
+}
+
+Float32	CAVolumeCurve::ConvertDBToScalarContinuous(Float32 inDB) const
+{
+	//	this is ConvertDBToScalar without rounding to whole raw steps
+	Float32 theOverallDBMin = GetMinimumDB();
+	Float32 theOverallDBMax = GetMaximumDB();
+	Float32 theOverallRawRange = static_cast<Float32>(GetMaximumRaw() - GetMinimumRaw());
+	
+	if(inDB < theOverallDBMin) inDB = theOverallDBMin;
+	if(inDB > theOverallDBMax) inDB = theOverallDBMax;
+	
+	Float32 theNumberRawSteps = 0;
+	for(CurveMap::const_iterator theIterator = mCurveMap.begin(); theIterator != mCurveMap.end(); std::advance(theIterator, 1))
+	{
+		Float32 theRawRange = static_cast<Float32>(theIterator->first.mMaximum - theIterator->first.mMinimum);
+		Float32 theDBMin = theIterator->second.mMinimum;
+		Float32 theDBMax = theIterator->second.mMaximum;
+		
+		if(inDB > theDBMax)
+		{
+			theNumberRawSteps += theRawRange;
+		}
+		else
+		{
+			if(theDBMax > theDBMin)
+			{
+				theNumberRawSteps += (inDB - theDBMin) * theRawRange / (theDBMax - theDBMin);
+			}
+			break;
+		}
+	}
+	
+	Float32 theAnswer = (theOverallRawRange > 0) ? (theNumberRawSteps / theOverallRawRange) : 0;
+	if(mIsApplyingTransferFunction && ((theOverallDBMax - theOverallDBMin) > 30.0f))
+	{
+		theAnswer = powf(theAnswer, mRawToScalarExponentNumerator / mRawToScalarExponentDenominator);
+	}
+	
+	return theAnswer;
+}
+
+void	CAVolumeCurve::BuildLookupTables(UInt32 inNumberSegments)
+{
+	DiscardLookupTables();
+	if(mCurveMap.empty() || (inNumberSegments == 0))
+	{
+		return;
+	}
+	
+	Float32 theDBMin = GetMinimumDB();
+	Float32 theDBMax = GetMaximumDB();
+	
+	//	enough roots to undo the transfer function's exponent, so the table is smooth in raw steps at 0
+	Float32 theExponent = (mIsApplyingTransferFunction && ((theDBMax - theDBMin) > 30.0f)) ? (mRawToScalarExponentNumerator / mRawToScalarExponentDenominator) : 1.0f;
+	UInt32 theRoots = 1;
+	while(static_cast<Float32>(1 << theRoots) < theExponent)
+	{
+		++theRoots;
+	}
+	
+	std::vector<Float32> theScalarToDBTable(inNumberSegments + 1);
+	std::vector<Float32> theScalarToAmplitudeTable(inNumberSegments + 1);
+	std::vector<Float32> theDBToScalarTable(inNumberSegments + 1);
+	for(UInt32 theIndex = 0; theIndex <= inNumberSegments; ++theIndex)
+	{
+		Float32 thePosition = static_cast<Float32>(theIndex) / static_cast<Float32>(inNumberSegments);
+		Float32 theDB = ConvertScalarToDBContinuous(TablePositionToScalar(thePosition, theRoots));
+		theScalarToDBTable[theIndex] = theDB;
+		theScalarToAmplitudeTable[theIndex] = powf(10.0f, theDB / 20.0f);
+		theDBToScalarTable[theIndex] = ConvertDBToScalarContinuous(theDBMin + thePosition * (theDBMax - theDBMin));
+	}
+	
+	mScalarToDBTable.swap(theScalarToDBTable);
+	mScalarToAmplitudeTable.swap(theScalarToAmplitudeTable);
+	mDBToScalarTable.swap(theDBToScalarTable);
+	mLookupTableRoots = theRoots;
+	
+	//	measure the error against the exact conversion at several points in every segment, spaced like the
+	//	table, and at many more in the segments at the ends, where the curves bend hardest.
+	const UInt32 kChecksPerSegment = 8;
+	const UInt32 kChecksPerEndSegment = 1024;
+	const UInt32 kNumberEndSegments = 4;
+	Float32 theError = 0;
+	for(UInt32 theSegment = 0; theSegment < inNumberSegments; ++theSegment)
+	{
+		UInt32 theNumberChecks = (theSegment < kNumberEndSegments || theSegment + kNumberEndSegments >= inNumberSegments) ? kChecksPerEndSegment : kChecksPerSegment;
+		for(UInt32 theCheck = 0; theCheck <= theNumberChecks; ++theCheck)
+		{
+			Float32 thePosition = (static_cast<Float32>(theSegment) + static_cast<Float32>(theCheck) / static_cast<Float32>(theNumberChecks)) / static_cast<Float32>(inNumberSegments);
+			Float32 theScalar = TablePositionToScalar(thePosition, theRoots);
+			theError = std::max(theError, fabsf(ConvertScalarToDBFast(theScalar) - ConvertScalarToDB(theScalar)));
+		}
+	}
+	mLookupTableErrorDB = theError;
+}
+
+void	CAVolumeCurve::DiscardLookupTables()
+{
+	mScalarToDBTable.clear();
+	mScalarToAmplitudeTable.clear();
+	mDBToScalarTable.clear();
+	mLookupTableErrorDB = 0;
+}
+
+Float32	CAVolumeCurve::ConvertScalarToDBFast(Float32 inScalar) const
+{
+	if(!HasLookupTables())
+	{
+		return ConvertScalarToDB(inScalar);
+	}
+	return InterpolateTable(&mScalarToDBTable[0], static_cast<UInt32>(mScalarToDBTable.size() - 1), ScalarToTablePosition(inScalar, mLookupTableRoots));
+}
+
+Float32	CAVolumeCurve::ConvertDBToScalarFast(Float32 inDB) const
+{
+	if(!HasLookupTables())
+	{
+		return ConvertDBToScalar(inDB);
+	}
+	Float32 theDBMin = GetMinimumDB();
+	Float32 theDBRange = GetMaximumDB() - theDBMin;
+	Float32 thePosition = (theDBRange > 0) ? ((inDB - theDBMin) / theDBRange) : 0;
+	return InterpolateTable(&mDBToScalarTable[0], static_cast<UInt32>(mDBToScalarTable.size() - 1), thePosition);
+}
+
+Float32	CAVolumeCurve::ConvertScalarToAmplitudeFast(Float32 inScalar) const
+{
+	if(!HasLookupTables())
+	{
+		return powf(10.0f, ConvertScalarToDB(inScalar) / 20.0f);
+	}
+	return InterpolateTable(&mScalarToAmplitudeTable[0], static_cast<UInt32>(mScalarToAmplitudeTable.size() - 1), ScalarToTablePosition(inScalar, mLookupTableRoots));
+}
+
+void	CAVolumeCurve::ConvertScalarsToAmplitudes(const Float32* inScalars, Float32* outAmplitudes, UInt32 inNumberFrames) const
+{
+	if(!HasLookupTables())
+	{
+		for(UInt32 theFrame = 0; theFrame < inNumberFrames; ++theFrame)
+		{
+			outAmplitudes[theFrame] = ConvertScalarToAmplitudeFast(inScalars[theFrame]);
+		}
+		return;
+	}
+	ApplyTable(&mScalarToAmplitudeTable[0], static_cast<UInt32>(mScalarToAmplitudeTable.size() - 1), mLookupTableRoots, inScalars, NULL, outAmplitudes, inNumberFrames);
+}
+
+void	CAVolumeCurve::ApplyScalarGain(const Float32* inScalars, const Float32* inAudio, Float32* outAudio, UInt32 inNumberFrames) const
+{
+	if(!HasLookupTables())
+	{
+		for(UInt32 theFrame = 0; theFrame < inNumberFrames; ++theFrame)
+		{
+			outAudio[theFrame] = inAudio[theFrame] * ConvertScalarToAmplitudeFast(inScalars[theFrame]);
+		}
+		return;
+	}
+	ApplyTable(&mScalarToAmplitudeTable[0], static_cast<UInt32>(mScalarToAmplitudeTable.size() - 1), mLookupTableRoots, inScalars, inAudio, outAudio, inNumberFrames);
+}
@@ -51,6 +51,7 @@
 	#include <CoreAudioTypes.h>
 #endif
 #include <map>
+#include <vector>
 
 //=============================================================================
 //	Types
@@ -139,7 +140,7 @@ public:
 	Float32			GetMinimumDB() const;
 	Float32			GetMaximumDB() const;
 	
-	void			SetIsApplyingTransferFunction(bool inIsApplyingTransferFunction)  { mIsApplyingTransferFunction = inIsApplyingTransferFunction; }
+	void			SetIsApplyingTransferFunction(bool inIsApplyingTransferFunction)  { mIsApplyingTransferFunction = inIsApplyingTransferFunction; DiscardLookupTables(); }
 	int				GetTransferFunction() const { return mTransferFunction; }
 	void			SetTransferFunction(int inTransferFunction);
 
@@ -156,8 +157,38 @@ public:
 	SInt32			ConvertScalarToRaw(Float32 inScalar) const;
 	Float32			ConvertScalarToDB(Float32 inScalar) const;
 
+//	Lookup Tables
+//	The Fast conversions interpolate in tables built by BuildLookupTables rather than walking the curve map
+//	and calling powf, so they are cheap enough to run per sample on the render thread.  Unlike the exact
+//	conversions they are continuous instead of moving in whole raw steps, so they can differ from them by up
+//	to half a raw step plus the interpolation error, over the whole range including both ends;
+//	GetLookupTableErrorDB reports the largest difference from ConvertScalarToDB found when the tables were
+//	built.  Changing the curve discards the tables, and until they are rebuilt the Fast conversions fall back
+//	to the exact ones.  The tables belong to the curve, so curves on different threads don't interact, but
+//	like the rest of a curve they mustn't be rebuilt or discarded while another thread is converting.
+public:
+	enum			{ kDefaultLookupTableSize = 1024 };
+	
+	void			BuildLookupTables(UInt32 inNumberSegments = kDefaultLookupTableSize);
+	bool			HasLookupTables() const { return !mScalarToDBTable.empty(); }
+	Float32			GetLookupTableErrorDB() const { return mLookupTableErrorDB; }
+	
+	Float32			ConvertScalarToDBFast(Float32 inScalar) const;
+	Float32			ConvertDBToScalarFast(Float32 inDB) const;
+	Float32			ConvertScalarToAmplitudeFast(Float32 inScalar) const;		//	linear gain, 10^(dB/20)
+	
+	//	Block operations for fader automation: each sample of inAudio is multiplied by the amplitude for the
+	//	corresponding fader position in inScalars.  inAudio and outAudio may be the same buffer.
+	void			ConvertScalarsToAmplitudes(const Float32* inScalars, Float32* outAmplitudes, UInt32 inNumberFrames) const;
+	void			ApplyScalarGain(const Float32* inScalars, const Float32* inAudio, Float32* outAudio, UInt32 inNumberFrames) const;
+
 //	Implementation
 private:
+	Float32			ConvertScalarToDBContinuous(Float32 inScalar) const;
+	Float32			ConvertDBToScalarContinuous(Float32 inDB) const;
+	void			DiscardLookupTables();
+	
+
 	typedef	std::map<CARawPoint, CADBPoint>	CurveMap;
 	
 	UInt32			mTag;
@@ -166,6 +197,12 @@ private:
 	UInt32			mTransferFunction;
 	Float32			mRawToScalarExponentNumerator;
 	Float32			mRawToScalarExponentDenominator;
+	
+	std::vector<Float32>	mScalarToDBTable;			//	segments + 1 entries, evenly spaced in the scalar with mLookupTableRoots square roots taken
+	std::vector<Float32>	mScalarToAmplitudeTable;
+	std::vector<Float32>	mDBToScalarTable;			//	evenly spaced from the minimum to the maximum dB
+	UInt32			mLookupTableRoots;			//	square roots taken of a scalar to find its table position
+	Float32			mLookupTableErrorDB;
 
 };
 
@@ -48,7 +48,9 @@
 // Modifications to fit into the AU.js project public domain by JRM 2012
 
 #include "CAPlayThrough.h"
+#include "CAAtomic.h"
 #include <dispatch/dispatch.h>
+#include <unistd.h>
 
 #pragma mark -- CAPlayThrough
 
@@ -71,9 +73,11 @@ public:
 	AudioDeviceID GetOutputDeviceID()	{ return mOutputDevice.mID; }
 	
     AudioUnit   GetEffectAU() {return mEffectUnit;}
+	CABroadcastRingBuffer* GetOutputTap() {return mOutputTap;}
 
 private:
 	OSStatus SetupGraph(AudioDeviceID out);
+	void RemoveOutputTap();
 	OSStatus MakeGraph();
 	
 	OSStatus SetupAUHAL(AudioDeviceID in);
@@ -96,12 +100,24 @@ private:
 							   UInt32				inBusNumber,
 							   UInt32				inNumberFrames,
 							   AudioBufferList *	ioData);
+	
+	static OSStatus EffectRenderNotify(void *inRefCon,
+									   AudioUnitRenderActionFlags *ioActionFlags,
+									   const AudioTimeStamp *inTimeStamp,
+									   UInt32				inBusNumber,
+									   UInt32				inNumberFrames,
+									   AudioBufferList *	ioData);
 											
 	AudioUnit mInputUnit;
 	AudioBufferList *mInputBuffer;
 	AudioDevice mInputDevice, mOutputDevice;
 	CARingBuffer *mBuffer;
 	
+	//The render notify counts itself in mTapWriters while it writes, so RemoveOutputTap can
+	//wait for it to finish before deleting the tap
+	CABroadcastRingBuffer * volatile mOutputTap;
+	volatile SInt32 mTapWriters;
+	
 	//AudioUnits and Graph
 	AUGraph mGraph;
 	AUNode mVarispeedNode;
@@ -157,6 +173,8 @@ namespace
 #pragma mark ---CAPlayThrough Methods---
 CAPlayThrough::CAPlayThrough(AudioDeviceID input, AudioDeviceID output):
 mBuffer(NULL),
+mOutputTap(NULL),
+mTapWriters(0),
 mFirstInputTime(-1),
 mFirstOutputTime(-1),
 mInToOutSampleOffset(0)
@@ -202,6 +220,10 @@ OSStatus CAPlayThrough::Init(AudioDeviceID input, AudioDeviceID output)
 	err = AUGraphInitialize(mGraph); 
 	checkErr(err);
 	
+	//Copy the effect's output into the tap after each render
+	err = AudioUnitAddRenderNotify(mEffectUnit, EffectRenderNotify, this);
+	checkErr(err);
+	
 	//Add latency between the two devices
 	ComputeThruOffset();
 		
@@ -212,6 +234,9 @@ void CAPlayThrough::Cleanup()
 {
 	//clean up
 	Stop();
+	
+	AudioUnitRemoveRenderNotify(mEffectUnit, EffectRenderNotify, this);
+	RemoveOutputTap();
 									
 	delete mBuffer;
 	mBuffer = 0;
@@ -635,9 +660,26 @@ OSStatus CAPlayThrough::SetupBuffers()
 	mBuffer = new CARingBuffer();	
 	mBuffer->Allocate(asbd.mChannelsPerFrame, asbd.mBytesPerFrame, bufferSizeFrames * 20);
 	
+	//The tap holds the effect's output, which has the same channels as the input at the output device's rate
+	CABroadcastRingBuffer *tap = new CABroadcastRingBuffer();
+	tap->Allocate(asbd.mChannelsPerFrame, asbd.mBytesPerFrame, bufferSizeFrames * 20);
+	CAMemoryBarrier();
+	mOutputTap = tap;
+	
     return err;
 }
 
+void CAPlayThrough::RemoveOutputTap()
+{
+	//Take the tap away from the render notify first, then wait out a write that had already
+	//picked it up; only then is it safe to delete
+	CABroadcastRingBuffer *tap = mOutputTap;
+	CAAtomicCompareAndSwapPtrBarrier(tap, NULL, (volatile void **)&mOutputTap);
+	while (mTapWriters > 0)
+		usleep(100);
+	delete tap;
+}
+
 void	CAPlayThrough::ComputeThruOffset()
 {
 	//The initial latency will at least be the saftey offset's of the devices + the buffer sizes
@@ -745,6 +787,27 @@ OSStatus CAPlayThrough::OutputProc(void *inRefCon,
 	return noErr;
 }
 
+OSStatus CAPlayThrough::EffectRenderNotify(void *inRefCon,
+											 AudioUnitRenderActionFlags *ioActionFlags,
+											 const AudioTimeStamp *inTimeStamp,
+											 UInt32 inBusNumber,
+											 UInt32 inNumberFrames,
+											 AudioBufferList * ioData)
+{
+	CAPlayThrough *This = (CAPlayThrough *)inRefCon;
+	
+	if ((*ioActionFlags & kAudioUnitRenderAction_PostRender) && !(*ioActionFlags & kAudioUnitRenderAction_PostRenderError) && inBusNumber == 0)
+	{
+		CAAtomicIncrement32Barrier(&This->mTapWriters);
+		CABroadcastRingBuffer *tap = This->mOutputTap;
+		if (tap)
+			tap->Write(ioData, inNumberFrames);
+		CAAtomicDecrement32Barrier(&This->mTapWriters);
+	}
+	
+	return noErr;
+}
+
 #pragma mark -- Listeners --
 
 OSStatus CAPlayThroughHost::StreamListener(AudioObjectID inObjectID,
@@ -815,6 +878,11 @@ AudioUnit   CAPlayThroughHost::GetEffectAU()
     return mPlayThrough ? mPlayThrough->GetEffectAU() : 0;
 }
 
+CABroadcastRingBuffer*   CAPlayThroughHost::GetOutputTap()
+{
+    return mPlayThrough ? mPlayThrough->GetOutputTap() : NULL;
+}
+
 OSStatus	CAPlayThroughHost::Start()
 {
 	if (mPlayThrough) return mPlayThrough->Start();
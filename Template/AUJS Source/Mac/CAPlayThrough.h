@@ -65,6 +65,7 @@ if(err) {\
 #include <AudioToolbox/AudioToolbox.h>
 #include <AudioUnit/AudioUnit.h>
 #include "CARingBuffer.h"
+#include "CABroadcastRingBuffer.h"
 #include "AudioDevice.h"
 #include "CAStreamBasicDescription.h"
 
@@ -83,6 +84,11 @@ public:
 	void		DeletePlayThrough();
 	bool		PlayThroughExists();
 	AudioUnit   GetEffectAU();
+	
+	// A copy of everything the effect renders, for meters, scopes and recorders to read from any thread.  Like
+	// the effect AU it's replaced when the input device's format changes, and deleted with the play through,
+	// once its render notify is no longer writing to it; readers must stop using it before then.
+	CABroadcastRingBuffer*	GetOutputTap();
     
     
 	OSStatus	Start();